@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <benchmark.hpp>
+#include <memory.hpp>
+#include <object.hpp>
+
+namespace lox {
+
+auto bench_strings(ObjectAllocator allocator, char const *name,
+                   std::vector<std::string> const &keys) -> void;
+
+// Allocates and frees strings shaped like the keys and short values of the
+// records our scripts handle, once from the system allocator and once from
+// the pool, and reports the time per string.
+auto bench_allocation() -> void {
+  auto keys = std::vector<std::string>{};
+  auto seed = uint32_t{12345};
+  for (int i = 0; i < 10000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    keys.push_back("key" + std::string(seed >> 16 & 31, 'x') +
+                   std::to_string(i));
+  }
+  bench_strings(ObjectAllocator::SYSTEM, "strings from the system", keys);
+  bench_strings(ObjectAllocator::POOL, "strings from the pool", keys);
+}
+
+// Builds a string for every key and frees them all, then churns a window
+// of 256 live strings, replacing the oldest with each new one.
+auto bench_strings(ObjectAllocator allocator, char const *name,
+                   std::vector<std::string> const &keys) -> void {
+  auto const previous = object_allocator();
+  set_object_allocator(allocator);
+  auto strings = std::vector<ObjString *>(keys.size());
+  auto seconds = benchmark(name, 100, [&] {
+    for (size_t i = 0; i < keys.size(); ++i)
+      strings[i] = copy_string(keys[i]);
+    for (auto const string : strings)
+      free_object(&string->obj);
+  });
+  printf("%-44s %14.2f ns per string\n", "", seconds * 1e9 / keys.size());
+  ObjString *window[256];
+  for (int i = 0; i < 256; ++i)
+    window[i] = copy_string(keys[i]);
+  seconds = benchmark("  churning a window of them", 100, [&] {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      auto &slot = window[i % 256];
+      free_object(&slot->obj);
+      slot = copy_string(keys[i]);
+    }
+  });
+  printf("%-44s %14.2f ns per string\n", "", seconds * 1e9 / keys.size());
+  for (auto const string : window)
+    free_object(&string->obj);
+  set_object_allocator(previous);
+}
+
+} // namespace lox
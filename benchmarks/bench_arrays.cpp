@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <natives.hpp>
+#include <number_array.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_array_script(char const *name, char const *source) -> void;
+
+// Both scripts compute sum(2 * x + 1) over ten thousand numbers, once with a
+// lox loop and once with whole array operations on number arrays.
+auto bench_arrays() -> void {
+  printf("number array kernels use %s\n", simd_instruction_set());
+  bench_array_script("scalar loop over 10000 numbers",
+                     "{ var sum = 0;"
+                     "  for (var i = 0; i < 10000; i = i + 1)"
+                     "    sum = sum + (2 * i + 1); }");
+  bench_array_script("array operations over 10000 numbers",
+                     "{ var x = range(10000);"
+                     "  var total = sum(2 * x + 1); }");
+}
+
+auto bench_array_script(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  define_array_natives(vm);
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 1000, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per element\n", "", seconds * 1e9 / 10000);
+}
+
+} // namespace lox
@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include <batch.hpp>
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto constexpr bench_rows = 10000;
+
+// Scores ten thousand rows with the same filter expression, once by running
+// the compiled chunk per row and once as a single batch.
+auto bench_batch() -> void {
+  auto vm = VirtualMachine{};
+  auto xs = Array<Value>{};
+  auto ys = Array<Value>{};
+  auto results = Array<Value>{};
+  for (int i = 0; i < bench_rows; ++i) {
+    write(xs, number_val(i));
+    write(ys, number_val(i % 7));
+    write(results, nil_val);
+  }
+  auto const per_row = compile("r = x * 2 + y > 5000;", vm.globals);
+  auto const expression = compile("x * 2 + y > 5000", vm.globals);
+  auto const x = resolve_global(vm.globals, "x");
+  auto const y = resolve_global(vm.globals, "y");
+  auto const r = resolve_global(vm.globals, "r");
+  vm.globals.slots.data[r].defined = true;
+
+  vm.globals.slots.data[x] = {xs.data[0], true};
+  vm.globals.slots.data[y] = {ys.data[0], true};
+  expect_ok(interpret(vm, per_row), "run an expression per row");
+  auto seconds = benchmark("run an expression per row", 100, [&] {
+    for (int i = 0; i < bench_rows; ++i) {
+      vm.globals.slots.data[x] = {xs.data[i], true};
+      vm.globals.slots.data[y] = {ys.data[i], true};
+      interpret(vm, per_row);
+      results.data[i] = vm.globals.slots.data[r].value;
+    }
+    keep(results.data[0]);
+  });
+  printf("%-44s %14.2f ns per row\n", "", seconds * 1e9 / bench_rows);
+
+  auto batch = Batch{};
+  BatchInput const inputs[] = {{x, {xs.data, bench_rows}},
+                               {y, {ys.data, bench_rows}}};
+  expect_ok(evaluate_batch(batch, expression, vm.globals, inputs,
+                           {results.data, bench_rows}),
+            "run an expression over a batch");
+  seconds = benchmark("run an expression over a batch", 1000, [&] {
+    keep(evaluate_batch(batch, expression, vm.globals, inputs,
+                        {results.data, bench_rows}));
+  });
+  printf("%-44s %14.2f ns per row\n", "", seconds * 1e9 / bench_rows);
+  free_object(&per_row->obj);
+  free_object(&expression->obj);
+}
+
+} // namespace lox
@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_call(char const *name, char const *source, int calls) -> void;
+
+auto bench_calls() -> void {
+  bench_call("recursive fib(25)",
+             "fun fib(n) { if (n < 2) return n;"
+             "             return fib(n - 2) + fib(n - 1); }"
+             "fib(25);",
+             242785);
+  bench_call("tail recursive count to 1000000",
+             "fun count(n) { if (n == 0) return n;"
+             "               return count(n - 1); }"
+             "count(1000000);",
+             1000001);
+}
+
+auto bench_call(char const *name, char const *source, int calls) -> void {
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 10, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per call\n", "", seconds * 1e9 / calls);
+}
+
+} // namespace lox
@@ -0,0 +1,43 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <memory.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_closure(char const *name, char const *source) -> void;
+
+// Each script creates a closure over one local a thousand times and either
+// hands it down to a callback or lets it escape into a global.
+auto bench_closures() -> void {
+  bench_closure("callback closures",
+                "fun each(n, f) { for (var i = 0; i < n; i = i + 1) f(i); }"
+                "for (var k = 0; k < 1000; k = k + 1) {"
+                "  var sum = 0;"
+                "  fun add(i) { sum = sum + i; }"
+                "  each(10, add);"
+                "}");
+  bench_closure("escaping closures",
+                "var kept;"
+                "for (var k = 0; k < 1000; k = k + 1) {"
+                "  var sum = 0;"
+                "  fun add(i) { sum = sum + i; }"
+                "  kept = add;"
+                "}");
+}
+
+auto bench_closure(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 100, [&] { keep(interpret(vm, source)); });
+  reset_memory_stats();
+  interpret(vm, source);
+  auto const &objects =
+      memory_stats().categories[static_cast<uint8_t>(MemoryCategory::OBJECT)];
+  printf("%-44s %14.2f ns per closure %6.2f objects per closure\n", "",
+         seconds * 1e9 / 1000, objects.allocations / 1000.0);
+}
+
+} // namespace lox
@@ -0,0 +1,53 @@
+#include <limits.h>
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <collector.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_heap(Collector &collector, char const *name) -> void;
+auto print_pauses(char const *name, PauseStats const &stats) -> void;
+
+// Churns through short lived instances next to a list of 200000 live ones,
+// once with the default slices and once with budgets large enough that
+// every cycle marks and sweeps all at once, as a stop the world collector
+// would, and reports the pauses of each.
+auto bench_collector() -> void {
+  auto incremental = Collector{};
+  bench_heap(incremental, "churn next to a large heap, incremental");
+  auto whole = Collector{};
+  whole.slice_objects = INT_MAX;
+  whole.sweep_objects = INT_MAX;
+  bench_heap(whole, "churn next to a large heap, whole cycles");
+}
+
+auto bench_heap(Collector &collector, char const *name) -> void {
+  auto constexpr heap =
+      "class N { init(v, next) { this.v = v; this.next = next; } }"
+      "var list = nil; for (var i = 0; i < 200000; i = i + 1)"
+      "  list = N(i, list); var total = 0;";
+  auto constexpr churn = "for (var i = 0; i < 200000; i = i + 1) {"
+                         "  var p = N(i, nil); total = total + p.v; }";
+  auto vm = VirtualMachine{};
+  vm.collector = &collector;
+  expect_ok(interpret(vm, heap), name);
+  expect_ok(interpret(vm, churn), name);
+  collector.mark_pauses = PauseStats{};
+  collector.sweep_pauses = PauseStats{};
+  auto const seconds =
+      benchmark(name, 5, [&] { keep(interpret(vm, churn)); });
+  printf("%-44s %14.2f ns per instance\n", "", seconds * 1e9 / 200000);
+  print_pauses("  marking", collector.mark_pauses);
+  print_pauses("  sweeping", collector.sweep_pauses);
+}
+
+auto print_pauses(char const *name, PauseStats const &stats) -> void {
+  printf("%-24s p50 %8llu ns  p99 %8llu ns  max %8llu ns\n", name,
+         static_cast<unsigned long long>(pause_percentile(stats, 0.5)),
+         static_cast<unsigned long long>(pause_percentile(stats, 0.99)),
+         static_cast<unsigned long long>(stats.max_ns));
+}
+
+} // namespace lox
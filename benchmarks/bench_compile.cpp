@@ -0,0 +1,88 @@
+#include <charconv>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark.hpp>
+#include <chunk.hpp>
+#include <compiler.hpp>
+#include <globals.hpp>
+#include <grammar.hpp>
+
+namespace lox {
+
+auto number_table(int count, bool fractions) -> std::string;
+auto number_tokens(std::string_view table) -> std::vector<std::string_view>;
+
+auto bench_compile() -> void {
+  auto const integers = number_table(20000, false);
+  auto const decimals = number_table(20000, true);
+
+  benchmark(
+      "compile integer table", 100,
+      [&] {
+        auto globals = Globals{};
+        auto const function = compile(integers, globals);
+        keep(function);
+        free_object(&function->obj);
+      },
+      integers.length());
+  benchmark(
+      "compile decimal table", 100,
+      [&] {
+        auto globals = Globals{};
+        auto const function = compile(decimals, globals);
+        keep(function);
+        free_object(&function->obj);
+      },
+      decimals.length());
+
+  auto const tokens = number_tokens(decimals);
+  benchmark("parse decimal literals with std::stod", 100, [&] {
+    for (auto const token : tokens)
+      keep(std::stod(std::string{token}));
+  });
+  benchmark("parse decimal literals with from_chars", 100, [&] {
+    for (auto const token : tokens) {
+      auto value = 0.0;
+      std::from_chars(token.begin(), token.end(), value);
+      keep(value);
+    }
+  });
+  benchmark("parse decimal literals with parse_number", 100, [&] {
+    for (auto const token : tokens)
+      keep(parse_number(token));
+  });
+}
+
+// A sum over count pseudo random literals, the shape of the data tables our
+// generated scripts embed.
+auto number_table(int count, bool fractions) -> std::string {
+  auto table = std::string{"0"};
+  auto seed = uint32_t{12345};
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1103515245 + 12345;
+    table += " + ";
+    table += std::to_string(seed % 100000);
+    if (fractions) {
+      table += '.';
+      table += std::to_string(seed % 997);
+    }
+  }
+  return table;
+}
+
+auto number_tokens(std::string_view table) -> std::vector<std::string_view> {
+  auto tokens = std::vector<std::string_view>{};
+  while (!table.empty()) {
+    auto const end = table.find(" + ");
+    tokens.push_back(table.substr(0, end));
+    if (end == std::string_view::npos)
+      break;
+    table.remove_prefix(end + 3);
+  }
+  return tokens;
+}
+
+} // namespace lox
@@ -0,0 +1,58 @@
+#include <memory>
+#include <stdio.h>
+#include <string_view>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_expression(char const *name, char const *source) -> void;
+
+// Evaluates rules shaped like the generated ones, which spell out the same
+// subexpressions again wherever they are needed, and reports how many
+// instructions each evaluation runs.
+auto bench_expressions() -> void {
+  bench_expression("rule over a discounted total",
+                   "price * quantity * (1 - discount) > 100 and "
+                   "price * quantity * (1 - discount) < 5000 or "
+                   "price * quantity * (1 - discount) * (1 + discount) > "
+                   "quantity * 1000");
+  bench_expression("score with a repeated activation",
+                   "(price * discount + quantity) * "
+                   "(price * discount + quantity) + "
+                   "(price * discount + quantity) / "
+                   "(1 + (price * discount + quantity) * "
+                   "(price * discount + quantity))");
+}
+
+auto bench_expression(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  std::string_view const parameters[] = {"price", "quantity", "discount"};
+  auto const function = compile_expression(source, parameters, vm.globals);
+  if (function == nullptr)
+    return;
+  auto const ring = std::make_unique<TraceRing>();
+  auto result = Value{};
+  Value const arguments[] = {number_val(12.5), number_val(40),
+                             number_val(0.2)};
+  vm.trace = ring.get();
+  evaluate(vm, function, arguments, result);
+  vm.trace = nullptr;
+  auto const seconds = benchmark(name, 100, [&] {
+    for (int i = 0; i < 1000; ++i) {
+      Value const arguments[] = {number_val(i), number_val(40),
+                                 number_val(0.2)};
+      evaluate(vm, function, arguments, result);
+      keep(result);
+    }
+  });
+  printf("%-44s %14.2f ns per evaluation %4llu instructions\n", "",
+         seconds * 1e9 / 1000,
+         static_cast<unsigned long long>(ring->head.load()));
+  free_object(&function->obj);
+}
+
+} // namespace lox
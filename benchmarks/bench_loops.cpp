@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_loop(char const *name, char const *source, int iterations) -> void;
+auto bench_sliced_loop(int slice) -> void;
+auto bench_limited_loop() -> void;
+
+// Each script runs its loop body one million times, so the time per run in
+// nanoseconds divided by a million is the cost of one iteration.
+auto bench_loops() -> void {
+  bench_loop("count with a global while loop",
+             "var i = 0; while (i < 1000000) i = i + 1;", 10);
+  bench_loop("count with a local while loop",
+             "{ var i = 0; while (i < 1000000) i = i + 1; }", 10);
+  bench_loop("count with a for loop",
+             "for (var i = 0; i < 1000000; i = i + 1) {}", 10);
+  bench_loop("sum with a for loop",
+             "{ var sum = 0;"
+             "  for (var i = 0; i < 1000000; i = i + 1) sum = sum + i; }",
+             10);
+  bench_sliced_loop(1000);
+  bench_sliced_loop(100);
+  bench_limited_loop();
+}
+
+auto bench_loop(char const *name, char const *source, int iterations) -> void {
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, iterations, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+}
+
+// Runs the for loop count in slices of slice back edges, resuming after each
+// one as a host scheduler would.
+auto bench_sliced_loop(int slice) -> void {
+  auto vm = VirtualMachine{};
+  auto const function =
+      compile("for (var i = 0; i < 1000000; i = i + 1) {}", vm.globals);
+  char name[64];
+  snprintf(name, sizeof(name), "count in slices of %d back edges", slice);
+  auto const run = [&] {
+    vm.fuel = slice;
+    auto result = interpret(vm, function);
+    while (result == InterpretResult::YIELDED) {
+      vm.fuel = slice;
+      result = resume(vm);
+    }
+    return result;
+  };
+  expect_ok(run(), name);
+  auto const seconds = benchmark(name, 10, [&] { keep(run()); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+  free_object(&function->obj);
+}
+
+// Counts under every resource limit, which looks at the clock every
+// limit_check_steps back edges.
+auto bench_limited_loop() -> void {
+  auto vm = VirtualMachine{};
+  vm.limits.heap_bytes = 1 << 20;
+  vm.limits.frames = 16;
+  vm.limits.steps = UINT64_MAX - 1;
+  vm.limits.nanoseconds = UINT64_MAX - 1;
+  auto constexpr name = "count with a for loop under limits";
+  auto constexpr source = "for (var i = 0; i < 1000000; i = i + 1) {}";
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 10, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+}
+
+} // namespace lox
@@ -0,0 +1,44 @@
+namespace lox {
+
+auto bench_compile() -> void;
+auto bench_loops() -> void;
+auto bench_calls() -> void;
+auto bench_closures() -> void;
+auto bench_properties() -> void;
+auto bench_natives() -> void;
+auto bench_arrays() -> void;
+auto bench_batch() -> void;
+auto bench_prepared() -> void;
+auto bench_snapshot() -> void;
+auto bench_trace() -> void;
+auto bench_stack_cache() -> void;
+auto bench_registers() -> void;
+auto bench_expressions() -> void;
+auto bench_allocation() -> void;
+auto bench_nursery() -> void;
+auto bench_collector() -> void;
+auto bench_output() -> void;
+
+} // namespace lox
+
+auto main() -> int {
+  lox::bench_compile();
+  lox::bench_loops();
+  lox::bench_calls();
+  lox::bench_closures();
+  lox::bench_properties();
+  lox::bench_natives();
+  lox::bench_arrays();
+  lox::bench_batch();
+  lox::bench_prepared();
+  lox::bench_snapshot();
+  lox::bench_trace();
+  lox::bench_stack_cache();
+  lox::bench_registers();
+  lox::bench_expressions();
+  lox::bench_allocation();
+  lox::bench_nursery();
+  lox::bench_collector();
+  lox::bench_output();
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <span>
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <object.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_native_loop(char const *name, char const *source) -> void;
+auto lookup(std::span<Value const> arguments) -> Value;
+auto lookup_batch(std::span<Value const> inputs, std::span<Value> results)
+    -> void;
+
+// The scripts run one million iterations that add a value obtained by an
+// opcode, a native call or a lox function call, so the difference between
+// them is the cost of crossing into the callee.
+auto bench_natives() -> void {
+  bench_native_loop("add a constant",
+                    "{ var sum = 0;"
+                    "  for (var i = 0; i < 1000000; i = i + 1)"
+                    "    sum = sum + -i; }");
+  bench_native_loop("add a native result",
+                    "{ var sum = 0;"
+                    "  for (var i = 0; i < 1000000; i = i + 1)"
+                    "    sum = sum + lookup(i); }");
+  bench_native_loop("add a function result",
+                    "fun f(n) { return -n; }"
+                    "{ var sum = 0;"
+                    "  for (var i = 0; i < 1000000; i = i + 1)"
+                    "    sum = sum + f(i); }");
+
+  auto inputs = Array<Value>{};
+  auto results = Array<Value>{};
+  for (int i = 0; i < 10000; ++i) {
+    write(inputs, number_val(i));
+    write(results, nil_val);
+  }
+  auto const name = copy_string("lookup");
+  auto const scalar = new_native(name, 1, lookup, nullptr);
+  auto const batched = new_native(name, 1, lookup, lookup_batch);
+  auto const bench_batch = [&](char const *label, ObjNative const *native) {
+    auto const seconds = benchmark(label, 1000, [&] {
+      call_native(native, {inputs.data, 10000}, {results.data, 10000});
+      keep(results.data[0]);
+    });
+    printf("%-44s %14.2f ns per row\n", "", seconds * 1e9 / 10000);
+  };
+  bench_batch("call a native per row", scalar);
+  bench_batch("call a batched native", batched);
+}
+
+auto bench_native_loop(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  define_native(vm, "lookup", 1, lookup, lookup_batch);
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 10, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+}
+
+auto lookup(std::span<Value const> arguments) -> Value {
+  return number_val(-arguments[0].as.number);
+}
+
+auto lookup_batch(std::span<Value const> inputs, std::span<Value> results)
+    -> void {
+  for (size_t i = 0; i < results.size(); ++i)
+    results[i] = number_val(-inputs[i].as.number);
+}
+
+} // namespace lox
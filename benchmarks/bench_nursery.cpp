@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string_view>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <memory.hpp>
+#include <natives.hpp>
+#include <nursery.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_requests(Nursery *nursery, char const *name) -> void;
+
+// Prices an order of 64 lines per request, which makes four arrays that die
+// as the request ends, once with the temporaries left to the object
+// allocator and once in a nursery.
+auto bench_nursery() -> void {
+  bench_requests(nullptr, "array temporaries, no nursery");
+  auto nursery = Nursery{};
+  bench_requests(&nursery, "array temporaries in a nursery");
+  printf("%-44s %14zu collections\n", "", nursery.collections);
+}
+
+auto bench_requests(Nursery *nursery, char const *name) -> void {
+  auto vm = VirtualMachine{};
+  vm.nursery = nursery;
+  define_array_natives(vm);
+  auto const prices = new_number_array(64);
+  auto const quantities = new_number_array(64);
+  for (int i = 0; i < 64; ++i) {
+    prices->data[i] = 1.5 * i;
+    quantities->data[i] = i % 7;
+  }
+  std::string_view const parameters[] = {"prices", "quantities", "discount"};
+  auto const function = compile_expression(
+      "sum(prices * quantities * (1 - discount)) + sum(quantities)",
+      parameters, vm.globals);
+  auto total = Value{};
+  auto const seconds = benchmark(name, 20, [&] {
+    for (int i = 0; i < 1000; ++i) {
+      Value const arguments[] = {obj_val(prices), obj_val(quantities),
+                                 number_val(i % 10 * 0.01)};
+      evaluate(vm, function, arguments, total);
+      keep(total);
+    }
+  });
+  printf("%-44s %14.2f ns per request\n", "", seconds * 1e9 / 1000);
+  free_object(&function->obj);
+  free_object(&prices->obj);
+  free_object(&quantities->obj);
+}
+
+} // namespace lox
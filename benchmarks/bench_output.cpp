@@ -0,0 +1,44 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <output.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_prints(char const *name, OutputFn sink, void *context) -> void;
+auto discard(void *context, char const *data, size_t size) -> void;
+
+// Prints 100000 numbers, half of them fractions, to /dev/null through
+// writev and to a host callback that drops them.
+auto bench_output() -> void {
+  bench_prints("print numbers through writev", nullptr, nullptr);
+  auto bytes = size_t{0};
+  bench_prints("print numbers to a callback", discard, &bytes);
+  printf("%-44s %14zu bytes\n", "", bytes);
+}
+
+auto bench_prints(char const *name, OutputFn sink, void *context) -> void {
+  auto vm = VirtualMachine{};
+  vm.out.fd = open("/dev/null", O_WRONLY);
+  vm.out.sink = sink;
+  vm.out.context = context;
+  auto const function = compile(
+      "for (var i = 0; i < 50000; i = i + 1) { print i; print i / 8; }",
+      vm.globals);
+  expect_ok(interpret(vm, function), name);
+  auto const seconds =
+      benchmark(name, 10, [&] { keep(interpret(vm, function)); });
+  printf("%-44s %14.2f ns per print\n", "", seconds * 1e9 / 100000);
+  free_object(&function->obj);
+  close(vm.out.fd);
+}
+
+auto discard(void *context, char const *, size_t size) -> void {
+  *static_cast<size_t *>(context) += size;
+}
+
+} // namespace lox
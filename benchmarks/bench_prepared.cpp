@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string_view>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+// Evaluates the same pricing expression for a thousand requests, once by
+// compiling the source for each request and once through a prepared function
+// with the inputs bound as arguments.
+auto bench_prepared() -> void {
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, "var price = 0; var quantity = 0; var total = 0;"),
+            "declare the request globals");
+  auto const price = resolve_global(vm.globals, "price");
+  auto const quantity = resolve_global(vm.globals, "quantity");
+  auto constexpr request = "total = price * quantity * 1.2 + 5;";
+  expect_ok(interpret(vm, request), "compile and interpret per request");
+  auto seconds = benchmark("compile and interpret per request", 100, [&] {
+    for (int i = 0; i < 1000; ++i) {
+      vm.globals.slots.data[price].value = number_val(i);
+      vm.globals.slots.data[quantity].value = number_val(3);
+      interpret(vm, request);
+    }
+  });
+  printf("%-44s %14.2f ns per request\n", "", seconds * 1e9 / 1000);
+
+  std::string_view const parameters[] = {"price", "quantity"};
+  auto const function = compile_expression("price * quantity * 1.2 + 5",
+                                           parameters, vm.globals);
+  auto total = Value{};
+  Value const sample[] = {number_val(1), number_val(3)};
+  expect_ok(evaluate(vm, function, sample, total),
+            "evaluate a prepared expression");
+  seconds = benchmark("evaluate a prepared expression", 100, [&] {
+    for (int i = 0; i < 1000; ++i) {
+      Value const arguments[] = {number_val(i), number_val(3)};
+      evaluate(vm, function, arguments, total);
+      keep(total);
+    }
+  });
+  printf("%-44s %14.2f ns per request\n", "", seconds * 1e9 / 1000);
+  free_object(&function->obj);
+}
+
+} // namespace lox
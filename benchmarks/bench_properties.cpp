@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_property(char const *name, char const *source) -> void;
+
+// Each script reads or writes a property one million times. The record shapes
+// are monomorphic in the first scripts and alternate between two in the last.
+auto bench_properties() -> void {
+  bench_property("load a field",
+                 "class R {} var r = R(); r.a = 1; r.b = 2;"
+                 "{ var sum = 0;"
+                 "  for (var i = 0; i < 1000000; i = i + 1) sum = sum + r.b; }");
+  bench_property("store a field",
+                 "class R {} var r = R(); r.a = 1;"
+                 "for (var i = 0; i < 1000000; i = i + 1) r.a = i;");
+  bench_property("invoke a method",
+                 "class R { get() { return 1; } } var r = R();"
+                 "for (var i = 0; i < 1000000; i = i + 1) r.get();");
+  bench_property("load a field from two shapes",
+                 "class R {} var r = R(); r.a = 1; r.b = 2;"
+                 "var s = R(); s.b = 3;"
+                 "{ var sum = 0; var o = r;"
+                 "  for (var i = 0; i < 1000000; i = i + 1) {"
+                 "    sum = sum + o.b; if (o == r) o = s; else o = r; } }");
+}
+
+auto bench_property(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, source), name);
+  auto const seconds =
+      benchmark(name, 10, [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+}
+
+} // namespace lox
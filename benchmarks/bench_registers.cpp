@@ -0,0 +1,62 @@
+#include <memory>
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <compiler.hpp>
+#include <registers.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_register_loop(char const *name, char const *source) -> void;
+
+// Runs each loop on the stack machine and lowered to registers, and reports
+// how many instructions each ran. Every script runs its body one million
+// times.
+auto bench_registers() -> void {
+  bench_register_loop("count with a local while loop",
+                      "{ var i = 0; while (i < 1000000) i = i + 1; }");
+  bench_register_loop("sum with a for loop",
+                      "{ var sum = 0;"
+                      "  for (var i = 0; i < 1000000; i = i + 1)"
+                      "    sum = sum + i; }");
+  bench_register_loop("polynomial with a for loop",
+                      "{ var y = 0;"
+                      "  for (var x = 0; x < 1000000; x = x + 1)"
+                      "    y = ((3 * x + 2) * x - 7) / (x + 1); }");
+  bench_register_loop("a + b * c over locals",
+                      "{ var a = 1; var b = 2; var c = 3; var d = 0;"
+                      "  for (var i = 0; i < 1000000; i = i + 1) {"
+                      "    d = a + b * c; a = d - c; } }");
+}
+
+auto bench_register_loop(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  auto const function = compile(source, vm.globals);
+  auto chunk = RegisterChunk{};
+  if (function == nullptr || !lower_to_registers(function, chunk))
+    return;
+  // Tracing records one entry per instruction the stack machine runs.
+  auto const ring = std::make_unique<TraceRing>();
+  vm.trace = ring.get();
+  expect_ok(interpret(vm, function), name);
+  vm.trace = nullptr;
+  auto executed = uint64_t{0};
+  expect_ok(run_registers(vm, chunk, &executed), name);
+
+  char label[64];
+  snprintf(label, sizeof(label), "%s, stack", name);
+  auto seconds =
+      benchmark(label, 10, [&] { keep(interpret(vm, function)); });
+  printf("%-44s %14.2f ns per iteration %6.2f instructions\n", "",
+         seconds * 1e9 / 1000000,
+         static_cast<double>(ring->head.load()) / 1000000);
+  snprintf(label, sizeof(label), "%s, registers", name);
+  seconds = benchmark(label, 10, [&] { keep(run_registers(vm, chunk)); });
+  printf("%-44s %14.2f ns per iteration %6.2f instructions\n", "",
+         seconds * 1e9 / 1000000, static_cast<double>(executed) / 1000000);
+  free_object(&function->obj);
+}
+
+} // namespace lox
@@ -0,0 +1,45 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <snapshot.hpp>
+
+namespace lox {
+
+auto prelude_source() -> char const *;
+
+// Brings a fresh VirtualMachine to the same prelude state by compiling and
+// running the prelude, and by loading a snapshot taken after running it.
+auto bench_snapshot() -> void {
+  auto const source = prelude_source();
+  auto warm = VirtualMachine{};
+  expect_ok(interpret(warm, source), "start from the prelude source");
+  auto seconds = benchmark("start from the prelude source", 100, [&] {
+    auto vm = VirtualMachine{};
+    keep(interpret(vm, source));
+  });
+  auto snapshot = Array<uint8_t>{};
+  save_snapshot(warm, snapshot);
+  seconds = benchmark("start from a prelude snapshot", 100, [&] {
+    auto vm = VirtualMachine{};
+    keep(load_snapshot(
+        vm, {snapshot.data, static_cast<size_t>(snapshot.count)}));
+  });
+  printf("%-44s %14d bytes\n", "", snapshot.count);
+  keep(seconds);
+}
+
+// Two hundred small classes and functions with a table of constants each,
+// standing in for the library a worker loads before serving requests.
+auto prelude_source() -> char const * {
+  static char source[200 * 160];
+  auto length = 0;
+  for (int i = 0; i < 200; ++i)
+    length += snprintf(source + length, sizeof(source) - length,
+                       "class C%d { get() { return this.v * %d; } }"
+                       "fun f%d(x) { return x * %d + %d; }"
+                       "var v%d = f%d(%d);",
+                       i, i, i, i, i + 1, i, i, i);
+  return source;
+}
+
+} // namespace lox
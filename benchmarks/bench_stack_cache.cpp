@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto bench_cached_loop(char const *name, char const *source) -> void;
+
+// Runs each loop with the top of the stack in memory and then in a register.
+// Every script runs its body one million times.
+auto bench_stack_cache() -> void {
+  bench_cached_loop("count with a local while loop",
+                    "{ var i = 0; while (i < 1000000) i = i + 1; }");
+  bench_cached_loop("sum with a for loop",
+                    "{ var sum = 0;"
+                    "  for (var i = 0; i < 1000000; i = i + 1)"
+                    "    sum = sum + i; }");
+  bench_cached_loop("polynomial with a for loop",
+                    "{ var y = 0;"
+                    "  for (var x = 0; x < 1000000; x = x + 1)"
+                    "    y = ((3 * x + 2) * x - 7) / (x + 1); }");
+}
+
+auto bench_cached_loop(char const *name, char const *source) -> void {
+  auto vm = VirtualMachine{};
+  for (auto const cache_top : {false, true}) {
+    vm.cache_top = cache_top;
+    char label[64];
+    snprintf(label, sizeof(label), "%s%s", name,
+             cache_top ? ", top cached" : "");
+    expect_ok(interpret(vm, source), label);
+    auto const seconds =
+        benchmark(label, 10, [&] { keep(interpret(vm, source)); });
+    printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+  }
+}
+
+} // namespace lox
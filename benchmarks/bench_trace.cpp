@@ -0,0 +1,35 @@
+#include <memory>
+#include <stdio.h>
+
+#include <benchmark.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+// Runs the same loop of five instructions per iteration without and with a
+// trace ring, so the difference is the cost of recording five records.
+auto bench_trace() -> void {
+  auto constexpr source = "{ var sum = 0;"
+                          "  for (var i = 0; i < 1000000; i = i + 1)"
+                          "    sum = sum + i; }";
+  auto vm = VirtualMachine{};
+  expect_ok(interpret(vm, source), "sum loop without a trace");
+  auto seconds = benchmark("sum loop without a trace", 10,
+                           [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+  auto ring = std::make_unique<TraceRing>();
+  vm.trace = ring.get();
+  seconds = benchmark("sum loop with a trace", 10,
+                      [&] { keep(interpret(vm, source)); });
+  printf("%-44s %14.2f ns per iteration\n", "", seconds * 1e9 / 1000000);
+  auto records = Array<TraceRecord>{};
+  seconds = benchmark("read a full trace ring", 100, [&] {
+    records.count = 0;
+    read_trace(*ring, records);
+    keep(records.count);
+  });
+  keep(seconds);
+}
+
+} // namespace lox
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+// Keeps the compiler from discarding a value computed only for timing.
+template <typename T> inline auto keep(T const &value) -> void {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Stops the benchmarks when a run they are about to time fails, so an error
+// is never reported as a time.
+inline auto expect_ok(InterpretResult result, char const *name) -> void {
+  if (result == InterpretResult::OK)
+    return;
+  fprintf(stderr, "%s: the run failed\n", name);
+  exit(1);
+}
+
+// Runs body once to warm up, then iterations times, and reports the mean time
+// per iteration. When each iteration processes bytes of input the throughput
+// is reported as well.
+template <typename Body>
+auto benchmark(char const *name, int iterations, Body &&body, size_t bytes = 0)
+    -> double {
+  body();
+  auto const start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    body();
+  auto const end = std::chrono::steady_clock::now();
+  auto const seconds =
+      std::chrono::duration<double>(end - start).count() / iterations;
+  printf("%-44s %14.1f ns", name, seconds * 1e9);
+  if (bytes)
+    printf(" %10.1f MB/s", bytes / seconds / 1e6);
+  printf("\n");
+  return seconds;
+}
+
+} // namespace lox
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string.h>
+
 #include <memory.hpp>
 
 namespace lox {
@@ -8,17 +10,72 @@ template <typename T> struct Array {
   int count = 0;
   int capacity = 0;
   T *data = nullptr;
+  MemoryCategory category = MemoryCategory::OTHER;
+
+  Array() = default;
+  explicit Array(MemoryCategory category) : category{category} {}
+  Array(Array const &) = delete;
+  Array(Array &&other) noexcept
+      : count{other.count}, capacity{other.capacity}, data{other.data},
+        category{other.category} {
+    other.count = 0;
+    other.capacity = 0;
+    other.data = nullptr;
+  }
 
-  ~Array() { free_array(data, capacity); }
+  auto operator=(Array const &) -> Array & = delete;
+  auto operator=(Array &&other) noexcept -> Array & {
+    if (this == &other)
+      return *this;
+    free_array(data, capacity, category);
+    count = other.count;
+    capacity = other.capacity;
+    data = other.data;
+    category = other.category;
+    other.count = 0;
+    other.capacity = 0;
+    other.data = nullptr;
+    return *this;
+  }
+
+  ~Array() { free_array(data, capacity, category); }
 };
 
+template <typename T>
+inline auto reserve(Array<T> &array, int capacity) -> void {
+  if (capacity <= array.capacity)
+    return;
+  array.data =
+      grow_array(array.data, array.capacity, capacity, array.category);
+  array.capacity = capacity;
+}
+
+template <typename T> inline auto shrink_to_fit(Array<T> &array) -> void {
+  if (array.count == array.capacity)
+    return;
+  array.data =
+      grow_array(array.data, array.capacity, array.count, array.category);
+  array.capacity = array.count;
+}
+
 template <typename T> inline auto write(Array<T> &array, T value) -> void {
-  if (array.capacity < array.count + 1) {
-    auto const old_capacity = array.capacity;
-    array.capacity = grow_capacity(old_capacity);
-    array.data = grow_array(array.data, old_capacity, array.capacity);
-  }
+  if (array.capacity < array.count + 1)
+    reserve(array, grow_capacity(array.capacity));
   array.data[array.count++] = value;
 }
 
+template <typename T>
+inline auto append(Array<T> &array, T const *values, int count) -> void {
+  if (count == 0)
+    return;
+  if (array.capacity < array.count + count) {
+    auto capacity = array.capacity;
+    while (capacity < array.count + count)
+      capacity = grow_capacity(capacity);
+    reserve(array, capacity);
+  }
+  memcpy(array.data + array.count, values, sizeof(T) * count);
+  array.count += count;
+}
+
 } // namespace lox
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <span>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <globals.hpp>
+#include <object.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto constexpr batch_rows = 1024;
+auto constexpr batch_stack_max = 32;
+
+// Binds a global slot to one value per row of a batch.
+struct BatchInput {
+  int global;
+  std::span<Value const> values;
+};
+
+enum class ColumnType : uint8_t { NUMBERS, BOOLS, VALUES };
+
+// The values an instruction produced for every row of a block. Numbers and
+// booleans are unboxed into numbers, booleans as 1 and 0, so the number array
+// kernels run over them. A uniform column holds the same value in every row
+// and stores only the first.
+struct BatchColumn {
+  ColumnType type;
+  bool uniform;
+  double *numbers;
+  Value const *values;
+};
+
+// Scratch columns for evaluate_batch, kept across calls so evaluating many
+// batches allocates only once.
+struct Batch {
+  BatchColumn stack[batch_stack_max];
+  Array<double> numbers{MemoryCategory::BATCH_COLUMNS};
+  Array<Value> values{MemoryCategory::BATCH_COLUMNS};
+  Array<Value> arguments{MemoryCategory::BATCH_COLUMNS};
+};
+
+// Evaluates the expression compiled into function once for every row of
+// results, reading the globals bound by inputs from the same row of their
+// values. Each instruction runs once per block of batch_rows rows; columns
+// that are not all numbers or all booleans fall back to checking types row
+// by row. Only code made of constants, globals, arithmetic, comparisons,
+// native calls and the temporaries that hold repeated subexpressions can run
+// in batches, anything else is a compile error.
+auto evaluate_batch(Batch &batch, ObjFunction const *function,
+                    Globals const &globals,
+                    std::span<BatchInput const> inputs,
+                    std::span<Value> results) -> InterpretResult;
+
+} // namespace lox
@@ -7,12 +7,27 @@
 
 namespace lox {
 
+struct Shape;
+
 enum struct OpCode : uint8_t {
   CONSTANT,
   CONSTANT_LONG,
   NIL,
   TRUE,
   FALSE,
+  POP,
+  GET_LOCAL,
+  SET_LOCAL,
+  DEFINE_GLOBAL,
+  GET_GLOBAL,
+  SET_GLOBAL,
+  GET_UPVALUE,
+  SET_UPVALUE,
+  GET_PROPERTY,
+  SET_PROPERTY,
+  JUMP,
+  JUMP_IF_FALSE,
+  LOOP,
   EQUAL,
   GREATER,
   LESS,
@@ -22,17 +37,88 @@ enum struct OpCode : uint8_t {
   DIVIDE,
   NOT,
   NEGATE,
+  PRINT,
+  CALL,
+  TAIL_CALL,
+  INVOKE,
+  CLOSURE,
+  CLOSE_UPVALUES,
+  CLASS,
+  METHOD,
   RETURN,
+  ADD_CONSTANT,
+  SUBTRACT_CONSTANT,
+  MULTIPLY_CONSTANT,
+  DIVIDE_CONSTANT,
+  EQUAL_CONSTANT,
+  GREATER_CONSTANT,
+  LESS_CONSTANT,
+};
+
+// A superinstruction runs a CONSTANT followed by a binary op in one dispatch,
+// with the constant as its right operand. The compiler fuses every pair
+// listed here; the set follows the most frequent opcode pairs lox-profile
+// reports, so adding a pair means adding an entry and its handlers.
+struct Superinstruction {
+  OpCode op_code;
+  OpCode fused;
+};
+
+inline constexpr Superinstruction superinstructions[] = {
+    {OpCode::ADD, OpCode::ADD_CONSTANT},
+    {OpCode::SUBTRACT, OpCode::SUBTRACT_CONSTANT},
+    {OpCode::MULTIPLY, OpCode::MULTIPLY_CONSTANT},
+    {OpCode::DIVIDE, OpCode::DIVIDE_CONSTANT},
+    {OpCode::EQUAL, OpCode::EQUAL_CONSTANT},
+    {OpCode::GREATER, OpCode::GREATER_CONSTANT},
+    {OpCode::LESS, OpCode::LESS_CONSTANT},
+};
+
+// Every LOOP instruction owns a site that counts how often its back edge is
+// taken, so a profiler or a future tier up can find the hot loops of a chunk.
+struct LoopSite {
+  int offset;
+  uint64_t count;
+};
+
+auto constexpr property_cache_size = 4;
+
+// Maps the shape of a receiver to the field slot holding the property, or to
+// a method of the receiver's class when slot is -1. A SET_PROPERTY entry that
+// adds the field also records the shape the instance moves to.
+struct CacheEntry {
+  Shape *shape;
+  Shape *transition;
+  int slot;
+  Value method;
+};
+
+// Every GET_PROPERTY, SET_PROPERTY and INVOKE owns a polymorphic inline cache
+// of up to property_cache_size shapes. Misses past that stay on the slow path.
+struct PropertyCache {
+  int offset;
+  int count;
+  uint64_t misses;
+  CacheEntry entries[property_cache_size];
 };
 
 struct Chunk {
-  Array<uint8_t> code;
-  Array<Value> constants;
-  Array<int> lines;
+  Array<uint8_t> code{MemoryCategory::CHUNK_CODE};
+  Array<Value> constants{MemoryCategory::CHUNK_CONSTANTS};
+  Array<int> lines{MemoryCategory::CHUNK_LINES};
+  Array<LoopSite> loops{MemoryCategory::CHUNK_LOOPS};
+  Array<PropertyCache> caches{MemoryCategory::CHUNK_CACHES};
 };
 
 auto write(Chunk &chunk, uint8_t byte, int line) -> void;
 auto write(Chunk &chunk, Value value, int line) -> void;
 auto add_constant(Chunk &chunk, Value value) -> int;
+auto add_loop_site(Chunk &chunk, int offset) -> int;
+auto add_property_cache(Chunk &chunk, int offset) -> int;
+auto reserve(Chunk &chunk, int code_capacity, int constants_capacity) -> void;
+auto shrink_to_fit(Chunk &chunk) -> void;
+// Returns the most stack slots a call of the chunk holds at once, from the
+// callee in slot zero up.
+auto stack_size(Chunk const &chunk, int arity) -> int;
 
 } // namespace lox
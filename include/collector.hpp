@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <object.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+struct Nursery;
+struct VirtualMachine;
+
+auto constexpr pause_histogram_buckets = 32;
+
+// Bucket i of the histogram counts pauses of [2^i, 2^(i + 1)) nanoseconds.
+struct PauseStats {
+  size_t pauses = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  size_t histogram[pause_histogram_buckets] = {};
+};
+
+enum class CollectorPhase : uint8_t { IDLE, MARK, SWEEP };
+
+// Frees the objects a VirtualMachine makes while it runs once nothing
+// reaches them, without stopping the run for longer than a slice. Those
+// objects, other than classes and the young ones of a nursery, are kept in
+// objects. A cycle starts once there are next_cycle of them, which then
+// becomes twice the survivors but at least cycle_minimum. The machine's
+// nursery, if any, is collected and the roots are marked gray, then each
+// slice blackens up to slice_objects gray objects, or with a nursery that
+// many for every slice_allocations allocations since the last slice.
+// Slices run where a run spends fuel, every slice_allocations allocations.
+// A store that overwrites a reference while marking shades the old value,
+// so every object reachable when the cycle started is marked, and objects
+// made since, from marked_limit on in objects, survive it. Once no gray is
+// left, the unmarked objects are freed sweep_objects at a time, every
+// sweep_allocations allocations. Functions belong to whoever compiled them
+// and are never marked. Objects made while no run was using the collector
+// are not freed, and a host must keep the objects it holds reachable from
+// the globals to have them outlive a cycle.
+struct Collector {
+  CollectorPhase phase = CollectorPhase::IDLE;
+  bool pending = false;
+  uint16_t epoch = 0;
+  Array<Obj *> objects{};
+  Array<Obj *> gray{};
+  int marked_limit = 0;
+  int sweep_index = 0;
+  int sweep_end = 0;
+  int kept = 0;
+  int allocations = 0;
+  int next_cycle = 4096;
+  int cycle_minimum = 4096;
+  int slice_objects = 256;
+  int slice_allocations = 64;
+  int sweep_objects = 128;
+  int sweep_allocations = 16;
+  size_t cycles = 0;
+  size_t freed = 0;
+  PauseStats mark_pauses;
+  PauseStats sweep_pauses;
+};
+
+// Adds object, which was just made, to the collector in use on this thread
+// if it is not young, and sweeps or asks for a slice when it is time to.
+auto track_object(Obj *object) -> void;
+auto use_collector(Collector *collector) -> Collector *;
+auto active_collector() -> Collector *;
+// Starts a cycle or continues marking. vm must have every value it holds
+// on its stack.
+auto collect_slice(VirtualMachine &vm) -> void;
+// Frees every object vm no longer reaches, without a budget, for a run that
+// cannot wait for the slices. vm must have every value it holds on its stack.
+auto collect_garbage(VirtualMachine &vm) -> void;
+// Blackens the young gray objects, which a nursery collection is about to
+// move or drop.
+auto trace_young(Collector &collector, Nursery const &nursery) -> void;
+auto mark_object(Collector &collector, Obj *object) -> void;
+auto record_pause(PauseStats &stats, uint64_t nanoseconds) -> void;
+// The upper bound of the bucket holding the pause fraction of the way
+// through the sorted pauses, or 0 without any.
+auto pause_percentile(PauseStats const &stats, double fraction) -> uint64_t;
+
+// Called with the reference a store into an object is about to overwrite.
+inline auto mark_barrier(Collector *collector, Obj *old) -> void {
+  if (collector != nullptr && collector->phase == CollectorPhase::MARK &&
+      old != nullptr)
+    mark_object(*collector, old);
+}
+
+inline auto mark_barrier(Collector *collector, Value const &old) -> void {
+  if (is_obj(old))
+    mark_barrier(collector, old.as.obj);
+}
+
+} // namespace lox
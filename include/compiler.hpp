@@ -1,11 +1,21 @@
 #pragma once
 
+#include <span>
 #include <string_view>
 
-#include <chunk.hpp>
+#include <globals.hpp>
+#include <grammar.hpp>
+#include <object.hpp>
 
 namespace lox {
 
-auto compile(std::string_view source, Chunk &chunk) -> bool;
+// Returns the function holding the top level code of source, or nullptr when
+// it has compile errors. The caller owns the returned function.
+auto compile(std::string_view source, Globals &globals) -> ObjFunction *;
+// Compiles source, which must be a single expression, into a function taking
+// parameters in order. Unlike compile, names in parameters resolve to locals.
+auto compile_expression(std::string_view source,
+                        std::span<std::string_view const> parameters,
+                        Globals &globals) -> ObjFunction *;
 
 } // namespace lox
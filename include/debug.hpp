@@ -1,13 +1,28 @@
 #pragma once
 
 #include <chunk.hpp>
+#include <memory.hpp>
 
 namespace lox {
 
+struct PauseStats;
+struct RegisterChunk;
+
+#ifdef NDEBUG
+auto constexpr print_code = false;
+auto constexpr trace_execution = false;
+#else
 auto constexpr print_code = true;
 auto constexpr trace_execution = true;
+#endif
 
 auto disassemble(Chunk const &chunk, char const *name) -> void;
 auto disassemble(Chunk const &chunk, int offset) -> int;
+auto disassemble(RegisterChunk const &chunk, char const *name) -> void;
+auto op_code_name(OpCode op_code) -> char const *;
+auto print_loop_sites(Chunk const &chunk) -> void;
+auto print_property_caches(Chunk const &chunk) -> void;
+auto print_memory_stats(MemoryStats const &stats) -> void;
+auto print_pause_stats(char const *name, PauseStats const &stats) -> void;
 
 } // namespace lox
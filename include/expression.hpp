@@ -0,0 +1,83 @@
+#pragma once
+
+#include <span>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+enum class NodeOp : uint8_t {
+  CONSTANT,
+  LOCAL,
+  UPVALUE,
+  GLOBAL,
+  NOT,
+  NEGATE,
+  EQUAL,
+  GREATER,
+  LESS,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  AND,
+  OR,
+  CALL,
+};
+
+// One value computed by an expression. operand is the slot a read names or
+// the argument count of a CALL, whose callee is left and whose arguments
+// start at right in ExpressionGraph::arguments. Reads carry the epoch they
+// ran in, so reads on either side of a call stay apart. number and boolean
+// record what the node is known to produce whatever its inputs are, pure
+// that computing it can neither fail nor have an effect, and size how many
+// instructions compute it from scratch.
+struct Node {
+  NodeOp op;
+  bool number;
+  bool boolean;
+  bool pure;
+  int operand;
+  int size;
+  int epoch;
+  int left;
+  int right;
+  int line;
+  Value value;
+};
+
+// The values of one expression as a DAG, in evaluation order, so every node
+// comes after its operands. Adding a node equal to one already in the graph
+// returns the existing node, which builds repeated subexpressions once.
+// Calls are never merged and start a new epoch. table is an open addressing
+// set of node indexes, -1 where empty.
+struct ExpressionGraph {
+  Array<Node> nodes{};
+  Array<int> arguments{};
+  Array<int> table{};
+  int epoch = 0;
+};
+
+auto clear(ExpressionGraph &graph) -> void;
+// Each of these returns the index of the node, or -1 if an operand is -1,
+// which only happens after a parse error. Operations are simplified as they
+// are added: x * 1, 1 * x, x / 1 and x - 0 become x when x is known to be a
+// number, !!x becomes x when x is known to be a boolean, ! of a constant is
+// folded, and and/or with a constant left operand keep the operand they
+// would evaluate to.
+auto constant_node(ExpressionGraph &graph, Value value, int line) -> int;
+auto read_node(ExpressionGraph &graph, NodeOp op, int slot, int line) -> int;
+auto unary_node(ExpressionGraph &graph, NodeOp op, int operand, int line)
+    -> int;
+auto binary_node(ExpressionGraph &graph, NodeOp op, int left, int right,
+                 int line) -> int;
+auto call_node(ExpressionGraph &graph, int callee,
+               std::span<int const> arguments, int line) -> int;
+// Counts how often each node is used on the way to root into uses. Nodes
+// that root does not reach, such as those simplified away, count zero.
+auto count_uses(ExpressionGraph const &graph, int root, Array<int> &uses)
+    -> void;
+
+} // namespace lox
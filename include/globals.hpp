@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <unordered_map>
+
+#include <array.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+struct ObjString;
+
+auto constexpr globals_max = UINT16_MAX + 1;
+
+// Global variables are resolved to dense slots at compile time, so the
+// virtual machine reads and writes them by index and never hashes a name.
+// A slot is allocated the first time a name is compiled and becomes defined
+// when its var declaration runs.
+struct GlobalSlot {
+  Value value;
+  bool defined;
+};
+
+struct Globals {
+  Array<GlobalSlot> slots;
+  Array<ObjString *> names;
+  std::unordered_map<std::string_view, int> indexes;
+};
+
+auto resolve_global(Globals &globals, std::string_view name) -> int;
+
+} // namespace lox
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <limits>
+#include <stdint.h>
+#include <string_view>
+
+#include <scanner.hpp>
+
+namespace lox {
+
+// What compile() and static_compile() both take from source, so the two read
+// an expression alike: the precedence of each operator, what each token does
+// in an expression, and the value of each number literal.
+
+enum class Precedence {
+  NONE,
+  ASSIGNMENT, // =
+  OR,         // or
+  AND,        // and
+  EQUALITY,   // == !=
+  COMPARISON, // < > <= >=
+  TERM,       // + -
+  FACTOR,     // * /
+  UNARY,      // ! -
+  CALL,       // . ()
+  PRIMARY
+};
+
+// Each compiler keeps a parse function for every Prefix and Infix, in the
+// order they are listed, and leaves out or rejects the ones it lacks.
+enum class Prefix : uint8_t {
+  NONE,
+  GROUPING,
+  UNARY,
+  VARIABLE,
+  STRING,
+  NUMBER,
+  LITERAL,
+  THIS,
+};
+
+enum class Infix : uint8_t { NONE, CALL, DOT, BINARY, AND, OR };
+
+struct GrammarRule {
+  Prefix prefix;
+  Infix infix;
+  Precedence precedence;
+};
+
+inline constexpr GrammarRule grammar_rules[] = {
+    {Prefix::GROUPING, Infix::CALL, Precedence::CALL},     // LEFT_PAREN
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // RIGHT_PAREN
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // LEFT_BRACE
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // RIGHT_BRACE
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // COMMA
+    {Prefix::NONE, Infix::DOT, Precedence::CALL},          // DOT
+    {Prefix::UNARY, Infix::BINARY, Precedence::TERM},      // MINUS
+    {Prefix::NONE, Infix::BINARY, Precedence::TERM},       // PLUS
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // SEMICOLON
+    {Prefix::NONE, Infix::BINARY, Precedence::FACTOR},     // SLASH
+    {Prefix::NONE, Infix::BINARY, Precedence::FACTOR},     // STAR
+    {Prefix::UNARY, Infix::NONE, Precedence::NONE},        // BANG
+    {Prefix::NONE, Infix::BINARY, Precedence::EQUALITY},   // BANG_EQUAL
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // EQUAL
+    {Prefix::NONE, Infix::BINARY, Precedence::EQUALITY},   // EQUAL_EQUAL
+    {Prefix::NONE, Infix::BINARY, Precedence::COMPARISON}, // GREATER
+    {Prefix::NONE, Infix::BINARY, Precedence::COMPARISON}, // GREATER_EQUAL
+    {Prefix::NONE, Infix::BINARY, Precedence::COMPARISON}, // LESS
+    {Prefix::NONE, Infix::BINARY, Precedence::COMPARISON}, // LESS_EQUAL
+    {Prefix::VARIABLE, Infix::NONE, Precedence::NONE},     // IDENTIFIER
+    {Prefix::STRING, Infix::NONE, Precedence::NONE},       // STRING
+    {Prefix::NUMBER, Infix::NONE, Precedence::NONE},       // NUMBER
+    {Prefix::NONE, Infix::AND, Precedence::AND},           // AND
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // CLASS
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // ELSE
+    {Prefix::LITERAL, Infix::NONE, Precedence::NONE},      // FALSE
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // FOR
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // FUN
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // IF
+    {Prefix::LITERAL, Infix::NONE, Precedence::NONE},      // NIL
+    {Prefix::NONE, Infix::OR, Precedence::OR},             // OR
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // PRINT
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // RETURN
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // SUPER
+    {Prefix::THIS, Infix::NONE, Precedence::NONE},         // THIS
+    {Prefix::LITERAL, Infix::NONE, Precedence::NONE},      // TRUE
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // VAR
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // WHILE
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // ERROR
+    {Prefix::NONE, Infix::NONE, Precedence::NONE},         // END_OF_FILE
+};
+
+// Significant digits past the first number_digits_max only decide rounding
+// when the rest are exactly halfway, which a nonzero digit in their place
+// decides the same way, so longer literals keep just that one more digit.
+auto constexpr number_digits_max = 800;
+auto constexpr big_integer_limbs = 128;
+
+// An unsigned integer of up to big_integer_limbs 32 bit limbs, least
+// significant first. It holds any literal scaled as parse_number scales it.
+struct BigInteger {
+  uint32_t limbs[big_integer_limbs] = {};
+  int count = 0;
+};
+
+constexpr auto grammar_rule(TokenType type) -> GrammarRule const &;
+constexpr auto parse_number(std::string_view digits) -> double;
+constexpr auto divide_rounded(BigInteger numerator, BigInteger denominator)
+    -> double;
+constexpr auto multiply_add(BigInteger &integer, uint32_t factor,
+                            uint32_t addend) -> void;
+constexpr auto shift_left(BigInteger &integer, int bits) -> void;
+constexpr auto shift_right_one(BigInteger &integer) -> void;
+constexpr auto bit_length(BigInteger const &integer) -> int;
+constexpr auto compare(BigInteger const &lhs, BigInteger const &rhs) -> int;
+constexpr auto subtract(BigInteger &lhs, BigInteger const &rhs) -> void;
+
+constexpr auto grammar_rule(TokenType type) -> GrammarRule const & {
+  return grammar_rules[static_cast<uint8_t>(type)];
+}
+
+// Returns the double nearest the value of a number literal, ties to even.
+// Literals of up to 15 significant digits scaled by at most 10^22 are a
+// single correctly rounded operation on exact doubles. Others are divided
+// out exactly in big integers, which only very long literals need.
+constexpr auto parse_number(std::string_view digits) -> double {
+  double constexpr powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                      1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                      1e18, 1e19, 1e20, 1e21, 1e22};
+  // The literal is 0.significant times 10^point.
+  uint8_t significant[number_digits_max + 1];
+  auto count = 0;
+  auto point = 0;
+  auto seen_dot = false;
+  auto inexact = false;
+  for (auto const c : digits) {
+    if (c == '.') {
+      seen_dot = true;
+      continue;
+    }
+    auto const digit = static_cast<uint8_t>(c - '0');
+    if (count == 0 && digit == 0) {
+      point -= seen_dot;
+      continue;
+    }
+    point += !seen_dot;
+    if (count < number_digits_max)
+      significant[count++] = digit;
+    else
+      inexact = inexact || digit != 0;
+  }
+  if (count == 0 || point <= -324)
+    return 0;
+  if (point >= 310)
+    return std::numeric_limits<double>::infinity();
+  if (inexact)
+    significant[count++] = 1;
+  auto const exponent = point - count;
+  if (count <= 15 && exponent >= -22 && exponent <= 22) {
+    auto mantissa = int64_t{0};
+    for (int i = 0; i < count; ++i)
+      mantissa = mantissa * 10 + significant[i];
+    auto const value = static_cast<double>(mantissa);
+    return exponent < 0 ? value / powers_of_ten[-exponent]
+                        : value * powers_of_ten[exponent];
+  }
+  auto numerator = BigInteger{};
+  auto denominator = BigInteger{};
+  for (int i = 0; i < count; ++i)
+    multiply_add(numerator, 10, significant[i]);
+  multiply_add(denominator, 1, 1);
+  for (int i = 0; i < exponent; ++i)
+    multiply_add(numerator, 10, 0);
+  for (int i = 0; i < -exponent; ++i)
+    multiply_add(denominator, 10, 0);
+  return divide_rounded(numerator, denominator);
+}
+
+// Scales the quotient to 55 or 56 bits, takes it by long division and rounds
+// it to the 53 bits of a double, or fewer for subnormals, with what remains
+// breaking ties.
+constexpr auto divide_rounded(BigInteger numerator, BigInteger denominator)
+    -> double {
+  auto const shift =
+      55 - (bit_length(numerator) - bit_length(denominator));
+  if (shift > 0)
+    shift_left(numerator, shift);
+  else
+    shift_left(denominator, -shift);
+  shift_left(denominator, 57);
+  auto quotient = uint64_t{0};
+  for (int bit = 56; bit >= 0; --bit) {
+    shift_right_one(denominator);
+    if (compare(numerator, denominator) >= 0) {
+      subtract(numerator, denominator);
+      quotient |= uint64_t{1} << bit;
+    }
+  }
+  auto length = 0;
+  while (quotient >> length != 0)
+    ++length;
+  auto const exponent = length - 1 - shift;
+  auto dropped = length - 53;
+  if (exponent < -1022)
+    dropped += -1022 - exponent;
+  if (dropped > length)
+    return 0;
+  auto mantissa = quotient >> dropped;
+  auto const rest = quotient & ((uint64_t{1} << dropped) - 1);
+  auto const half = uint64_t{1} << (dropped - 1);
+  if (rest > half ||
+      (rest == half && (numerator.count != 0 || (mantissa & 1) != 0)))
+    ++mantissa;
+  if (mantissa >> 53 != 0) {
+    mantissa >>= 1;
+    ++dropped;
+  }
+  if (52 + dropped - shift > 1023)
+    return std::numeric_limits<double>::infinity();
+  auto value = static_cast<double>(mantissa);
+  for (int i = dropped - shift; i > 0; --i)
+    value *= 2;
+  for (int i = dropped - shift; i < 0; ++i)
+    value /= 2;
+  return value;
+}
+
+constexpr auto multiply_add(BigInteger &integer, uint32_t factor,
+                            uint32_t addend) -> void {
+  auto carry = uint64_t{addend};
+  for (int i = 0; i < integer.count; ++i) {
+    carry += uint64_t{integer.limbs[i]} * factor;
+    integer.limbs[i] = static_cast<uint32_t>(carry);
+    carry >>= 32;
+  }
+  if (carry != 0)
+    integer.limbs[integer.count++] = static_cast<uint32_t>(carry);
+}
+
+constexpr auto shift_left(BigInteger &integer, int bits) -> void {
+  auto const limbs = bits / 32;
+  bits %= 32;
+  if (integer.count == 0)
+    return;
+  integer.limbs[integer.count + limbs] = 0;
+  for (int i = integer.count - 1; i >= 0; --i) {
+    auto const limb = uint64_t{integer.limbs[i]} << bits;
+    integer.limbs[i + limbs + 1] |= static_cast<uint32_t>(limb >> 32);
+    integer.limbs[i + limbs] = static_cast<uint32_t>(limb);
+  }
+  for (int i = 0; i < limbs; ++i)
+    integer.limbs[i] = 0;
+  integer.count += limbs + 1;
+  if (integer.limbs[integer.count - 1] == 0)
+    --integer.count;
+}
+
+constexpr auto shift_right_one(BigInteger &integer) -> void {
+  for (int i = 0; i < integer.count; ++i) {
+    auto const high = i + 1 < integer.count ? integer.limbs[i + 1] : 0;
+    integer.limbs[i] = (integer.limbs[i] >> 1) | (high << 31);
+  }
+  if (integer.count > 0 && integer.limbs[integer.count - 1] == 0)
+    --integer.count;
+}
+
+constexpr auto bit_length(BigInteger const &integer) -> int {
+  if (integer.count == 0)
+    return 0;
+  auto length = (integer.count - 1) * 32;
+  for (auto top = integer.limbs[integer.count - 1]; top != 0; top >>= 1)
+    ++length;
+  return length;
+}
+
+constexpr auto compare(BigInteger const &lhs, BigInteger const &rhs) -> int {
+  if (lhs.count != rhs.count)
+    return lhs.count < rhs.count ? -1 : 1;
+  for (int i = lhs.count - 1; i >= 0; --i)
+    if (lhs.limbs[i] != rhs.limbs[i])
+      return lhs.limbs[i] < rhs.limbs[i] ? -1 : 1;
+  return 0;
+}
+
+constexpr auto subtract(BigInteger &lhs, BigInteger const &rhs) -> void {
+  auto borrow = int64_t{0};
+  for (int i = 0; i < lhs.count; ++i) {
+    auto difference = int64_t{lhs.limbs[i]} - borrow -
+                      (i < rhs.count ? int64_t{rhs.limbs[i]} : 0);
+    borrow = difference < 0;
+    lhs.limbs[i] = static_cast<uint32_t>(difference + (borrow << 32));
+  }
+  while (lhs.count > 0 && lhs.limbs[lhs.count - 1] == 0)
+    --lhs.count;
+}
+
+} // namespace lox
@@ -1,13 +1,108 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
 namespace lox {
 
+enum class MemoryCategory : uint8_t {
+  CHUNK_CODE,
+  CHUNK_CONSTANTS,
+  CHUNK_LINES,
+  CHUNK_LOOPS,
+  CHUNK_CACHES,
+  OBJECT,
+  NUMBER_ARRAY,
+  BATCH_COLUMNS,
+  SHAPE,
+  STRING_CHARS,
+  OTHER,
+};
+
+auto constexpr memory_category_count = 11;
+auto constexpr memory_histogram_buckets = 32;
+auto constexpr pool_slab_size = 4096;
+auto constexpr pool_class_size = 16;
+auto constexpr pool_block_max = 256;
+
+// Where objects and short string payloads get their memory. POOL hands out
+// blocks of a size class from the free list of the calling thread, which
+// cuts them from page sized slabs, and falls back to the system for blocks
+// over pool_block_max bytes. A block goes back to the allocator that made
+// it, so the allocator of a thread may change at any time, but pooled
+// objects are freed by their own thread before it exits.
+enum class ObjectAllocator : uint8_t { SYSTEM, POOL };
+
+struct Nursery;
+
+// Bucket i of the histogram counts requests of [2^i, 2^(i + 1)) bytes.
+struct AllocationStats {
+  size_t current_bytes = 0;
+  size_t peak_bytes = 0;
+  size_t allocations = 0;
+  size_t reallocations = 0;
+  size_t frees = 0;
+  size_t histogram[memory_histogram_buckets] = {};
+};
+
+struct MemoryStats {
+  AllocationStats total;
+  AllocationStats categories[memory_category_count];
+};
+
+// Counts the bytes allocated on a thread while it is in use, less those
+// freed. The first time they pass limit it sets exceeded and moves *fuel, if
+// set, into fuel_left, so a run stops at its next back edge or call. A run
+// whose meter is reclaimable collects there and goes on if that brings it
+// back under limit.
+struct HeapMeter {
+  int64_t bytes = 0;
+  size_t limit = SIZE_MAX;
+  uint64_t *fuel = nullptr;
+  uint64_t fuel_left = 0;
+  bool exceeded = false;
+  bool reclaimable = false;
+};
+
 auto grow_capacity(int capacity) -> int;
+// Stats are kept per thread without atomics, so memory_stats() returns those
+// of the calling thread: what was allocated and freed on it since it last
+// called reset_memory_stats(). A block freed on another thread than the one
+// that made it counts as freed there.
+auto memory_stats() -> MemoryStats const &;
+auto reset_memory_stats() -> void;
+auto record_allocation(MemoryCategory category, size_t old_size,
+                       size_t new_size) -> void;
+auto object_allocator() -> ObjectAllocator;
+auto set_object_allocator(ObjectAllocator allocator) -> void;
+// Both record size as requested, whichever allocator serves it. While a
+// Nursery is in use on the thread, blocks come from it until it is full.
+auto allocate_small(size_t size, MemoryCategory category) -> void *;
+auto free_small(void *pointer, size_t size, MemoryCategory category) -> void;
+// Takes a block from the object allocator even while a Nursery is in use.
+// Returns null, as the system does, when there is no memory for it.
+auto allocate_tenured(size_t size, MemoryCategory category) -> void *;
+// Makes nursery the one allocate_small uses on this thread, or none when it
+// is null, and returns the one used before.
+auto use_nursery(Nursery *nursery) -> Nursery *;
+auto active_nursery() -> Nursery *;
+// Makes meter the one allocations on this thread are counted by, or none
+// when it is null, and returns the one used before.
+auto use_heap_meter(HeapMeter *meter) -> HeapMeter *;
+// Whether size more bytes fit under the limit of meter.
+auto fits(HeapMeter const &meter, size_t size) -> bool;
+// Whether size more bytes fit under the meter in use, if any. When they do
+// not, the meter passes its limit as if they had been allocated. A
+// reclaimable meter allows any size up to its limit, and one it refuses is
+// no longer reclaimable, as the caller has failed for want of the bytes.
+auto heap_allows(size_t size) -> bool;
+// How many slabs the pool of the calling thread holds.
+auto pool_slabs() -> size_t;
 
 template <typename T>
-inline auto reallocate(T *previous, size_t, size_t new_size) -> T * {
+inline auto reallocate(T *previous, size_t old_size, size_t new_size,
+                       MemoryCategory category) -> T * {
+  record_allocation(category, previous ? old_size : 0, new_size);
   if (new_size == 0) {
     free(previous);
     return nullptr;
@@ -16,16 +111,46 @@ inline auto reallocate(T *previous, size_t, size_t new_size) -> T * {
 }
 
 template <typename T>
-inline auto grow_array(T *previous, int old_count, int count) -> T * {
-  return reallocate(previous, sizeof(T) * old_count, sizeof(T) * count);
+inline auto grow_array(T *previous, int old_count, int count,
+                       MemoryCategory category) -> T * {
+  return reallocate(previous, sizeof(T) * old_count, sizeof(T) * count,
+                    category);
+}
+
+template <typename T>
+inline auto free_array(T *pointer, int old_count, MemoryCategory category)
+    -> T * {
+  return reallocate(pointer, sizeof(T) * old_count, 0, category);
 }
 
-template <typename T> inline auto free_array(T *pointer, int old_count) -> T * {
-  return reallocate(pointer, sizeof(T) * old_count, 0);
+template <typename T>
+inline auto allocate(unsigned int count, MemoryCategory category) -> T * {
+  return reallocate<T>(nullptr, 0, sizeof(T) * count, category);
 }
 
-template <typename T> inline auto allocate(unsigned int count) -> T * {
-  return reallocate<T>(nullptr, 0, sizeof(T) * count);
+// Sizes are rounded up to a multiple of alignment, which aligned_alloc
+// requires, and recorded as rounded.
+inline auto aligned_size(size_t size, size_t alignment) -> size_t {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+inline auto allocate_aligned(size_t count, size_t alignment,
+                             MemoryCategory category) -> T * {
+  auto const size = aligned_size(sizeof(T) * count, alignment);
+  if (size == 0)
+    return nullptr;
+  record_allocation(category, 0, size);
+  return static_cast<T *>(aligned_alloc(alignment, size));
+}
+
+template <typename T>
+inline auto free_aligned(T *pointer, size_t count, size_t alignment,
+                         MemoryCategory category) -> void {
+  if (pointer == nullptr)
+    return;
+  record_allocation(category, aligned_size(sizeof(T) * count, alignment), 0);
+  free(pointer);
 }
 
 } // namespace lox
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+// Binds array(count, fill), range(count), length(a), at(a, i), sum(a),
+// min(a) and max(a) in the globals of vm. They return nil when given
+// arguments of the wrong type or out of range.
+auto define_array_natives(VirtualMachine &vm) -> void;
+
+} // namespace lox
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lox {
+
+// Number array buffers are aligned to a cache line, which also satisfies
+// every vector width the kernels use.
+auto constexpr number_array_alignment = 64;
+
+enum class ArrayOp : uint8_t {
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  EQUAL,
+  LESS,
+  GREATER,
+};
+
+// An operand is either count contiguous numbers or a single number broadcast
+// to all of them.
+struct ArrayOperand {
+  double const *data;
+  bool broadcast;
+};
+
+// EQUAL, LESS and GREATER store 1 where the comparison holds and 0 where it does
+// not. The kernels are compiled for AVX2 and for the baseline instruction set
+// and the best one for the running processor is chosen when lox starts.
+auto apply(ArrayOp op, ArrayOperand lhs, ArrayOperand rhs, double *result,
+           size_t count) -> void;
+auto reduce_sum(double const *data, size_t count) -> double;
+auto reduce_min(double const *data, size_t count) -> double;
+auto reduce_max(double const *data, size_t count) -> double;
+auto simd_instruction_set() -> char const *;
+
+} // namespace lox
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <memory.hpp>
+#include <object.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+struct VirtualMachine;
+
+auto constexpr nursery_size = size_t{1} << 20;
+
+// Every block in a nursery follows its header, which records what the block
+// was allocated as and, once a collection copied it out, where to. Fillers
+// pad blocks to their alignment and stand in for blocks freed early.
+struct YoungHeader {
+  void *forward;
+  uint32_t size;
+  MemoryCategory category;
+  bool filler;
+};
+
+static_assert(sizeof(YoungHeader) == pool_class_size);
+
+// The young generation of a VirtualMachine. While the machine runs, the
+// objects it makes other than classes, and their strings and array data,
+// are bump allocated between begin and end. Once that is full they come
+// from the object allocator, the old generation, and are kept in tenured.
+// When the run next spends fuel, when a run ends with no frames left and
+// when a Collector starts a cycle, the young objects still reachable from the
+// machine, remembered, slots and tenured are copied into the old generation
+// and the nursery starts over from begin, so the temporaries that died cost
+// nothing to free. remembered holds the old objects a write barrier saw
+// given a young object, and slots the inline cache entries holding a young
+// method. Objects in these lists must not be freed before the nursery is
+// next collected.
+struct Nursery {
+  char *begin;
+  char *top;
+  char *end;
+  bool full = false;
+  Array<Obj *> remembered{};
+  Array<Value *> slots{};
+  Array<Obj *> tenured{};
+  Array<Obj *> copied{};
+  size_t collections = 0;
+  size_t promoted_bytes = 0;
+
+  explicit Nursery(size_t size = nursery_size);
+  Nursery(Nursery const &) = delete;
+  auto operator=(Nursery const &) -> Nursery & = delete;
+  ~Nursery();
+};
+
+inline auto is_young(Nursery const &nursery, void const *pointer) -> bool {
+  auto const address = reinterpret_cast<uintptr_t>(pointer);
+  return address >= reinterpret_cast<uintptr_t>(nursery.begin) &&
+         address < reinterpret_cast<uintptr_t>(nursery.top);
+}
+
+// Returns null once the nursery is full, which it stays until collected.
+auto allocate_young(Nursery &nursery, size_t size, size_t alignment,
+                    MemoryCategory category) -> void *;
+auto free_young(Nursery &nursery, void *block) -> void;
+auto remember(Nursery &nursery, Obj *owner) -> void;
+auto remember_slot(Nursery *nursery, Value *slot) -> void;
+// Promotes the young objects vm still reaches and empties its nursery. vm
+// must have every value it holds on its stack, as between runs or where a
+// run spends fuel.
+auto collect_nursery(VirtualMachine &vm) -> void;
+
+// Called as value is stored into owner, or as owner is made to point at
+// value, so that a collection finds young objects that old ones point at.
+inline auto write_barrier(Nursery *nursery, Obj *owner, Obj const *value)
+    -> void {
+  if (nursery != nullptr && value != nullptr && !owner->remembered &&
+      is_young(*nursery, value) && !is_young(*nursery, owner))
+    remember(*nursery, owner);
+}
+
+inline auto write_barrier(Nursery *nursery, Obj *owner, Value const &value)
+    -> void {
+  if (is_obj(value))
+    write_barrier(nursery, owner, value.as.obj);
+}
+
+} // namespace lox
@@ -1,15 +1,34 @@
 #pragma once
 
+#include <span>
+#include <stdint.h>
 #include <string_view>
 
+#include <chunk.hpp>
+#include <shape.hpp>
 #include <value.hpp>
 
 namespace lox {
 
-enum class ObjType { STRING };
+enum class ObjType : uint8_t {
+  BOUND_METHOD,
+  CLASS,
+  CLOSURE,
+  FUNCTION,
+  INSTANCE,
+  NATIVE,
+  NUMBER_ARRAY,
+  STRING,
+  UPVALUE,
+};
 
+// remembered is set while the object sits in the remembered set of a
+// Nursery. mark is the epoch of the last Collector cycle that reached the
+// object, or 0 if none has.
 struct Obj {
   ObjType type;
+  bool remembered;
+  uint16_t mark;
 };
 
 struct ObjString {
@@ -18,12 +37,130 @@ struct ObjString {
   char *chars;
 };
 
+// id numbers the functions of one compile() call in the order they were
+// compiled, starting with the script at 0, so tools that compile the same
+// source again can find a function by id. stack_size bounds the stack
+// slots a call of it uses, so calls check for room once.
+struct ObjFunction {
+  Obj obj;
+  int id;
+  int arity;
+  int upvalue_count;
+  int stack_size;
+  Chunk chunk;
+  ObjString *name;
+};
+
+// An open upvalue points at a stack slot and closing it moves the value into
+// closed. The pooled upvalues of a VirtualMachine forward to promoted once an
+// escaping closure needs the variable to outlive its scope.
+struct ObjUpvalue {
+  Obj obj;
+  Value *location;
+  Value closed;
+  ObjUpvalue *next;
+  ObjUpvalue *promoted;
+};
+
+// Captures are stored inline after the closure, in the same allocation.
+// Closures that never escape their scope keep pointing at pooled upvalues.
+struct ObjClosure {
+  Obj obj;
+  ObjFunction *function;
+  ObjUpvalue **upvalues;
+  int upvalue_count;
+  bool escaped;
+};
+
+// Natives read their arguments straight from the stack of the calling
+// VirtualMachine, so they must not keep the span past the call. A batched
+// native computes results.size() calls at once from inputs laid out row by
+// row, arity values per row.
+using NativeFn = auto (*)(std::span<Value const> arguments) -> Value;
+using BatchNativeFn = auto (*)(std::span<Value const> inputs,
+                               std::span<Value> results) -> void;
+
+struct ObjNative {
+  Obj obj;
+  ObjString *name;
+  int arity;
+  NativeFn function;
+  BatchNativeFn batch;
+};
+
+// data is aligned to number_array_alignment so the kernels in
+// number_array.hpp can use aligned vector loads on whole arrays.
+struct ObjNumberArray {
+  Obj obj;
+  int count;
+  double *data;
+};
+
+struct Method {
+  ObjString *name;
+  Value method;
+};
+
+// Instances of a class start out with its root shape, so a shape also
+// identifies the class and inline caches can key methods by shape.
+// initializer is the init method, or nil when the class has none.
+struct ObjClass {
+  Obj obj;
+  ObjString *name;
+  Shape *shape;
+  Value initializer;
+  Array<Method> methods{MemoryCategory::OBJECT};
+};
+
+// fields is indexed by the slots of shape, not by name.
+struct ObjInstance {
+  Obj obj;
+  ObjClass *klass;
+  Shape *shape;
+  Array<Value> fields{MemoryCategory::OBJECT};
+};
+
+struct ObjBoundMethod {
+  Obj obj;
+  Value receiver;
+  Value method;
+};
+
 auto obj_type(Value const &value) -> ObjType;
 auto is_string(Value const &value) -> bool;
+auto is_function(Value const &value) -> bool;
+auto as_function(Value const &value) -> ObjFunction *;
+auto is_closure(Value const &value) -> bool;
+auto as_closure(Value const &value) -> ObjClosure *;
+auto is_class(Value const &value) -> bool;
+auto as_class(Value const &value) -> ObjClass *;
+auto is_instance(Value const &value) -> bool;
+auto as_instance(Value const &value) -> ObjInstance *;
+auto is_native(Value const &value) -> bool;
+auto as_native(Value const &value) -> ObjNative *;
+auto is_number_array(Value const &value) -> bool;
+auto as_number_array(Value const &value) -> ObjNumberArray *;
+auto is_bound_method(Value const &value) -> bool;
+auto as_bound_method(Value const &value) -> ObjBoundMethod *;
 auto as_string(Value const &value) -> ObjString *;
 auto as_string(Value &value) -> ObjString *;
 auto as_cstring(Value const &value) -> char *;
 auto as_cstring(Value &value) -> char *;
 auto copy_string(std::string_view chars) -> ObjString *;
+auto equal(ObjString const *lhs, ObjString const *rhs) -> bool;
+auto new_function() -> ObjFunction *;
+auto new_closure(ObjFunction *function) -> ObjClosure *;
+auto new_upvalue(Value *slot) -> ObjUpvalue *;
+auto new_class(ObjString *name) -> ObjClass *;
+auto new_instance(ObjClass *klass) -> ObjInstance *;
+auto new_bound_method(Value receiver, Value method) -> ObjBoundMethod *;
+auto new_native(ObjString *name, int arity, NativeFn function,
+                BatchNativeFn batch) -> ObjNative *;
+auto new_number_array(int count) -> ObjNumberArray *;
+auto call_native(ObjNative const *native, std::span<Value const> inputs,
+                 std::span<Value> results) -> void;
+auto find_method(ObjClass const *klass, ObjString const *name)
+    -> Value const *;
+auto free_object(Obj *object) -> void;
 
 } // namespace lox
\ No newline at end of file
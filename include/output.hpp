@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <string_view>
+
+namespace lox {
+
+auto constexpr output_buffer_size = 4096;
+
+// Receives text an Output flushes, in order, so a host can capture what a
+// script prints.
+using OutputFn = void (*)(void *context, char const *data, size_t size);
+
+// Text written to an Output gathers in buffer and goes out when the buffer
+// fills or on flush, to sink when it is set and to fd with writev when it
+// is not. Text too large for the buffer goes out in the same writev as what
+// the buffer held. With flush_lines every line goes out as it ends, as on a
+// terminal.
+struct Output {
+  int fd = 1;
+  OutputFn sink = nullptr;
+  void *context = nullptr;
+  bool flush_lines = false;
+  size_t size = 0;
+  char buffer[output_buffer_size] = {};
+};
+
+auto put(Output &output, std::string_view text) -> void;
+auto put(Output &output, char c) -> void;
+// Numbers look as printf's %g shows them.
+auto put_number(Output &output, double number) -> void;
+__attribute__((format(printf, 2, 3))) auto
+put_format(Output &output, char const *format, ...) -> void;
+auto put_vformat(Output &output, char const *format, va_list args) -> void;
+auto flush(Output &output) -> void;
+// An OutputFn that hands text to the stdio FILE in context, so it keeps its
+// place among what printf writes there.
+auto write_stdio(void *context, char const *data, size_t size) -> void;
+// Makes output the one compile and batch errors on this thread go to, or
+// standard error when it is null, and returns the one used before. Each
+// error is flushed as it is reported.
+auto use_error_output(Output *output) -> Output *;
+auto error_output() -> Output &;
+
+} // namespace lox
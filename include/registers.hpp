@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array.hpp>
+#include <object.hpp>
+#include <value.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto constexpr registers_max = 256;
+
+enum struct RegisterOp : uint8_t {
+  MOVE,
+  DEFINE_GLOBAL,
+  GET_GLOBAL,
+  SET_GLOBAL,
+  EQUAL,
+  GREATER,
+  LESS,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  NOT,
+  NEGATE,
+  PRINT,
+  JUMP,
+  JUMP_IF_FALSE,
+  RETURN,
+};
+
+// Three-address code over the registers of a frame. a is the register an
+// instruction writes or, for JUMP_IF_FALSE, tests. b and c are operands,
+// except that b is the target instruction of a jump and the global slot of a
+// global instruction. An operand below RegisterChunk::register_count names a
+// register and any other names the constant at that distance past them:
+// constants are copied into the frame right after the registers, so reading
+// an operand never checks which kind it is.
+struct RegisterInstruction {
+  RegisterOp op;
+  uint8_t a;
+  uint16_t b;
+  uint16_t c;
+};
+
+struct RegisterChunk {
+  Array<RegisterInstruction> code{MemoryCategory::CHUNK_CODE};
+  Array<Value> constants{MemoryCategory::CHUNK_CONSTANTS};
+  Array<int> lines{MemoryCategory::CHUNK_LINES};
+  int register_count = 0;
+};
+
+// Lowers the stack code of function to registers. Stack slot i becomes
+// register i, and values are only moved into their slot when a local is
+// read, a branch joins or a slot is reused, so most pushes and pops vanish.
+// Only top level code without calls, closures, classes or upvalues can be
+// lowered; for anything else this returns false and leaves chunk empty.
+auto lower_to_registers(ObjFunction const *function, RegisterChunk &chunk)
+    -> bool;
+// Runs chunk to completion with its frame on the stack of vm and stores what
+// it returns in vm.result. Fuel and traces only apply to the stack machine.
+// When executed is set every instruction run is counted into it.
+auto run_registers(VirtualMachine &vm, RegisterChunk const &chunk,
+                   uint64_t *executed = nullptr) -> InterpretResult;
+
+} // namespace lox
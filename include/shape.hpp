@@ -0,0 +1,25 @@
+#pragma once
+
+#include <array.hpp>
+
+namespace lox {
+
+struct ObjString;
+
+// Shapes are hidden classes shared by every instance that added the same
+// fields in the same order. A shape is its parent plus one field, stored in
+// slot field_count - 1 of the instance, and it caches the shapes reached by
+// adding one more field in transitions.
+struct Shape {
+  Shape *parent;
+  ObjString *name;
+  int field_count;
+  Array<Shape *> transitions{MemoryCategory::SHAPE};
+};
+
+auto new_shape() -> Shape *;
+auto find_field(Shape const *shape, ObjString const *name) -> int;
+auto add_field(Shape *shape, ObjString *name) -> Shape *;
+auto free_shape(Shape *shape) -> void;
+
+} // namespace lox
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <span>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+// A snapshot holds the globals of an idle VirtualMachine and every object
+// they reach, with references stored as object indexes so the bytes can be
+// loaded at any address. Natives are stored by name and bound to the natives
+// of the loading VirtualMachine, which must define them first. Inline caches
+// and loop counters start empty again.
+auto save_snapshot(VirtualMachine const &vm, Array<uint8_t> &snapshot)
+    -> bool;
+// Allocates the objects of snapshot in one pass, then relocates their
+// references in a second pass over a list of fixups, and finally defines the
+// globals in vm. Returns false, leaving vm unchanged, when the snapshot is
+// malformed, names a native vm does not define or has more new globals than
+// vm has free slots.
+auto load_snapshot(VirtualMachine &vm, std::span<uint8_t const> snapshot)
+    -> bool;
+auto write_snapshot(VirtualMachine const &vm, char const *path) -> bool;
+// Maps the file at path into memory and loads it with load_snapshot.
+auto read_snapshot(VirtualMachine &vm, char const *path) -> bool;
+
+} // namespace lox
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+
+#include <chunk.hpp>
+#include <grammar.hpp>
+#include <scanner.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+// A compile time counterpart of compile(). Expressions are scanned, parsed and
+// constant folded during constant evaluation into a fixed size StaticChunk,
+// which load() copies into a regular Chunk at runtime. Syntax errors surface
+// as C++ compile errors through the non constexpr static_error().
+
+auto constexpr static_code_max = 256;
+auto constexpr static_constants_max = 256;
+
+struct StaticChunk {
+  uint8_t code[static_code_max] = {};
+  int lines[static_code_max] = {};
+  Value constants[static_constants_max] = {};
+  int code_count = 0;
+  int constants_count = 0;
+};
+
+struct StaticParser {
+  Scanner scanner;
+  Token current = {};
+  Token previous = {};
+  StaticChunk chunk = {};
+};
+
+// The result of parsing a subexpression. Constants are not emitted until an
+// operator that cannot fold them forces it, so folded operands leave no code.
+struct Folded {
+  bool constant = false;
+  Value value = nil_val;
+  int line = 0;
+};
+
+using StaticParseFn = auto (*)(StaticParser &, Folded) -> Folded;
+
+auto static_error(std::string_view message) -> void;
+auto load(StaticChunk const &static_chunk, Chunk &chunk) -> void;
+
+consteval auto static_compile(std::string_view source) -> StaticChunk;
+consteval auto fold(std::string_view source) -> Value;
+constexpr auto advance(StaticParser &parser) -> void;
+constexpr auto consume(StaticParser &parser, TokenType type,
+                       std::string_view message) -> void;
+constexpr auto emit_byte(StaticParser &parser, uint8_t byte, int line) -> void;
+constexpr auto emit_op(StaticParser &parser, OpCode op_code, int line) -> void;
+constexpr auto materialize(StaticParser &parser, Folded const &folded) -> void;
+constexpr auto fold_unary(TokenType operator_type, Value operand) -> Folded;
+constexpr auto fold_binary(TokenType operator_type, Value lhs, Value rhs)
+    -> Folded;
+constexpr auto number(StaticParser &parser, Folded) -> Folded;
+constexpr auto string(StaticParser &parser, Folded) -> Folded;
+constexpr auto literal(StaticParser &parser, Folded) -> Folded;
+constexpr auto grouping(StaticParser &parser, Folded) -> Folded;
+constexpr auto unary(StaticParser &parser, Folded) -> Folded;
+constexpr auto binary(StaticParser &parser, Folded lhs) -> Folded;
+constexpr auto parse_precedence(StaticParser &parser, Precedence precedence)
+    -> Folded;
+
+consteval auto static_compile(std::string_view source) -> StaticChunk {
+  auto parser = StaticParser{.scanner = Scanner{source}};
+  advance(parser);
+  auto const result = parse_precedence(parser, Precedence::ASSIGNMENT);
+  consume(parser, TokenType::END_OF_FILE, "Expect end of expression.");
+  materialize(parser, result);
+  emit_op(parser, OpCode::RETURN, parser.previous.line);
+  return parser.chunk;
+}
+
+consteval auto fold(std::string_view source) -> Value {
+  auto const chunk = static_compile(source);
+  if (chunk.code_count != 3 ||
+      chunk.code[0] != static_cast<uint8_t>(OpCode::CONSTANT))
+    static_error("Expression does not fold to a constant.");
+  return chunk.constants[chunk.code[1]];
+}
+
+constexpr auto advance(StaticParser &parser) -> void {
+  parser.previous = parser.current;
+  parser.current = scan_token(parser.scanner);
+  if (parser.current.type == TokenType::ERROR)
+    static_error(parser.current.start);
+}
+
+constexpr auto consume(StaticParser &parser, TokenType type,
+                       std::string_view message) -> void {
+  if (parser.current.type != type)
+    static_error(message);
+  advance(parser);
+}
+
+constexpr auto emit_byte(StaticParser &parser, uint8_t byte, int line)
+    -> void {
+  auto &chunk = parser.chunk;
+  if (chunk.code_count == static_code_max)
+    static_error("Expression too large for a static chunk.");
+  chunk.lines[chunk.code_count] = line;
+  chunk.code[chunk.code_count++] = byte;
+}
+
+constexpr auto emit_op(StaticParser &parser, OpCode op_code, int line)
+    -> void {
+  emit_byte(parser, static_cast<uint8_t>(op_code), line);
+}
+
+constexpr auto materialize(StaticParser &parser, Folded const &folded)
+    -> void {
+  if (!folded.constant)
+    return;
+  auto &chunk = parser.chunk;
+  if (chunk.constants_count == static_constants_max)
+    static_error("Too many constants in one chunk.");
+  chunk.constants[chunk.constants_count] = folded.value;
+  emit_op(parser, OpCode::CONSTANT, folded.line);
+  emit_byte(parser, static_cast<uint8_t>(chunk.constants_count++),
+            folded.line);
+}
+
+// Operations the virtual machine would reject at runtime are left unfolded,
+// so they still report a runtime error from the same instruction.
+constexpr auto fold_unary(TokenType operator_type, Value operand) -> Folded {
+  switch (operator_type) {
+  case TokenType::BANG:
+    return {true, bool_val(is_falsey(operand))};
+  case TokenType::MINUS:
+    if (!is_number(operand))
+      return {};
+    return {true, number_val(-operand.as.number)};
+  default:
+    return {};
+  }
+}
+
+constexpr auto fold_binary(TokenType operator_type, Value lhs, Value rhs)
+    -> Folded {
+  auto const equal = lhs.type == rhs.type &&
+                     (is_nil(lhs) ||
+                      (is_bool(lhs) && lhs.as.boolean == rhs.as.boolean) ||
+                      (is_number(lhs) && lhs.as.number == rhs.as.number));
+  switch (operator_type) {
+  case TokenType::EQUAL_EQUAL:
+    return {true, bool_val(equal)};
+  case TokenType::BANG_EQUAL:
+    return {true, bool_val(!equal)};
+  default:
+    break;
+  }
+  if (!is_number(lhs) || !is_number(rhs))
+    return {};
+  auto const a = lhs.as.number;
+  auto const b = rhs.as.number;
+  switch (operator_type) {
+  case TokenType::GREATER:
+    return {true, bool_val(a > b)};
+  case TokenType::GREATER_EQUAL:
+    return {true, bool_val(!(a < b))};
+  case TokenType::LESS:
+    return {true, bool_val(a < b)};
+  case TokenType::LESS_EQUAL:
+    return {true, bool_val(!(a > b))};
+  case TokenType::PLUS:
+    return {true, number_val(a + b)};
+  case TokenType::MINUS:
+    return {true, number_val(a - b)};
+  case TokenType::STAR:
+    return {true, number_val(a * b)};
+  case TokenType::SLASH:
+    return {true, number_val(a / b)};
+  default:
+    return {};
+  }
+}
+
+constexpr auto number(StaticParser &parser, Folded) -> Folded {
+  return {true, number_val(parse_number(parser.previous.start)),
+          parser.previous.line};
+}
+
+constexpr auto string(StaticParser &parser, Folded) -> Folded {
+  if (parser.previous.type == TokenType::STRING)
+    static_error("Strings are not supported in static expressions.");
+  return {};
+}
+
+constexpr auto literal(StaticParser &parser, Folded) -> Folded {
+  auto const line = parser.previous.line;
+  switch (parser.previous.type) {
+  case TokenType::FALSE:
+    return {true, bool_val(false), line};
+  case TokenType::TRUE:
+    return {true, bool_val(true), line};
+  default:
+    return {true, nil_val, line};
+  }
+}
+
+constexpr auto grouping(StaticParser &parser, Folded) -> Folded {
+  auto const result = parse_precedence(parser, Precedence::ASSIGNMENT);
+  consume(parser, TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+  return result;
+}
+
+constexpr auto unary(StaticParser &parser, Folded) -> Folded {
+  auto const operator_type = parser.previous.type;
+  auto const line = parser.previous.line;
+  auto const operand = parse_precedence(parser, Precedence::UNARY);
+  if (operand.constant) {
+    auto folded = fold_unary(operator_type, operand.value);
+    if (folded.constant) {
+      folded.line = line;
+      return folded;
+    }
+  }
+  materialize(parser, operand);
+  emit_op(parser,
+          operator_type == TokenType::BANG ? OpCode::NOT : OpCode::NEGATE,
+          line);
+  return {false, nil_val, line};
+}
+
+constexpr auto binary(StaticParser &parser, Folded lhs) -> Folded {
+  auto const operator_type = parser.previous.type;
+  auto const line = parser.previous.line;
+  auto const rule = grammar_rule(operator_type);
+  auto const precedence = static_cast<uint8_t>(rule.precedence) + 1;
+  auto const code_count = parser.chunk.code_count;
+  auto const constants_count = parser.chunk.constants_count;
+  materialize(parser, lhs);
+  auto const rhs =
+      parse_precedence(parser, static_cast<Precedence>(precedence));
+  if (lhs.constant && rhs.constant) {
+    auto folded = fold_binary(operator_type, lhs.value, rhs.value);
+    if (folded.constant) {
+      parser.chunk.code_count = code_count;
+      parser.chunk.constants_count = constants_count;
+      folded.line = line;
+      return folded;
+    }
+  }
+  materialize(parser, rhs);
+  switch (operator_type) {
+  case TokenType::BANG_EQUAL:
+    emit_op(parser, OpCode::EQUAL, line);
+    emit_op(parser, OpCode::NOT, line);
+    break;
+  case TokenType::EQUAL_EQUAL:
+    emit_op(parser, OpCode::EQUAL, line);
+    break;
+  case TokenType::GREATER:
+    emit_op(parser, OpCode::GREATER, line);
+    break;
+  case TokenType::GREATER_EQUAL:
+    emit_op(parser, OpCode::LESS, line);
+    emit_op(parser, OpCode::NOT, line);
+    break;
+  case TokenType::LESS:
+    emit_op(parser, OpCode::LESS, line);
+    break;
+  case TokenType::LESS_EQUAL:
+    emit_op(parser, OpCode::GREATER, line);
+    emit_op(parser, OpCode::NOT, line);
+    break;
+  case TokenType::PLUS:
+    emit_op(parser, OpCode::ADD, line);
+    break;
+  case TokenType::MINUS:
+    emit_op(parser, OpCode::SUBTRACT, line);
+    break;
+  case TokenType::STAR:
+    emit_op(parser, OpCode::MULTIPLY, line);
+    break;
+  case TokenType::SLASH:
+    emit_op(parser, OpCode::DIVIDE, line);
+    break;
+  default:
+    break;
+  }
+  return {false, nil_val, line};
+}
+
+// Indexed by Prefix and Infix. Names, calls, properties and logical
+// operators need a runtime and are left out.
+inline constexpr StaticParseFn static_prefix_rules[] = {
+    nullptr, grouping, unary, nullptr, string, number, literal, nullptr};
+inline constexpr StaticParseFn static_infix_rules[] = {
+    nullptr, nullptr, nullptr, binary, nullptr, nullptr};
+
+constexpr auto parse_precedence(StaticParser &parser, Precedence precedence)
+    -> Folded {
+  advance(parser);
+  auto const prefix_rule = static_prefix_rules[static_cast<uint8_t>(
+      grammar_rule(parser.previous.type).prefix)];
+  if (prefix_rule == nullptr) {
+    static_error("Expected expression.");
+    return {};
+  }
+  auto result = prefix_rule(parser, {});
+  while (precedence <= grammar_rule(parser.current.type).precedence) {
+    advance(parser);
+    auto const infix_rule = static_infix_rules[static_cast<uint8_t>(
+        grammar_rule(parser.previous.type).infix)];
+    if (infix_rule == nullptr) {
+      static_error("Operator not supported in static expressions.");
+      return {};
+    }
+    result = infix_rule(parser, result);
+  }
+  return result;
+}
+
+} // namespace lox
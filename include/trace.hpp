@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include <array.hpp>
+#include <chunk.hpp>
+#include <value.hpp>
+
+namespace lox {
+
+auto constexpr trace_capacity = 1 << 14;
+
+// One executed instruction: the id of its function, its offset in the
+// chunk, its opcode and the type of the value on top of the stack before it
+// ran, as a ValueType. Function ids past UINT16_MAX wrap.
+struct TraceRecord {
+  uint32_t offset;
+  uint16_t function;
+  OpCode op_code;
+  uint8_t top;
+};
+
+// The last trace_capacity instructions a VirtualMachine ran. The machine is
+// the only writer and never waits, while another thread or a crash handler
+// may read the ring at any time with read_trace. Records are packed into
+// single words so a reader never sees half of one.
+struct TraceRing {
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> records[trace_capacity] = {};
+};
+
+static_assert(sizeof(TraceRecord) == sizeof(uint64_t));
+
+inline auto record(TraceRing &ring, TraceRecord const &record) -> void {
+  auto word = uint64_t{};
+  __builtin_memcpy(&word, &record, sizeof(word));
+  auto const head = ring.head.load(std::memory_order_relaxed);
+  // Pairs with the fence in read_trace: a reader that copies this record
+  // then sees head at least where it is now, so it drops the older record
+  // the slot held instead of keeping the copy.
+  std::atomic_thread_fence(std::memory_order_release);
+  ring.records[head % trace_capacity].store(word, std::memory_order_relaxed);
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+// Copies up to trace_capacity - 1 of the newest records, oldest first, into
+// records. Records the writer overwrote during the copy are dropped.
+auto read_trace(TraceRing const &ring, Array<TraceRecord> &records) -> void;
+auto write_trace(TraceRing const &ring, char const *path) -> bool;
+// Reads a file made by write_trace. Returns false if it is not one.
+auto load_trace(char const *path, Array<TraceRecord> &records) -> bool;
+
+} // namespace lox
@@ -8,6 +8,7 @@ enum class ValueType { BOOL, NIL, NUMBER, OBJ };
 
 struct Obj;
 struct ObjString;
+struct Output;
 
 struct Value {
   ValueType type;
@@ -19,18 +20,43 @@ struct Value {
 };
 
 auto operator==(Value const &lhs, Value const &rhs) -> bool;
-auto is_bool(Value const &value) -> bool;
-auto is_nil(Value const &value) -> bool;
-auto is_number(Value const &value) -> bool;
-auto is_obj(Value const &value) -> bool;
+
+constexpr auto is_bool(Value const &value) -> bool {
+  return value.type == ValueType::BOOL;
+}
+
+constexpr auto is_nil(Value const &value) -> bool {
+  return value.type == ValueType::NIL;
+}
+
+constexpr auto is_number(Value const &value) -> bool {
+  return value.type == ValueType::NUMBER;
+}
+
+constexpr auto is_obj(Value const &value) -> bool {
+  return value.type == ValueType::OBJ;
+}
+
 auto constexpr nil_val = Value{ValueType::NIL, {.number = 0}};
-auto bool_val(bool value) -> Value;
-auto number_val(double value) -> Value;
+
+constexpr auto bool_val(bool value) -> Value {
+  return Value{ValueType::BOOL, {.boolean = value}};
+}
+
+constexpr auto number_val(double value) -> Value {
+  return Value{ValueType::NUMBER, {.number = value}};
+}
+
+constexpr auto is_falsey(Value const &value) -> bool {
+  return is_nil(value) || (is_bool(value) && !value.as.boolean);
+}
 
 template <typename T> auto obj_val(T value) -> Value {
   return Value{ValueType::OBJ, {.obj = reinterpret_cast<Obj *>(value)}};
 }
 
+// Prints to stdout through stdio.
 auto print(Value const &value) -> void;
+auto print(Output &output, Value const &value) -> void;
 
 } // namespace lox
@@ -1,27 +1,125 @@
 #pragma once
 
+#include <span>
+#include <stdint.h>
 #include <string_view>
 
-#include <chunk.hpp>
+#include <globals.hpp>
+#include <object.hpp>
+#include <output.hpp>
 #include <value.hpp>
 
 namespace lox {
 
-auto constexpr stack_max = 256;
+auto constexpr frames_max = 64;
+auto constexpr stack_max = frames_max * 256;
+auto constexpr upvalues_max = 256;
 
-struct VirtualMachine {
-  Chunk *chunk;
+struct Collector;
+struct Nursery;
+struct TraceRing;
+
+// A frame's slots are a window into VirtualMachine::stack that starts at the
+// callee, so the arguments pushed by the caller become its first locals.
+// closure is null for functions that capture nothing.
+struct CallFrame {
+  ObjFunction *function;
+  ObjClosure *closure;
   uint8_t *instruction_pointer;
+  Value *slots;
+};
+
+enum class ResourceLimit : uint8_t { NONE, HEAP, FRAMES, STEPS, TIME };
+
+// Caps on what the runs of one VirtualMachine may use, so a host can run
+// untrusted scripts side by side. heap_bytes caps the bytes the runs have
+// allocated and not freed, frames the depth of calls, steps the back edges
+// and calls, as counted by fuel, and nanoseconds the wall time spent in
+// runs. None is set by default.
+struct ResourceLimits {
+  size_t heap_bytes = SIZE_MAX;
+  int frames = frames_max;
+  uint64_t steps = UINT64_MAX;
+  uint64_t nanoseconds = UINT64_MAX;
+};
+
+// What runs used while the VirtualMachine had limits, summed until the host
+// resets it, and the limit the last run passed.
+struct ResourceUsage {
+  int64_t heap_bytes = 0;
+  uint64_t steps = 0;
+  uint64_t nanoseconds = 0;
+  ResourceLimit exceeded = ResourceLimit::NONE;
+};
+
+// Open upvalues come from upvalue_pool and are only copied to the heap when a
+// closure capturing them escapes, so closures passed down as callbacks
+// capture variables without allocating. result holds the value the last top
+// level function returned. Each back edge and call spends one unit of fuel
+// and running out stops the run with YIELDED. When trace is set every
+// instruction is recorded into it before it runs. With cache_top the common
+// instructions run with the top of the stack in a register, and without it
+// every instruction runs on the stack in memory, with the same results.
+// With a nursery the objects a run makes start out young and those still
+// reachable when it ends are promoted, see nursery.hpp. With a collector
+// the objects a run makes are freed once unreachable, see collector.hpp.
+// A run that passes one of limits stops with LIMIT_EXCEEDED and its frames
+// are dropped, as after a runtime error.
+// What scripts print goes to out and runtime errors to err, see output.hpp.
+// out is flushed as each run stops and err after each error. script is the
+// function interpret compiled from source while its run is yielded.
+struct VirtualMachine {
+  CallFrame frames[frames_max];
+  int frame_count;
   Value stack[stack_max];
   Value *stack_top;
+  Globals globals;
+  ObjUpvalue upvalue_pool[upvalues_max];
+  ObjUpvalue *free_upvalues;
+  ObjUpvalue *open_upvalues;
+  Value result = nil_val;
+  uint64_t fuel = UINT64_MAX;
+  TraceRing *trace = nullptr;
+  Nursery *nursery = nullptr;
+  Collector *collector = nullptr;
+  bool cache_top = true;
+  ResourceLimits limits{};
+  ResourceUsage usage{};
+  Output out{1};
+  Output err{2};
+  ObjFunction *script = nullptr;
 
   VirtualMachine();
+  ~VirtualMachine();
 };
 
-enum class InterpretResult { OK, COMPILE_ERROR, RUNTIME_ERROR };
+enum class InterpretResult {
+  OK,
+  COMPILE_ERROR,
+  RUNTIME_ERROR,
+  YIELDED,
+  LIMIT_EXCEEDED,
+};
 
 auto reset_stack(VirtualMachine &vm) -> void;
 auto interpret(VirtualMachine &vm, std::string_view source) -> InterpretResult;
+auto interpret(VirtualMachine &vm, ObjFunction *function) -> InterpretResult;
+// Continues a run that stopped with YIELDED from where it left off, so a host
+// can interleave scripts by refilling fuel between slices. A run interpret
+// started on source prints its result and frees its function once it ends,
+// on whichever call that is.
+auto resume(VirtualMachine &vm) -> InterpretResult;
+// Runs a function made by compile_expression with arguments bound to its
+// parameters and stores its value in result. Nothing is printed, so an
+// embedder can prepare an expression once and evaluate it per request.
+auto evaluate(VirtualMachine &vm, ObjFunction *function,
+              std::span<Value const> arguments, Value &result)
+    -> InterpretResult;
+// Binds name to a native in the globals of vm. Either function or batch may
+// be null, but not both. Returns false, binding nothing, when name is new and
+// every global slot is taken.
+auto define_native(VirtualMachine &vm, std::string_view name, int arity,
+                   NativeFn function, BatchNativeFn batch = nullptr) -> bool;
 auto push(VirtualMachine &vm, Value value) -> void;
 auto pop(VirtualMachine &vm) -> Value;
 auto peek(VirtualMachine &vm, int distance) -> Value;
@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <stdarg.h>
+
+#include <batch.hpp>
+#include <bits.hpp>
+#include <number_array.hpp>
+#include <output.hpp>
+
+namespace lox {
+
+auto batch_depth(Chunk const &chunk) -> int;
+auto run_block(Batch &batch, ObjFunction const *function,
+               Globals const &globals, std::span<BatchInput const> inputs,
+               int first, std::span<Value> results) -> InterpretResult;
+auto numbers_at(Batch &batch, int depth) -> double *;
+auto values_at(Batch &batch, int depth) -> Value *;
+auto column_value(BatchColumn const &column, int row) -> Value;
+auto uniform(Batch &batch, int depth, Value value) -> void;
+auto narrow(Batch &batch, int depth, int rows) -> void;
+auto copy_column(Batch &batch, int from, int to, int rows) -> void;
+auto binary(Batch &batch, int depth, ArrayOp op, int first, int rows)
+    -> bool;
+auto negate(Batch &batch, int depth, int first, int rows) -> bool;
+auto not_(Batch &batch, int depth, int rows) -> void;
+auto call(Batch &batch, int depth, int argument_count, int first, int rows)
+    -> bool;
+auto row_error(int row, char const *format, ...) -> void;
+
+auto evaluate_batch(Batch &batch, ObjFunction const *function,
+                    Globals const &globals,
+                    std::span<BatchInput const> inputs,
+                    std::span<Value> results) -> InterpretResult {
+  auto const depth = batch_depth(function->chunk);
+  if (depth == -1) {
+    put(error_output(), "Only expressions can run in batches.\n");
+    flush(error_output());
+    return InterpretResult::COMPILE_ERROR;
+  }
+  if (depth > batch_stack_max) {
+    put(error_output(), "Expression is too deep to run in batches.\n");
+    flush(error_output());
+    return InterpretResult::COMPILE_ERROR;
+  }
+  reserve(batch.numbers, depth * batch_rows);
+  reserve(batch.values, depth * batch_rows);
+  int const count = results.size();
+  for (int first = 0; first < count; first += batch_rows) {
+    auto const rows = std::min(batch_rows, count - first);
+    auto const result = run_block(batch, function, globals, inputs, first,
+                                  results.subspan(first, rows));
+    if (result != InterpretResult::OK)
+      return result;
+  }
+  return InterpretResult::OK;
+}
+
+// Returns the deepest stack the chunk reaches, or -1 when it does anything
+// but compute a single value without branching. Batches never push the
+// function into slot zero, so local slot n is stack column n - 1.
+auto batch_depth(Chunk const &chunk) -> int {
+  auto const code = chunk.code.data;
+  auto depth = 0;
+  auto max_depth = 0;
+  for (int offset = 0; offset < chunk.code.count;) {
+    switch (static_cast<OpCode>(code[offset])) {
+    case OpCode::CONSTANT:
+      ++depth;
+      offset += 2;
+      break;
+    case OpCode::CONSTANT_LONG:
+      ++depth;
+      offset += 4;
+      break;
+    case OpCode::NIL:
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+      ++depth;
+      ++offset;
+      break;
+    case OpCode::GET_GLOBAL:
+      ++depth;
+      offset += 3;
+      break;
+    case OpCode::GET_LOCAL:
+      if (code[offset + 1] == 0 || code[offset + 1] > depth)
+        return -1;
+      ++depth;
+      offset += 2;
+      break;
+    case OpCode::SET_LOCAL:
+      if (code[offset + 1] == 0 || code[offset + 1] >= depth)
+        return -1;
+      offset += 2;
+      break;
+    case OpCode::POP:
+      --depth;
+      ++offset;
+      break;
+    case OpCode::EQUAL:
+    case OpCode::GREATER:
+    case OpCode::LESS:
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+      --depth;
+      ++offset;
+      break;
+    case OpCode::NOT:
+    case OpCode::NEGATE:
+      ++offset;
+      break;
+    case OpCode::ADD_CONSTANT:
+    case OpCode::SUBTRACT_CONSTANT:
+    case OpCode::MULTIPLY_CONSTANT:
+    case OpCode::DIVIDE_CONSTANT:
+    case OpCode::EQUAL_CONSTANT:
+    case OpCode::GREATER_CONSTANT:
+    case OpCode::LESS_CONSTANT:
+      max_depth = std::max(max_depth, depth + 1);
+      offset += 2;
+      break;
+    case OpCode::CALL:
+      depth -= code[offset + 1];
+      offset += 2;
+      break;
+    case OpCode::RETURN:
+      if (offset + 1 != chunk.code.count || depth != 1)
+        return -1;
+      return max_depth;
+    default:
+      return -1;
+    }
+    max_depth = std::max(max_depth, depth);
+  }
+  return -1;
+}
+
+// Runs every instruction of function once over the rows of one block, which
+// start at row first of the batch.
+auto run_block(Batch &batch, ObjFunction const *function,
+               Globals const &globals, std::span<BatchInput const> inputs,
+               int first, std::span<Value> results) -> InterpretResult {
+  auto const &chunk = function->chunk;
+  auto instruction_pointer = chunk.code.data;
+  int const rows = results.size();
+  auto depth = 0;
+  auto const read_byte = [&]() -> uint8_t { return *instruction_pointer++; };
+  auto const read_short = [&]() -> uint16_t {
+    instruction_pointer += 2;
+    return (instruction_pointer[-2] << 8) | instruction_pointer[-1];
+  };
+  auto const binary_op = [&](ArrayOp op) -> bool {
+    if (!binary(batch, depth, op, first, rows))
+      return false;
+    --depth;
+    return true;
+  };
+  auto const binary_constant = [&](ArrayOp op) -> bool {
+    uniform(batch, depth++, chunk.constants.data[read_byte()]);
+    return binary_op(op);
+  };
+
+  for (;;) {
+    switch (static_cast<OpCode>(read_byte())) {
+    case OpCode::CONSTANT:
+      uniform(batch, depth++, chunk.constants.data[read_byte()]);
+      break;
+    case OpCode::CONSTANT_LONG: {
+      auto const a = read_byte();
+      auto const b = read_byte();
+      auto const c = read_byte();
+      uniform(batch, depth++, chunk.constants.data[decode_bits(a, b, c)]);
+      break;
+    }
+    case OpCode::NIL:
+      uniform(batch, depth++, nil_val);
+      break;
+    case OpCode::TRUE:
+      uniform(batch, depth++, bool_val(true));
+      break;
+    case OpCode::FALSE:
+      uniform(batch, depth++, bool_val(false));
+      break;
+    case OpCode::GET_GLOBAL: {
+      auto const index = read_short();
+      auto const input = std::find_if(
+          inputs.begin(), inputs.end(),
+          [&](BatchInput const &input) { return input.global == index; });
+      if (input != inputs.end()) {
+        batch.stack[depth] = {ColumnType::VALUES, false, nullptr,
+                              input->values.data() + first};
+        narrow(batch, depth++, rows);
+        break;
+      }
+      auto const &global = globals.slots.data[index];
+      if (!global.defined) {
+        row_error(first, "Undefined variable '%s'.",
+                  globals.names.data[index]->chars);
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      uniform(batch, depth++, global.value);
+      break;
+    }
+    case OpCode::GET_LOCAL:
+      copy_column(batch, read_byte() - 1, depth++, rows);
+      break;
+    case OpCode::SET_LOCAL:
+      copy_column(batch, depth - 1, read_byte() - 1, rows);
+      break;
+    case OpCode::POP:
+      --depth;
+      break;
+    case OpCode::EQUAL:
+      if (!binary_op(ArrayOp::EQUAL))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::GREATER:
+      if (!binary_op(ArrayOp::GREATER))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::LESS:
+      if (!binary_op(ArrayOp::LESS))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::ADD:
+      if (!binary_op(ArrayOp::ADD))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::SUBTRACT:
+      if (!binary_op(ArrayOp::SUBTRACT))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::MULTIPLY:
+      if (!binary_op(ArrayOp::MULTIPLY))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::DIVIDE:
+      if (!binary_op(ArrayOp::DIVIDE))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::NOT:
+      not_(batch, depth, rows);
+      break;
+    case OpCode::NEGATE:
+      if (!negate(batch, depth, first, rows))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::ADD_CONSTANT:
+      if (!binary_constant(ArrayOp::ADD))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::SUBTRACT_CONSTANT:
+      if (!binary_constant(ArrayOp::SUBTRACT))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::MULTIPLY_CONSTANT:
+      if (!binary_constant(ArrayOp::MULTIPLY))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::DIVIDE_CONSTANT:
+      if (!binary_constant(ArrayOp::DIVIDE))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::EQUAL_CONSTANT:
+      if (!binary_constant(ArrayOp::EQUAL))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::GREATER_CONSTANT:
+      if (!binary_constant(ArrayOp::GREATER))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::LESS_CONSTANT:
+      if (!binary_constant(ArrayOp::LESS))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case OpCode::CALL: {
+      auto const argument_count = read_byte();
+      if (!call(batch, depth, argument_count, first, rows))
+        return InterpretResult::RUNTIME_ERROR;
+      depth -= argument_count;
+      break;
+    }
+    case OpCode::RETURN: {
+      auto const &column = batch.stack[depth - 1];
+      for (int row = 0; row < rows; ++row)
+        results[row] = column_value(column, column.uniform ? 0 : row);
+      return InterpretResult::OK;
+    }
+    default:
+      return InterpretResult::COMPILE_ERROR;
+    }
+  }
+}
+
+// Every stack slot owns a block of numbers and one of values, and a column
+// only ever writes into the buffers of the slot it sits in.
+auto numbers_at(Batch &batch, int depth) -> double * {
+  return batch.numbers.data + depth * batch_rows;
+}
+
+auto values_at(Batch &batch, int depth) -> Value * {
+  return batch.values.data + depth * batch_rows;
+}
+
+auto column_value(BatchColumn const &column, int row) -> Value {
+  switch (column.type) {
+  case ColumnType::NUMBERS:
+    return number_val(column.numbers[row]);
+  case ColumnType::BOOLS:
+    return bool_val(column.numbers[row] != 0);
+  case ColumnType::VALUES:
+    return column.values[row];
+  }
+  return nil_val;
+}
+
+auto uniform(Batch &batch, int depth, Value value) -> void {
+  auto &column = batch.stack[depth];
+  column.uniform = true;
+  column.numbers = numbers_at(batch, depth);
+  if (is_number(value)) {
+    column.type = ColumnType::NUMBERS;
+    column.numbers[0] = value.as.number;
+  } else if (is_bool(value)) {
+    column.type = ColumnType::BOOLS;
+    column.numbers[0] = value.as.boolean;
+  } else {
+    column.type = ColumnType::VALUES;
+    values_at(batch, depth)[0] = value;
+    column.values = values_at(batch, depth);
+  }
+}
+
+// Unboxes a column of values that turn out to be all numbers or all booleans
+// so the instructions that consume it take the kernel path.
+auto narrow(Batch &batch, int depth, int rows) -> void {
+  auto &column = batch.stack[depth];
+  auto const count = column.uniform ? 1 : rows;
+  auto const values = column.values;
+  auto all_numbers = true;
+  auto all_bools = true;
+  for (int row = 0; row < count; ++row) {
+    all_numbers = all_numbers && is_number(values[row]);
+    all_bools = all_bools && is_bool(values[row]);
+  }
+  if (!all_numbers && !all_bools)
+    return;
+  auto const numbers = numbers_at(batch, depth);
+  for (int row = 0; row < count; ++row)
+    numbers[row] =
+        all_numbers ? values[row].as.number : values[row].as.boolean;
+  column.type = all_numbers ? ColumnType::NUMBERS : ColumnType::BOOLS;
+  column.numbers = numbers;
+}
+
+// Instructions overwrite the buffers of the column they work on, so a column
+// is copied into the buffers of its new slot rather than shared.
+auto copy_column(Batch &batch, int from, int to, int rows) -> void {
+  auto const &source = batch.stack[from];
+  auto const count = source.uniform ? 1 : rows;
+  auto &column = batch.stack[to];
+  column = source;
+  if (source.type == ColumnType::VALUES) {
+    column.values = values_at(batch, to);
+    std::copy_n(source.values, count, values_at(batch, to));
+  } else {
+    column.numbers = numbers_at(batch, to);
+    std::copy_n(source.numbers, count, numbers_at(batch, to));
+  }
+}
+
+// Replaces the top two columns with the result of op. Numbers, and booleans
+// compared for equality, go through the kernels. Anything else is checked
+// and computed row by row.
+auto binary(Batch &batch, int depth, ArrayOp op, int first, int rows)
+    -> bool {
+  auto &lhs = batch.stack[depth - 2];
+  auto const &rhs = batch.stack[depth - 1];
+  auto const is_uniform = lhs.uniform && rhs.uniform;
+  auto const count = is_uniform ? 1 : rows;
+  auto const is_comparison =
+      op == ArrayOp::EQUAL || op == ArrayOp::LESS || op == ArrayOp::GREATER;
+  auto const numeric =
+      op == ArrayOp::EQUAL
+          ? lhs.type == rhs.type && lhs.type != ColumnType::VALUES
+          : lhs.type == ColumnType::NUMBERS &&
+                rhs.type == ColumnType::NUMBERS;
+  if (numeric) {
+    // The result overwrites the numbers of lhs, so a broadcast lhs is copied
+    // out before the kernel stores into its first row.
+    auto const lhs_first = lhs.numbers[0];
+    auto const result = numbers_at(batch, depth - 2);
+    apply(op, {lhs.uniform ? &lhs_first : lhs.numbers, lhs.uniform},
+          {rhs.numbers, rhs.uniform}, result, count);
+    lhs = {is_comparison ? ColumnType::BOOLS : ColumnType::NUMBERS,
+           is_uniform, result, nullptr};
+    return true;
+  }
+  auto const result = values_at(batch, depth - 2);
+  for (int row = 0; row < count; ++row) {
+    auto const left = column_value(lhs, lhs.uniform ? 0 : row);
+    auto const right = column_value(rhs, rhs.uniform ? 0 : row);
+    if (op == ArrayOp::EQUAL) {
+      result[row] = bool_val(left == right);
+      continue;
+    }
+    if (!is_number(left) || !is_number(right)) {
+      row_error(first + row, "Operands must be numbers.");
+      return false;
+    }
+    auto number = 0.0;
+    apply(op, {&left.as.number, true}, {&right.as.number, true}, &number, 1);
+    result[row] = is_comparison ? bool_val(number != 0) : number_val(number);
+  }
+  lhs = {ColumnType::VALUES, is_uniform, nullptr, result};
+  narrow(batch, depth - 2, rows);
+  return true;
+}
+
+auto negate(Batch &batch, int depth, int first, int rows) -> bool {
+  auto &column = batch.stack[depth - 1];
+  auto const count = column.uniform ? 1 : rows;
+  if (column.type != ColumnType::NUMBERS) {
+    auto row = 0;
+    while (row < count && is_number(column_value(column, row)))
+      ++row;
+    row_error(first + row, "Operand must be a number.");
+    return false;
+  }
+  for (int row = 0; row < count; ++row)
+    column.numbers[row] = -column.numbers[row];
+  return true;
+}
+
+auto not_(Batch &batch, int depth, int rows) -> void {
+  auto &column = batch.stack[depth - 1];
+  auto const count = column.uniform ? 1 : rows;
+  switch (column.type) {
+  case ColumnType::NUMBERS:
+    uniform(batch, depth - 1, bool_val(false));
+    break;
+  case ColumnType::BOOLS:
+    for (int row = 0; row < count; ++row)
+      column.numbers[row] = 1 - column.numbers[row];
+    break;
+  case ColumnType::VALUES: {
+    auto const result = values_at(batch, depth - 1);
+    for (int row = 0; row < count; ++row)
+      result[row] = bool_val(is_falsey(column.values[row]));
+    column.values = result;
+    narrow(batch, depth - 1, rows);
+    break;
+  }
+  }
+}
+
+// The callee must be the same native in every row. Its arguments are laid
+// out row by row for call_native, and arguments that are uniform across the
+// block call the native once, so natives used in batches must be pure.
+auto call(Batch &batch, int depth, int argument_count, int first, int rows)
+    -> bool {
+  auto const callee_depth = depth - argument_count - 1;
+  auto const &callee = batch.stack[callee_depth];
+  if (callee.type != ColumnType::VALUES || !callee.uniform ||
+      !is_native(callee.values[0])) {
+    row_error(first, "Can only call natives in batches.");
+    return false;
+  }
+  auto const native = as_native(callee.values[0]);
+  if (argument_count != native->arity) {
+    row_error(first, "Expected %d arguments but got %d.", native->arity,
+              argument_count);
+    return false;
+  }
+  auto const arguments = batch.stack + callee_depth + 1;
+  auto is_uniform = argument_count > 0;
+  for (int i = 0; i < argument_count; ++i)
+    is_uniform = is_uniform && arguments[i].uniform;
+  auto const count = is_uniform ? 1 : rows;
+  reserve(batch.arguments, count * argument_count);
+  for (int row = 0; row < count; ++row)
+    for (int i = 0; i < argument_count; ++i)
+      batch.arguments.data[row * argument_count + i] =
+          column_value(arguments[i], arguments[i].uniform ? 0 : row);
+  auto const result = values_at(batch, callee_depth);
+  call_native(native,
+              {batch.arguments.data,
+               static_cast<size_t>(count * argument_count)},
+              {result, static_cast<size_t>(count)});
+  batch.stack[callee_depth] = {ColumnType::VALUES, is_uniform, nullptr,
+                               result};
+  narrow(batch, callee_depth, rows);
+  return true;
+}
+
+auto row_error(int row, char const *format, ...) -> void {
+  auto &output = error_output();
+  va_list args;
+  va_start(args, format);
+  put_vformat(output, format, args);
+  va_end(args);
+  put_format(output, "\n[row %d]\n", row);
+  flush(output);
+}
+
+} // namespace lox
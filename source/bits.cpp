@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include <bits.hpp>
 
 namespace lox {
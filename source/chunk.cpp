@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <bits.hpp>
 #include <chunk.hpp>
 
@@ -27,4 +29,151 @@ auto add_constant(Chunk &chunk, Value value) -> int {
   return chunk.constants.count - 1;
 }
 
+auto add_loop_site(Chunk &chunk, int offset) -> int {
+  write(chunk.loops, LoopSite{offset, 0});
+  return chunk.loops.count - 1;
+}
+
+auto add_property_cache(Chunk &chunk, int offset) -> int {
+  write(chunk.caches, PropertyCache{offset, 0, 0, {}});
+  return chunk.caches.count - 1;
+}
+
+auto reserve(Chunk &chunk, int code_capacity, int constants_capacity) -> void {
+  reserve(chunk.code, code_capacity);
+  reserve(chunk.lines, code_capacity);
+  reserve(chunk.constants, constants_capacity);
+}
+
+auto shrink_to_fit(Chunk &chunk) -> void {
+  shrink_to_fit(chunk.code);
+  shrink_to_fit(chunk.lines);
+  shrink_to_fit(chunk.constants);
+  shrink_to_fit(chunk.loops);
+  shrink_to_fit(chunk.caches);
+}
+
+// Every path into an instruction reaches it at the same depth, so each one is
+// visited once, at the depth of the first path found. Binary ops with a
+// constant operand push it before they pop both.
+auto stack_size(Chunk const &chunk, int arity) -> int {
+  auto const code = chunk.code.data;
+  auto depths = Array<int>{};
+  reserve(depths, chunk.code.count);
+  for (int i = 0; i < chunk.code.count; ++i)
+    write(depths, -1);
+  auto pending = Array<int>{};
+  auto const reach = [&](int offset, int depth) {
+    if (offset < 0 || offset >= chunk.code.count || depths.data[offset] != -1)
+      return;
+    depths.data[offset] = depth;
+    write(pending, offset);
+  };
+  auto size = arity + 1;
+  reach(0, size);
+  while (pending.count > 0) {
+    auto const offset = pending.data[--pending.count];
+    auto depth = depths.data[offset];
+    auto next = offset + 1;
+    auto target = -1;
+    switch (static_cast<OpCode>(code[offset])) {
+    case OpCode::NIL:
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+      ++depth;
+      break;
+    case OpCode::CONSTANT:
+    case OpCode::GET_LOCAL:
+    case OpCode::GET_UPVALUE:
+      ++depth;
+      next += 1;
+      break;
+    case OpCode::CONSTANT_LONG:
+      ++depth;
+      next += 3;
+      break;
+    case OpCode::GET_GLOBAL:
+    case OpCode::CLASS:
+      ++depth;
+      next += 2;
+      break;
+    case OpCode::POP:
+    case OpCode::EQUAL:
+    case OpCode::GREATER:
+    case OpCode::LESS:
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::PRINT:
+      --depth;
+      break;
+    case OpCode::NOT:
+    case OpCode::NEGATE:
+      break;
+    case OpCode::SET_LOCAL:
+    case OpCode::SET_UPVALUE:
+    case OpCode::CLOSE_UPVALUES:
+      next += 1;
+      break;
+    case OpCode::ADD_CONSTANT:
+    case OpCode::SUBTRACT_CONSTANT:
+    case OpCode::MULTIPLY_CONSTANT:
+    case OpCode::DIVIDE_CONSTANT:
+    case OpCode::EQUAL_CONSTANT:
+    case OpCode::GREATER_CONSTANT:
+    case OpCode::LESS_CONSTANT:
+      size = std::max(size, depth + 1);
+      next += 1;
+      break;
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::METHOD:
+      --depth;
+      next += 2;
+      break;
+    case OpCode::SET_GLOBAL:
+      next += 2;
+      break;
+    case OpCode::GET_PROPERTY:
+      next += 4;
+      break;
+    case OpCode::SET_PROPERTY:
+      --depth;
+      next += 4;
+      break;
+    case OpCode::JUMP:
+      target = next + 2 + ((code[offset + 1] << 8) | code[offset + 2]);
+      next = -1;
+      break;
+    case OpCode::JUMP_IF_FALSE:
+      next += 2;
+      target = next + ((code[offset + 1] << 8) | code[offset + 2]);
+      break;
+    case OpCode::LOOP:
+      target = next + 4 - ((code[offset + 1] << 8) | code[offset + 2]);
+      next = -1;
+      break;
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+      depth -= code[offset + 1];
+      next += 1;
+      break;
+    case OpCode::INVOKE:
+      depth -= code[offset + 3];
+      next += 5;
+      break;
+    case OpCode::CLOSURE:
+      next += 1 + 2 * code[offset + 1];
+      break;
+    case OpCode::RETURN:
+      next = -1;
+      break;
+    }
+    size = std::max(size, depth);
+    reach(next, depth);
+    reach(target, depth);
+  }
+  return size;
+}
+
 } // namespace lox
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <string.h>
+
+#include <collector.hpp>
+#include <memory.hpp>
+#include <nursery.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+thread_local auto current_collector = static_cast<Collector *>(nullptr);
+
+auto start_cycle(Collector &collector, VirtualMachine &vm) -> void;
+auto mark(Collector &collector, int budget) -> void;
+auto mark_value(Collector &collector, Value const &value) -> void;
+auto blacken(Collector &collector, Obj *object) -> void;
+auto sweep(Collector &collector, int budget) -> void;
+auto finish_sweep(Collector &collector) -> void;
+auto nanoseconds_since(std::chrono::steady_clock::time_point start)
+    -> uint64_t;
+
+// Sweeping here frees nothing made since marking started, so the caller
+// may hold the objects it made just before this one.
+auto track_object(Obj *object) -> void {
+  auto const collector = current_collector;
+  if (collector == nullptr)
+    return;
+  auto const nursery = active_nursery();
+  if (nursery != nullptr && is_young(*nursery, object))
+    return;
+  write(collector->objects, object);
+  ++collector->allocations;
+  switch (collector->phase) {
+  case CollectorPhase::IDLE:
+    collector->pending = collector->objects.count >= collector->next_cycle;
+    break;
+  case CollectorPhase::MARK:
+    collector->pending =
+        collector->allocations >= collector->slice_allocations;
+    break;
+  case CollectorPhase::SWEEP:
+    if (collector->allocations >= collector->sweep_allocations) {
+      auto const start = std::chrono::steady_clock::now();
+      collector->allocations = 0;
+      sweep(*collector, collector->sweep_objects);
+      record_pause(collector->sweep_pauses, nanoseconds_since(start));
+    }
+    break;
+  }
+}
+
+auto use_collector(Collector *collector) -> Collector * {
+  auto const previous = current_collector;
+  current_collector = collector;
+  return previous;
+}
+
+auto active_collector() -> Collector * { return current_collector; }
+
+// A nursery promotes many objects at once, so with one a slice marks in
+// proportion to the allocations since the last. Marking is done once no
+// gray is left. The barrier has shaded whatever the run dropped since the
+// cycle started, so the roots are not scanned again. A cycle starts with an
+// empty nursery, so the old objects its lists gain later were reachable then
+// or made since, and none is swept before the nursery is collected again.
+auto collect_slice(VirtualMachine &vm) -> void {
+  auto &collector = *vm.collector;
+  auto const start = std::chrono::steady_clock::now();
+  auto const slices =
+      vm.nursery == nullptr
+          ? 1
+          : std::max(1, collector.allocations / collector.slice_allocations);
+  collector.pending = false;
+  collector.allocations = 0;
+  if (collector.phase == CollectorPhase::SWEEP)
+    return;
+  if (collector.phase == CollectorPhase::IDLE) {
+    if (vm.nursery != nullptr)
+      collect_nursery(vm);
+    start_cycle(collector, vm);
+  }
+  mark(collector, slices * collector.slice_objects);
+  record_pause(collector.mark_pauses, nanoseconds_since(start));
+}
+
+// The cycle in progress keeps what was reachable when it started and what
+// was made since, so a whole cycle follows it.
+auto collect_garbage(VirtualMachine &vm) -> void {
+  auto &collector = *vm.collector;
+  auto const start = std::chrono::steady_clock::now();
+  collector.pending = false;
+  collector.allocations = 0;
+  auto cycles = collector.phase == CollectorPhase::IDLE ? 1 : 2;
+  for (; cycles > 0; --cycles) {
+    if (collector.phase == CollectorPhase::IDLE) {
+      if (vm.nursery != nullptr)
+        collect_nursery(vm);
+      start_cycle(collector, vm);
+    }
+    if (collector.phase == CollectorPhase::MARK)
+      mark(collector, INT_MAX);
+    if (collector.phase == CollectorPhase::SWEEP)
+      sweep(collector, INT_MAX);
+  }
+  record_pause(collector.mark_pauses, nanoseconds_since(start));
+}
+
+auto trace_young(Collector &collector, Nursery const &nursery) -> void {
+  if (collector.phase != CollectorPhase::MARK)
+    return;
+  auto &gray = collector.gray;
+  for (int i = 0; i < gray.count;) {
+    auto const object = gray.data[i];
+    if (!is_young(nursery, object)) {
+      ++i;
+      continue;
+    }
+    gray.data[i] = gray.data[--gray.count];
+    blacken(collector, object);
+  }
+}
+
+auto mark_object(Collector &collector, Obj *object) -> void {
+  if (object == nullptr || object->mark == collector.epoch ||
+      object->type == ObjType::FUNCTION)
+    return;
+  object->mark = collector.epoch;
+  write(collector.gray, object);
+}
+
+auto record_pause(PauseStats &stats, uint64_t nanoseconds) -> void {
+  ++stats.pauses;
+  stats.total_ns += nanoseconds;
+  stats.max_ns = std::max(stats.max_ns, nanoseconds);
+  auto bucket = 0;
+  for (auto rest = nanoseconds; rest >>= 1;)
+    ++bucket;
+  ++stats.histogram[std::min(bucket, pause_histogram_buckets - 1)];
+}
+
+auto pause_percentile(PauseStats const &stats, double fraction) -> uint64_t {
+  if (stats.pauses == 0)
+    return 0;
+  auto const rank = static_cast<size_t>(fraction * (stats.pauses - 1));
+  auto seen = size_t{0};
+  for (int i = 0; i < pause_histogram_buckets; ++i) {
+    seen += stats.histogram[i];
+    if (seen > rank)
+      return (uint64_t{2} << i) - 1;
+  }
+  return stats.max_ns;
+}
+
+// The epoch changes every cycle, so no mark has to be cleared. 0 is left
+// for objects no cycle has reached.
+auto start_cycle(Collector &collector, VirtualMachine &vm) -> void {
+  collector.epoch = collector.epoch == UINT16_MAX ? 1 : collector.epoch + 1;
+  collector.marked_limit = collector.objects.count;
+  collector.phase = CollectorPhase::MARK;
+  for (auto slot = vm.stack; slot < vm.stack_top; ++slot)
+    mark_value(collector, *slot);
+  for (int i = 0; i < vm.frame_count; ++i)
+    if (vm.frames[i].closure != nullptr)
+      mark_object(collector, &vm.frames[i].closure->obj);
+  for (auto upvalue = vm.open_upvalues; upvalue != nullptr;
+       upvalue = upvalue->next)
+    mark_object(collector, &upvalue->obj);
+  for (int i = 0; i < vm.globals.slots.count; ++i)
+    mark_value(collector, vm.globals.slots.data[i].value);
+  mark_value(collector, vm.result);
+}
+
+// Blackens up to budget gray objects, and starts sweeping once none is
+// left.
+auto mark(Collector &collector, int budget) -> void {
+  for (; budget > 0 && collector.gray.count > 0; --budget)
+    blacken(collector, collector.gray.data[--collector.gray.count]);
+  if (collector.gray.count != 0)
+    return;
+  collector.phase = CollectorPhase::SWEEP;
+  collector.sweep_index = 0;
+  collector.sweep_end = collector.objects.count;
+  collector.kept = 0;
+  sweep(collector, 0);
+}
+
+auto mark_value(Collector &collector, Value const &value) -> void {
+  if (is_obj(value))
+    mark_object(collector, value.as.obj);
+}
+
+// A closure's function is never marked, and an open upvalue's value is on
+// the stack.
+auto blacken(Collector &collector, Obj *object) -> void {
+  switch (object->type) {
+  case ObjType::BOUND_METHOD: {
+    auto const bound = reinterpret_cast<ObjBoundMethod *>(object);
+    mark_value(collector, bound->receiver);
+    mark_value(collector, bound->method);
+    break;
+  }
+  case ObjType::CLASS: {
+    auto const klass = reinterpret_cast<ObjClass *>(object);
+    mark_object(collector, &klass->name->obj);
+    mark_value(collector, klass->initializer);
+    for (int i = 0; i < klass->methods.count; ++i) {
+      mark_object(collector, &klass->methods.data[i].name->obj);
+      mark_value(collector, klass->methods.data[i].method);
+    }
+    break;
+  }
+  case ObjType::CLOSURE: {
+    auto const closure = reinterpret_cast<ObjClosure *>(object);
+    for (int i = 0; i < closure->upvalue_count; ++i)
+      if (closure->upvalues[i] != nullptr)
+        mark_object(collector, &closure->upvalues[i]->obj);
+    break;
+  }
+  case ObjType::INSTANCE: {
+    auto const instance = reinterpret_cast<ObjInstance *>(object);
+    mark_object(collector, &instance->klass->obj);
+    for (int i = 0; i < instance->fields.count; ++i)
+      mark_value(collector, instance->fields.data[i]);
+    break;
+  }
+  case ObjType::NATIVE: {
+    auto const native = reinterpret_cast<ObjNative *>(object);
+    mark_object(collector, &native->name->obj);
+    break;
+  }
+  case ObjType::UPVALUE: {
+    auto const upvalue = reinterpret_cast<ObjUpvalue *>(object);
+    mark_value(collector, upvalue->closed);
+    if (upvalue->promoted != nullptr)
+      mark_object(collector, &upvalue->promoted->obj);
+    break;
+  }
+  case ObjType::FUNCTION:
+  case ObjType::NUMBER_ARRAY:
+  case ObjType::STRING:
+    break;
+  }
+}
+
+// Objects from marked_limit on were made while marking and survive
+// unmarked.
+auto sweep(Collector &collector, int budget) -> void {
+  auto &objects = collector.objects;
+  for (; budget > 0 && collector.sweep_index < collector.sweep_end;
+       --budget) {
+    auto const index = collector.sweep_index++;
+    auto const object = objects.data[index];
+    if (index >= collector.marked_limit || object->mark == collector.epoch) {
+      objects.data[collector.kept++] = object;
+    } else {
+      free_object(object);
+      ++collector.freed;
+    }
+  }
+  if (collector.sweep_index == collector.sweep_end)
+    finish_sweep(collector);
+}
+
+// Moves the objects made while sweeping down after the survivors.
+auto finish_sweep(Collector &collector) -> void {
+  auto &objects = collector.objects;
+  auto const made = objects.count - collector.sweep_end;
+  if (made != 0)
+    memmove(objects.data + collector.kept,
+            objects.data + collector.sweep_end, sizeof(Obj *) * made);
+  objects.count = collector.kept + made;
+  collector.next_cycle =
+      std::max(collector.cycle_minimum, 2 * collector.kept);
+  collector.phase = CollectorPhase::IDLE;
+  ++collector.cycles;
+}
+
+auto nanoseconds_since(std::chrono::steady_clock::time_point start)
+    -> uint64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace lox
@@ -1,80 +1,306 @@
-#include <string>
-
 #include <chunk.hpp>
 #include <compiler.hpp>
 #include <debug.hpp>
+#include <expression.hpp>
+#include <globals.hpp>
+#include <grammar.hpp>
 #include <object.hpp>
+#include <output.hpp>
 #include <scanner.hpp>
 
 namespace lox {
 
+auto constexpr uint8_count = 256;
+auto constexpr graph_limit = 256;
+
 struct Parser {
   Token current;
   Token previous;
   bool had_error = false;
   bool panic_mode = false;
+  bool can_assign = false;
+  int function_count = 1;
 };
 
-enum class Precedence {
-  NONE,
-  ASSIGNMENT, // =
-  OR,         // or
-  AND,        // and
-  EQUALITY,   // == !=
-  COMPARISON, // < > <= >=
-  TERM,       // + -
-  FACTOR,     // * /
-  UNARY,      // ! -
-  CALL,       // . ()
-  PRIMARY
+// A depth of -1 marks a local whose initializer is still being compiled.
+// Only captured locals need their upvalues closed when the scope ends.
+struct Local {
+  Token name;
+  int depth;
+  bool is_captured;
 };
 
-using ParseFn = auto (*)(Chunk &, Parser &, Scanner &) -> void;
+struct Upvalue {
+  uint8_t index;
+  bool is_local;
+};
 
-struct ParseRule {
-  ParseFn prefix;
-  ParseFn infix;
-  Precedence precedence;
+enum class FunctionType { FUNCTION, INITIALIZER, METHOD, SCRIPT };
+
+// An and/or whose left operand is on the stack of a graph being built. Once
+// the graph is flushed, jump is the jump over its right operand.
+struct OpenBranch {
+  NodeOp op;
+  int jump;
 };
 
+// Expressions are parsed into a graph, simplified and emitted once complete.
+// stack mirrors the VM stack at the current point of the expression: node
+// indexes, and -2 - i for the left operand of branches[i]. Anything a graph
+// cannot hold, such as an assignment, flushes it: the stack so far is
+// emitted and the rest of the expression is emitted as it is parsed. Nodes
+// used more than once are kept in temporaries, stack slots reserved from
+// base before the expression starts. spine is scratch space for emit_node.
+struct ExpressionBuilder {
+  ExpressionGraph graph;
+  Array<int> stack{};
+  Array<OpenBranch> branches{};
+  Array<int> uses{};
+  Array<int> temporaries{};
+  Array<bool> stored{};
+  Array<int> spine{};
+  int base = 0;
+  bool open = false;
+  bool active = false;
+};
+
+// Locals live in the stack slot matching their index in locals, so resolving
+// a name at compile time yields the operand of GET_LOCAL and SET_LOCAL. Slot
+// zero holds the function being called.
+struct Compiler {
+  Compiler *enclosing;
+  ObjFunction *function;
+  FunctionType type;
+  Globals &globals;
+  Local locals[uint8_count] = {};
+  Upvalue upvalues[uint8_count] = {};
+  int local_count = 0;
+  int scope_depth = 0;
+  int branch_depth = 0;
+  int class_depth = 0;
+  int last_call = -1;
+  int last_constant = -1;
+  int jump_target = -1;
+  bool has_result = false;
+  ExpressionBuilder builder{};
+};
+
+using ParseFn = auto (*)(Compiler &, Parser &, Scanner &) -> void;
+
+auto init_compiler(Compiler &compiler, Parser const &parser) -> void;
+auto presize(Chunk &chunk, std::string_view source) -> void;
 auto advance(Parser &parser, Scanner &scanner) -> void;
-auto expression(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
+auto check(Parser const &parser, TokenType type) -> bool;
+auto match(Parser &parser, Scanner &scanner, TokenType type) -> bool;
 auto consume(Parser &parser, Scanner &scanner, TokenType type,
              std::string_view message) -> void;
+auto synchronize(Parser &parser, Scanner &scanner) -> void;
+auto declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto class_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto method(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto fun_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto function(Compiler &compiler, Parser &parser, Scanner &scanner,
+              FunctionType type) -> void;
+auto var_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto statement(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto print_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto if_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto return_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto while_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto for_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void;
+auto branch(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto expression_statement(Compiler &compiler, Parser &parser,
+                          Scanner &scanner) -> void;
+auto block(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto begin_scope(Compiler &compiler) -> void;
+auto end_scope(Compiler &compiler, Parser const &parser) -> void;
+auto expression(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto begin_graph(Compiler &compiler) -> void;
+auto end_graph(Compiler &compiler, Parser &parser, bool discard) -> bool;
+auto flush_graph(Compiler &compiler, Parser &parser) -> void;
+auto building(Compiler &compiler, Parser &parser) -> bool;
+auto push_node(Compiler &compiler, int node) -> void;
+auto pop_node(Compiler &compiler) -> int;
+auto emit_node(Compiler &compiler, Parser &parser, int index,
+               bool conditional) -> void;
+auto finish_node(Compiler &compiler, Parser &parser, int index,
+                 bool conditional) -> void;
+auto is_stored(ExpressionBuilder const &builder, int index) -> bool;
 auto error_at_current(Parser &parser, std::string_view message) -> void;
 auto error(Parser &parser, std::string_view message) -> void;
 auto error_at(Parser &parser, Token const &token, std::string_view message)
     -> void;
-auto end_compiler(Chunk &chunk, Parser const &parser) -> void;
-auto emit_return(Chunk &chunk, Parser const &parser) -> void;
+auto end_compiler(Compiler &compiler, Parser const &parser) -> ObjFunction *;
+auto emit_return(Compiler &compiler, Parser const &parser) -> void;
+auto current_chunk(Compiler &compiler) -> Chunk &;
 
-auto emit_bytes(Chunk &chunk, Parser const &parser, uint8_t byte) -> void;
-auto emit_bytes(Chunk &chunk, Parser const &parser, OpCode op_code) -> void;
+auto emit_bytes(Compiler &compiler, Parser const &parser, uint8_t byte)
+    -> void;
+auto emit_bytes(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> void;
 template <typename... Bytes>
-auto emit_bytes(Chunk &chunk, Parser const &parser, uint8_t byte,
+auto emit_bytes(Compiler &compiler, Parser const &parser, uint8_t byte,
                 Bytes... bytes) -> void;
 template <typename... Bytes>
-auto emit_bytes(Chunk &chunk, Parser const &parser, OpCode op_code,
+auto emit_bytes(Compiler &compiler, Parser const &parser, OpCode op_code,
                 Bytes... bytes) -> void;
+auto emit_variable(Compiler &compiler, Parser const &parser, OpCode op_code,
+                   int operand) -> void;
+auto emit_jump(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> int;
+auto patch_jump(Compiler &compiler, Parser &parser, int offset) -> void;
+auto emit_binary(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> void;
+auto emit_constant(Compiler &compiler, Parser const &parser, Value value)
+    -> void;
+auto binary_op_code(NodeOp op) -> OpCode;
+auto emit_loop(Compiler &compiler, Parser &parser, int loop_start) -> void;
+auto emit_property(Compiler &compiler, Parser &parser, OpCode op_code,
+                   int name, int argument_count) -> void;
+auto identifier_constant(Compiler &compiler, Parser &parser,
+                         Token const &name) -> int;
+
+// Property operands are a two byte name constant, the argument count for
+// INVOKE, and a two byte index into Chunk::caches.
+auto emit_property(Compiler &compiler, Parser &parser, OpCode op_code,
+                   int name, int argument_count) -> void {
+  auto &chunk = current_chunk(compiler);
+  auto const cache = add_property_cache(chunk, chunk.code.count);
+  if (cache > UINT16_MAX)
+    error(parser, "Too many property accesses in one chunk.");
+  emit_bytes(compiler, parser, op_code, static_cast<uint8_t>(name >> 8),
+             static_cast<uint8_t>(name));
+  if (op_code == OpCode::INVOKE)
+    emit_bytes(compiler, parser, static_cast<uint8_t>(argument_count));
+  emit_bytes(compiler, parser, static_cast<uint8_t>(cache >> 8),
+             static_cast<uint8_t>(cache));
+}
+
+auto identifier_constant(Compiler &compiler, Parser &parser,
+                         Token const &name) -> int {
+  auto const constant =
+      add_constant(current_chunk(compiler), obj_val(copy_string(name.start)));
+  if (constant > UINT16_MAX)
+    error(parser, "Too many constants in one chunk.");
+  return constant;
+}
+
+auto parse_variable(Compiler &compiler, Parser &parser, Scanner &scanner,
+                    std::string_view message) -> int;
+auto declare_variable(Compiler &compiler, Parser &parser) -> void;
+auto add_local(Compiler &compiler, Parser &parser, Token const &name) -> void;
+auto mark_initialized(Compiler &compiler) -> void;
+auto define_variable(Compiler &compiler, Parser const &parser, int global)
+    -> void;
+auto resolve_local(Compiler &compiler, Parser &parser, Token const &name)
+    -> int;
+auto resolve_upvalue(Compiler &compiler, Parser &parser, Token const &name)
+    -> int;
+auto add_upvalue(Compiler &compiler, Parser &parser, uint8_t index,
+                 bool is_local) -> int;
+auto resolve_global(Compiler &compiler, Parser &parser, Token const &name)
+    -> int;
+auto named_variable(Compiler &compiler, Parser &parser, Scanner &scanner,
+                    Token const &name) -> void;
 
-auto number(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto string(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto grouping(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto unary(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto binary(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto literal(Chunk &chunk, Parser &parser, Scanner &scanner) -> void;
-auto parse_precedence(Chunk &chunk, Parser &parser, Scanner &scanner,
+auto constant(Compiler &compiler, Parser &parser, Value value) -> void;
+auto number(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto string(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto variable(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto grouping(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto and_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto or_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto logical(Compiler &compiler, Parser &parser, Scanner &scanner, NodeOp op)
+    -> void;
+auto unary(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto binary(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto literal(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto call(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto dot(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto this_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void;
+auto argument_list(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> uint8_t;
+auto parse_precedence(Compiler &compiler, Parser &parser, Scanner &scanner,
                       Precedence precedence) -> void;
-auto get_rule(TokenType type) -> ParseRule const &;
 
-auto compile(std::string_view source, Chunk &chunk) -> bool {
+auto compile(std::string_view source, Globals &globals) -> ObjFunction * {
   auto parser = Parser{};
   auto scanner = Scanner{source};
+  auto compiler = Compiler{nullptr, nullptr, FunctionType::SCRIPT, globals};
+  init_compiler(compiler, parser);
+  presize(current_chunk(compiler), source);
   advance(parser, scanner);
-  expression(chunk, parser, scanner);
+  while (!match(parser, scanner, TokenType::END_OF_FILE))
+    declaration(compiler, parser, scanner);
+  auto const function = end_compiler(compiler, parser);
+  if (parser.had_error) {
+    free_object(&function->obj);
+    return nullptr;
+  }
+  return function;
+}
+
+auto compile_expression(std::string_view source,
+                        std::span<std::string_view const> parameters,
+                        Globals &globals) -> ObjFunction * {
+  auto parser = Parser{};
+  auto scanner = Scanner{source};
+  auto compiler = Compiler{nullptr, nullptr, FunctionType::SCRIPT, globals};
+  init_compiler(compiler, parser);
+  begin_scope(compiler);
+  for (auto const parameter : parameters) {
+    // Parameters are reported as if on the first line of source. A name
+    // must scan as one identifier, so keywords such as this are refused.
+    auto const name = Token{TokenType::IDENTIFIER, parameter, 1};
+    auto name_scanner = Scanner{parameter};
+    auto const scanned = scan_token(name_scanner);
+    if (scanned.type != TokenType::IDENTIFIER || scanned.start != parameter)
+      error_at(parser, name, "Expect parameter name.");
+    else if (resolve_local(compiler, parser, name) != -1)
+      error_at(parser, name, "Already a parameter with this name.");
+    add_local(compiler, parser, name);
+    mark_initialized(compiler);
+  }
+  compiler.function->arity = parameters.size();
+  advance(parser, scanner);
+  expression(compiler, parser, scanner);
   consume(parser, scanner, TokenType::END_OF_FILE, "Expect end of expression.");
-  end_compiler(chunk, parser);
-  return !parser.had_error;
+  compiler.has_result = true;
+  auto const function = end_compiler(compiler, parser);
+  if (parser.had_error) {
+    free_object(&function->obj);
+    return nullptr;
+  }
+  return function;
+}
+
+// Slot zero holds the receiver in methods, where it is named this.
+auto init_compiler(Compiler &compiler, Parser const &parser) -> void {
+  compiler.function = new_function();
+  if (compiler.type != FunctionType::SCRIPT)
+    compiler.function->name = copy_string(parser.previous.start);
+  auto receiver = Token{};
+  if (compiler.type == FunctionType::METHOD ||
+      compiler.type == FunctionType::INITIALIZER)
+    receiver.start = "this";
+  compiler.locals[compiler.local_count++] = Local{receiver, 0, false};
+}
+
+// Number dense sources such as data tables compile to roughly one byte of
+// code per two characters and one constant per four. Reserving that up front
+// replaces the doubling chain from 8; shrink_to_fit() returns the slack.
+auto presize(Chunk &chunk, std::string_view source) -> void {
+  int const length = source.length();
+  reserve(chunk, length / 2 + 8, length / 4 + 8);
 }
 
 auto advance(Parser &parser, Scanner &scanner) -> void {
@@ -87,8 +313,15 @@ auto advance(Parser &parser, Scanner &scanner) -> void {
   }
 }
 
-auto expression(Chunk &chunk, Parser &parser, Scanner &scanner) -> void {
-  parse_precedence(chunk, parser, scanner, Precedence::ASSIGNMENT);
+auto check(Parser const &parser, TokenType type) -> bool {
+  return parser.current.type == type;
+}
+
+auto match(Parser &parser, Scanner &scanner, TokenType type) -> bool {
+  if (!check(parser, type))
+    return false;
+  advance(parser, scanner);
+  return true;
 }
 
 auto consume(Parser &parser, Scanner &scanner, TokenType type,
@@ -100,6 +333,541 @@ auto consume(Parser &parser, Scanner &scanner, TokenType type,
   error_at_current(parser, message);
 }
 
+auto synchronize(Parser &parser, Scanner &scanner) -> void {
+  parser.panic_mode = false;
+  while (parser.current.type != TokenType::END_OF_FILE) {
+    if (parser.previous.type == TokenType::SEMICOLON)
+      return;
+    switch (parser.current.type) {
+    case TokenType::CLASS:
+    case TokenType::FUN:
+    case TokenType::VAR:
+    case TokenType::FOR:
+    case TokenType::IF:
+    case TokenType::WHILE:
+    case TokenType::PRINT:
+    case TokenType::RETURN:
+      return;
+    default:
+      advance(parser, scanner);
+    }
+  }
+}
+
+auto declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  if (match(parser, scanner, TokenType::CLASS))
+    class_declaration(compiler, parser, scanner);
+  else if (match(parser, scanner, TokenType::FUN))
+    fun_declaration(compiler, parser, scanner);
+  else if (match(parser, scanner, TokenType::VAR))
+    var_declaration(compiler, parser, scanner);
+  else
+    statement(compiler, parser, scanner);
+  if (parser.panic_mode)
+    synchronize(parser, scanner);
+}
+
+auto class_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  consume(parser, scanner, TokenType::IDENTIFIER, "Expect class name.");
+  auto const class_name = parser.previous;
+  auto const name = identifier_constant(compiler, parser, class_name);
+  declare_variable(compiler, parser);
+  auto global = 0;
+  if (compiler.scope_depth == 0)
+    global = resolve_global(compiler, parser, class_name);
+  emit_bytes(compiler, parser, OpCode::CLASS, static_cast<uint8_t>(name >> 8),
+             static_cast<uint8_t>(name));
+  define_variable(compiler, parser, global);
+
+  ++compiler.class_depth;
+  named_variable(compiler, parser, scanner, class_name);
+  consume(parser, scanner, TokenType::LEFT_BRACE,
+          "Expect '{' before class body.");
+  while (!check(parser, TokenType::RIGHT_BRACE) &&
+         !check(parser, TokenType::END_OF_FILE))
+    method(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::RIGHT_BRACE,
+          "Expect '}' after class body.");
+  emit_bytes(compiler, parser, OpCode::POP);
+  --compiler.class_depth;
+}
+
+auto method(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  consume(parser, scanner, TokenType::IDENTIFIER, "Expect method name.");
+  auto const name = identifier_constant(compiler, parser, parser.previous);
+  auto const type = parser.previous.start == "init"
+                        ? FunctionType::INITIALIZER
+                        : FunctionType::METHOD;
+  function(compiler, parser, scanner, type);
+  emit_bytes(compiler, parser, OpCode::METHOD, static_cast<uint8_t>(name >> 8),
+             static_cast<uint8_t>(name));
+}
+
+auto fun_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  auto const global =
+      parse_variable(compiler, parser, scanner, "Expect function name.");
+  if (compiler.scope_depth > 0)
+    mark_initialized(compiler);
+  function(compiler, parser, scanner, FunctionType::FUNCTION);
+  define_variable(compiler, parser, global);
+}
+
+// Parameters are the first locals of the new function, so the arguments a
+// caller pushes after the callee already sit in their slots. Functions that
+// capture nothing are called as they are, without a closure object.
+auto function(Compiler &compiler, Parser &parser, Scanner &scanner,
+              FunctionType type) -> void {
+  auto inner = Compiler{&compiler, nullptr, type, compiler.globals};
+  inner.class_depth = compiler.class_depth;
+  init_compiler(inner, parser);
+  inner.function->id = parser.function_count++;
+  begin_scope(inner);
+  consume(parser, scanner, TokenType::LEFT_PAREN,
+          "Expect '(' after function name.");
+  if (!check(parser, TokenType::RIGHT_PAREN)) {
+    do {
+      ++inner.function->arity;
+      if (inner.function->arity > 255)
+        error_at_current(parser, "Can't have more than 255 parameters.");
+      auto const parameter =
+          parse_variable(inner, parser, scanner, "Expect parameter name.");
+      define_variable(inner, parser, parameter);
+    } while (match(parser, scanner, TokenType::COMMA));
+  }
+  consume(parser, scanner, TokenType::RIGHT_PAREN,
+          "Expect ')' after parameters.");
+  consume(parser, scanner, TokenType::LEFT_BRACE,
+          "Expect '{' before function body.");
+  block(inner, parser, scanner);
+  auto const function = end_compiler(inner, parser);
+  write(current_chunk(compiler), obj_val(function), parser.previous.line);
+  if (function->upvalue_count == 0)
+    return;
+  emit_bytes(compiler, parser, OpCode::CLOSURE,
+             static_cast<uint8_t>(function->upvalue_count));
+  for (int i = 0; i < function->upvalue_count; ++i) {
+    auto const &upvalue = inner.upvalues[i];
+    emit_bytes(compiler, parser, static_cast<uint8_t>(upvalue.is_local),
+               upvalue.index);
+  }
+}
+
+auto var_declaration(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  auto const global =
+      parse_variable(compiler, parser, scanner, "Expect variable name.");
+  if (match(parser, scanner, TokenType::EQUAL))
+    expression(compiler, parser, scanner);
+  else
+    emit_bytes(compiler, parser, OpCode::NIL);
+  consume(parser, scanner, TokenType::SEMICOLON,
+          "Expect ';' after variable declaration.");
+  define_variable(compiler, parser, global);
+}
+
+auto statement(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  if (match(parser, scanner, TokenType::PRINT)) {
+    print_statement(compiler, parser, scanner);
+  } else if (match(parser, scanner, TokenType::IF)) {
+    if_statement(compiler, parser, scanner);
+  } else if (match(parser, scanner, TokenType::RETURN)) {
+    return_statement(compiler, parser, scanner);
+  } else if (match(parser, scanner, TokenType::WHILE)) {
+    while_statement(compiler, parser, scanner);
+  } else if (match(parser, scanner, TokenType::FOR)) {
+    for_statement(compiler, parser, scanner);
+  } else if (match(parser, scanner, TokenType::LEFT_BRACE)) {
+    begin_scope(compiler);
+    block(compiler, parser, scanner);
+    end_scope(compiler, parser);
+  } else {
+    expression_statement(compiler, parser, scanner);
+  }
+}
+
+auto print_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  expression(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::SEMICOLON, "Expect ';' after value.");
+  emit_bytes(compiler, parser, OpCode::PRINT);
+}
+
+auto if_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  consume(parser, scanner, TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+  expression(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::RIGHT_PAREN,
+          "Expect ')' after condition.");
+  auto const then_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+  emit_bytes(compiler, parser, OpCode::POP);
+  branch(compiler, parser, scanner);
+  auto const else_jump = emit_jump(compiler, parser, OpCode::JUMP);
+  patch_jump(compiler, parser, then_jump);
+  emit_bytes(compiler, parser, OpCode::POP);
+  if (match(parser, scanner, TokenType::ELSE))
+    branch(compiler, parser, scanner);
+  patch_jump(compiler, parser, else_jump);
+}
+
+// A call whose result is returned right away becomes TAIL_CALL, which reuses
+// the frame of the caller. RETURN still follows for jumps that skip the call,
+// as in return a or f();
+auto return_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  if (compiler.type == FunctionType::SCRIPT)
+    error(parser, "Can't return from top-level code.");
+  if (match(parser, scanner, TokenType::SEMICOLON)) {
+    emit_return(compiler, parser);
+    return;
+  }
+  if (compiler.type == FunctionType::INITIALIZER)
+    error(parser, "Can't return a value from an initializer.");
+  expression(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::SEMICOLON,
+          "Expect ';' after return value.");
+  auto &chunk = current_chunk(compiler);
+  if (compiler.last_call == chunk.code.count)
+    chunk.code.data[chunk.code.count - 2] =
+        static_cast<uint8_t>(OpCode::TAIL_CALL);
+  emit_bytes(compiler, parser, OpCode::RETURN);
+}
+
+auto while_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  auto const loop_start = current_chunk(compiler).code.count;
+  consume(parser, scanner, TokenType::LEFT_PAREN,
+          "Expect '(' after 'while'.");
+  expression(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::RIGHT_PAREN,
+          "Expect ')' after condition.");
+  auto const exit_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+  emit_bytes(compiler, parser, OpCode::POP);
+  branch(compiler, parser, scanner);
+  emit_loop(compiler, parser, loop_start);
+  patch_jump(compiler, parser, exit_jump);
+  emit_bytes(compiler, parser, OpCode::POP);
+}
+
+auto for_statement(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> void {
+  begin_scope(compiler);
+  ++compiler.branch_depth;
+  consume(parser, scanner, TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(parser, scanner, TokenType::SEMICOLON)) {
+  } else if (match(parser, scanner, TokenType::VAR)) {
+    var_declaration(compiler, parser, scanner);
+  } else {
+    expression_statement(compiler, parser, scanner);
+  }
+  auto loop_start = current_chunk(compiler).code.count;
+  auto exit_jump = -1;
+  if (!match(parser, scanner, TokenType::SEMICOLON)) {
+    expression(compiler, parser, scanner);
+    consume(parser, scanner, TokenType::SEMICOLON,
+            "Expect ';' after loop condition.");
+    exit_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+    emit_bytes(compiler, parser, OpCode::POP);
+  }
+  if (!match(parser, scanner, TokenType::RIGHT_PAREN)) {
+    auto const body_jump = emit_jump(compiler, parser, OpCode::JUMP);
+    auto const increment_start = current_chunk(compiler).code.count;
+    expression(compiler, parser, scanner);
+    emit_bytes(compiler, parser, OpCode::POP);
+    consume(parser, scanner, TokenType::RIGHT_PAREN,
+            "Expect ')' after for clauses.");
+    emit_loop(compiler, parser, loop_start);
+    loop_start = increment_start;
+    patch_jump(compiler, parser, body_jump);
+  }
+  statement(compiler, parser, scanner);
+  emit_loop(compiler, parser, loop_start);
+  if (exit_jump != -1) {
+    patch_jump(compiler, parser, exit_jump);
+    emit_bytes(compiler, parser, OpCode::POP);
+  }
+  --compiler.branch_depth;
+  end_scope(compiler, parser);
+}
+
+// Compiles the body of a control flow statement, which never provides the
+// result of the script even when it ends the source.
+auto branch(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  ++compiler.branch_depth;
+  statement(compiler, parser, scanner);
+  --compiler.branch_depth;
+}
+
+// A top level expression left without a semicolon at the end of the source
+// is the result of the script, which RETURN hands back to the caller.
+auto expression_statement(Compiler &compiler, Parser &parser,
+                          Scanner &scanner) -> void {
+  begin_graph(compiler);
+  parse_precedence(compiler, parser, scanner, Precedence::ASSIGNMENT);
+  if (compiler.scope_depth == 0 && compiler.branch_depth == 0 &&
+      check(parser, TokenType::END_OF_FILE)) {
+    end_graph(compiler, parser, false);
+    compiler.has_result = true;
+    return;
+  }
+  consume(parser, scanner, TokenType::SEMICOLON,
+          "Expect ';' after expression.");
+  if (!end_graph(compiler, parser, true))
+    emit_bytes(compiler, parser, OpCode::POP);
+}
+
+auto block(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  while (!check(parser, TokenType::RIGHT_BRACE) &&
+         !check(parser, TokenType::END_OF_FILE))
+    declaration(compiler, parser, scanner);
+  consume(parser, scanner, TokenType::RIGHT_BRACE, "Expect '}' after block.");
+}
+
+auto begin_scope(Compiler &compiler) -> void { ++compiler.scope_depth; }
+
+// One CLOSE_UPVALUES closes every captured local of the scope at once, and
+// scopes without captured locals only pop.
+auto end_scope(Compiler &compiler, Parser const &parser) -> void {
+  --compiler.scope_depth;
+  auto const local_count = compiler.local_count;
+  auto captured = false;
+  while (compiler.local_count > 0 &&
+         compiler.locals[compiler.local_count - 1].depth >
+             compiler.scope_depth) {
+    --compiler.local_count;
+    captured = captured || compiler.locals[compiler.local_count].is_captured;
+  }
+  if (captured)
+    emit_bytes(compiler, parser, OpCode::CLOSE_UPVALUES,
+               static_cast<uint8_t>(compiler.local_count));
+  for (int i = compiler.local_count; i < local_count; ++i)
+    emit_bytes(compiler, parser, OpCode::POP);
+}
+
+// Expressions nested in another, such as arguments, join its graph.
+auto expression(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  if (compiler.builder.open) {
+    parse_precedence(compiler, parser, scanner, Precedence::ASSIGNMENT);
+    return;
+  }
+  begin_graph(compiler);
+  parse_precedence(compiler, parser, scanner, Precedence::ASSIGNMENT);
+  end_graph(compiler, parser, false);
+}
+
+// The value of an expression goes in the first free slot, which belongs to
+// the local being declared while its initializer compiles.
+auto begin_graph(Compiler &compiler) -> void {
+  auto &builder = compiler.builder;
+  clear(builder.graph);
+  builder.stack.count = 0;
+  builder.branches.count = 0;
+  builder.base = compiler.local_count;
+  if (compiler.locals[compiler.local_count - 1].depth == -1)
+    --builder.base;
+  builder.open = true;
+  builder.active = true;
+}
+
+// Temporaries sit below the value of the expression, so it is stored over
+// the first of them before they are popped. A node is only worth a
+// temporary when computing it again costs more than that. Returns whether
+// the value was dropped instead, which only happens when discard is set and
+// computing it can neither fail nor have an effect.
+auto end_graph(Compiler &compiler, Parser &parser, bool discard) -> bool {
+  auto &builder = compiler.builder;
+  builder.open = false;
+  if (!builder.active)
+    return false;
+  builder.active = false;
+  if (parser.had_error || builder.stack.count != 1 ||
+      builder.stack.data[0] < 0)
+    return false;
+  auto const root = builder.stack.data[0];
+  auto const &graph = builder.graph;
+  if (discard && graph.nodes.data[root].pure)
+    return true;
+  count_uses(graph, root, builder.uses);
+  reserve(builder.temporaries, graph.nodes.count);
+  reserve(builder.stored, graph.nodes.count);
+  builder.temporaries.count = graph.nodes.count;
+  builder.stored.count = graph.nodes.count;
+  auto temporary_count = 0;
+  for (auto i = 0; i < graph.nodes.count; ++i) {
+    auto const &node = graph.nodes.data[i];
+    auto const uses = builder.uses.data[i];
+    auto const worth = uses > 1 && (uses - 1) * (node.size - 1) > 3;
+    builder.temporaries.data[i] = -1;
+    builder.stored.data[i] = false;
+    if (worth && builder.base + temporary_count < UINT8_MAX)
+      builder.temporaries.data[i] = builder.base + temporary_count++;
+  }
+  auto const line = parser.previous.line;
+  for (auto i = 0; i < temporary_count; ++i)
+    emit_bytes(compiler, parser, OpCode::NIL);
+  emit_node(compiler, parser, root, false);
+  parser.previous.line = line;
+  if (temporary_count == 0)
+    return false;
+  emit_bytes(compiler, parser, OpCode::SET_LOCAL,
+             static_cast<uint8_t>(builder.base));
+  for (auto i = 0; i < temporary_count; ++i)
+    emit_bytes(compiler, parser, OpCode::POP);
+  return false;
+}
+
+// Emits what the graph has put on the stack so far, without temporaries,
+// including the jumps of and/or whose right operand is still being parsed.
+auto flush_graph(Compiler &compiler, Parser &parser) -> void {
+  auto &builder = compiler.builder;
+  if (!builder.active)
+    return;
+  builder.active = false;
+  builder.temporaries.count = 0;
+  auto const line = parser.previous.line;
+  for (auto i = 0; i < builder.stack.count; ++i) {
+    auto const entry = builder.stack.data[i];
+    if (entry >= -1) {
+      emit_node(compiler, parser, entry, false);
+      continue;
+    }
+    parser.previous.line = line;
+    auto &branch = builder.branches.data[-2 - entry];
+    if (branch.op == NodeOp::AND) {
+      branch.jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+    } else {
+      auto const else_jump =
+          emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+      branch.jump = emit_jump(compiler, parser, OpCode::JUMP);
+      patch_jump(compiler, parser, else_jump);
+    }
+    emit_bytes(compiler, parser, OpCode::POP);
+  }
+  parser.previous.line = line;
+}
+
+// Every operator needs a leaf, so checking here bounds the graph. Past
+// graph_limit nodes, such as in a long sum of literals, sharing rarely pays
+// for the cost of building the graph, and the rest is emitted directly.
+auto building(Compiler &compiler, Parser &parser) -> bool {
+  if (compiler.builder.graph.nodes.count >= graph_limit)
+    flush_graph(compiler, parser);
+  return compiler.builder.active;
+}
+
+auto push_node(Compiler &compiler, int node) -> void {
+  write(compiler.builder.stack, node);
+}
+
+// Parse errors can leave the stack short, in which case this returns -1
+// rather than take an operand that is not there.
+auto pop_node(Compiler &compiler) -> int {
+  auto &stack = compiler.builder.stack;
+  if (stack.count == 0 || stack.data[stack.count - 1] < -1)
+    return -1;
+  return stack.data[--stack.count];
+}
+
+// Left operands are emitted first, and long chains such as a + b + c nest
+// them deeply, so the chain of left operands is walked in a loop and only
+// other operands recurse.
+auto emit_node(Compiler &compiler, Parser &parser, int index,
+               bool conditional) -> void {
+  if (index < 0)
+    return;
+  auto &builder = compiler.builder;
+  auto const bottom = builder.spine.count;
+  for (auto node = index;; node = builder.graph.nodes.data[node].left) {
+    write(builder.spine, node);
+    if (is_stored(builder, node) || builder.graph.nodes.data[node].left < 0)
+      break;
+  }
+  while (builder.spine.count > bottom)
+    finish_node(compiler, parser, builder.spine.data[--builder.spine.count],
+                conditional);
+}
+
+// Emits what is left of a node once its left operand is on the stack. A node
+// used more than once is stored in its temporary where it is first computed
+// unconditionally and read back from there afterwards. In the right operand
+// of an and/or it is computed in place, as that code may not run. Each
+// instruction takes the line of the node it computes.
+auto finish_node(Compiler &compiler, Parser &parser, int index,
+                 bool conditional) -> void {
+  auto &builder = compiler.builder;
+  auto const temporary = index < builder.temporaries.count
+                             ? builder.temporaries.data[index]
+                             : -1;
+  if (is_stored(builder, index)) {
+    emit_bytes(compiler, parser, OpCode::GET_LOCAL,
+               static_cast<uint8_t>(temporary));
+    return;
+  }
+  auto const node = builder.graph.nodes.data[index];
+  parser.previous.line = node.line;
+  switch (node.op) {
+  case NodeOp::CONSTANT:
+    emit_constant(compiler, parser, node.value);
+    break;
+  case NodeOp::LOCAL:
+    emit_variable(compiler, parser, OpCode::GET_LOCAL, node.operand);
+    break;
+  case NodeOp::UPVALUE:
+    emit_variable(compiler, parser, OpCode::GET_UPVALUE, node.operand);
+    break;
+  case NodeOp::GLOBAL:
+    emit_variable(compiler, parser, OpCode::GET_GLOBAL, node.operand);
+    break;
+  case NodeOp::NOT:
+    emit_bytes(compiler, parser, OpCode::NOT);
+    break;
+  case NodeOp::NEGATE:
+    emit_bytes(compiler, parser, OpCode::NEGATE);
+    break;
+  case NodeOp::AND: {
+    auto const end_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+    emit_bytes(compiler, parser, OpCode::POP);
+    emit_node(compiler, parser, node.right, true);
+    patch_jump(compiler, parser, end_jump);
+    break;
+  }
+  case NodeOp::OR: {
+    auto const else_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+    auto const end_jump = emit_jump(compiler, parser, OpCode::JUMP);
+    patch_jump(compiler, parser, else_jump);
+    emit_bytes(compiler, parser, OpCode::POP);
+    emit_node(compiler, parser, node.right, true);
+    patch_jump(compiler, parser, end_jump);
+    break;
+  }
+  case NodeOp::CALL:
+    for (auto i = 0; i < node.operand; ++i)
+      emit_node(compiler, parser,
+                builder.graph.arguments.data[node.right + i], conditional);
+    parser.previous.line = node.line;
+    emit_bytes(compiler, parser, OpCode::CALL,
+               static_cast<uint8_t>(node.operand));
+    compiler.last_call = current_chunk(compiler).code.count;
+    break;
+  default:
+    emit_node(compiler, parser, node.right, conditional);
+    parser.previous.line = node.line;
+    emit_binary(compiler, parser, binary_op_code(node.op));
+  }
+  if (temporary != -1 && !conditional) {
+    emit_bytes(compiler, parser, OpCode::SET_LOCAL,
+               static_cast<uint8_t>(temporary));
+    builder.stored.data[index] = true;
+  }
+}
+
+auto is_stored(ExpressionBuilder const &builder, int index) -> bool {
+  return index < builder.temporaries.count &&
+         builder.temporaries.data[index] != -1 && builder.stored.data[index];
+}
+
 auto error_at_current(Parser &parser, std::string_view message) -> void {
   error_at(parser, parser.current, message);
 }
@@ -110,205 +878,567 @@ auto error(Parser &parser, std::string_view message) -> void {
 
 auto error_at(Parser &parser, Token const &token, std::string_view message)
     -> void {
+  if (parser.panic_mode)
+    return;
   parser.panic_mode = true;
-  fprintf(stderr, "[line %d] Error", token.line);
-  if (token.type == TokenType::END_OF_FILE)
-    fprintf(stderr, " at end");
-  else if (token.type == TokenType::ERROR) {
-  } else {
-    int const length = token.start.length();
-    fprintf(stderr, " at '%.*s'", length, token.start.begin());
+  auto &output = error_output();
+  put_format(output, "[line %d] Error", token.line);
+  if (token.type == TokenType::END_OF_FILE) {
+    put(output, " at end");
+  } else if (token.type != TokenType::ERROR) {
+    put(output, " at '");
+    put(output, token.start);
+    put(output, '\'');
   }
-  int const length = message.length();
-  fprintf(stderr, ": %.*s\n", length, message.begin());
+  put(output, ": ");
+  put(output, message);
+  put(output, '\n');
+  flush(output);
   parser.had_error = true;
 }
 
-auto end_compiler(Chunk &chunk, Parser const &parser) -> void {
-  emit_return(chunk, parser);
+auto end_compiler(Compiler &compiler, Parser const &parser) -> ObjFunction * {
+  if (compiler.has_result)
+    emit_bytes(compiler, parser, OpCode::RETURN);
+  else
+    emit_return(compiler, parser);
+  auto const function = compiler.function;
+  shrink_to_fit(function->chunk);
+  function->stack_size = stack_size(function->chunk, function->arity);
   if constexpr (print_code)
     if (!parser.had_error)
-      disassemble(chunk, "code");
+      disassemble(function->chunk, function->name != nullptr
+                                       ? function->name->chars
+                                       : "<script>");
+  return function;
 }
 
-auto emit_return(Chunk &chunk, Parser const &parser) -> void {
-  return emit_bytes(chunk, parser, OpCode::RETURN);
+// Initializers always return the instance they initialized.
+auto emit_return(Compiler &compiler, Parser const &parser) -> void {
+  if (compiler.type == FunctionType::INITIALIZER)
+    emit_bytes(compiler, parser, OpCode::GET_LOCAL, uint8_t{0});
+  else
+    emit_bytes(compiler, parser, OpCode::NIL);
+  emit_bytes(compiler, parser, OpCode::RETURN);
 }
 
-auto emit_bytes(Chunk &chunk, Parser const &parser, uint8_t byte) -> void {
-  write(chunk, byte, parser.previous.line);
+auto current_chunk(Compiler &compiler) -> Chunk & {
+  return compiler.function->chunk;
 }
 
-auto emit_bytes(Chunk &chunk, Parser const &parser, OpCode op_code) -> void {
-  write(chunk, static_cast<uint8_t>(op_code), parser.previous.line);
+auto emit_bytes(Compiler &compiler, Parser const &parser, uint8_t byte)
+    -> void {
+  write(current_chunk(compiler), byte, parser.previous.line);
+}
+
+auto emit_bytes(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> void {
+  write(current_chunk(compiler), static_cast<uint8_t>(op_code),
+        parser.previous.line);
 }
 
 template <typename... Bytes>
-auto emit_bytes(Chunk &chunk, Parser const &parser, uint8_t byte,
+auto emit_bytes(Compiler &compiler, Parser const &parser, uint8_t byte,
                 Bytes... bytes) -> void {
-  write(chunk, byte, parser.previous.line);
-  emit_bytes(chunk, parser, bytes...);
+  emit_bytes(compiler, parser, byte);
+  emit_bytes(compiler, parser, bytes...);
 }
 
 template <typename... Bytes>
-auto emit_bytes(Chunk &chunk, Parser const &parser, OpCode op_code,
+auto emit_bytes(Compiler &compiler, Parser const &parser, OpCode op_code,
                 Bytes... bytes) -> void {
-  write(chunk, static_cast<uint8_t>(op_code), parser.previous.line);
-  emit_bytes(chunk, parser, bytes...);
+  emit_bytes(compiler, parser, op_code);
+  emit_bytes(compiler, parser, bytes...);
 }
 
-auto number(Chunk &chunk, Parser &parser, Scanner &) -> void {
-  auto const value = std::stod(std::string{parser.previous.start});
-  write(chunk, number_val(value), parser.previous.line);
+// Local and upvalue operands are one byte indexes, global operands two byte
+// indexes into Globals::slots.
+auto emit_variable(Compiler &compiler, Parser const &parser, OpCode op_code,
+                   int operand) -> void {
+  switch (op_code) {
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::GET_UPVALUE:
+  case OpCode::SET_UPVALUE:
+    emit_bytes(compiler, parser, op_code, static_cast<uint8_t>(operand));
+    break;
+  default:
+    emit_bytes(compiler, parser, op_code, static_cast<uint8_t>(operand >> 8),
+               static_cast<uint8_t>(operand));
+  }
 }
 
-auto string(Chunk &chunk, Parser &parser, Scanner &) -> void {
+auto emit_jump(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> int {
+  emit_bytes(compiler, parser, op_code, uint8_t{0xff}, uint8_t{0xff});
+  return current_chunk(compiler).code.count - 2;
+}
+
+auto patch_jump(Compiler &compiler, Parser &parser, int offset) -> void {
+  auto &chunk = current_chunk(compiler);
+  auto const jump = chunk.code.count - offset - 2;
+  if (jump > UINT16_MAX)
+    error(parser, "Too much code to jump over.");
+  chunk.code.data[offset] = static_cast<uint8_t>(jump >> 8);
+  chunk.code.data[offset + 1] = static_cast<uint8_t>(jump);
+  compiler.jump_target = chunk.code.count;
+}
+
+// Fuses op_code with a number constant right before it into the matching
+// superinstruction, unless a jump lands between the two.
+auto emit_binary(Compiler &compiler, Parser const &parser, OpCode op_code)
+    -> void {
+  auto &chunk = current_chunk(compiler);
+  auto const constant = chunk.code.count - 2;
+  if (compiler.last_constant == constant &&
+      chunk.code.data[constant] == static_cast<uint8_t>(OpCode::CONSTANT) &&
+      compiler.jump_target != chunk.code.count)
+    for (auto const &superinstruction : superinstructions)
+      if (superinstruction.op_code == op_code) {
+        chunk.code.data[constant] =
+            static_cast<uint8_t>(superinstruction.fused);
+        return;
+      }
+  emit_bytes(compiler, parser, op_code);
+}
+
+// nil, true and false have instructions of their own. Only number constants
+// can fuse with the binary op after them.
+auto emit_constant(Compiler &compiler, Parser const &parser, Value value)
+    -> void {
+  if (is_nil(value)) {
+    emit_bytes(compiler, parser, OpCode::NIL);
+  } else if (is_bool(value)) {
+    emit_bytes(compiler, parser,
+               value.as.boolean ? OpCode::TRUE : OpCode::FALSE);
+  } else {
+    auto &chunk = current_chunk(compiler);
+    if (is_number(value))
+      compiler.last_constant = chunk.code.count;
+    write(chunk, value, parser.previous.line);
+  }
+}
+
+auto binary_op_code(NodeOp op) -> OpCode {
+  switch (op) {
+  case NodeOp::EQUAL:
+    return OpCode::EQUAL;
+  case NodeOp::GREATER:
+    return OpCode::GREATER;
+  case NodeOp::LESS:
+    return OpCode::LESS;
+  case NodeOp::ADD:
+    return OpCode::ADD;
+  case NodeOp::SUBTRACT:
+    return OpCode::SUBTRACT;
+  case NodeOp::MULTIPLY:
+    return OpCode::MULTIPLY;
+  default:
+    return OpCode::DIVIDE;
+  }
+}
+
+// LOOP carries the distance back to loop_start followed by its loop site.
+auto emit_loop(Compiler &compiler, Parser &parser, int loop_start) -> void {
+  auto &chunk = current_chunk(compiler);
+  auto const site = add_loop_site(chunk, chunk.code.count);
+  emit_bytes(compiler, parser, OpCode::LOOP);
+  auto const offset = chunk.code.count + 4 - loop_start;
+  if (offset > UINT16_MAX)
+    error(parser, "Loop body too large.");
+  if (site > UINT16_MAX)
+    error(parser, "Too many loops in one chunk.");
+  emit_bytes(compiler, parser, static_cast<uint8_t>(offset >> 8),
+             static_cast<uint8_t>(offset), static_cast<uint8_t>(site >> 8),
+             static_cast<uint8_t>(site));
+}
+
+auto parse_variable(Compiler &compiler, Parser &parser, Scanner &scanner,
+                    std::string_view message) -> int {
+  consume(parser, scanner, TokenType::IDENTIFIER, message);
+  declare_variable(compiler, parser);
+  if (compiler.scope_depth > 0)
+    return 0;
+  return resolve_global(compiler, parser, parser.previous);
+}
+
+auto declare_variable(Compiler &compiler, Parser &parser) -> void {
+  if (compiler.scope_depth == 0)
+    return;
+  auto const &name = parser.previous;
+  for (int i = compiler.local_count - 1; i >= 0; --i) {
+    auto const &local = compiler.locals[i];
+    if (local.depth != -1 && local.depth < compiler.scope_depth)
+      break;
+    if (local.name.start == name.start)
+      error(parser, "Already a variable with this name in this scope.");
+  }
+  add_local(compiler, parser, name);
+}
+
+auto add_local(Compiler &compiler, Parser &parser, Token const &name) -> void {
+  if (compiler.local_count == uint8_count) {
+    error(parser, "Too many local variables in function.");
+    return;
+  }
+  compiler.locals[compiler.local_count++] = Local{name, -1, false};
+}
+
+auto mark_initialized(Compiler &compiler) -> void {
+  compiler.locals[compiler.local_count - 1].depth = compiler.scope_depth;
+}
+
+auto define_variable(Compiler &compiler, Parser const &parser, int global)
+    -> void {
+  if (compiler.scope_depth > 0) {
+    mark_initialized(compiler);
+    return;
+  }
+  emit_variable(compiler, parser, OpCode::DEFINE_GLOBAL, global);
+}
+
+auto resolve_local(Compiler &compiler, Parser &parser, Token const &name)
+    -> int {
+  for (int i = compiler.local_count - 1; i >= 0; --i) {
+    auto const &local = compiler.locals[i];
+    if (local.name.start != name.start)
+      continue;
+    if (local.depth == -1)
+      error(parser, "Can't read local variable in its own initializer.");
+    return i;
+  }
+  return -1;
+}
+
+auto resolve_upvalue(Compiler &compiler, Parser &parser, Token const &name)
+    -> int {
+  if (compiler.enclosing == nullptr)
+    return -1;
+  auto &enclosing = *compiler.enclosing;
+  auto const local = resolve_local(enclosing, parser, name);
+  if (local != -1) {
+    enclosing.locals[local].is_captured = true;
+    return add_upvalue(compiler, parser, local, true);
+  }
+  auto const upvalue = resolve_upvalue(enclosing, parser, name);
+  if (upvalue != -1)
+    return add_upvalue(compiler, parser, upvalue, false);
+  return -1;
+}
+
+auto add_upvalue(Compiler &compiler, Parser &parser, uint8_t index,
+                 bool is_local) -> int {
+  auto &upvalue_count = compiler.function->upvalue_count;
+  for (int i = 0; i < upvalue_count; ++i) {
+    auto const &upvalue = compiler.upvalues[i];
+    if (upvalue.index == index && upvalue.is_local == is_local)
+      return i;
+  }
+  if (upvalue_count == UINT8_MAX) {
+    error(parser, "Too many closure variables in function.");
+    return 0;
+  }
+  compiler.upvalues[upvalue_count] = Upvalue{index, is_local};
+  return upvalue_count++;
+}
+
+auto resolve_global(Compiler &compiler, Parser &parser, Token const &name)
+    -> int {
+  auto const global = resolve_global(compiler.globals, name.start);
+  if (global == -1) {
+    error(parser, "Too many global variables.");
+    return 0;
+  }
+  return global;
+}
+
+auto named_variable(Compiler &compiler, Parser &parser, Scanner &scanner,
+                    Token const &name) -> void {
+  auto const can_assign = parser.can_assign;
+  auto get_op = OpCode::GET_LOCAL;
+  auto set_op = OpCode::SET_LOCAL;
+  auto read_op = NodeOp::LOCAL;
+  auto operand = resolve_local(compiler, parser, name);
+  if (operand == -1) {
+    get_op = OpCode::GET_UPVALUE;
+    set_op = OpCode::SET_UPVALUE;
+    read_op = NodeOp::UPVALUE;
+    operand = resolve_upvalue(compiler, parser, name);
+  }
+  if (operand == -1) {
+    get_op = OpCode::GET_GLOBAL;
+    set_op = OpCode::SET_GLOBAL;
+    read_op = NodeOp::GLOBAL;
+    operand = resolve_global(compiler, parser, name);
+  }
+  if (can_assign && match(parser, scanner, TokenType::EQUAL)) {
+    flush_graph(compiler, parser);
+    expression(compiler, parser, scanner);
+    emit_variable(compiler, parser, set_op, operand);
+  } else if (building(compiler, parser)) {
+    push_node(compiler, read_node(compiler.builder.graph, read_op, operand,
+                                  parser.previous.line));
+  } else {
+    emit_variable(compiler, parser, get_op, operand);
+  }
+}
+
+auto constant(Compiler &compiler, Parser &parser, Value value) -> void {
+  if (building(compiler, parser))
+    push_node(compiler, constant_node(compiler.builder.graph, value,
+                                      parser.previous.line));
+  else
+    emit_constant(compiler, parser, value);
+}
+
+auto number(Compiler &compiler, Parser &parser, Scanner &) -> void {
+  constant(compiler, parser,
+           number_val(parse_number(parser.previous.start)));
+}
+
+auto string(Compiler &compiler, Parser &parser, Scanner &) -> void {
   auto const string = parser.previous.start;
-  auto const value =
-      obj_val(copy_string(string.substr(1, string.length() - 2)));
-  write(chunk, value, parser.previous.line);
+  constant(compiler, parser,
+           obj_val(copy_string(string.substr(1, string.length() - 2))));
+}
+
+auto variable(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  named_variable(compiler, parser, scanner, parser.previous);
 }
 
-auto grouping(Chunk &chunk, Parser &parser, Scanner &scanner) -> void {
-  expression(chunk, parser, scanner);
+auto grouping(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  expression(compiler, parser, scanner);
   consume(parser, scanner, TokenType::RIGHT_PAREN,
           "Expect ')' after expression.");
 }
 
-auto unary(Chunk &chunk, Parser &parser, Scanner &scanner) -> void {
-  auto const operator_type = parser.previous.type;
-  parse_precedence(chunk, parser, scanner, Precedence::UNARY);
-  switch (operator_type) {
-  case TokenType::BANG:
-    emit_bytes(chunk, parser, OpCode::NOT);
-    break;
-  case TokenType::MINUS:
-    emit_bytes(chunk, parser, OpCode::NEGATE);
-    break;
-  default:
+auto and_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  if (compiler.builder.active) {
+    logical(compiler, parser, scanner, NodeOp::AND);
+    return;
+  }
+  auto const end_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+  emit_bytes(compiler, parser, OpCode::POP);
+  parse_precedence(compiler, parser, scanner, Precedence::AND);
+  patch_jump(compiler, parser, end_jump);
+}
+
+auto or_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  if (compiler.builder.active) {
+    logical(compiler, parser, scanner, NodeOp::OR);
+    return;
+  }
+  auto const else_jump = emit_jump(compiler, parser, OpCode::JUMP_IF_FALSE);
+  auto const end_jump = emit_jump(compiler, parser, OpCode::JUMP);
+  patch_jump(compiler, parser, else_jump);
+  emit_bytes(compiler, parser, OpCode::POP);
+  parse_precedence(compiler, parser, scanner, Precedence::OR);
+  patch_jump(compiler, parser, end_jump);
+}
+
+// The left operand stays on the stack under a marker while the right one is
+// parsed. If that flushes the graph, the jump over the right operand has
+// been emitted already and only needs patching.
+auto logical(Compiler &compiler, Parser &parser, Scanner &scanner, NodeOp op)
+    -> void {
+  auto &builder = compiler.builder;
+  auto const branch = builder.branches.count;
+  write(builder.branches, OpenBranch{op, -1});
+  push_node(compiler, -2 - branch);
+  parse_precedence(compiler, parser, scanner,
+                   op == NodeOp::AND ? Precedence::AND : Precedence::OR);
+  if (!builder.active) {
+    if (auto const jump = builder.branches.data[branch].jump; jump != -1)
+      patch_jump(compiler, parser, jump);
     return;
   }
+  auto const right = pop_node(compiler);
+  if (builder.stack.count > 0 && builder.stack.data[builder.stack.count - 1] ==
+                                     -2 - branch)
+    --builder.stack.count;
+  auto const left = pop_node(compiler);
+  push_node(compiler, binary_node(builder.graph, op, left, right,
+                                  parser.previous.line));
+}
+
+auto unary(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  auto const operator_type = parser.previous.type;
+  parse_precedence(compiler, parser, scanner, Precedence::UNARY);
+  auto const op =
+      operator_type == TokenType::BANG ? NodeOp::NOT : NodeOp::NEGATE;
+  if (compiler.builder.active)
+    push_node(compiler, unary_node(compiler.builder.graph, op,
+                                   pop_node(compiler), parser.previous.line));
+  else
+    emit_bytes(compiler, parser,
+               op == NodeOp::NOT ? OpCode::NOT : OpCode::NEGATE);
 }
 
-auto binary(Chunk &chunk, Parser &parser, Scanner &scanner) -> void {
+auto binary(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
   auto const operator_type = parser.previous.type;
-  auto const rule = get_rule(operator_type);
+  auto const rule = grammar_rule(operator_type);
   auto const precedence = static_cast<uint8_t>(rule.precedence) + 1;
-  parse_precedence(chunk, parser, scanner, static_cast<Precedence>(precedence));
+  parse_precedence(compiler, parser, scanner,
+                   static_cast<Precedence>(precedence));
+  auto op = NodeOp::ADD;
+  auto negate = false;
   switch (operator_type) {
   case TokenType::BANG_EQUAL:
-    emit_bytes(chunk, parser, OpCode::EQUAL, OpCode::NOT);
+    op = NodeOp::EQUAL;
+    negate = true;
     break;
   case TokenType::EQUAL_EQUAL:
-    emit_bytes(chunk, parser, OpCode::EQUAL);
+    op = NodeOp::EQUAL;
     break;
   case TokenType::GREATER:
-    emit_bytes(chunk, parser, OpCode::GREATER);
+    op = NodeOp::GREATER;
     break;
   case TokenType::GREATER_EQUAL:
-    emit_bytes(chunk, parser, OpCode::LESS, OpCode::NOT);
+    op = NodeOp::LESS;
+    negate = true;
     break;
   case TokenType::LESS:
-    emit_bytes(chunk, parser, OpCode::LESS);
+    op = NodeOp::LESS;
     break;
   case TokenType::LESS_EQUAL:
-    emit_bytes(chunk, parser, OpCode::GREATER, OpCode::NOT);
+    op = NodeOp::GREATER;
+    negate = true;
     break;
   case TokenType::PLUS:
-    emit_bytes(chunk, parser, OpCode::ADD);
+    op = NodeOp::ADD;
     break;
   case TokenType::MINUS:
-    emit_bytes(chunk, parser, OpCode::SUBTRACT);
+    op = NodeOp::SUBTRACT;
     break;
   case TokenType::STAR:
-    emit_bytes(chunk, parser, OpCode::MULTIPLY);
+    op = NodeOp::MULTIPLY;
     break;
   case TokenType::SLASH:
-    emit_bytes(chunk, parser, OpCode::DIVIDE);
+    op = NodeOp::DIVIDE;
     break;
   default:
     return;
   }
+  if (compiler.builder.active) {
+    auto &graph = compiler.builder.graph;
+    auto const line = parser.previous.line;
+    auto const right = pop_node(compiler);
+    auto node = binary_node(graph, op, pop_node(compiler), right, line);
+    if (negate)
+      node = unary_node(graph, NodeOp::NOT, node, line);
+    push_node(compiler, node);
+    return;
+  }
+  emit_binary(compiler, parser, binary_op_code(op));
+  if (negate)
+    emit_bytes(compiler, parser, OpCode::NOT);
 }
 
-auto literal(Chunk &chunk, Parser &parser, Scanner &) -> void {
+auto literal(Compiler &compiler, Parser &parser, Scanner &) -> void {
   switch (parser.previous.type) {
   case TokenType::FALSE:
-    emit_bytes(chunk, parser, OpCode::FALSE);
+    constant(compiler, parser, bool_val(false));
     break;
   case TokenType::TRUE:
-    emit_bytes(chunk, parser, OpCode::TRUE);
+    constant(compiler, parser, bool_val(true));
     break;
   case TokenType::NIL:
-    emit_bytes(chunk, parser, OpCode::NIL);
+    constant(compiler, parser, nil_val);
     break;
   default:
     return;
   }
 }
 
-constexpr ParseRule rules[] = {
-    {grouping, NULL, Precedence::NONE},     // TOKEN_LEFT_PAREN
-    {NULL, NULL, Precedence::NONE},         // TOKEN_RIGHT_PAREN
-    {NULL, NULL, Precedence::NONE},         // TOKEN_LEFT_BRACE
-    {NULL, NULL, Precedence::NONE},         // TOKEN_RIGHT_BRACE
-    {NULL, NULL, Precedence::NONE},         // TOKEN_COMMA
-    {NULL, NULL, Precedence::NONE},         // TOKEN_DOT
-    {unary, binary, Precedence::TERM},      // TOKEN_MINUS
-    {NULL, binary, Precedence::TERM},       // TOKEN_PLUS
-    {NULL, NULL, Precedence::NONE},         // TOKEN_SEMICOLON
-    {NULL, binary, Precedence::FACTOR},     // TOKEN_SLASH
-    {NULL, binary, Precedence::FACTOR},     // TOKEN_STAR
-    {unary, NULL, Precedence::NONE},        // TOKEN_BANG
-    {NULL, binary, Precedence::EQUALITY},   // TOKEN_BANG_EQUAL
-    {NULL, NULL, Precedence::NONE},         // TOKEN_EQUAL
-    {NULL, binary, Precedence::EQUALITY},   // TOKEN_EQUAL_EQUAL
-    {NULL, binary, Precedence::COMPARISON}, // TOKEN_GREATER
-    {NULL, binary, Precedence::COMPARISON}, // TOKEN_GREATER_EQUAL
-    {NULL, binary, Precedence::COMPARISON}, // TOKEN_LESS
-    {NULL, binary, Precedence::COMPARISON}, // TOKEN_LESS_EQUAL
-    {NULL, NULL, Precedence::NONE},         // TOKEN_IDENTIFIER
-    {string, NULL, Precedence::NONE},       // TOKEN_STRING
-    {number, NULL, Precedence::NONE},       // TOKEN_NUMBER
-    {NULL, NULL, Precedence::NONE},         // TOKEN_AND
-    {NULL, NULL, Precedence::NONE},         // TOKEN_CLASS
-    {NULL, NULL, Precedence::NONE},         // TOKEN_ELSE
-    {literal, NULL, Precedence::NONE},      // TOKEN_FALSE
-    {NULL, NULL, Precedence::NONE},         // TOKEN_FOR
-    {NULL, NULL, Precedence::NONE},         // TOKEN_FUN
-    {NULL, NULL, Precedence::NONE},         // TOKEN_IF
-    {literal, NULL, Precedence::NONE},      // TOKEN_NIL
-    {NULL, NULL, Precedence::NONE},         // TOKEN_OR
-    {NULL, NULL, Precedence::NONE},         // TOKEN_PRINT
-    {NULL, NULL, Precedence::NONE},         // TOKEN_RETURN
-    {NULL, NULL, Precedence::NONE},         // TOKEN_SUPER
-    {NULL, NULL, Precedence::NONE},         // TOKEN_THIS
-    {literal, NULL, Precedence::NONE},      // TOKEN_TRUE
-    {NULL, NULL, Precedence::NONE},         // TOKEN_VAR
-    {NULL, NULL, Precedence::NONE},         // TOKEN_WHILE
-    {NULL, NULL, Precedence::NONE},         // TOKEN_ERROR
-    {NULL, NULL, Precedence::NONE},         // TOKEN_EOF
-};
+auto call(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  auto const argument_count = argument_list(compiler, parser, scanner);
+  if (compiler.builder.active) {
+    int arguments[uint8_count];
+    for (auto i = argument_count; i > 0; --i)
+      arguments[i - 1] = pop_node(compiler);
+    auto const callee = pop_node(compiler);
+    push_node(compiler,
+              call_node(compiler.builder.graph, callee,
+                        std::span{arguments, argument_count},
+                        parser.previous.line));
+    return;
+  }
+  emit_bytes(compiler, parser, OpCode::CALL, argument_count);
+  compiler.last_call = current_chunk(compiler).code.count;
+}
+
+// A call on a property compiles to INVOKE, which calls a method without
+// binding it to the receiver first.
+auto dot(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  flush_graph(compiler, parser);
+  auto const can_assign = parser.can_assign;
+  consume(parser, scanner, TokenType::IDENTIFIER,
+          "Expect property name after '.'.");
+  auto const name = identifier_constant(compiler, parser, parser.previous);
+  if (can_assign && match(parser, scanner, TokenType::EQUAL)) {
+    expression(compiler, parser, scanner);
+    emit_property(compiler, parser, OpCode::SET_PROPERTY, name, 0);
+  } else if (match(parser, scanner, TokenType::LEFT_PAREN)) {
+    auto const argument_count = argument_list(compiler, parser, scanner);
+    emit_property(compiler, parser, OpCode::INVOKE, name, argument_count);
+  } else {
+    emit_property(compiler, parser, OpCode::GET_PROPERTY, name, 0);
+  }
+}
 
-auto get_rule(TokenType type) -> ParseRule const & {
-  return rules[static_cast<uint8_t>(type)];
+auto this_(Compiler &compiler, Parser &parser, Scanner &scanner) -> void {
+  if (compiler.class_depth == 0) {
+    error(parser, "Can't use 'this' outside of a class.");
+    return;
+  }
+  parser.can_assign = false;
+  variable(compiler, parser, scanner);
+}
+
+auto argument_list(Compiler &compiler, Parser &parser, Scanner &scanner)
+    -> uint8_t {
+  auto argument_count = 0;
+  if (!check(parser, TokenType::RIGHT_PAREN)) {
+    do {
+      expression(compiler, parser, scanner);
+      if (argument_count == 255)
+        error(parser, "Can't have more than 255 arguments.");
+      ++argument_count;
+    } while (match(parser, scanner, TokenType::COMMA));
+  }
+  consume(parser, scanner, TokenType::RIGHT_PAREN,
+          "Expect ')' after arguments.");
+  return argument_count;
 }
 
-auto parse_precedence(Chunk &chunk, Parser &parser, Scanner &scanner,
+// Indexed by Prefix and Infix.
+constexpr ParseFn prefix_rules[] = {nullptr, grouping, unary,   variable,
+                                    string,  number,   literal, this_};
+constexpr ParseFn infix_rules[] = {nullptr, call, dot, binary, and_, or_};
+
+auto parse_precedence(Compiler &compiler, Parser &parser, Scanner &scanner,
                       Precedence precedence) -> void {
   advance(parser, scanner);
-  auto const prefix_rule = get_rule(parser.previous.type).prefix;
+  auto const prefix_rule = prefix_rules[static_cast<uint8_t>(
+      grammar_rule(parser.previous.type).prefix)];
   if (prefix_rule == nullptr) {
     error(parser, "Expected expression.");
     return;
   }
-  prefix_rule(chunk, parser, scanner);
+  auto const can_assign = precedence <= Precedence::ASSIGNMENT;
+  parser.can_assign = can_assign;
+  prefix_rule(compiler, parser, scanner);
 
-  while (precedence <= get_rule(parser.current.type).precedence) {
+  while (precedence <= grammar_rule(parser.current.type).precedence) {
     advance(parser, scanner);
-    auto const infix_rule = get_rule(parser.previous.type).infix;
-    infix_rule(chunk, parser, scanner);
+    auto const infix_rule = infix_rules[static_cast<uint8_t>(
+        grammar_rule(parser.previous.type).infix)];
+    parser.can_assign = can_assign;
+    infix_rule(compiler, parser, scanner);
   }
+
+  if (can_assign && match(parser, scanner, TokenType::EQUAL))
+    error(parser, "Invalid assignment target.");
 }
 
 } // namespace lox
@@ -1,7 +1,10 @@
+#include <iterator>
 #include <stdio.h>
 
 #include <bits.hpp>
+#include <collector.hpp>
 #include <debug.hpp>
+#include <registers.hpp>
 #include <value.hpp>
 
 namespace lox {
@@ -37,6 +40,80 @@ auto constant_long_instruction(char const *name, Chunk const &chunk, int offset)
   return offset + 4;
 }
 
+auto short_constant_instruction(char const *name, Chunk const &chunk,
+                                int offset) -> int {
+  auto const data = chunk.code.data;
+  auto const constant = (data[offset + 1] << 8) | data[offset + 2];
+  printf("%-16s %4d '", name, constant);
+  print(chunk.constants.data[constant]);
+  printf("'\n");
+  return offset + 3;
+}
+
+// Property instructions carry a name constant, an argument count for INVOKE
+// and their inline cache.
+auto property_instruction(char const *name, Chunk const &chunk, int offset)
+    -> int {
+  auto const data = chunk.code.data;
+  auto const constant = (data[offset + 1] << 8) | data[offset + 2];
+  auto const invoke = data[offset] == static_cast<uint8_t>(OpCode::INVOKE);
+  auto const cache_offset = offset + (invoke ? 4 : 3);
+  auto const cache = (data[cache_offset] << 8) | data[cache_offset + 1];
+  printf("%-16s %4d '", name, constant);
+  print(chunk.constants.data[constant]);
+  if (invoke)
+    printf("' (%d args) cache %d\n", data[offset + 3], cache);
+  else
+    printf("' cache %d\n", cache);
+  return cache_offset + 2;
+}
+
+auto byte_instruction(char const *name, Chunk const &chunk, int offset)
+    -> int {
+  auto const slot = chunk.code.data[offset + 1];
+  printf("%-16s %4d\n", name, slot);
+  return offset + 2;
+}
+
+auto short_instruction(char const *name, Chunk const &chunk, int offset)
+    -> int {
+  auto const data = chunk.code.data;
+  auto const index = (data[offset + 1] << 8) | data[offset + 2];
+  printf("%-16s %4d\n", name, index);
+  return offset + 3;
+}
+
+auto jump_instruction(char const *name, int sign, Chunk const &chunk,
+                      int offset) -> int {
+  auto const data = chunk.code.data;
+  auto const jump = (data[offset + 1] << 8) | data[offset + 2];
+  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+  return offset + 3;
+}
+
+auto loop_instruction(char const *name, Chunk const &chunk, int offset)
+    -> int {
+  auto const data = chunk.code.data;
+  auto const jump = (data[offset + 1] << 8) | data[offset + 2];
+  auto const site = (data[offset + 3] << 8) | data[offset + 4];
+  printf("%-16s %4d -> %d site %d\n", name, offset, offset + 5 - jump, site);
+  return offset + 5;
+}
+
+// CLOSURE turns the function on top of the stack into a closure and is
+// followed by an is_local and index byte pair for each captured variable.
+auto closure_instruction(char const *name, Chunk const &chunk, int offset)
+    -> int {
+  auto const data = chunk.code.data;
+  auto const count = data[offset + 1];
+  printf("%-16s %4d\n", name, count);
+  offset += 2;
+  for (int i = 0; i < count; ++i, offset += 2)
+    printf("%04d      |                     %s %d\n", offset,
+           data[offset] ? "local" : "upvalue", data[offset + 1]);
+  return offset;
+}
+
 auto disassemble(Chunk const &chunk, int offset) -> int {
   printf("%04d ", offset);
   if (offset > 0 && chunk.lines.data[offset] == chunk.lines.data[offset - 1])
@@ -56,6 +133,32 @@ auto disassemble(Chunk const &chunk, int offset) -> int {
     return simple_instruction("TRUE", offset);
   case static_cast<uint8_t>(OpCode::NIL):
     return simple_instruction("NIL", offset);
+  case static_cast<uint8_t>(OpCode::POP):
+    return simple_instruction("POP", offset);
+  case static_cast<uint8_t>(OpCode::GET_LOCAL):
+    return byte_instruction("GET_LOCAL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::SET_LOCAL):
+    return byte_instruction("SET_LOCAL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::DEFINE_GLOBAL):
+    return short_instruction("DEFINE_GLOBAL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::GET_GLOBAL):
+    return short_instruction("GET_GLOBAL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::SET_GLOBAL):
+    return short_instruction("SET_GLOBAL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::GET_UPVALUE):
+    return byte_instruction("GET_UPVALUE", chunk, offset);
+  case static_cast<uint8_t>(OpCode::SET_UPVALUE):
+    return byte_instruction("SET_UPVALUE", chunk, offset);
+  case static_cast<uint8_t>(OpCode::GET_PROPERTY):
+    return property_instruction("GET_PROPERTY", chunk, offset);
+  case static_cast<uint8_t>(OpCode::SET_PROPERTY):
+    return property_instruction("SET_PROPERTY", chunk, offset);
+  case static_cast<uint8_t>(OpCode::JUMP):
+    return jump_instruction("JUMP", 1, chunk, offset);
+  case static_cast<uint8_t>(OpCode::JUMP_IF_FALSE):
+    return jump_instruction("JUMP_IF_FALSE", 1, chunk, offset);
+  case static_cast<uint8_t>(OpCode::LOOP):
+    return loop_instruction("LOOP", chunk, offset);
   case static_cast<uint8_t>(OpCode::EQUAL):
     return simple_instruction("EQUAL", offset);
   case static_cast<uint8_t>(OpCode::GREATER):
@@ -74,12 +177,181 @@ auto disassemble(Chunk const &chunk, int offset) -> int {
     return simple_instruction("NOT", offset);
   case static_cast<uint8_t>(OpCode::NEGATE):
     return simple_instruction("NEGATE", offset);
+  case static_cast<uint8_t>(OpCode::PRINT):
+    return simple_instruction("PRINT", offset);
+  case static_cast<uint8_t>(OpCode::CALL):
+    return byte_instruction("CALL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::TAIL_CALL):
+    return byte_instruction("TAIL_CALL", chunk, offset);
+  case static_cast<uint8_t>(OpCode::INVOKE):
+    return property_instruction("INVOKE", chunk, offset);
+  case static_cast<uint8_t>(OpCode::CLOSURE):
+    return closure_instruction("CLOSURE", chunk, offset);
+  case static_cast<uint8_t>(OpCode::CLOSE_UPVALUES):
+    return byte_instruction("CLOSE_UPVALUES", chunk, offset);
+  case static_cast<uint8_t>(OpCode::CLASS):
+    return short_constant_instruction("CLASS", chunk, offset);
+  case static_cast<uint8_t>(OpCode::METHOD):
+    return short_constant_instruction("METHOD", chunk, offset);
   case static_cast<uint8_t>(OpCode::RETURN):
     return simple_instruction("RETURN", offset);
+  case static_cast<uint8_t>(OpCode::ADD_CONSTANT):
+    return constant_instruction("ADD_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::SUBTRACT_CONSTANT):
+    return constant_instruction("SUBTRACT_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::MULTIPLY_CONSTANT):
+    return constant_instruction("MULTIPLY_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::DIVIDE_CONSTANT):
+    return constant_instruction("DIVIDE_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::EQUAL_CONSTANT):
+    return constant_instruction("EQUAL_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::GREATER_CONSTANT):
+    return constant_instruction("GREATER_CONSTANT", chunk, offset);
+  case static_cast<uint8_t>(OpCode::LESS_CONSTANT):
+    return constant_instruction("LESS_CONSTANT", chunk, offset);
   default:
     printf("Unknown opcode %d\n", instruction);
     return offset + 1;
   }
 }
 
+// Registers print as r and their number, constants as their value.
+auto print_operand(RegisterChunk const &chunk, int operand) -> void {
+  if (operand < chunk.register_count) {
+    printf(" r%d", operand);
+    return;
+  }
+  printf(" '");
+  print(chunk.constants.data[operand - chunk.register_count]);
+  printf("'");
+}
+
+auto disassemble(RegisterChunk const &chunk, char const *name) -> void {
+  char const *const names[] = {
+      "MOVE",          "DEFINE_GLOBAL", "GET_GLOBAL",    "SET_GLOBAL",
+      "EQUAL",         "GREATER",       "LESS",          "ADD",
+      "SUBTRACT",      "MULTIPLY",      "DIVIDE",        "NOT",
+      "NEGATE",        "PRINT",         "JUMP",          "JUMP_IF_FALSE",
+      "RETURN",
+  };
+  printf("== %s (%d registers) ==\n", name, chunk.register_count);
+  for (int i = 0; i < chunk.code.count; ++i) {
+    auto const &instruction = chunk.code.data[i];
+    printf("%04d %4d %-16s", i, chunk.lines.data[i],
+           names[static_cast<int>(instruction.op)]);
+    switch (instruction.op) {
+    case RegisterOp::DEFINE_GLOBAL:
+    case RegisterOp::SET_GLOBAL:
+      printf(" g%d", instruction.b);
+      print_operand(chunk, instruction.c);
+      break;
+    case RegisterOp::GET_GLOBAL:
+      printf(" r%d g%d", instruction.a, instruction.b);
+      break;
+    case RegisterOp::MOVE:
+    case RegisterOp::NOT:
+    case RegisterOp::NEGATE:
+      printf(" r%d", instruction.a);
+      print_operand(chunk, instruction.b);
+      break;
+    case RegisterOp::PRINT:
+    case RegisterOp::RETURN:
+      print_operand(chunk, instruction.b);
+      break;
+    case RegisterOp::JUMP:
+      printf(" -> %d", instruction.b);
+      break;
+    case RegisterOp::JUMP_IF_FALSE:
+      printf(" r%d -> %d", instruction.a, instruction.b);
+      break;
+    default:
+      printf(" r%d", instruction.a);
+      print_operand(chunk, instruction.b);
+      print_operand(chunk, instruction.c);
+    }
+    printf("\n");
+  }
+}
+
+auto op_code_name(OpCode op_code) -> char const * {
+  char const *const names[] = {
+      "CONSTANT",          "CONSTANT_LONG",     "NIL",
+      "TRUE",              "FALSE",             "POP",
+      "GET_LOCAL",         "SET_LOCAL",         "DEFINE_GLOBAL",
+      "GET_GLOBAL",        "SET_GLOBAL",        "GET_UPVALUE",
+      "SET_UPVALUE",       "GET_PROPERTY",      "SET_PROPERTY",
+      "JUMP",              "JUMP_IF_FALSE",     "LOOP",
+      "EQUAL",             "GREATER",           "LESS",
+      "ADD",               "SUBTRACT",          "MULTIPLY",
+      "DIVIDE",            "NOT",               "NEGATE",
+      "PRINT",             "CALL",              "TAIL_CALL",
+      "INVOKE",            "CLOSURE",           "CLOSE_UPVALUES",
+      "CLASS",             "METHOD",            "RETURN",
+      "ADD_CONSTANT",      "SUBTRACT_CONSTANT", "MULTIPLY_CONSTANT",
+      "DIVIDE_CONSTANT",   "EQUAL_CONSTANT",    "GREATER_CONSTANT",
+      "LESS_CONSTANT",
+  };
+  auto const index = static_cast<size_t>(op_code);
+  return index < std::size(names) ? names[index] : "UNKNOWN";
+}
+
+auto print_loop_sites(Chunk const &chunk) -> void {
+  printf("== loops ==\n");
+  for (int i = 0; i < chunk.loops.count; ++i) {
+    auto const &site = chunk.loops.data[i];
+    printf("%4d %04d line %4d %12llu\n", i, site.offset,
+           chunk.lines.data[site.offset],
+           static_cast<unsigned long long>(site.count));
+  }
+}
+
+auto print_property_caches(Chunk const &chunk) -> void {
+  printf("== property caches ==\n");
+  for (int i = 0; i < chunk.caches.count; ++i) {
+    auto const &cache = chunk.caches.data[i];
+    printf("%4d %04d line %4d %d shapes %12llu misses\n", i, cache.offset,
+           chunk.lines.data[cache.offset], cache.count,
+           static_cast<unsigned long long>(cache.misses));
+  }
+}
+
+auto print_allocation_stats(char const *name, AllocationStats const &stats)
+    -> void {
+  fprintf(stderr, "%-16s %10zu %10zu %8zu %8zu %8zu\n", name,
+          stats.current_bytes, stats.peak_bytes, stats.allocations,
+          stats.reallocations, stats.frees);
+}
+
+auto print_memory_stats(MemoryStats const &stats) -> void {
+  char const *names[memory_category_count] = {
+      "chunk code",    "chunk constants", "chunk lines",   "chunk loops",
+      "chunk caches",  "objects",         "number arrays", "batch columns",
+      "shapes",        "string chars",    "other",
+  };
+  fprintf(stderr, "== memory ==\n");
+  fprintf(stderr, "%-16s %10s %10s %8s %8s %8s\n", "category", "current",
+          "peak", "allocs", "reallocs", "frees");
+  for (int i = 0; i < memory_category_count; ++i)
+    print_allocation_stats(names[i], stats.categories[i]);
+  print_allocation_stats("total", stats.total);
+  fprintf(stderr, "== allocation sizes ==\n");
+  for (int i = 0; i < memory_histogram_buckets; ++i)
+    if (stats.total.histogram[i])
+      fprintf(stderr, "%10zu - %-10zu %8zu\n", size_t{1} << i,
+              (size_t{2} << i) - 1, stats.total.histogram[i]);
+}
+
+auto print_pause_stats(char const *name, PauseStats const &stats) -> void {
+  fprintf(stderr, "== %s pauses ==\n", name);
+  fprintf(stderr, "%zu pauses, p50 %llu ns, p99 %llu ns, max %llu ns\n",
+          stats.pauses,
+          static_cast<unsigned long long>(pause_percentile(stats, 0.5)),
+          static_cast<unsigned long long>(pause_percentile(stats, 0.99)),
+          static_cast<unsigned long long>(stats.max_ns));
+  for (int i = 0; i < pause_histogram_buckets; ++i)
+    if (stats.histogram[i])
+      fprintf(stderr, "%10llu - %-10llu %8zu\n", 1ull << i, (2ull << i) - 1,
+              stats.histogram[i]);
+}
+
 } // namespace lox
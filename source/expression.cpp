@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include <expression.hpp>
+
+namespace lox {
+
+auto constexpr table_minimum = 64;
+auto constexpr size_limit = 1 << 20;
+
+auto intern(ExpressionGraph &graph, Node const &node) -> int;
+auto grow_table(ExpressionGraph &graph) -> void;
+auto find_slot(ExpressionGraph const &graph, Node const &node) -> int;
+auto hash_node(Node const &node) -> uint64_t;
+auto mix(uint64_t value) -> uint64_t;
+auto same_node(Node const &lhs, Node const &rhs) -> bool;
+auto value_bits(Value const &value) -> uint64_t;
+auto is_constant(ExpressionGraph const &graph, int node, double number)
+    -> bool;
+auto combined_size(int lhs, int rhs) -> int;
+
+// A large expression leaves a large table behind, which the small ones that
+// usually follow would otherwise clear in full every time.
+auto clear(ExpressionGraph &graph) -> void {
+  if (graph.table.count > table_minimum &&
+      graph.table.count > 4 * graph.nodes.count)
+    graph.table.count = table_minimum;
+  std::fill_n(graph.table.data, graph.table.count, -1);
+  graph.nodes.count = 0;
+  graph.arguments.count = 0;
+  graph.epoch = 0;
+}
+
+auto constant_node(ExpressionGraph &graph, Value value, int line) -> int {
+  return intern(graph, Node{NodeOp::CONSTANT, is_number(value),
+                            is_bool(value), true, 0, 1, 0, -1, -1, line,
+                            value});
+}
+
+auto read_node(ExpressionGraph &graph, NodeOp op, int slot, int line)
+    -> int {
+  return intern(graph, Node{op, false, false, op != NodeOp::GLOBAL, slot, 1,
+                            graph.epoch, -1, -1, line, nil_val});
+}
+
+auto unary_node(ExpressionGraph &graph, NodeOp op, int operand, int line)
+    -> int {
+  if (operand < 0)
+    return -1;
+  auto const x = graph.nodes.data[operand];
+  if (op == NodeOp::NOT && x.op == NodeOp::CONSTANT)
+    return constant_node(graph, bool_val(is_falsey(x.value)), line);
+  if (op == NodeOp::NOT && x.op == NodeOp::NOT &&
+      graph.nodes.data[x.left].boolean)
+    return x.left;
+  auto const number = op == NodeOp::NEGATE && x.number;
+  auto const pure = x.pure && (op == NodeOp::NOT || x.number);
+  return intern(graph, Node{op, number, op == NodeOp::NOT, pure, 0,
+                            combined_size(x.size, 0), 0, operand, -1, line,
+                            nil_val});
+}
+
+// x + 0 is left alone: it turns -0 into 0.
+auto binary_node(ExpressionGraph &graph, NodeOp op, int left, int right,
+                 int line) -> int {
+  if (left < 0 || right < 0)
+    return -1;
+  auto const x = graph.nodes.data[left];
+  auto const y = graph.nodes.data[right];
+  switch (op) {
+  case NodeOp::AND:
+    if (x.op == NodeOp::CONSTANT)
+      return is_falsey(x.value) ? left : right;
+    break;
+  case NodeOp::OR:
+    if (x.op == NodeOp::CONSTANT)
+      return is_falsey(x.value) ? right : left;
+    break;
+  case NodeOp::MULTIPLY:
+    if (x.number && is_constant(graph, right, 1))
+      return left;
+    if (y.number && is_constant(graph, left, 1))
+      return right;
+    break;
+  case NodeOp::DIVIDE:
+    if (x.number && is_constant(graph, right, 1))
+      return left;
+    break;
+  case NodeOp::SUBTRACT:
+    if (x.number && is_constant(graph, right, 0))
+      return left;
+    break;
+  default:
+    break;
+  }
+  auto const numbers = x.number && y.number;
+  auto node = Node{op, false, false, x.pure && y.pure, 0,
+                   combined_size(x.size, y.size), 0, left, right, line,
+                   nil_val};
+  switch (op) {
+  case NodeOp::EQUAL:
+    node.boolean = true;
+    break;
+  case NodeOp::GREATER:
+  case NodeOp::LESS:
+    node.boolean = numbers;
+    node.pure = node.pure && numbers;
+    break;
+  case NodeOp::AND:
+  case NodeOp::OR:
+    node.boolean = x.boolean && y.boolean;
+    break;
+  default:
+    node.number = numbers;
+    node.pure = node.pure && numbers;
+  }
+  return intern(graph, node);
+}
+
+auto call_node(ExpressionGraph &graph, int callee,
+               std::span<int const> arguments, int line) -> int {
+  if (callee < 0)
+    return -1;
+  auto size = graph.nodes.data[callee].size;
+  for (auto const argument : arguments) {
+    if (argument < 0)
+      return -1;
+    size = combined_size(size, graph.nodes.data[argument].size);
+  }
+  auto const start = graph.arguments.count;
+  append(graph.arguments, arguments.data(),
+         static_cast<int>(arguments.size()));
+  write(graph.nodes, Node{NodeOp::CALL, false, false, false,
+                          static_cast<int>(arguments.size()), size,
+                          graph.epoch, callee, start, line, nil_val});
+  ++graph.epoch;
+  return graph.nodes.count - 1;
+}
+
+// Operands come before their users, so walking down from root sees every
+// user of a node before the node itself.
+auto count_uses(ExpressionGraph const &graph, int root, Array<int> &uses)
+    -> void {
+  reserve(uses, graph.nodes.count);
+  uses.count = graph.nodes.count;
+  std::fill_n(uses.data, uses.count, 0);
+  if (root < 0)
+    return;
+  uses.data[root] = 1;
+  for (auto i = root; i >= 0; --i) {
+    if (uses.data[i] == 0)
+      continue;
+    auto const &node = graph.nodes.data[i];
+    switch (node.op) {
+    case NodeOp::CONSTANT:
+    case NodeOp::LOCAL:
+    case NodeOp::UPVALUE:
+    case NodeOp::GLOBAL:
+      break;
+    case NodeOp::NOT:
+    case NodeOp::NEGATE:
+      ++uses.data[node.left];
+      break;
+    case NodeOp::CALL:
+      ++uses.data[node.left];
+      for (auto j = 0; j < node.operand; ++j)
+        ++uses.data[graph.arguments.data[node.right + j]];
+      break;
+    default:
+      ++uses.data[node.left];
+      ++uses.data[node.right];
+    }
+  }
+}
+
+// Calls are never interned, so that each one runs.
+auto intern(ExpressionGraph &graph, Node const &node) -> int {
+  if (2 * (graph.nodes.count + 1) > graph.table.count)
+    grow_table(graph);
+  auto const slot = find_slot(graph, node);
+  if (graph.table.data[slot] != -1)
+    return graph.table.data[slot];
+  graph.table.data[slot] = graph.nodes.count;
+  write(graph.nodes, node);
+  return graph.nodes.count - 1;
+}
+
+auto grow_table(ExpressionGraph &graph) -> void {
+  auto const count = std::max(table_minimum, 2 * graph.table.count);
+  reserve(graph.table, count);
+  graph.table.count = count;
+  std::fill_n(graph.table.data, count, -1);
+  for (auto i = 0; i < graph.nodes.count; ++i)
+    if (graph.nodes.data[i].op != NodeOp::CALL)
+      graph.table.data[find_slot(graph, graph.nodes.data[i])] = i;
+}
+
+// The slot holding a node equal to node, or the empty slot it would go in.
+auto find_slot(ExpressionGraph const &graph, Node const &node) -> int {
+  auto const mask = graph.table.count - 1;
+  for (auto slot = static_cast<int>(hash_node(node) & mask);;
+       slot = (slot + 1) & mask) {
+    auto const index = graph.table.data[slot];
+    if (index == -1 || same_node(graph.nodes.data[index], node))
+      return slot;
+  }
+}
+
+auto hash_node(Node const &node) -> uint64_t {
+  uint64_t const fields[] = {
+      static_cast<uint64_t>(node.op), static_cast<uint64_t>(node.operand),
+      static_cast<uint64_t>(node.epoch), static_cast<uint64_t>(node.left),
+      static_cast<uint64_t>(node.right), value_bits(node.value)};
+  auto hash = uint64_t{0};
+  for (auto const field : fields)
+    hash = mix(hash ^ field);
+  return hash;
+}
+
+// The finalizer of splitmix64, which spreads every bit of value over the
+// bits the table index takes. Integer constants differ only in high bits.
+auto mix(uint64_t value) -> uint64_t {
+  value = (value ^ value >> 30) * 0xbf58476d1ce4e5b9u;
+  value = (value ^ value >> 27) * 0x94d049bb133111ebu;
+  return value ^ value >> 31;
+}
+
+// Constants are only equal when they are the same bits, so 0 and -0 stay
+// apart.
+auto same_node(Node const &lhs, Node const &rhs) -> bool {
+  return lhs.op == rhs.op && lhs.operand == rhs.operand &&
+         lhs.epoch == rhs.epoch && lhs.left == rhs.left &&
+         lhs.right == rhs.right && lhs.value.type == rhs.value.type &&
+         value_bits(lhs.value) == value_bits(rhs.value);
+}
+
+auto value_bits(Value const &value) -> uint64_t {
+  auto bits = uint64_t{0};
+  switch (value.type) {
+  case ValueType::BOOL:
+    return value.as.boolean;
+  case ValueType::NIL:
+    return 0;
+  case ValueType::NUMBER:
+    memcpy(&bits, &value.as.number, sizeof(bits));
+    return bits;
+  case ValueType::OBJ:
+    return reinterpret_cast<uintptr_t>(value.as.obj);
+  }
+  return bits;
+}
+
+auto is_constant(ExpressionGraph const &graph, int node, double number)
+    -> bool {
+  auto const &value = graph.nodes.data[node].value;
+  return graph.nodes.data[node].op == NodeOp::CONSTANT && is_number(value) &&
+         value_bits(value) == value_bits(number_val(number));
+}
+
+auto combined_size(int lhs, int rhs) -> int {
+  return std::min(lhs + rhs + 1, size_limit);
+}
+
+} // namespace lox
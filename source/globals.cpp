@@ -0,0 +1,24 @@
+#include <globals.hpp>
+#include <object.hpp>
+
+namespace lox {
+
+// Returns the slot of name, allocating an undefined one on first use, or -1
+// when every slot is taken.
+auto resolve_global(Globals &globals, std::string_view name) -> int {
+  auto const found = globals.indexes.find(name);
+  if (found != globals.indexes.end())
+    return found->second;
+  if (globals.slots.count == globals_max)
+    return -1;
+  auto const string = copy_string(name);
+  write(globals.slots, GlobalSlot{nil_val, false});
+  write(globals.names, string);
+  auto const index = globals.slots.count - 1;
+  globals.indexes.emplace(std::string_view{string->chars,
+                                           static_cast<size_t>(string->length)},
+                          index);
+  return index;
+}
+
+} // namespace lox
@@ -1,38 +1,101 @@
 #include <cstdio>
 #include <fstream>
+#include <memory>
 #include <stdio.h>
 #include <stdlib.h>
 #include <streambuf>
 #include <string>
+#include <string_view>
+#include <unistd.h>
 
 #include <chunk.hpp>
+#include <collector.hpp>
+#include <compiler.hpp>
 #include <debug.hpp>
+#include <natives.hpp>
+#include <nursery.hpp>
+#include <registers.hpp>
+#include <trace.hpp>
 #include <virtual_machine.hpp>
 
 using lox::add_constant;
 using lox::Chunk;
+using lox::Collector;
+using lox::compile;
+using lox::define_array_natives;
 using lox::disassemble;
 using lox::interpret;
 using lox::InterpretResult;
+using lox::lower_to_registers;
+using lox::memory_stats;
+using lox::Nursery;
+using lox::ObjectAllocator;
 using lox::OpCode;
+using lox::print_memory_stats;
+using lox::print_pause_stats;
+using lox::RegisterChunk;
+using lox::run_registers;
+using lox::set_object_allocator;
+using lox::TraceRing;
 using lox::VirtualMachine;
 using lox::write;
+using lox::write_trace;
 
 auto repl(VirtualMachine &vm) -> void;
 auto run_file(VirtualMachine &vm, char const *path) -> void;
+auto run_on_registers(VirtualMachine &vm, std::string const &source)
+    -> InterpretResult;
+auto usage() -> void;
+auto report_memory_stats() -> void;
+auto dump_trace() -> void;
 
+static auto trace = std::unique_ptr<TraceRing>{};
+static auto collector = std::unique_ptr<Collector>{};
+static auto trace_path = static_cast<char const *>(nullptr);
+static auto on_registers = false;
+
+// Flags come before the path, in any order.
 auto main(int argc, char const *argv[]) -> int
 {
+  auto nursery = std::unique_ptr<Nursery>{};
+  auto path = static_cast<char const *>(nullptr);
+  for (auto i = 1; i < argc; ++i)
+  {
+    auto const argument = std::string_view{argv[i]};
+    if (path != nullptr)
+      usage();
+    else if (argument == "--mem-stats")
+      atexit(report_memory_stats);
+    else if (argument == "--trace" && i + 1 < argc)
+    {
+      trace = std::make_unique<TraceRing>();
+      trace_path = argv[++i];
+      atexit(dump_trace);
+    }
+    else if (argument == "--registers")
+      on_registers = true;
+    else if (argument == "--pool")
+      set_object_allocator(ObjectAllocator::POOL);
+    else if (argument == "--nursery")
+      nursery = std::make_unique<Nursery>();
+    else if (argument == "--gc")
+      collector = std::make_unique<Collector>();
+    else if (argument.starts_with("--"))
+      usage();
+    else
+      path = argv[i];
+  }
   auto vm = VirtualMachine{};
-  if (argc == 1)
+  vm.trace = trace.get();
+  vm.nursery = nursery.get();
+  vm.collector = collector.get();
+  // Like stdout, what scripts print goes out a line at a time on a terminal.
+  vm.out.flush_lines = isatty(STDOUT_FILENO);
+  define_array_natives(vm);
+  if (path == nullptr)
     repl(vm);
-  else if (argc == 2)
-    run_file(vm, argv[1]);
   else
-  {
-    fprintf(stderr, "Usage: lox [path]\n");
-    exit(64);
-  }
+    run_file(vm, path);
   return 0;
 }
 
@@ -42,6 +105,7 @@ auto repl(VirtualMachine &vm) -> void
   for (;;)
   {
     printf("> ");
+    fflush(stdout);
     if (!fgets(line, sizeof(line), stdin))
     {
       printf("\n");
@@ -56,9 +120,62 @@ auto run_file(VirtualMachine &vm, char const *path) -> void
   auto file = std::ifstream{path};
   auto const source = std::string{std::istreambuf_iterator<char>(file),
                                   std::istreambuf_iterator<char>()};
-  auto const result = interpret(vm, source);
+  auto const result =
+      on_registers ? run_on_registers(vm, source) : interpret(vm, source);
   if (result == InterpretResult::COMPILE_ERROR)
     exit(65);
   if (result == InterpretResult::RUNTIME_ERROR)
     exit(70);
 }
+
+// Lowers the script to register code and runs that instead of its stack
+// code.
+auto run_on_registers(VirtualMachine &vm, std::string const &source)
+    -> InterpretResult
+{
+  auto const function = compile(source, vm.globals);
+  if (function == nullptr)
+    return InterpretResult::COMPILE_ERROR;
+  auto chunk = RegisterChunk{};
+  auto result = InterpretResult::COMPILE_ERROR;
+  if (!lower_to_registers(function, chunk))
+    fprintf(stderr, "Only scripts without calls, closures or classes can run "
+                    "on registers.\n");
+  else
+  {
+    if constexpr (lox::print_code)
+      disassemble(chunk, "registers");
+    result = run_registers(vm, chunk);
+    if (result == InterpretResult::OK && !is_nil(vm.result))
+    {
+      print(vm.out, vm.result);
+      put(vm.out, '\n');
+      flush(vm.out);
+    }
+  }
+  free_object(&function->obj);
+  return result;
+}
+
+auto usage() -> void
+{
+  fprintf(stderr, "Usage: lox [--mem-stats] [--trace file] [--registers] "
+                  "[--pool] [--nursery] [--gc] [path]\n");
+  exit(64);
+}
+
+auto report_memory_stats() -> void
+{
+  print_memory_stats(memory_stats());
+  if (collector == nullptr)
+    return;
+  print_pause_stats("marking", collector->mark_pauses);
+  print_pause_stats("sweeping", collector->sweep_pauses);
+}
+
+// Runs at exit, so the trace of a script that failed is written too.
+auto dump_trace() -> void
+{
+  if (!write_trace(*trace, trace_path))
+    fprintf(stderr, "Could not write trace \"%s\".\n", trace_path);
+}
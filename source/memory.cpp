@@ -1,9 +1,266 @@
 #include <memory.hpp>
+#include <nursery.hpp>
 
 namespace lox {
 
+auto constexpr pool_class_count = pool_block_max / pool_class_size;
+
+// A free block holds the next one on the free list of its size class.
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+// Slabs are aligned to their size, so rounding a block down gives its slab.
+// slabs is an open addressed set of their addresses, with 0 for a free
+// entry, that tells pooled blocks from those of the system, which never
+// share a page with a slab. The slabs go back to the system when the thread
+// exits.
+struct Pool {
+  FreeBlock *free_blocks[pool_class_count] = {};
+  uintptr_t *slabs = nullptr;
+  size_t slab_capacity = 0;
+  size_t slab_count = 0;
+
+  ~Pool();
+};
+
+thread_local auto heap_stats = MemoryStats{};
+thread_local auto pool = Pool{};
+thread_local auto current_allocator = ObjectAllocator::SYSTEM;
+thread_local auto current_nursery = static_cast<Nursery *>(nullptr);
+thread_local auto current_meter = static_cast<HeapMeter *>(nullptr);
+
+auto meter(HeapMeter &meter, int64_t bytes) -> void;
+auto exceed(HeapMeter &meter) -> void;
+auto record(AllocationStats &stats, size_t old_size, size_t new_size) -> void;
+auto histogram_bucket(size_t size) -> int;
+auto size_class(size_t size) -> int;
+auto refill(int size_class) -> bool;
+auto is_pooled(void const *pointer) -> bool;
+auto add_slab(uintptr_t slab) -> bool;
+auto slab_index(uintptr_t slab, size_t capacity) -> size_t;
+
 auto grow_capacity(int capacity) -> int {
   return capacity < 8 ? 8 : capacity * 2;
 }
 
+auto memory_stats() -> MemoryStats const & { return heap_stats; }
+
+auto reset_memory_stats() -> void { heap_stats = MemoryStats{}; }
+
+auto record_allocation(MemoryCategory category, size_t old_size,
+                       size_t new_size) -> void {
+  if (old_size == 0 && new_size == 0)
+    return;
+  if (current_meter != nullptr)
+    meter(*current_meter, static_cast<int64_t>(new_size - old_size));
+  record(heap_stats.total, old_size, new_size);
+  record(heap_stats.categories[static_cast<uint8_t>(category)], old_size,
+         new_size);
+}
+
+auto meter(HeapMeter &meter, int64_t bytes) -> void {
+  meter.bytes += bytes;
+  if (!meter.exceeded && !fits(meter, 0))
+    exceed(meter);
+}
+
+// Frees of blocks allocated before the meter was in use can take bytes
+// below zero.
+auto fits(HeapMeter const &meter, size_t size) -> bool {
+  auto const bytes = meter.bytes + static_cast<int64_t>(size);
+  return bytes <= 0 || static_cast<size_t>(bytes) <= meter.limit;
+}
+
+auto exceed(HeapMeter &meter) -> void {
+  meter.exceeded = true;
+  if (meter.fuel == nullptr)
+    return;
+  meter.fuel_left = *meter.fuel;
+  *meter.fuel = 0;
+}
+
+auto record(AllocationStats &stats, size_t old_size, size_t new_size) -> void {
+  if (old_size == 0)
+    ++stats.allocations;
+  else if (new_size == 0)
+    ++stats.frees;
+  else
+    ++stats.reallocations;
+  if (new_size != 0)
+    ++stats.histogram[histogram_bucket(new_size)];
+  stats.current_bytes = stats.current_bytes - old_size + new_size;
+  if (stats.current_bytes > stats.peak_bytes)
+    stats.peak_bytes = stats.current_bytes;
+}
+
+auto histogram_bucket(size_t size) -> int {
+  auto bucket = 0;
+  while (size >>= 1)
+    ++bucket;
+  return bucket < memory_histogram_buckets ? bucket
+                                           : memory_histogram_buckets - 1;
+}
+
+auto object_allocator() -> ObjectAllocator { return current_allocator; }
+
+auto set_object_allocator(ObjectAllocator allocator) -> void {
+  current_allocator = allocator;
+}
+
+// Objects that go to the object allocator because the nursery is full may
+// be given young values without a write barrier seeing it, so the nursery
+// keeps them to look through when it is collected.
+auto allocate_small(size_t size, MemoryCategory category) -> void * {
+  if (current_nursery == nullptr)
+    return allocate_tenured(size, category);
+  auto block = allocate_young(*current_nursery, size, pool_class_size,
+                              category);
+  if (block != nullptr)
+    return block;
+  block = allocate_tenured(size, category);
+  if (category == MemoryCategory::OBJECT)
+    write(current_nursery->tenured, static_cast<Obj *>(block));
+  return block;
+}
+
+auto allocate_tenured(size_t size, MemoryCategory category) -> void * {
+  if (current_allocator == ObjectAllocator::SYSTEM || size > pool_block_max)
+    return reallocate<void>(nullptr, 0, size, category);
+  auto const index = size_class(size);
+  if (pool.free_blocks[index] == nullptr && !refill(index))
+    return nullptr;
+  record_allocation(category, 0, size);
+  auto const block = pool.free_blocks[index];
+  pool.free_blocks[index] = block->next;
+  return block;
+}
+
+auto free_small(void *pointer, size_t size, MemoryCategory category) -> void {
+  if (current_nursery != nullptr && is_young(*current_nursery, pointer)) {
+    free_young(*current_nursery, pointer);
+    return;
+  }
+  if (size > pool_block_max || !is_pooled(pointer)) {
+    reallocate(pointer, size, 0, category);
+    return;
+  }
+  record_allocation(category, size, 0);
+  auto const index = size_class(size);
+  auto const block = static_cast<FreeBlock *>(pointer);
+  block->next = pool.free_blocks[index];
+  pool.free_blocks[index] = block;
+}
+
+auto use_nursery(Nursery *nursery) -> Nursery * {
+  auto const previous = current_nursery;
+  current_nursery = nursery;
+  return previous;
+}
+
+auto active_nursery() -> Nursery * { return current_nursery; }
+
+auto use_heap_meter(HeapMeter *meter) -> HeapMeter * {
+  auto const previous = current_meter;
+  current_meter = meter;
+  return previous;
+}
+
+auto heap_allows(size_t size) -> bool {
+  if (current_meter == nullptr || fits(*current_meter, size))
+    return true;
+  if (current_meter->reclaimable && size <= current_meter->limit)
+    return true;
+  current_meter->reclaimable = false;
+  if (!current_meter->exceeded)
+    exceed(*current_meter);
+  return false;
+}
+
+auto pool_slabs() -> size_t { return pool.slab_count; }
+
+Pool::~Pool() {
+  for (size_t i = 0; i < slab_capacity; ++i)
+    free(reinterpret_cast<void *>(slabs[i]));
+  free(slabs);
+}
+
+auto size_class(size_t size) -> int {
+  return size == 0 ? 0 : static_cast<int>((size - 1) / pool_class_size);
+}
+
+// Cuts a new slab into blocks of size_class, pushed so that the first one
+// handed out is the lowest in the slab. Returns false if the system has no
+// memory for it.
+auto refill(int size_class) -> bool {
+  auto const slab = aligned_alloc(pool_slab_size, pool_slab_size);
+  if (slab == nullptr)
+    return false;
+  if (!add_slab(reinterpret_cast<uintptr_t>(slab))) {
+    free(slab);
+    return false;
+  }
+  auto const block_size = (size_class + 1) * pool_class_size;
+  auto const blocks = static_cast<char *>(slab);
+  auto const count = pool_slab_size / block_size;
+  for (auto i = count; i > 0; --i) {
+    auto const block = reinterpret_cast<FreeBlock *>(blocks +
+                                                     (i - 1) * block_size);
+    block->next = pool.free_blocks[size_class];
+    pool.free_blocks[size_class] = block;
+  }
+  return true;
+}
+
+auto is_pooled(void const *pointer) -> bool {
+  if (pool.slab_count == 0)
+    return false;
+  auto const slab = reinterpret_cast<uintptr_t>(pointer) &
+                    ~static_cast<uintptr_t>(pool_slab_size - 1);
+  for (auto i = slab_index(slab, pool.slab_capacity);;
+       i = (i + 1) & (pool.slab_capacity - 1)) {
+    if (pool.slabs[i] == slab)
+      return true;
+    if (pool.slabs[i] == 0)
+      return false;
+  }
+}
+
+// The set is kept at most half full, growing by doubling. Its memory is
+// not counted, as that of the slabs is not.
+auto add_slab(uintptr_t slab) -> bool {
+  if (2 * (pool.slab_count + 1) > pool.slab_capacity) {
+    auto const capacity = pool.slab_capacity < 64 ? 64 : 2 * pool.slab_capacity;
+    auto const slabs =
+        static_cast<uintptr_t *>(calloc(capacity, sizeof(uintptr_t)));
+    if (slabs == nullptr)
+      return false;
+    for (size_t i = 0; i < pool.slab_capacity; ++i) {
+      if (pool.slabs[i] == 0)
+        continue;
+      auto j = slab_index(pool.slabs[i], capacity);
+      while (slabs[j] != 0)
+        j = (j + 1) & (capacity - 1);
+      slabs[j] = pool.slabs[i];
+    }
+    free(pool.slabs);
+    pool.slabs = slabs;
+    pool.slab_capacity = capacity;
+  }
+  auto i = slab_index(slab, pool.slab_capacity);
+  while (pool.slabs[i] != 0)
+    i = (i + 1) & (pool.slab_capacity - 1);
+  pool.slabs[i] = slab;
+  ++pool.slab_count;
+  return true;
+}
+
+// Slabs differ only in the bits above those of the offset. An odd
+// multiplier maps consecutive slabs to different entries and spreads those
+// far apart.
+auto slab_index(uintptr_t slab, size_t capacity) -> size_t {
+  return (slab / pool_slab_size * UINT64_C(0x9e3779b97f4a7c15)) &
+         (capacity - 1);
+}
+
 } // namespace lox
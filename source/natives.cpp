@@ -0,0 +1,98 @@
+#include <math.h>
+
+#include <memory.hpp>
+#include <natives.hpp>
+#include <number_array.hpp>
+#include <object.hpp>
+
+namespace lox {
+
+auto is_count(Value const &value) -> bool;
+auto is_array_size(Value const &value) -> bool;
+auto array_native(std::span<Value const> arguments) -> Value;
+auto range_native(std::span<Value const> arguments) -> Value;
+auto length_native(std::span<Value const> arguments) -> Value;
+auto at_native(std::span<Value const> arguments) -> Value;
+auto sum_native(std::span<Value const> arguments) -> Value;
+auto min_native(std::span<Value const> arguments) -> Value;
+auto max_native(std::span<Value const> arguments) -> Value;
+template <typename Reduce>
+auto reduce(Value const &value, Reduce reduce) -> Value;
+
+auto define_array_natives(VirtualMachine &vm) -> void {
+  define_native(vm, "array", 2, array_native);
+  define_native(vm, "range", 1, range_native);
+  define_native(vm, "length", 1, length_native);
+  define_native(vm, "at", 2, at_native);
+  define_native(vm, "sum", 1, sum_native);
+  define_native(vm, "min", 1, min_native);
+  define_native(vm, "max", 1, max_native);
+}
+
+auto is_count(Value const &value) -> bool {
+  return is_number(value) && value.as.number >= 0 &&
+         value.as.number <= INT32_MAX &&
+         value.as.number == trunc(value.as.number);
+}
+
+// An array too large for the heap limit of the run is not made, and the
+// run stops once the native returns.
+auto is_array_size(Value const &value) -> bool {
+  return is_count(value) && heap_allows(sizeof(double) * value.as.number);
+}
+
+auto array_native(std::span<Value const> arguments) -> Value {
+  if (!is_array_size(arguments[0]) || !is_number(arguments[1]))
+    return nil_val;
+  auto const array = new_number_array(arguments[0].as.number);
+  for (int i = 0; i < array->count; ++i)
+    array->data[i] = arguments[1].as.number;
+  return obj_val(array);
+}
+
+auto range_native(std::span<Value const> arguments) -> Value {
+  if (!is_array_size(arguments[0]))
+    return nil_val;
+  auto const array = new_number_array(arguments[0].as.number);
+  for (int i = 0; i < array->count; ++i)
+    array->data[i] = i;
+  return obj_val(array);
+}
+
+auto length_native(std::span<Value const> arguments) -> Value {
+  if (!is_number_array(arguments[0]))
+    return nil_val;
+  return number_val(as_number_array(arguments[0])->count);
+}
+
+auto at_native(std::span<Value const> arguments) -> Value {
+  if (!is_number_array(arguments[0]) || !is_count(arguments[1]))
+    return nil_val;
+  auto const array = as_number_array(arguments[0]);
+  auto const index = static_cast<int>(arguments[1].as.number);
+  if (index >= array->count)
+    return nil_val;
+  return number_val(array->data[index]);
+}
+
+auto sum_native(std::span<Value const> arguments) -> Value {
+  return reduce(arguments[0], reduce_sum);
+}
+
+auto min_native(std::span<Value const> arguments) -> Value {
+  return reduce(arguments[0], reduce_min);
+}
+
+auto max_native(std::span<Value const> arguments) -> Value {
+  return reduce(arguments[0], reduce_max);
+}
+
+template <typename Reduce>
+auto reduce(Value const &value, Reduce reduce) -> Value {
+  if (!is_number_array(value))
+    return nil_val;
+  auto const array = as_number_array(value);
+  return number_val(reduce(array->data, array->count));
+}
+
+} // namespace lox
@@ -0,0 +1,200 @@
+#include <math.h>
+#include <string.h>
+
+#include <number_array.hpp>
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__gnu_linux__)
+#define LOX_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define LOX_SIMD_CLONES
+#endif
+
+namespace lox {
+
+// Four lanes fill one AVX2 register and two SSE2 registers, so the same
+// generic code is lowered to either by the clone it is inlined into. Every
+// function taking Lanes is always inlined into a clone, so the vector calling
+// convention that -Wpsabi warns about is never used.
+#pragma GCC diagnostic ignored "-Wpsabi"
+using Lanes = double __attribute__((vector_size(32)));
+using Mask = int64_t __attribute__((vector_size(32)));
+auto constexpr lane_count = sizeof(Lanes) / sizeof(double);
+
+struct Add {
+  template <typename T>
+  [[gnu::always_inline]] auto operator()(T const &lhs, T const &rhs) const
+      -> T {
+    return lhs + rhs;
+  }
+};
+
+struct Subtract {
+  template <typename T>
+  [[gnu::always_inline]] auto operator()(T const &lhs, T const &rhs) const
+      -> T {
+    return lhs - rhs;
+  }
+};
+
+struct Multiply {
+  template <typename T>
+  [[gnu::always_inline]] auto operator()(T const &lhs, T const &rhs) const
+      -> T {
+    return lhs * rhs;
+  }
+};
+
+struct Divide {
+  template <typename T>
+  [[gnu::always_inline]] auto operator()(T const &lhs, T const &rhs) const
+      -> T {
+    return lhs / rhs;
+  }
+};
+
+// Comparisons yield all ones lanes, and masking the bits of 1.0 with them
+// produces 1.0 or 0.0 without a branch.
+auto constexpr one_bits = int64_t{0x3ff0000000000000};
+
+struct Equal {
+  [[gnu::always_inline]] auto operator()(Lanes const &lhs,
+                                         Lanes const &rhs) const -> Lanes {
+    return reinterpret_cast<Lanes>((lhs == rhs) & one_bits);
+  }
+  [[gnu::always_inline]] auto operator()(double lhs, double rhs) const
+      -> double {
+    return lhs == rhs ? 1.0 : 0.0;
+  }
+};
+
+struct Less {
+  [[gnu::always_inline]] auto operator()(Lanes const &lhs,
+                                         Lanes const &rhs) const -> Lanes {
+    return reinterpret_cast<Lanes>((lhs < rhs) & one_bits);
+  }
+  [[gnu::always_inline]] auto operator()(double lhs, double rhs) const
+      -> double {
+    return lhs < rhs ? 1.0 : 0.0;
+  }
+};
+
+struct Greater {
+  [[gnu::always_inline]] auto operator()(Lanes const &lhs,
+                                         Lanes const &rhs) const -> Lanes {
+    return reinterpret_cast<Lanes>((lhs > rhs) & one_bits);
+  }
+  [[gnu::always_inline]] auto operator()(double lhs, double rhs) const
+      -> double {
+    return lhs > rhs ? 1.0 : 0.0;
+  }
+};
+
+[[gnu::always_inline]] inline auto load(double const *data) -> Lanes {
+  auto lanes = Lanes{};
+  memcpy(&lanes, data, sizeof(lanes));
+  return lanes;
+}
+
+[[gnu::always_inline]] inline auto load(ArrayOperand operand, size_t index)
+    -> Lanes {
+  if (operand.broadcast)
+    return Lanes{} + operand.data[0];
+  return load(operand.data + index);
+}
+
+[[gnu::always_inline]] inline auto store(double *data, Lanes const &lanes)
+    -> void {
+  memcpy(data, &lanes, sizeof(lanes));
+}
+
+template <typename Op>
+[[gnu::always_inline]] inline auto apply(Op op, ArrayOperand lhs,
+                                         ArrayOperand rhs, double *result,
+                                         size_t count) -> void {
+  auto i = size_t{0};
+  for (; i + lane_count <= count; i += lane_count)
+    store(result + i, op(load(lhs, i), load(rhs, i)));
+  for (; i < count; ++i)
+    result[i] = op(lhs.data[lhs.broadcast ? 0 : i],
+                   rhs.data[rhs.broadcast ? 0 : i]);
+}
+
+LOX_SIMD_CLONES auto apply(ArrayOp op, ArrayOperand lhs, ArrayOperand rhs,
+                           double *result, size_t count) -> void {
+  switch (op) {
+  case ArrayOp::ADD:
+    return apply(Add{}, lhs, rhs, result, count);
+  case ArrayOp::SUBTRACT:
+    return apply(Subtract{}, lhs, rhs, result, count);
+  case ArrayOp::MULTIPLY:
+    return apply(Multiply{}, lhs, rhs, result, count);
+  case ArrayOp::DIVIDE:
+    return apply(Divide{}, lhs, rhs, result, count);
+  case ArrayOp::EQUAL:
+    return apply(Equal{}, lhs, rhs, result, count);
+  case ArrayOp::LESS:
+    return apply(Less{}, lhs, rhs, result, count);
+  case ArrayOp::GREATER:
+    return apply(Greater{}, lhs, rhs, result, count);
+  }
+}
+
+LOX_SIMD_CLONES auto reduce_sum(double const *data, size_t count) -> double {
+  auto lanes = Lanes{};
+  auto i = size_t{0};
+  for (; i + lane_count <= count; i += lane_count)
+    lanes += load(data + i);
+  auto sum = 0.0;
+  for (size_t lane = 0; lane < lane_count; ++lane)
+    sum += lanes[lane];
+  for (; i < count; ++i)
+    sum += data[i];
+  return sum;
+}
+
+// An empty array has no minimum or maximum, which is reported as NaN.
+LOX_SIMD_CLONES auto reduce_min(double const *data, size_t count) -> double {
+  if (count == 0)
+    return NAN;
+  auto lanes = Lanes{} + data[0];
+  auto i = size_t{0};
+  for (; i + lane_count <= count; i += lane_count) {
+    auto const next = load(data + i);
+    lanes = next < lanes ? next : lanes;
+  }
+  auto min = lanes[0];
+  for (size_t lane = 1; lane < lane_count; ++lane)
+    min = lanes[lane] < min ? lanes[lane] : min;
+  for (; i < count; ++i)
+    min = data[i] < min ? data[i] : min;
+  return min;
+}
+
+LOX_SIMD_CLONES auto reduce_max(double const *data, size_t count) -> double {
+  if (count == 0)
+    return NAN;
+  auto lanes = Lanes{} + data[0];
+  auto i = size_t{0};
+  for (; i + lane_count <= count; i += lane_count) {
+    auto const next = load(data + i);
+    lanes = next > lanes ? next : lanes;
+  }
+  auto max = lanes[0];
+  for (size_t lane = 1; lane < lane_count; ++lane)
+    max = lanes[lane] > max ? lanes[lane] : max;
+  for (; i < count; ++i)
+    max = data[i] > max ? data[i] : max;
+  return max;
+}
+
+auto simd_instruction_set() -> char const * {
+#if defined(__GNUC__) && defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    return "avx2";
+  return "sse2";
+#else
+  return "generic";
+#endif
+}
+
+} // namespace lox
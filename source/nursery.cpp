@@ -0,0 +1,283 @@
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#include <collector.hpp>
+#include <number_array.hpp>
+#include <nursery.hpp>
+#include <virtual_machine.hpp>
+
+namespace lox {
+
+auto header_of(void *block) -> YoungHeader *;
+auto promote(Nursery &nursery, Value &value) -> void;
+template <typename T> auto promote(Nursery &nursery, T *&object) -> void;
+auto evacuate(Nursery &nursery, Obj *object) -> Obj *;
+auto trace(Nursery &nursery, Obj *object) -> void;
+auto sweep(Nursery &nursery) -> void;
+auto release(Nursery const &nursery, Obj *object) -> void;
+
+Nursery::Nursery(size_t size)
+    : begin{static_cast<char *>(malloc(size))}, top{begin},
+      end{begin + size} {}
+
+Nursery::~Nursery() { free(begin); }
+
+// Blocks and headers are kept at multiples of the header size, so a block
+// that needs more alignment is preceded by a filler.
+auto allocate_young(Nursery &nursery, size_t size, size_t alignment,
+                    MemoryCategory category) -> void * {
+  auto const header = sizeof(YoungHeader);
+  auto const address = reinterpret_cast<uintptr_t>(nursery.top) + header;
+  auto const padding = aligned_size(address, alignment) - address;
+  auto const needed = padding + header + aligned_size(size, header);
+  if (nursery.full ||
+      needed > static_cast<size_t>(nursery.end - nursery.top)) {
+    nursery.full = true;
+    return nullptr;
+  }
+  if (padding != 0) {
+    new (nursery.top) YoungHeader{nullptr,
+                                  static_cast<uint32_t>(padding - header),
+                                  MemoryCategory::OTHER, true};
+    nursery.top += padding;
+  }
+  auto const young = new (nursery.top)
+      YoungHeader{nullptr, static_cast<uint32_t>(size), category, false};
+  nursery.top += needed - padding;
+  record_allocation(category, 0, size);
+  return young + 1;
+}
+
+// The block is only given back when the nursery is collected, as it may
+// not be the last one.
+auto free_young(Nursery &, void *block) -> void {
+  auto const header = header_of(block);
+  record_allocation(header->category, header->size, 0);
+  header->filler = true;
+}
+
+auto remember(Nursery &nursery, Obj *owner) -> void {
+  owner->remembered = true;
+  write(nursery.remembered, owner);
+}
+
+auto remember_slot(Nursery *nursery, Value *slot) -> void {
+  if (nursery != nullptr && is_obj(*slot) && is_young(*nursery, slot->as.obj))
+    write(nursery->slots, slot);
+}
+
+// The roots are the stack, the closures of the frames, the open upvalues,
+// the globals, the result, and the old objects that may point into the
+// nursery. Copies are traced in the order they were made, which reaches
+// every young object the roots do.
+auto collect_nursery(VirtualMachine &vm) -> void {
+  auto &nursery = *vm.nursery;
+  if (nursery.top == nursery.begin)
+    return;
+  if (vm.collector != nullptr)
+    trace_young(*vm.collector, nursery);
+  for (auto slot = vm.stack; slot < vm.stack_top; ++slot)
+    promote(nursery, *slot);
+  for (int i = 0; i < vm.frame_count; ++i)
+    promote(nursery, vm.frames[i].closure);
+  // Pooled upvalues are not objects of either generation, so each one on
+  // the list is traced here for the copy it may have promoted.
+  for (auto link = &vm.open_upvalues; *link != nullptr;
+       link = &(*link)->next) {
+    promote(nursery, *link);
+    trace(nursery, &(*link)->obj);
+  }
+  for (int i = 0; i < vm.globals.slots.count; ++i)
+    promote(nursery, vm.globals.slots.data[i].value);
+  promote(nursery, vm.result);
+  for (int i = 0; i < nursery.slots.count; ++i)
+    promote(nursery, *nursery.slots.data[i]);
+  for (int i = 0; i < nursery.remembered.count; ++i) {
+    nursery.remembered.data[i]->remembered = false;
+    trace(nursery, nursery.remembered.data[i]);
+  }
+  for (int i = 0; i < nursery.tenured.count; ++i)
+    trace(nursery, nursery.tenured.data[i]);
+  for (int i = 0; i < nursery.copied.count; ++i)
+    trace(nursery, nursery.copied.data[i]);
+  sweep(nursery);
+  nursery.top = nursery.begin;
+  nursery.full = false;
+  nursery.remembered.count = 0;
+  nursery.slots.count = 0;
+  nursery.tenured.count = 0;
+  nursery.copied.count = 0;
+  ++nursery.collections;
+}
+
+auto header_of(void *block) -> YoungHeader * {
+  return static_cast<YoungHeader *>(block) - 1;
+}
+
+auto promote(Nursery &nursery, Value &value) -> void {
+  if (is_obj(value))
+    value.as.obj = evacuate(nursery, value.as.obj);
+}
+
+template <typename T> auto promote(Nursery &nursery, T *&object) -> void {
+  if (object != nullptr)
+    object = reinterpret_cast<T *>(evacuate(nursery, &object->obj));
+}
+
+// Copies a young object into the old generation once, leaving the address
+// of the copy behind for every other reference to it. A closure's captures
+// and a closed upvalue's value live inside the object, and strings and
+// arrays take their young payload along.
+auto evacuate(Nursery &nursery, Obj *object) -> Obj * {
+  if (!is_young(nursery, object))
+    return object;
+  auto const header = header_of(object);
+  if (header->forward != nullptr)
+    return static_cast<Obj *>(header->forward);
+  auto const copy =
+      static_cast<Obj *>(allocate_tenured(header->size, header->category));
+  memcpy(copy, object, header->size);
+  track_object(copy);
+  header->forward = copy;
+  nursery.promoted_bytes += header->size;
+  switch (copy->type) {
+  case ObjType::CLOSURE: {
+    auto const closure = reinterpret_cast<ObjClosure *>(copy);
+    closure->upvalues = reinterpret_cast<ObjUpvalue **>(closure + 1);
+    break;
+  }
+  case ObjType::NUMBER_ARRAY: {
+    auto const array = reinterpret_cast<ObjNumberArray *>(copy);
+    if (!is_young(nursery, array->data))
+      break;
+    auto const data = allocate_aligned<double>(
+        array->count, number_array_alignment, MemoryCategory::NUMBER_ARRAY);
+    if (data != nullptr)
+      memcpy(data, array->data, sizeof(double) * array->count);
+    array->data = data;
+    nursery.promoted_bytes += sizeof(double) * array->count;
+    break;
+  }
+  case ObjType::STRING: {
+    auto const string = reinterpret_cast<ObjString *>(copy);
+    if (!is_young(nursery, string->chars))
+      break;
+    auto const chars = static_cast<char *>(
+        allocate_tenured(string->length + 1, MemoryCategory::STRING_CHARS));
+    memcpy(chars, string->chars, string->length + 1);
+    string->chars = chars;
+    nursery.promoted_bytes += string->length + 1;
+    break;
+  }
+  case ObjType::UPVALUE: {
+    auto const upvalue = reinterpret_cast<ObjUpvalue *>(copy);
+    if (upvalue->location == &reinterpret_cast<ObjUpvalue *>(object)->closed)
+      upvalue->location = &upvalue->closed;
+    break;
+  }
+  default:
+    break;
+  }
+  write(nursery.copied, copy);
+  return copy;
+}
+
+// Updates the references object holds to young objects. The list open
+// upvalues are linked on is updated as collect_nursery walks it.
+auto trace(Nursery &nursery, Obj *object) -> void {
+  switch (object->type) {
+  case ObjType::BOUND_METHOD: {
+    auto const bound = reinterpret_cast<ObjBoundMethod *>(object);
+    promote(nursery, bound->receiver);
+    promote(nursery, bound->method);
+    break;
+  }
+  case ObjType::CLASS: {
+    auto const klass = reinterpret_cast<ObjClass *>(object);
+    promote(nursery, klass->name);
+    promote(nursery, klass->initializer);
+    for (int i = 0; i < klass->methods.count; ++i) {
+      promote(nursery, klass->methods.data[i].name);
+      promote(nursery, klass->methods.data[i].method);
+    }
+    break;
+  }
+  case ObjType::CLOSURE: {
+    auto const closure = reinterpret_cast<ObjClosure *>(object);
+    promote(nursery, closure->function);
+    for (int i = 0; i < closure->upvalue_count; ++i)
+      promote(nursery, closure->upvalues[i]);
+    break;
+  }
+  case ObjType::FUNCTION: {
+    auto const function = reinterpret_cast<ObjFunction *>(object);
+    promote(nursery, function->name);
+    for (int i = 0; i < function->chunk.constants.count; ++i)
+      promote(nursery, function->chunk.constants.data[i]);
+    break;
+  }
+  case ObjType::INSTANCE: {
+    auto const instance = reinterpret_cast<ObjInstance *>(object);
+    promote(nursery, instance->klass);
+    for (int i = 0; i < instance->fields.count; ++i)
+      promote(nursery, instance->fields.data[i]);
+    break;
+  }
+  case ObjType::NATIVE:
+    promote(nursery, reinterpret_cast<ObjNative *>(object)->name);
+    break;
+  case ObjType::NUMBER_ARRAY:
+  case ObjType::STRING:
+    break;
+  case ObjType::UPVALUE: {
+    auto const upvalue = reinterpret_cast<ObjUpvalue *>(object);
+    promote(nursery, upvalue->closed);
+    promote(nursery, upvalue->promoted);
+    break;
+  }
+  }
+}
+
+// Walks every block in the nursery, accounting it as freed and releasing
+// what dead objects own outside it.
+auto sweep(Nursery &nursery) -> void {
+  auto const header = sizeof(YoungHeader);
+  for (auto block = nursery.begin; block < nursery.top;) {
+    auto const young = reinterpret_cast<YoungHeader *>(block);
+    if (!young->filler) {
+      if (young->forward == nullptr &&
+          young->category == MemoryCategory::OBJECT)
+        release(nursery, reinterpret_cast<Obj *>(young + 1));
+      record_allocation(young->category, young->size, 0);
+    }
+    block += header + aligned_size(young->size, header);
+  }
+}
+
+// Classes never live in the nursery, so only these own memory outside it.
+auto release(Nursery const &nursery, Obj *object) -> void {
+  switch (object->type) {
+  case ObjType::INSTANCE:
+    reinterpret_cast<ObjInstance *>(object)->~ObjInstance();
+    break;
+  case ObjType::NUMBER_ARRAY: {
+    auto const array = reinterpret_cast<ObjNumberArray *>(object);
+    if (!is_young(nursery, array->data))
+      free_aligned(array->data, array->count, number_array_alignment,
+                   MemoryCategory::NUMBER_ARRAY);
+    break;
+  }
+  case ObjType::STRING: {
+    auto const string = reinterpret_cast<ObjString *>(object);
+    if (!is_young(nursery, string->chars))
+      free_small(string->chars, string->length + 1,
+                 MemoryCategory::STRING_CHARS);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+} // namespace lox
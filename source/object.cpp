@@ -1,3 +1,9 @@
+#include <new>
+#include <string.h>
+
+#include <collector.hpp>
+#include <number_array.hpp>
+#include <nursery.hpp>
 #include <object.hpp>
 
 namespace lox {
@@ -12,6 +18,34 @@ auto is_string(Value const &value) -> bool {
   return is_obj_type(value, ObjType::STRING);
 }
 
+auto is_function(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::FUNCTION);
+}
+
+auto is_closure(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::CLOSURE);
+}
+
+auto is_class(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::CLASS);
+}
+
+auto is_instance(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::INSTANCE);
+}
+
+auto is_native(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::NATIVE);
+}
+
+auto is_number_array(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::NUMBER_ARRAY);
+}
+
+auto is_bound_method(Value const &value) -> bool {
+  return is_obj_type(value, ObjType::BOUND_METHOD);
+}
+
 auto is_obj_type(Value const &value, ObjType type) -> bool {
   return is_obj(value) && obj_type(value) == type;
 }
@@ -24,17 +58,55 @@ auto as_string(Value &value) -> ObjString * {
   return reinterpret_cast<ObjString *>(value.as.obj);
 }
 
+auto as_function(Value const &value) -> ObjFunction * {
+  return reinterpret_cast<ObjFunction *>(value.as.obj);
+}
+
+auto as_closure(Value const &value) -> ObjClosure * {
+  return reinterpret_cast<ObjClosure *>(value.as.obj);
+}
+
+auto as_class(Value const &value) -> ObjClass * {
+  return reinterpret_cast<ObjClass *>(value.as.obj);
+}
+
+auto as_instance(Value const &value) -> ObjInstance * {
+  return reinterpret_cast<ObjInstance *>(value.as.obj);
+}
+
+auto as_native(Value const &value) -> ObjNative * {
+  return reinterpret_cast<ObjNative *>(value.as.obj);
+}
+
+auto as_number_array(Value const &value) -> ObjNumberArray * {
+  return reinterpret_cast<ObjNumberArray *>(value.as.obj);
+}
+
+auto as_bound_method(Value const &value) -> ObjBoundMethod * {
+  return reinterpret_cast<ObjBoundMethod *>(value.as.obj);
+}
+
 auto as_cstring(Value const &value) -> char * {
   return as_string(value)->chars;
 }
 auto as_cstring(Value &value) -> char * { return as_string(value)->chars; }
 
+// The string is allocated before its chars, so an old string never holds
+// chars in a nursery, which is only full from some point of a run on.
 auto copy_string(std::string_view chars) -> ObjString * {
   auto const length = chars.length();
-  auto heap_chars = allocate<char>(length + 1);
+  auto const string = allocate_string(nullptr, length);
+  auto heap_chars = static_cast<char *>(
+      allocate_small(length + 1, MemoryCategory::STRING_CHARS));
   memcpy(heap_chars, chars.data(), length);
   heap_chars[length] = '\0';
-  return allocate_string(heap_chars, length);
+  string->chars = heap_chars;
+  return string;
+}
+
+auto equal(ObjString const *lhs, ObjString const *rhs) -> bool {
+  return lhs == rhs || (lhs->length == rhs->length &&
+                        memcmp(lhs->chars, rhs->chars, lhs->length) == 0);
 }
 
 auto allocate_string(char *chars, unsigned int length) -> ObjString * {
@@ -44,10 +116,171 @@ auto allocate_string(char *chars, unsigned int length) -> ObjString * {
   return string;
 }
 
+auto new_function() -> ObjFunction * {
+  return allocate_obj<ObjFunction>(ObjType::FUNCTION);
+}
+
+auto new_closure(ObjFunction *function) -> ObjClosure * {
+  auto const upvalue_count = function->upvalue_count;
+  auto const size = sizeof(ObjClosure) + sizeof(ObjUpvalue *) * upvalue_count;
+  auto const memory = allocate_small(size, MemoryCategory::OBJECT);
+  auto const closure = new (memory) ObjClosure{};
+  closure->obj.type = ObjType::CLOSURE;
+  closure->function = function;
+  closure->upvalues = reinterpret_cast<ObjUpvalue **>(closure + 1);
+  closure->upvalue_count = upvalue_count;
+  for (int i = 0; i < upvalue_count; ++i)
+    closure->upvalues[i] = nullptr;
+  track_object(&closure->obj);
+  return closure;
+}
+
+auto new_upvalue(Value *slot) -> ObjUpvalue * {
+  auto const upvalue = allocate_obj<ObjUpvalue>(ObjType::UPVALUE);
+  upvalue->location = slot;
+  upvalue->closed = nil_val;
+  return upvalue;
+}
+
+// Classes skip the nursery. Their shapes key inline caches, so a class
+// must not be freed just because a run no longer reaches it.
+auto new_class(ObjString *name) -> ObjClass * {
+  auto const klass = new (allocate_tenured(sizeof(ObjClass),
+                                           MemoryCategory::OBJECT)) ObjClass{};
+  klass->obj.type = ObjType::CLASS;
+  klass->name = name;
+  klass->shape = new_shape();
+  klass->initializer = nil_val;
+  return klass;
+}
+
+auto new_instance(ObjClass *klass) -> ObjInstance * {
+  auto const instance = allocate_obj<ObjInstance>(ObjType::INSTANCE);
+  instance->klass = klass;
+  instance->shape = klass->shape;
+  return instance;
+}
+
+auto new_bound_method(Value receiver, Value method) -> ObjBoundMethod * {
+  auto const bound = allocate_obj<ObjBoundMethod>(ObjType::BOUND_METHOD);
+  bound->receiver = receiver;
+  bound->method = method;
+  return bound;
+}
+
+auto new_native(ObjString *name, int arity, NativeFn function,
+                BatchNativeFn batch) -> ObjNative * {
+  auto const native = allocate_obj<ObjNative>(ObjType::NATIVE);
+  native->name = name;
+  native->arity = arity;
+  native->function = function;
+  native->batch = batch;
+  return native;
+}
+
+auto new_number_array(int count) -> ObjNumberArray * {
+  auto const array = allocate_obj<ObjNumberArray>(ObjType::NUMBER_ARRAY);
+  array->count = count;
+  auto const nursery = active_nursery();
+  array->data = nullptr;
+  if (nursery != nullptr)
+    array->data = static_cast<double *>(
+        allocate_young(*nursery, sizeof(double) * count,
+                       number_array_alignment, MemoryCategory::NUMBER_ARRAY));
+  if (array->data == nullptr)
+    array->data = allocate_aligned<double>(count, number_array_alignment,
+                                           MemoryCategory::NUMBER_ARRAY);
+  return array;
+}
+
+// Runs a native over every row of inputs, using the batched form when there
+// is one and calling the scalar form once per row otherwise.
+auto call_native(ObjNative const *native, std::span<Value const> inputs,
+                 std::span<Value> results) -> void {
+  if (native->batch != nullptr) {
+    native->batch(inputs, results);
+    return;
+  }
+  auto const arity = static_cast<size_t>(native->arity);
+  for (size_t row = 0; row < results.size(); ++row)
+    results[row] = native->function(inputs.subspan(row * arity, arity));
+}
+
+auto find_method(ObjClass const *klass, ObjString const *name)
+    -> Value const * {
+  for (int i = 0; i < klass->methods.count; ++i)
+    if (equal(klass->methods.data[i].name, name))
+      return &klass->methods.data[i].method;
+  return nullptr;
+}
+
+auto free_object(Obj *object) -> void {
+  switch (object->type) {
+  case ObjType::BOUND_METHOD:
+    free_small(object, sizeof(ObjBoundMethod), MemoryCategory::OBJECT);
+    break;
+  case ObjType::CLASS: {
+    auto const klass = reinterpret_cast<ObjClass *>(object);
+    free_shape(klass->shape);
+    klass->~ObjClass();
+    free_small(klass, sizeof(ObjClass), MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::CLOSURE: {
+    auto const closure = reinterpret_cast<ObjClosure *>(object);
+    free_small(closure,
+               sizeof(ObjClosure) +
+                   sizeof(ObjUpvalue *) * closure->upvalue_count,
+               MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::FUNCTION: {
+    auto const function = reinterpret_cast<ObjFunction *>(object);
+    function->~ObjFunction();
+    free_small(function, sizeof(ObjFunction), MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::INSTANCE: {
+    auto const instance = reinterpret_cast<ObjInstance *>(object);
+    instance->~ObjInstance();
+    free_small(instance, sizeof(ObjInstance), MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::NATIVE:
+    free_small(object, sizeof(ObjNative), MemoryCategory::OBJECT);
+    break;
+  case ObjType::NUMBER_ARRAY: {
+    auto const array = reinterpret_cast<ObjNumberArray *>(object);
+    auto const nursery = active_nursery();
+    if (nursery != nullptr && is_young(*nursery, array->data))
+      free_young(*nursery, array->data);
+    else
+      free_aligned(array->data, array->count, number_array_alignment,
+                   MemoryCategory::NUMBER_ARRAY);
+    free_small(array, sizeof(ObjNumberArray), MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::STRING: {
+    auto const string = reinterpret_cast<ObjString *>(object);
+    free_small(string->chars, string->length + 1,
+               MemoryCategory::STRING_CHARS);
+    free_small(string, sizeof(ObjString), MemoryCategory::OBJECT);
+    break;
+  }
+  case ObjType::UPVALUE:
+    free_small(object, sizeof(ObjUpvalue), MemoryCategory::OBJECT);
+    break;
+  }
+}
+
+// Objects are constructed in place, so members such as a function's Chunk
+// start out initialized.
 template <typename T> auto allocate_obj(ObjType type) -> T * {
-  auto object = reallocate<Obj>(NULL, 0, sizeof(T));
-  object->type = type;
-  return reinterpret_cast<T *>(object);
+  auto const memory = allocate_small(sizeof(T), MemoryCategory::OBJECT);
+  auto const object = new (memory) T{};
+  object->obj.type = type;
+  track_object(&object->obj);
+  return object;
 }
 
 } // namespace lox
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <charconv>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include <output.hpp>
+
+namespace lox {
+
+thread_local auto standard_error = Output{2};
+thread_local auto current_error_output = static_cast<Output *>(nullptr);
+
+auto flush_with(Output &output, std::string_view text) -> void;
+auto write_all(int fd, iovec *pieces, int count) -> void;
+
+auto put(Output &output, std::string_view text) -> void {
+  if (text.size() <= output_buffer_size - output.size) {
+    std::copy(text.begin(), text.end(), output.buffer + output.size);
+    output.size += text.size();
+    return;
+  }
+  flush_with(output, text);
+}
+
+auto put(Output &output, char c) -> void {
+  if (output.size == output_buffer_size)
+    flush(output);
+  output.buffer[output.size++] = c;
+  if (c == '\n' && output.flush_lines)
+    flush(output);
+}
+
+// to_chars in general format with a precision of 6 is specified to match
+// %g, without going through the locale or a format string. %g shows whole
+// numbers under a million as integers, which are quicker to convert. -0 is
+// not one of them.
+auto put_number(Output &output, double number) -> void {
+  auto constexpr longest = sizeof("-1.23457e-308");
+  if (output_buffer_size - output.size < longest)
+    flush(output);
+  auto const begin = output.buffer + output.size;
+  auto const end = output.buffer + output_buffer_size;
+  auto const small = number > -1000000 && number < 1000000;
+  auto const integer = small ? static_cast<int>(number) : 0;
+  auto const written =
+      small && integer == number && (integer != 0 || !signbit(number))
+          ? std::to_chars(begin, end, integer)
+          : std::to_chars(begin, end, number, std::chars_format::general, 6);
+  output.size += written.ptr - begin;
+}
+
+auto put_format(Output &output, char const *format, ...) -> void {
+  va_list args;
+  va_start(args, format);
+  put_vformat(output, format, args);
+  va_end(args);
+}
+
+// Longer text is cut short.
+auto put_vformat(Output &output, char const *format, va_list args) -> void {
+  char text[1024];
+  auto const length = vsnprintf(text, sizeof(text), format, args);
+  if (length > 0)
+    put(output, {text, std::min(static_cast<size_t>(length),
+                                sizeof(text) - 1)});
+}
+
+auto flush(Output &output) -> void { flush_with(output, {}); }
+
+auto write_stdio(void *context, char const *data, size_t size) -> void {
+  fwrite(data, 1, size, static_cast<FILE *>(context));
+}
+
+auto use_error_output(Output *output) -> Output * {
+  auto const previous = current_error_output;
+  current_error_output = output;
+  return previous;
+}
+
+auto error_output() -> Output & {
+  return current_error_output != nullptr ? *current_error_output
+                                         : standard_error;
+}
+
+// Sends the buffer and then text, and empties the buffer.
+auto flush_with(Output &output, std::string_view text) -> void {
+  if (output.sink != nullptr) {
+    if (output.size != 0)
+      output.sink(output.context, output.buffer, output.size);
+    if (!text.empty())
+      output.sink(output.context, text.data(), text.size());
+  } else {
+    iovec pieces[] = {{output.buffer, output.size},
+                      {const_cast<char *>(text.data()), text.size()}};
+    write_all(output.fd, pieces, 2);
+  }
+  output.size = 0;
+}
+
+// Output that cannot be written is dropped, as stdio would drop it.
+auto write_all(int fd, iovec *pieces, int count) -> void {
+  while (count > 0) {
+    auto written = writev(fd, pieces, count);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    for (; count > 0 && static_cast<size_t>(written) >= pieces->iov_len;
+         ++pieces, --count)
+      written -= pieces->iov_len;
+    if (count > 0) {
+      pieces->iov_base = static_cast<char *>(pieces->iov_base) + written;
+      pieces->iov_len -= written;
+    }
+  }
+}
+
+} // namespace lox
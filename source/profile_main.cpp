@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <streambuf>
+#include <string.h>
+#include <string>
+
+#include <array.hpp>
+#include <chunk.hpp>
+#include <debug.hpp>
+#include <natives.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+using lox::Array;
+using lox::define_array_natives;
+using lox::interpret;
+using lox::InterpretResult;
+using lox::op_code_name;
+using lox::OpCode;
+using lox::resume;
+using lox::trace_capacity;
+using lox::TraceRecord;
+using lox::TraceRing;
+using lox::VirtualMachine;
+
+auto constexpr op_code_count = 256;
+
+struct Bigram
+{
+  uint64_t count;
+  OpCode first;
+  OpCode second;
+};
+
+// Counts of every pair of instructions that ran one after the other in the
+// same function.
+struct Profile
+{
+  uint64_t pairs[op_code_count][op_code_count] = {};
+  uint64_t instructions = 0;
+  uint64_t lost = 0;
+  bool has_last = false;
+  TraceRecord last = {};
+};
+
+auto profile_script(char const *path, Profile &profile) -> bool;
+auto drain(TraceRing const &ring, uint64_t &read, Profile &profile) -> void;
+auto follows(TraceRecord const &first, TraceRecord const &second) -> bool;
+auto print_profile(Profile const &profile) -> void;
+
+// Runs every script with a trace ring attached and prints the opcode pairs
+// they executed most often, the candidates for new superinstructions.
+auto main(int argc, char const *argv[]) -> int
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: lox-profile <script>...\n");
+    exit(64);
+  }
+  auto profile = std::make_unique<Profile>();
+  for (auto i = 1; i < argc; ++i)
+    if (!profile_script(argv[i], *profile))
+      fprintf(stderr, "Script \"%s\" did not finish.\n", argv[i]);
+  print_profile(*profile);
+  return 0;
+}
+
+// The script runs one unit of fuel at a time, so the ring is drained at every
+// back edge and call, before it can wrap.
+auto profile_script(char const *path, Profile &profile) -> bool
+{
+  auto file = std::ifstream{path};
+  if (!file)
+    return false;
+  auto const source = std::string{std::istreambuf_iterator<char>(file),
+                                  std::istreambuf_iterator<char>()};
+  auto ring = std::make_unique<TraceRing>();
+  auto vm = VirtualMachine{};
+  vm.trace = ring.get();
+  vm.fuel = 1;
+  define_array_natives(vm);
+  auto read = uint64_t{0};
+  profile.has_last = false;
+  auto result = interpret(vm, source);
+  while (result == InterpretResult::YIELDED)
+  {
+    drain(*ring, read, profile);
+    vm.fuel = 1;
+    result = resume(vm);
+  }
+  drain(*ring, read, profile);
+  return result == InterpretResult::OK;
+}
+
+auto drain(TraceRing const &ring, uint64_t &read, Profile &profile) -> void
+{
+  auto const head = ring.head.load(std::memory_order_acquire);
+  if (head - read > trace_capacity)
+  {
+    profile.lost += head - read - trace_capacity;
+    read = head - trace_capacity;
+    profile.has_last = false;
+  }
+  for (; read < head; ++read)
+  {
+    auto const word =
+        ring.records[read % trace_capacity].load(std::memory_order_relaxed);
+    auto record = TraceRecord{};
+    memcpy(&record, &word, sizeof(record));
+    ++profile.instructions;
+    if (profile.has_last && follows(profile.last, record))
+      ++profile.pairs[static_cast<uint8_t>(profile.last.op_code)]
+                     [static_cast<uint8_t>(record.op_code)];
+    profile.last = record;
+    profile.has_last = true;
+  }
+}
+
+// Whether second ran right after first fell through to it, rather than after
+// a jump, a call or a return. Only those pairs can share a dispatch.
+auto follows(TraceRecord const &first, TraceRecord const &second) -> bool
+{
+  if (first.function != second.function)
+    return false;
+  switch (first.op_code)
+  {
+  case OpCode::JUMP:
+  case OpCode::JUMP_IF_FALSE:
+  case OpCode::LOOP:
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+  case OpCode::INVOKE:
+  case OpCode::RETURN:
+    return false;
+  default:
+    return second.offset > first.offset;
+  }
+}
+
+auto print_profile(Profile const &profile) -> void
+{
+  auto bigrams = Array<Bigram>{};
+  auto total = uint64_t{0};
+  for (auto first = 0; first < op_code_count; ++first)
+    for (auto second = 0; second < op_code_count; ++second)
+      if (auto const count = profile.pairs[first][second]; count > 0)
+      {
+        write(bigrams, Bigram{count, static_cast<OpCode>(first),
+                              static_cast<OpCode>(second)});
+        total += count;
+      }
+  std::sort(bigrams.data, bigrams.data + bigrams.count,
+            [](Bigram const &a, Bigram const &b) { return a.count > b.count; });
+  printf("%llu instructions, %llu pairs, %llu records lost\n",
+         static_cast<unsigned long long>(profile.instructions),
+         static_cast<unsigned long long>(total),
+         static_cast<unsigned long long>(profile.lost));
+  for (auto i = 0; i < std::min(bigrams.count, 32); ++i)
+  {
+    auto const &bigram = bigrams.data[i];
+    printf("%-18s %-18s %12llu %6.2f%%\n", op_code_name(bigram.first),
+           op_code_name(bigram.second),
+           static_cast<unsigned long long>(bigram.count),
+           100.0 * static_cast<double>(bigram.count) / total);
+  }
+}
@@ -0,0 +1,595 @@
+#include <algorithm>
+#include <stdarg.h>
+
+#include <bits.hpp>
+#include <number_array.hpp>
+#include <output.hpp>
+#include <registers.hpp>
+
+namespace lox {
+
+// Operands name constants at constant_operand and above while lowering, and
+// are moved down to sit right after the registers once their count is known.
+auto constexpr constant_operand = registers_max;
+
+struct Fixup {
+  int instruction;
+  int target;
+};
+
+// The state of lowering one function. stack holds the operand each stack
+// slot stands for, which is the slot's own register once its value is in
+// place. An operand only ever names a lower register, so writing a slot in
+// place never changes the value of a slot below it. depths holds the stack
+// depth at each jump target, -2 for targets not reached yet and -1 for any
+// other offset. label is the first instruction after the last jump target.
+struct Lowering {
+  Chunk const &source;
+  RegisterChunk &chunk;
+  Array<uint16_t> stack{};
+  Array<int> depths{};
+  Array<int> addresses{};
+  Array<Fixup> fixups{};
+  int line = 0;
+  int label = 0;
+  int nil_constant = -1;
+  int true_constant = -1;
+  int false_constant = -1;
+};
+
+auto instruction_size(Chunk const &chunk, int offset) -> int;
+auto jump_target(Chunk const &chunk, int offset) -> int;
+auto lower(Lowering &lowering) -> bool;
+auto lower_instruction(Lowering &lowering, int offset, bool &reachable)
+    -> bool;
+auto emit(Lowering &lowering, RegisterOp op, int a, int b, int c) -> void;
+auto push_result(Lowering &lowering, RegisterOp op, int b, int c) -> bool;
+auto pop_operand(Lowering &lowering) -> uint16_t;
+auto constant(Lowering &lowering, int &index, Value value) -> uint16_t;
+auto materialize(Lowering &lowering, int slot) -> void;
+auto materialize_all(Lowering &lowering) -> void;
+auto retarget(Lowering &lowering, int slot) -> bool;
+auto join(Lowering &lowering, int target) -> bool;
+auto relocate_constants(RegisterChunk &chunk) -> void;
+auto array_binary(ArrayOp op, Value lhs, Value rhs, Value &result)
+    -> char const *;
+auto register_error(VirtualMachine &vm, RegisterChunk const &chunk,
+                    RegisterInstruction const *instruction,
+                    char const *format, ...) -> void;
+
+auto lower_to_registers(ObjFunction const *function, RegisterChunk &chunk)
+    -> bool {
+  auto lowering = Lowering{function->chunk, chunk};
+  append(chunk.constants, function->chunk.constants.data,
+         function->chunk.constants.count);
+  if (function->name == nullptr && lower(lowering) &&
+      chunk.constants.count <= UINT16_MAX - registers_max) {
+    relocate_constants(chunk);
+    return true;
+  }
+  chunk = RegisterChunk{};
+  return false;
+}
+
+// Returns the size of the instruction at offset, or -1 when it cannot be
+// lowered.
+auto instruction_size(Chunk const &chunk, int offset) -> int {
+  switch (static_cast<OpCode>(chunk.code.data[offset])) {
+  case OpCode::NIL:
+  case OpCode::TRUE:
+  case OpCode::FALSE:
+  case OpCode::POP:
+  case OpCode::EQUAL:
+  case OpCode::GREATER:
+  case OpCode::LESS:
+  case OpCode::ADD:
+  case OpCode::SUBTRACT:
+  case OpCode::MULTIPLY:
+  case OpCode::DIVIDE:
+  case OpCode::NOT:
+  case OpCode::NEGATE:
+  case OpCode::PRINT:
+  case OpCode::RETURN:
+    return 1;
+  case OpCode::CONSTANT:
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::ADD_CONSTANT:
+  case OpCode::SUBTRACT_CONSTANT:
+  case OpCode::MULTIPLY_CONSTANT:
+  case OpCode::DIVIDE_CONSTANT:
+  case OpCode::EQUAL_CONSTANT:
+  case OpCode::GREATER_CONSTANT:
+  case OpCode::LESS_CONSTANT:
+    return 2;
+  case OpCode::DEFINE_GLOBAL:
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL:
+  case OpCode::JUMP:
+  case OpCode::JUMP_IF_FALSE:
+    return 3;
+  case OpCode::CONSTANT_LONG:
+    return 4;
+  case OpCode::LOOP:
+    return 5;
+  default:
+    return -1;
+  }
+}
+
+auto jump_target(Chunk const &chunk, int offset) -> int {
+  auto const code = chunk.code.data + offset;
+  auto const distance = (code[1] << 8) | code[2];
+  return static_cast<OpCode>(code[0]) == OpCode::LOOP ? offset + 5 - distance
+                                                      : offset + 3 + distance;
+}
+
+// Marks every jump target first, so values are in place before a backward
+// jump lands on them too.
+auto lower(Lowering &lowering) -> bool {
+  auto const &source = lowering.source;
+  auto const count = source.code.count;
+  reserve(lowering.depths, count);
+  reserve(lowering.addresses, count);
+  for (int offset = 0; offset < count; ++offset) {
+    write(lowering.depths, -1);
+    write(lowering.addresses, -1);
+  }
+  for (int offset = 0; offset < count;) {
+    auto const size = instruction_size(source, offset);
+    if (size == -1 || offset + size > count)
+      return false;
+    switch (static_cast<OpCode>(source.code.data[offset])) {
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::LOOP: {
+      auto const target = jump_target(source, offset);
+      if (target < 0 || target >= count)
+        return false;
+      lowering.depths.data[target] = -2;
+      break;
+    }
+    default:
+      break;
+    }
+    offset += size;
+  }
+  // Slot zero holds the function being run.
+  write(lowering.stack, uint16_t{0});
+  lowering.chunk.register_count = 1;
+  auto reachable = true;
+  for (int offset = 0; offset < count;
+       offset += instruction_size(source, offset)) {
+    auto const depth = lowering.depths.data[offset];
+    if (depth != -1) {
+      // Code only reached by a backward jump, like the increment of a for
+      // loop, starts with the depth of the jump over it, which the backward
+      // jump then has to match.
+      if (reachable)
+        materialize_all(lowering);
+      else {
+        auto const count = depth == -2 ? lowering.stack.count : depth;
+        lowering.stack.count = 0;
+        for (int slot = 0; slot < count; ++slot)
+          write(lowering.stack, static_cast<uint16_t>(slot));
+      }
+      if (!join(lowering, offset))
+        return false;
+      reachable = true;
+      lowering.label = lowering.chunk.code.count;
+    }
+    lowering.addresses.data[offset] = lowering.chunk.code.count;
+    if (reachable && !lower_instruction(lowering, offset, reachable))
+      return false;
+  }
+  for (int i = 0; i < lowering.fixups.count; ++i) {
+    auto const &fixup = lowering.fixups.data[i];
+    lowering.chunk.code.data[fixup.instruction].b =
+        lowering.addresses.data[fixup.target];
+  }
+  return !reachable;
+}
+
+auto lower_instruction(Lowering &lowering, int offset, bool &reachable)
+    -> bool {
+  auto const &source = lowering.source;
+  auto const code = source.code.data + offset;
+  auto &stack = lowering.stack;
+  auto const top = stack.count - 1;
+  auto const constant_at = [](int index) {
+    return static_cast<uint16_t>(constant_operand + index);
+  };
+  auto const binary = [&](RegisterOp op) {
+    auto const rhs = pop_operand(lowering);
+    auto const lhs = pop_operand(lowering);
+    return push_result(lowering, op, lhs, rhs);
+  };
+  auto const binary_constant = [&](RegisterOp op) {
+    return push_result(lowering, op, pop_operand(lowering),
+                       constant_at(code[1]));
+  };
+  auto const push = [&](uint16_t operand) {
+    if (stack.count == registers_max)
+      return false;
+    write(stack, operand);
+    return true;
+  };
+  auto const global = [&] { return (code[1] << 8) | code[2]; };
+  lowering.line = source.lines.data[offset];
+  switch (static_cast<OpCode>(code[0])) {
+  case OpCode::CONSTANT:
+    return push(constant_at(code[1]));
+  case OpCode::CONSTANT_LONG:
+    return push(constant_at(decode_bits(code[1], code[2], code[3])));
+  case OpCode::NIL:
+    return push(constant(lowering, lowering.nil_constant, nil_val));
+  case OpCode::TRUE:
+    return push(constant(lowering, lowering.true_constant, bool_val(true)));
+  case OpCode::FALSE:
+    return push(constant(lowering, lowering.false_constant, bool_val(false)));
+  case OpCode::POP:
+    pop_operand(lowering);
+    return true;
+  // Reading a local copies the operand it stands for, so a local holding a
+  // constant is read as that constant.
+  case OpCode::GET_LOCAL:
+    return code[1] <= top && push(stack.data[code[1]]);
+  // Copies still naming the register are put in place before it changes.
+  case OpCode::SET_LOCAL: {
+    auto const slot = code[1];
+    if (slot > top)
+      return false;
+    if (slot == top)
+      return true;
+    for (int i = slot + 1; i <= top; ++i)
+      if (stack.data[i] == slot)
+        materialize(lowering, i);
+    if (stack.data[top] != slot && !retarget(lowering, slot))
+      emit(lowering, RegisterOp::MOVE, slot, stack.data[top], 0);
+    stack.data[slot] = slot;
+    return true;
+  }
+  case OpCode::DEFINE_GLOBAL:
+    emit(lowering, RegisterOp::DEFINE_GLOBAL, 0, global(),
+         pop_operand(lowering));
+    return true;
+  case OpCode::GET_GLOBAL:
+    return push_result(lowering, RegisterOp::GET_GLOBAL, global(), 0);
+  case OpCode::SET_GLOBAL:
+    emit(lowering, RegisterOp::SET_GLOBAL, 0, global(), stack.data[top]);
+    return true;
+  case OpCode::JUMP:
+  case OpCode::JUMP_IF_FALSE:
+  case OpCode::LOOP: {
+    materialize_all(lowering);
+    auto const target = jump_target(source, offset);
+    if (!join(lowering, target))
+      return false;
+    write(lowering.fixups, Fixup{lowering.chunk.code.count, target});
+    if (static_cast<OpCode>(code[0]) == OpCode::JUMP_IF_FALSE) {
+      emit(lowering, RegisterOp::JUMP_IF_FALSE, top, 0, 0);
+      return true;
+    }
+    emit(lowering, RegisterOp::JUMP, 0, 0, 0);
+    reachable = false;
+    return true;
+  }
+  case OpCode::EQUAL:
+    return binary(RegisterOp::EQUAL);
+  case OpCode::GREATER:
+    return binary(RegisterOp::GREATER);
+  case OpCode::LESS:
+    return binary(RegisterOp::LESS);
+  case OpCode::ADD:
+    return binary(RegisterOp::ADD);
+  case OpCode::SUBTRACT:
+    return binary(RegisterOp::SUBTRACT);
+  case OpCode::MULTIPLY:
+    return binary(RegisterOp::MULTIPLY);
+  case OpCode::DIVIDE:
+    return binary(RegisterOp::DIVIDE);
+  case OpCode::NOT:
+    return push_result(lowering, RegisterOp::NOT, pop_operand(lowering), 0);
+  case OpCode::NEGATE:
+    return push_result(lowering, RegisterOp::NEGATE, pop_operand(lowering),
+                       0);
+  case OpCode::PRINT:
+    emit(lowering, RegisterOp::PRINT, 0, pop_operand(lowering), 0);
+    return true;
+  case OpCode::RETURN:
+    emit(lowering, RegisterOp::RETURN, 0, pop_operand(lowering), 0);
+    reachable = false;
+    return true;
+  case OpCode::ADD_CONSTANT:
+    return binary_constant(RegisterOp::ADD);
+  case OpCode::SUBTRACT_CONSTANT:
+    return binary_constant(RegisterOp::SUBTRACT);
+  case OpCode::MULTIPLY_CONSTANT:
+    return binary_constant(RegisterOp::MULTIPLY);
+  case OpCode::DIVIDE_CONSTANT:
+    return binary_constant(RegisterOp::DIVIDE);
+  case OpCode::EQUAL_CONSTANT:
+    return binary_constant(RegisterOp::EQUAL);
+  case OpCode::GREATER_CONSTANT:
+    return binary_constant(RegisterOp::GREATER);
+  case OpCode::LESS_CONSTANT:
+    return binary_constant(RegisterOp::LESS);
+  default:
+    return false;
+  }
+}
+
+auto emit(Lowering &lowering, RegisterOp op, int a, int b, int c) -> void {
+  auto &chunk = lowering.chunk;
+  write(chunk.code,
+        RegisterInstruction{op, static_cast<uint8_t>(a),
+                            static_cast<uint16_t>(b),
+                            static_cast<uint16_t>(c)});
+  write(chunk.lines, lowering.line);
+  if (op != RegisterOp::JUMP && op != RegisterOp::JUMP_IF_FALSE)
+    chunk.register_count = std::max(chunk.register_count, a + 1);
+}
+
+// Computes into the register of the slot the result is pushed to.
+auto push_result(Lowering &lowering, RegisterOp op, int b, int c) -> bool {
+  auto &stack = lowering.stack;
+  if (stack.count == registers_max)
+    return false;
+  emit(lowering, op, stack.count, b, c);
+  write(stack, static_cast<uint16_t>(stack.count));
+  return true;
+}
+
+auto pop_operand(Lowering &lowering) -> uint16_t {
+  auto &stack = lowering.stack;
+  return stack.data[--stack.count];
+}
+
+// nil and the booleans have no constants of their own in stack code.
+auto constant(Lowering &lowering, int &index, Value value) -> uint16_t {
+  if (index == -1) {
+    index = lowering.chunk.constants.count;
+    write(lowering.chunk.constants, value);
+  }
+  return static_cast<uint16_t>(constant_operand + index);
+}
+
+auto materialize(Lowering &lowering, int slot) -> void {
+  auto &operand = lowering.stack.data[slot];
+  if (operand == slot)
+    return;
+  emit(lowering, RegisterOp::MOVE, slot, operand, 0);
+  operand = slot;
+}
+
+auto materialize_all(Lowering &lowering) -> void {
+  for (int slot = 0; slot < lowering.stack.count; ++slot)
+    materialize(lowering, slot);
+}
+
+// When the value on top was just computed into its own register, the
+// instruction computing it writes slot instead, which saves a MOVE.
+auto retarget(Lowering &lowering, int slot) -> bool {
+  auto &chunk = lowering.chunk;
+  auto const top = lowering.stack.count - 1;
+  if (lowering.stack.data[top] != top || chunk.code.count == lowering.label)
+    return false;
+  auto &last = chunk.code.data[chunk.code.count - 1];
+  switch (last.op) {
+  case RegisterOp::MOVE:
+  case RegisterOp::GET_GLOBAL:
+  case RegisterOp::EQUAL:
+  case RegisterOp::GREATER:
+  case RegisterOp::LESS:
+  case RegisterOp::ADD:
+  case RegisterOp::SUBTRACT:
+  case RegisterOp::MULTIPLY:
+  case RegisterOp::DIVIDE:
+  case RegisterOp::NOT:
+  case RegisterOp::NEGATE:
+    if (last.a != top)
+      return false;
+    last.a = static_cast<uint8_t>(slot);
+    lowering.stack.data[top] = static_cast<uint16_t>(slot);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Every path into a jump target must reach it with the same stack depth.
+auto join(Lowering &lowering, int target) -> bool {
+  auto &depth = lowering.depths.data[target];
+  if (depth == -2)
+    depth = lowering.stack.count;
+  return depth == lowering.stack.count;
+}
+
+auto relocate_constants(RegisterChunk &chunk) -> void {
+  auto const relocate = [&](uint16_t &operand) {
+    if (operand >= constant_operand)
+      operand = operand - constant_operand + chunk.register_count;
+  };
+  for (int i = 0; i < chunk.code.count; ++i) {
+    auto &instruction = chunk.code.data[i];
+    switch (instruction.op) {
+    case RegisterOp::DEFINE_GLOBAL:
+    case RegisterOp::SET_GLOBAL:
+      relocate(instruction.c);
+      break;
+    case RegisterOp::GET_GLOBAL:
+    case RegisterOp::JUMP:
+    case RegisterOp::JUMP_IF_FALSE:
+      break;
+    default:
+      relocate(instruction.b);
+      relocate(instruction.c);
+    }
+  }
+}
+
+auto run_registers(VirtualMachine &vm, RegisterChunk const &chunk,
+                   uint64_t *executed) -> InterpretResult {
+  auto const registers = vm.stack_top;
+  if (registers + chunk.register_count + chunk.constants.count >
+      vm.stack + stack_max) {
+    put(vm.err, "Stack overflow.\n");
+    flush(vm.err);
+    return InterpretResult::RUNTIME_ERROR;
+  }
+  std::fill_n(registers, chunk.register_count, nil_val);
+  std::copy_n(chunk.constants.data, chunk.constants.count,
+              registers + chunk.register_count);
+  auto const code = chunk.code.data;
+  auto const globals = vm.globals.slots.data;
+  auto instruction_pointer = code;
+  auto const binary_op = [&](RegisterInstruction const &instruction,
+                             auto value_type, auto op,
+                             ArrayOp array_op) -> bool {
+    auto const lhs = registers[instruction.b];
+    auto const rhs = registers[instruction.c];
+    if (is_number(lhs) && is_number(rhs)) {
+      registers[instruction.a] = value_type(op(lhs.as.number, rhs.as.number));
+      return true;
+    }
+    auto const error =
+        array_binary(array_op, lhs, rhs, registers[instruction.a]);
+    if (error != nullptr)
+      register_error(vm, chunk, &instruction, "%s", error);
+    return error == nullptr;
+  };
+  auto const defined = [&](RegisterInstruction const &instruction) {
+    if (!globals[instruction.b].defined)
+      register_error(vm, chunk, &instruction, "Undefined variable '%s'.",
+                     vm.globals.names.data[instruction.b]->chars);
+    return globals[instruction.b].defined;
+  };
+
+  for (;;) {
+    auto const &instruction = *instruction_pointer++;
+    if (executed != nullptr)
+      ++*executed;
+    auto &a = registers[instruction.a];
+    auto const &b = registers[instruction.b];
+    auto const &c = registers[instruction.c];
+    switch (instruction.op) {
+    case RegisterOp::MOVE:
+      a = b;
+      break;
+    case RegisterOp::DEFINE_GLOBAL:
+      globals[instruction.b] = {c, true};
+      break;
+    case RegisterOp::GET_GLOBAL:
+      if (!defined(instruction))
+        return InterpretResult::RUNTIME_ERROR;
+      a = globals[instruction.b].value;
+      break;
+    case RegisterOp::SET_GLOBAL:
+      if (!defined(instruction))
+        return InterpretResult::RUNTIME_ERROR;
+      globals[instruction.b].value = c;
+      break;
+    case RegisterOp::EQUAL:
+      a = bool_val(b == c);
+      break;
+    case RegisterOp::GREATER:
+      if (!binary_op(instruction, bool_val, std::greater<double>(),
+                     ArrayOp::GREATER))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::LESS:
+      if (!binary_op(instruction, bool_val, std::less<double>(),
+                     ArrayOp::LESS))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::ADD:
+      if (!binary_op(instruction, number_val, std::plus<double>(),
+                     ArrayOp::ADD))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::SUBTRACT:
+      if (!binary_op(instruction, number_val, std::minus<double>(),
+                     ArrayOp::SUBTRACT))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::MULTIPLY:
+      if (!binary_op(instruction, number_val, std::multiplies<double>(),
+                     ArrayOp::MULTIPLY))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::DIVIDE:
+      if (!binary_op(instruction, number_val, std::divides<double>(),
+                     ArrayOp::DIVIDE))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case RegisterOp::NOT:
+      a = bool_val(is_falsey(b));
+      break;
+    case RegisterOp::NEGATE:
+      if (!is_number(b)) {
+        register_error(vm, chunk, &instruction, "Operand must be a number.");
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      a = number_val(-b.as.number);
+      break;
+    case RegisterOp::PRINT:
+      print(vm.out, b);
+      put(vm.out, '\n');
+      break;
+    case RegisterOp::JUMP:
+      instruction_pointer = code + instruction.b;
+      break;
+    case RegisterOp::JUMP_IF_FALSE:
+      if (is_falsey(a))
+        instruction_pointer = code + instruction.b;
+      break;
+    case RegisterOp::RETURN:
+      vm.result = b;
+      flush(vm.out);
+      return InterpretResult::OK;
+    }
+  }
+}
+
+// Number arrays broadcast against numbers as they do on the stack machine.
+// Returns the error message when the operands do not fit.
+auto array_binary(ArrayOp op, Value lhs, Value rhs, Value &result)
+    -> char const * {
+  auto const is_operand = [](Value const &value) {
+    return is_number(value) || is_number_array(value);
+  };
+  if (!is_operand(lhs) || !is_operand(rhs))
+    return "Operands must be numbers.";
+  auto const operand = [](Value const &value, int &count) {
+    if (is_number(value))
+      return ArrayOperand{&value.as.number, true};
+    auto const array = as_number_array(value);
+    count = array->count;
+    return ArrayOperand{array->data, false};
+  };
+  auto lhs_count = -1;
+  auto rhs_count = -1;
+  auto const lhs_operand = operand(lhs, lhs_count);
+  auto const rhs_operand = operand(rhs, rhs_count);
+  if (lhs_count != -1 && rhs_count != -1 && lhs_count != rhs_count)
+    return "Array lengths differ.";
+  auto const array = new_number_array(std::max(lhs_count, rhs_count));
+  apply(op, lhs_operand, rhs_operand, array->data, array->count);
+  result = obj_val(array);
+  return nullptr;
+}
+
+auto register_error(VirtualMachine &vm, RegisterChunk const &chunk,
+                    RegisterInstruction const *instruction,
+                    char const *format, ...) -> void {
+  va_list args;
+  va_start(args, format);
+  put_vformat(vm.err, format, args);
+  va_end(args);
+  put_format(vm.err, "\n[line %d] in script\n",
+             chunk.lines.data[instruction - chunk.code.data]);
+  flush(vm.out);
+  flush(vm.err);
+}
+
+} // namespace lox
@@ -0,0 +1,47 @@
+#include <new>
+
+#include <object.hpp>
+#include <shape.hpp>
+
+namespace lox {
+
+auto allocate_shape(Shape *parent, ObjString *name) -> Shape *;
+
+auto new_shape() -> Shape * { return allocate_shape(nullptr, nullptr); }
+
+auto find_field(Shape const *shape, ObjString const *name) -> int {
+  for (; shape->parent != nullptr; shape = shape->parent)
+    if (equal(shape->name, name))
+      return shape->field_count - 1;
+  return -1;
+}
+
+auto add_field(Shape *shape, ObjString *name) -> Shape * {
+  for (int i = 0; i < shape->transitions.count; ++i) {
+    auto const transition = shape->transitions.data[i];
+    if (equal(transition->name, name))
+      return transition;
+  }
+  auto const transition = allocate_shape(shape, name);
+  write(shape->transitions, transition);
+  return transition;
+}
+
+auto free_shape(Shape *shape) -> void {
+  for (int i = 0; i < shape->transitions.count; ++i)
+    free_shape(shape->transitions.data[i]);
+  shape->~Shape();
+  reallocate<void>(shape, sizeof(Shape), 0, MemoryCategory::SHAPE);
+}
+
+auto allocate_shape(Shape *parent, ObjString *name) -> Shape * {
+  auto const memory =
+      reallocate<void>(nullptr, 0, sizeof(Shape), MemoryCategory::SHAPE);
+  auto const shape = new (memory) Shape{};
+  shape->parent = parent;
+  shape->name = name;
+  shape->field_count = parent != nullptr ? parent->field_count + 1 : 0;
+  return shape;
+}
+
+} // namespace lox
@@ -0,0 +1,547 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include <object.hpp>
+#include <shape.hpp>
+#include <snapshot.hpp>
+
+namespace lox {
+
+auto constexpr snapshot_magic = uint64_t{0x02'50414e53'584f4c}; // LOXSNAP 2
+auto constexpr null_reference = UINT32_MAX;
+
+enum class SnapshotTag : uint8_t { NIL, FALSE, TRUE, NUMBER, OBJ };
+
+// Objects are numbered in the order they are first reached, except that a
+// closure's function and an instance's class and field names are numbered
+// before it, because loading needs them to allocate it.
+struct SnapshotWriter {
+  Array<uint8_t> &bytes;
+  std::unordered_map<Obj const *, uint32_t> indexes;
+  Array<Obj const *> objects;
+};
+
+// References read before every object exists hold the index of their target
+// and are listed in fixups, which relocation rewrites in one pass.
+struct SnapshotReader {
+  std::span<uint8_t const> bytes;
+  VirtualMachine &vm;
+  size_t position = 0;
+  bool failed = false;
+  Array<Obj *> objects;
+  Array<void **> fixups;
+};
+
+template <typename T> auto put(Array<uint8_t> &bytes, T value) -> void;
+auto put_string(Array<uint8_t> &bytes, ObjString const *string) -> void;
+auto index_of(SnapshotWriter &writer, Obj const *object) -> uint32_t;
+template <typename T>
+auto put_reference(SnapshotWriter &writer, T const *object) -> void;
+auto put_value(SnapshotWriter &writer, Value const &value) -> void;
+auto put_object(SnapshotWriter &writer, Obj const *object) -> void;
+template <typename T> auto take(SnapshotReader &reader) -> T;
+auto take_bytes(SnapshotReader &reader, size_t count) -> uint8_t const *;
+auto take_count(SnapshotReader &reader, size_t min_size) -> uint32_t;
+template <typename T>
+auto take_reference(SnapshotReader &reader, T *&reference) -> void;
+template <typename T>
+auto take_earlier(SnapshotReader &reader, ObjType type) -> T *;
+auto take_value(SnapshotReader &reader, Value &value) -> void;
+auto take_object(SnapshotReader &reader) -> void;
+auto take_function(SnapshotReader &reader, ObjFunction *function) -> void;
+auto relocate(SnapshotReader &reader) -> void;
+auto discard(SnapshotReader &reader) -> void;
+
+auto save_snapshot(VirtualMachine const &vm, Array<uint8_t> &snapshot)
+    -> bool {
+  if (vm.frame_count != 0)
+    return false;
+  auto writer = SnapshotWriter{snapshot, {}, {}};
+  auto const &globals = vm.globals;
+  put(snapshot, snapshot_magic);
+  auto const counts = snapshot.count;
+  put(snapshot, uint32_t{0});
+  put<uint32_t>(snapshot, globals.slots.count);
+  for (int i = 0; i < globals.slots.count; ++i)
+    if (is_obj(globals.slots.data[i].value))
+      index_of(writer, globals.slots.data[i].value.as.obj);
+  // put_object numbers the objects it reaches, so the loop runs until every
+  // reachable object has been written.
+  for (int i = 0; i < writer.objects.count; ++i)
+    put_object(writer, writer.objects.data[i]);
+  for (int i = 0; i < globals.slots.count; ++i) {
+    put_string(snapshot, globals.names.data[i]);
+    put<uint8_t>(snapshot, globals.slots.data[i].defined);
+    put_value(writer, globals.slots.data[i].value);
+  }
+  auto const object_count = static_cast<uint32_t>(writer.objects.count);
+  memcpy(snapshot.data + counts, &object_count, sizeof(object_count));
+  return true;
+}
+
+auto load_snapshot(VirtualMachine &vm, std::span<uint8_t const> snapshot)
+    -> bool {
+  auto reader = SnapshotReader{snapshot, vm, 0, false, {}, {}};
+  if (take<uint64_t>(reader) != snapshot_magic)
+    return false;
+  auto const object_count = take_count(reader, 1);
+  auto const global_count = take_count(reader, sizeof(uint32_t) + 2);
+  reserve(reader.objects, object_count);
+  for (uint32_t i = 0; i < object_count && !reader.failed; ++i)
+    take_object(reader);
+
+  struct Global {
+    std::string_view name;
+    bool defined;
+    Value value;
+  };
+  auto globals = Array<Global>{};
+  reserve(globals, global_count);
+  for (uint32_t i = 0; i < global_count && !reader.failed; ++i) {
+    auto &global = globals.data[globals.count++];
+    auto const length = take<uint32_t>(reader);
+    auto const chars = take_bytes(reader, length);
+    global.name = {reinterpret_cast<char const *>(chars), length};
+    global.defined = take<uint8_t>(reader) != 0;
+    take_value(reader, global.value);
+  }
+  if (reader.position != snapshot.size())
+    reader.failed = true;
+  relocate(reader);
+  // Every name new to vm needs a free slot before any global is assigned.
+  auto fresh = 0;
+  for (int i = 0; i < globals.count; ++i)
+    if (vm.globals.indexes.count(globals.data[i].name) == 0)
+      ++fresh;
+  if (reader.failed || vm.globals.slots.count + fresh > globals_max) {
+    discard(reader);
+    return false;
+  }
+  for (int i = 0; i < globals.count; ++i) {
+    auto const &global = globals.data[i];
+    auto const index = resolve_global(vm.globals, global.name);
+    vm.globals.slots.data[index] = {global.value, global.defined};
+  }
+  return true;
+}
+
+auto write_snapshot(VirtualMachine const &vm, char const *path) -> bool {
+  auto snapshot = Array<uint8_t>{};
+  if (!save_snapshot(vm, snapshot))
+    return false;
+  auto const file = fopen(path, "wb");
+  if (file == nullptr)
+    return false;
+  auto const written = fwrite(snapshot.data, 1, snapshot.count, file);
+  return fclose(file) == 0 && written == static_cast<size_t>(snapshot.count);
+}
+
+auto read_snapshot(VirtualMachine &vm, char const *path) -> bool {
+  auto const file = open(path, O_RDONLY);
+  if (file == -1)
+    return false;
+  struct stat status;
+  if (fstat(file, &status) == -1 || status.st_size == 0) {
+    close(file);
+    return false;
+  }
+  auto const size = static_cast<size_t>(status.st_size);
+  auto const memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (memory == MAP_FAILED)
+    return false;
+  auto const loaded =
+      load_snapshot(vm, {static_cast<uint8_t const *>(memory), size});
+  munmap(memory, size);
+  return loaded;
+}
+
+template <typename T> auto put(Array<uint8_t> &bytes, T value) -> void {
+  append(bytes, reinterpret_cast<uint8_t const *>(&value), sizeof(value));
+}
+
+auto put_string(Array<uint8_t> &bytes, ObjString const *string) -> void {
+  put<uint32_t>(bytes, string->length);
+  append(bytes, reinterpret_cast<uint8_t const *>(string->chars),
+         string->length);
+}
+
+auto index_of(SnapshotWriter &writer, Obj const *object) -> uint32_t {
+  auto const found = writer.indexes.find(object);
+  if (found != writer.indexes.end())
+    return found->second;
+  if (object->type == ObjType::CLOSURE) {
+    index_of(writer, &reinterpret_cast<ObjClosure const *>(object)
+                          ->function->obj);
+  } else if (object->type == ObjType::INSTANCE) {
+    auto const instance = reinterpret_cast<ObjInstance const *>(object);
+    index_of(writer, &instance->klass->obj);
+    for (auto shape = instance->shape; shape->parent != nullptr;
+         shape = shape->parent)
+      index_of(writer, &shape->name->obj);
+  }
+  auto const index = static_cast<uint32_t>(writer.objects.count);
+  writer.indexes.emplace(object, index);
+  write(writer.objects, object);
+  return index;
+}
+
+template <typename T>
+auto put_reference(SnapshotWriter &writer, T const *object) -> void {
+  put<uint32_t>(writer.bytes, object != nullptr
+                                  ? index_of(writer, &object->obj)
+                                  : null_reference);
+}
+
+auto put_value(SnapshotWriter &writer, Value const &value) -> void {
+  switch (value.type) {
+  case ValueType::NIL:
+    put(writer.bytes, SnapshotTag::NIL);
+    break;
+  case ValueType::BOOL:
+    put(writer.bytes,
+        value.as.boolean ? SnapshotTag::TRUE : SnapshotTag::FALSE);
+    break;
+  case ValueType::NUMBER:
+    put(writer.bytes, SnapshotTag::NUMBER);
+    put(writer.bytes, value.as.number);
+    break;
+  case ValueType::OBJ:
+    put(writer.bytes, SnapshotTag::OBJ);
+    put(writer.bytes, index_of(writer, value.as.obj));
+    break;
+  }
+}
+
+auto put_object(SnapshotWriter &writer, Obj const *object) -> void {
+  auto &bytes = writer.bytes;
+  put(bytes, object->type);
+  switch (object->type) {
+  case ObjType::BOUND_METHOD: {
+    auto const bound = reinterpret_cast<ObjBoundMethod const *>(object);
+    put_value(writer, bound->receiver);
+    put_value(writer, bound->method);
+    break;
+  }
+  case ObjType::CLASS: {
+    auto const klass = reinterpret_cast<ObjClass const *>(object);
+    put_reference(writer, klass->name);
+    put_value(writer, klass->initializer);
+    put<uint32_t>(bytes, klass->methods.count);
+    for (int i = 0; i < klass->methods.count; ++i) {
+      put_reference(writer, klass->methods.data[i].name);
+      put_value(writer, klass->methods.data[i].method);
+    }
+    break;
+  }
+  case ObjType::CLOSURE: {
+    auto const closure = reinterpret_cast<ObjClosure const *>(object);
+    put_reference(writer, closure->function);
+    put<uint32_t>(bytes, closure->upvalue_count);
+    for (int i = 0; i < closure->upvalue_count; ++i)
+      put_reference(writer, closure->upvalues[i]);
+    break;
+  }
+  case ObjType::FUNCTION: {
+    auto const function = reinterpret_cast<ObjFunction const *>(object);
+    auto const &chunk = function->chunk;
+    put<int32_t>(bytes, function->id);
+    put<int32_t>(bytes, function->arity);
+    put<int32_t>(bytes, function->upvalue_count);
+    put_reference(writer, function->name);
+    put<uint32_t>(bytes, chunk.code.count);
+    append(bytes, chunk.code.data, chunk.code.count);
+    put<uint32_t>(bytes, chunk.lines.count);
+    for (int i = 0; i < chunk.lines.count; ++i)
+      put<int32_t>(bytes, chunk.lines.data[i]);
+    put<uint32_t>(bytes, chunk.constants.count);
+    for (int i = 0; i < chunk.constants.count; ++i)
+      put_value(writer, chunk.constants.data[i]);
+    put<uint32_t>(bytes, chunk.loops.count);
+    for (int i = 0; i < chunk.loops.count; ++i)
+      put<int32_t>(bytes, chunk.loops.data[i].offset);
+    put<uint32_t>(bytes, chunk.caches.count);
+    for (int i = 0; i < chunk.caches.count; ++i)
+      put<int32_t>(bytes, chunk.caches.data[i].offset);
+    break;
+  }
+  case ObjType::INSTANCE: {
+    auto const instance = reinterpret_cast<ObjInstance const *>(object);
+    put_reference(writer, instance->klass);
+    put<uint32_t>(bytes, instance->fields.count);
+    auto names = Array<ObjString const *>{};
+    reserve(names, instance->fields.count);
+    names.count = instance->fields.count;
+    for (auto shape = instance->shape; shape->parent != nullptr;
+         shape = shape->parent)
+      names.data[shape->field_count - 1] = shape->name;
+    for (int i = 0; i < instance->fields.count; ++i) {
+      put_reference(writer, names.data[i]);
+      put_value(writer, instance->fields.data[i]);
+    }
+    break;
+  }
+  case ObjType::NATIVE: {
+    auto const native = reinterpret_cast<ObjNative const *>(object);
+    put_string(bytes, native->name);
+    put<int32_t>(bytes, native->arity);
+    break;
+  }
+  case ObjType::NUMBER_ARRAY: {
+    auto const array = reinterpret_cast<ObjNumberArray const *>(object);
+    put<uint32_t>(bytes, array->count);
+    append(bytes, reinterpret_cast<uint8_t const *>(array->data),
+           array->count * sizeof(double));
+    break;
+  }
+  case ObjType::STRING:
+    put_string(bytes, reinterpret_cast<ObjString const *>(object));
+    break;
+  case ObjType::UPVALUE:
+    put_value(writer, *reinterpret_cast<ObjUpvalue const *>(object)->location);
+    break;
+  }
+}
+
+template <typename T> auto take(SnapshotReader &reader) -> T {
+  auto value = T{};
+  auto const bytes = take_bytes(reader, sizeof(T));
+  if (bytes != nullptr)
+    memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+auto take_bytes(SnapshotReader &reader, size_t count) -> uint8_t const * {
+  if (reader.failed || reader.bytes.size() - reader.position < count) {
+    reader.failed = true;
+    return nullptr;
+  }
+  auto const bytes = reader.bytes.data() + reader.position;
+  reader.position += count;
+  return bytes;
+}
+
+// Reads the length of a sequence whose elements take at least min_size bytes
+// each, failing before anything is allocated for a length the remaining
+// bytes cannot hold.
+auto take_count(SnapshotReader &reader, size_t min_size) -> uint32_t {
+  auto const count = take<uint32_t>(reader);
+  if (reader.failed ||
+      count * min_size > reader.bytes.size() - reader.position) {
+    reader.failed = true;
+    return 0;
+  }
+  return count;
+}
+
+template <typename T>
+auto take_reference(SnapshotReader &reader, T *&reference) -> void {
+  auto const index = take<uint32_t>(reader);
+  if (index == null_reference) {
+    reference = nullptr;
+    return;
+  }
+  reference = reinterpret_cast<T *>(static_cast<uintptr_t>(index));
+  write(reader.fixups, reinterpret_cast<void **>(&reference));
+}
+
+// Reads a reference to an object that must already have been loaded.
+template <typename T>
+auto take_earlier(SnapshotReader &reader, ObjType type) -> T * {
+  auto const index = take<uint32_t>(reader);
+  if (reader.failed || index >= static_cast<uint32_t>(reader.objects.count) ||
+      reader.objects.data[index]->type != type) {
+    reader.failed = true;
+    return nullptr;
+  }
+  return reinterpret_cast<T *>(reader.objects.data[index]);
+}
+
+auto take_value(SnapshotReader &reader, Value &value) -> void {
+  value = nil_val;
+  switch (take<SnapshotTag>(reader)) {
+  case SnapshotTag::NIL:
+    break;
+  case SnapshotTag::FALSE:
+    value = bool_val(false);
+    break;
+  case SnapshotTag::TRUE:
+    value = bool_val(true);
+    break;
+  case SnapshotTag::NUMBER:
+    value = number_val(take<double>(reader));
+    break;
+  case SnapshotTag::OBJ:
+    value.type = ValueType::OBJ;
+    take_reference(reader, value.as.obj);
+    break;
+  default:
+    reader.failed = true;
+  }
+}
+
+// Allocates the next object and reads its fields. An object is listed in
+// objects as soon as it exists, so discard() frees it if reading fails.
+auto take_object(SnapshotReader &reader) -> void {
+  auto const list = [&](auto object) {
+    write(reader.objects, &object->obj);
+    return object;
+  };
+  switch (take<ObjType>(reader)) {
+  case ObjType::BOUND_METHOD: {
+    auto const bound = list(new_bound_method(nil_val, nil_val));
+    take_value(reader, bound->receiver);
+    take_value(reader, bound->method);
+    break;
+  }
+  case ObjType::CLASS: {
+    auto const klass = list(new_class(nullptr));
+    take_reference(reader, klass->name);
+    take_value(reader, klass->initializer);
+    auto const count = take_count(reader, sizeof(uint32_t) + 1);
+    reserve(klass->methods, count);
+    for (uint32_t i = 0; i < count; ++i) {
+      auto &method = klass->methods.data[klass->methods.count++];
+      take_reference(reader, method.name);
+      take_value(reader, method.method);
+    }
+    break;
+  }
+  case ObjType::CLOSURE: {
+    auto const function =
+        take_earlier<ObjFunction>(reader, ObjType::FUNCTION);
+    auto const count = take<uint32_t>(reader);
+    if (function == nullptr ||
+        count != static_cast<uint32_t>(function->upvalue_count)) {
+      reader.failed = true;
+      break;
+    }
+    auto const closure = list(new_closure(function));
+    closure->escaped = true;
+    for (uint32_t i = 0; i < count; ++i)
+      take_reference(reader, closure->upvalues[i]);
+    break;
+  }
+  case ObjType::FUNCTION:
+    take_function(reader, list(new_function()));
+    break;
+  case ObjType::INSTANCE: {
+    auto const klass = take_earlier<ObjClass>(reader, ObjType::CLASS);
+    if (klass == nullptr)
+      break;
+    auto const instance = list(new_instance(klass));
+    auto const count = take_count(reader, sizeof(uint32_t) + 1);
+    reserve(instance->fields, count);
+    for (uint32_t i = 0; i < count && !reader.failed; ++i) {
+      auto const name = take_earlier<ObjString>(reader, ObjType::STRING);
+      if (name == nullptr)
+        break;
+      instance->shape = add_field(instance->shape, name);
+      take_value(reader, instance->fields.data[instance->fields.count++]);
+    }
+    break;
+  }
+  case ObjType::NATIVE: {
+    auto const length = take<uint32_t>(reader);
+    auto const chars = take_bytes(reader, length);
+    auto const arity = take<int32_t>(reader);
+    if (reader.failed)
+      break;
+    auto const &indexes = reader.vm.globals.indexes;
+    auto const found = indexes.find(
+        std::string_view{reinterpret_cast<char const *>(chars), length});
+    auto const native =
+        found != indexes.end() ? reader.vm.globals.slots.data[found->second]
+                                     .value
+                               : nil_val;
+    if (!is_native(native) || as_native(native)->arity != arity) {
+      reader.failed = true;
+      break;
+    }
+    write(reader.objects, native.as.obj);
+    break;
+  }
+  case ObjType::NUMBER_ARRAY: {
+    auto const count = take_count(reader, sizeof(double));
+    auto const data = take_bytes(reader, count * sizeof(double));
+    if (data == nullptr)
+      break;
+    auto const array = list(new_number_array(count));
+    memcpy(array->data, data, count * sizeof(double));
+    break;
+  }
+  case ObjType::STRING: {
+    auto const length = take<uint32_t>(reader);
+    auto const chars = take_bytes(reader, length);
+    if (chars == nullptr)
+      break;
+    list(copy_string({reinterpret_cast<char const *>(chars), length}));
+    break;
+  }
+  case ObjType::UPVALUE: {
+    auto const upvalue = list(new_upvalue(nullptr));
+    upvalue->location = &upvalue->closed;
+    take_value(reader, upvalue->closed);
+    break;
+  }
+  default:
+    reader.failed = true;
+  }
+}
+
+auto take_function(SnapshotReader &reader, ObjFunction *function) -> void {
+  auto &chunk = function->chunk;
+  function->id = take<int32_t>(reader);
+  function->arity = take<int32_t>(reader);
+  function->upvalue_count = take<int32_t>(reader);
+  take_reference(reader, function->name);
+  auto count = take_count(reader, 1);
+  if (auto const code = take_bytes(reader, count))
+    append(chunk.code, code, count);
+  count = take_count(reader, sizeof(int32_t));
+  reserve(chunk.lines, count);
+  for (uint32_t i = 0; i < count; ++i)
+    write(chunk.lines, static_cast<int>(take<int32_t>(reader)));
+  count = take_count(reader, 1);
+  reserve(chunk.constants, count);
+  for (uint32_t i = 0; i < count; ++i)
+    take_value(reader, chunk.constants.data[chunk.constants.count++]);
+  count = take_count(reader, sizeof(int32_t));
+  for (uint32_t i = 0; i < count; ++i)
+    add_loop_site(chunk, take<int32_t>(reader));
+  count = take_count(reader, sizeof(int32_t));
+  for (uint32_t i = 0; i < count; ++i)
+    add_property_cache(chunk, take<int32_t>(reader));
+  if (chunk.lines.count != chunk.code.count)
+    reader.failed = true;
+  function->stack_size = stack_size(chunk, function->arity);
+}
+
+auto relocate(SnapshotReader &reader) -> void {
+  if (reader.failed)
+    return;
+  auto const object_count = static_cast<uintptr_t>(reader.objects.count);
+  for (int i = 0; i < reader.fixups.count; ++i) {
+    auto const fixup = reader.fixups.data[i];
+    auto const index = reinterpret_cast<uintptr_t>(*fixup);
+    if (index >= object_count) {
+      reader.failed = true;
+      return;
+    }
+    *fixup = reader.objects.data[index];
+  }
+}
+
+// Frees what a failed load allocated. Natives belong to the VirtualMachine.
+auto discard(SnapshotReader &reader) -> void {
+  for (int i = 0; i < reader.objects.count; ++i)
+    if (reader.objects.data[i]->type != ObjType::NATIVE)
+      free_object(reader.objects.data[i]);
+}
+
+} // namespace lox
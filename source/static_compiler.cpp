@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <static_compiler.hpp>
+
+namespace lox {
+
+auto static_error(std::string_view message) -> void {
+  int const length = message.length();
+  fprintf(stderr, "Error: %.*s\n", length, message.begin());
+  abort();
+}
+
+auto load(StaticChunk const &static_chunk, Chunk &chunk) -> void {
+  append(chunk.constants, static_chunk.constants,
+         static_chunk.constants_count);
+  append(chunk.code, static_chunk.code, static_chunk.code_count);
+  append(chunk.lines, static_chunk.lines, static_chunk.code_count);
+}
+
+} // namespace lox
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <trace.hpp>
+
+namespace lox {
+
+auto constexpr trace_magic = uint64_t{0x45434152'54584f4c}; // LOXTRACE
+// The writer fills the slot after the newest record before publishing it, so
+// that slot is never copied and a read returns one record fewer than the ring
+// holds.
+auto constexpr trace_window = uint64_t{trace_capacity - 1};
+
+auto read_trace(TraceRing const &ring, Array<TraceRecord> &records) -> void {
+  auto const end = ring.head.load(std::memory_order_acquire);
+  auto const begin = end > trace_window ? end - trace_window : 0;
+  auto const start = records.count;
+  reserve(records, start + static_cast<int>(end - begin));
+  for (auto i = begin; i < end; ++i) {
+    auto const word =
+        ring.records[i % trace_capacity].load(std::memory_order_relaxed);
+    memcpy(&records.data[records.count++], &word, sizeof(word));
+  }
+  // A record the writer reached again while they were being copied, or is
+  // writing now, is newer than its copy, so those copies are dropped.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto const head = ring.head.load(std::memory_order_relaxed);
+  auto const valid = head > trace_window ? head - trace_window : 0;
+  if (valid <= begin)
+    return;
+  auto const kept = static_cast<int>(end - std::min(valid, end));
+  memmove(records.data + start, records.data + records.count - kept,
+          sizeof(TraceRecord) * kept);
+  records.count = start + kept;
+}
+
+auto write_trace(TraceRing const &ring, char const *path) -> bool {
+  auto records = Array<TraceRecord>{};
+  read_trace(ring, records);
+  auto const file = fopen(path, "wb");
+  if (file == nullptr)
+    return false;
+  auto const count = static_cast<uint64_t>(records.count);
+  auto written = fwrite(&trace_magic, sizeof(trace_magic), 1, file);
+  written += fwrite(&count, sizeof(count), 1, file);
+  written += fwrite(records.data, sizeof(TraceRecord), records.count, file);
+  return fclose(file) == 0 && written == 2 + count;
+}
+
+auto load_trace(char const *path, Array<TraceRecord> &records) -> bool {
+  auto const file = fopen(path, "rb");
+  if (file == nullptr)
+    return false;
+  auto magic = uint64_t{};
+  auto count = uint64_t{};
+  auto loaded = fread(&magic, sizeof(magic), 1, file) == 1 &&
+                magic == trace_magic &&
+                fread(&count, sizeof(count), 1, file) == 1 &&
+                count <= trace_capacity;
+  if (loaded) {
+    reserve(records, records.count + static_cast<int>(count));
+    loaded = fread(records.data + records.count, sizeof(TraceRecord), count,
+                   file) == count;
+    if (loaded)
+      records.count += count;
+  }
+  fclose(file);
+  return loaded;
+}
+
+} // namespace lox
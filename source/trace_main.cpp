@@ -0,0 +1,88 @@
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <streambuf>
+#include <string>
+
+#include <array.hpp>
+#include <compiler.hpp>
+#include <debug.hpp>
+#include <natives.hpp>
+#include <object.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+using lox::Array;
+using lox::as_function;
+using lox::compile;
+using lox::define_array_natives;
+using lox::disassemble;
+using lox::is_function;
+using lox::load_trace;
+using lox::ObjFunction;
+using lox::TraceRecord;
+using lox::VirtualMachine;
+
+auto collect_functions(ObjFunction *function, Array<ObjFunction *> &functions)
+    -> void;
+
+// Decodes a trace written by lox --trace. The script is compiled again, which
+// numbers its functions the same way, so each record is printed with the
+// disassembly and source line of its instruction.
+auto main(int argc, char const *argv[]) -> int
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "Usage: lox-trace <script> <trace>\n");
+    exit(64);
+  }
+  auto file = std::ifstream{argv[1]};
+  auto const source = std::string{std::istreambuf_iterator<char>(file),
+                                  std::istreambuf_iterator<char>()};
+  auto vm = VirtualMachine{};
+  define_array_natives(vm);
+  auto const script = compile(source, vm.globals);
+  if (script == nullptr)
+    exit(65);
+  auto records = Array<TraceRecord>{};
+  if (!load_trace(argv[2], records))
+  {
+    fprintf(stderr, "Could not read trace \"%s\".\n", argv[2]);
+    exit(74);
+  }
+  auto functions = Array<ObjFunction *>{};
+  collect_functions(script, functions);
+  char const *const types[] = {"bool", "nil", "number", "obj"};
+  for (auto i = 0; i < records.count; ++i)
+  {
+    auto const &record = records.data[i];
+    auto const function = record.function < functions.count
+                              ? functions.data[record.function]
+                              : nullptr;
+    if (function == nullptr ||
+        record.offset >= static_cast<uint32_t>(function->chunk.code.count) ||
+        record.top >= std::size(types))
+    {
+      fprintf(stderr, "Trace does not match \"%s\".\n", argv[1]);
+      exit(65);
+    }
+    printf("%-16s line %-4d %-6s ",
+           function->name == nullptr ? "<script>" : function->name->chars,
+           function->chunk.lines.data[record.offset], types[record.top]);
+    disassemble(function->chunk, static_cast<int>(record.offset));
+  }
+  return 0;
+}
+
+auto collect_functions(ObjFunction *function, Array<ObjFunction *> &functions)
+    -> void
+{
+  while (functions.count <= function->id)
+    write(functions, static_cast<ObjFunction *>(nullptr));
+  functions.data[function->id] = function;
+  auto const &constants = function->chunk.constants;
+  for (auto i = 0; i < constants.count; ++i)
+    if (is_function(constants.data[i]))
+      collect_functions(as_function(constants.data[i]), functions);
+}
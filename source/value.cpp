@@ -1,11 +1,12 @@
 #include <stdio.h>
 
 #include <object.hpp>
+#include <output.hpp>
 #include <value.hpp>
 
 namespace lox {
 
-auto print_object(Value const &value) -> void;
+auto print_object(Output &output, Value const &value) -> void;
 
 auto operator==(Value const &lhs, Value const &rhs) -> bool {
   if (lhs.type != rhs.type)
@@ -18,56 +19,87 @@ auto operator==(Value const &lhs, Value const &rhs) -> bool {
   case ValueType::NIL:
     return true;
   case ValueType::OBJ: {
-    auto const lhs_string = as_string(lhs);
-    auto const rhs_string = as_string(rhs);
-    auto const length = lhs_string->length;
-    return length == rhs_string->length &&
-           memcmp(lhs_string->chars, rhs_string->chars, length) == 0;
+    if (!is_string(lhs) || !is_string(rhs))
+      return lhs.as.obj == rhs.as.obj;
+    return equal(as_string(lhs), as_string(rhs));
   }
   }
 }
 
-auto is_bool(Value const &value) -> bool {
-  return value.type == ValueType::BOOL;
-}
-
-auto is_nil(Value const &value) -> bool { return value.type == ValueType::NIL; }
-
-auto is_number(Value const &value) -> bool {
-  return value.type == ValueType::NUMBER;
-}
-
-auto is_obj(Value const &value) -> bool { return value.type == ValueType::OBJ; }
-
-auto bool_val(bool value) -> Value {
-  return Value{ValueType::BOOL, {.boolean = value}};
-}
-
-auto number_val(double value) -> Value {
-  return Value{ValueType::NUMBER, {.number = value}};
+auto print(Value const &value) -> void {
+  auto output = Output{};
+  output.sink = write_stdio;
+  output.context = stdout;
+  print(output, value);
+  flush(output);
 }
 
-auto print(Value const &value) -> void {
+auto print(Output &output, Value const &value) -> void {
   switch (value.type) {
   case ValueType::BOOL:
-    printf(value.as.boolean ? "true" : "false");
+    put(output, value.as.boolean ? "true" : "false");
     break;
   case ValueType::NIL:
-    printf("nil");
+    put(output, "nil");
     break;
   case ValueType::NUMBER:
-    printf("%g", value.as.number);
+    put_number(output, value.as.number);
     break;
   case ValueType::OBJ:
-    print_object(value);
+    print_object(output, value);
     break;
   }
 }
 
-auto print_object(Value const &value) -> void {
+auto print_object(Output &output, Value const &value) -> void {
   switch (obj_type(value)) {
-  case ObjType::STRING:
-    printf("%s", as_cstring(value));
+  case ObjType::BOUND_METHOD:
+    print(output, as_bound_method(value)->method);
+    break;
+  case ObjType::CLASS:
+    put(output, as_class(value)->name->chars);
+    break;
+  case ObjType::INSTANCE:
+    put(output, as_instance(value)->klass->name->chars);
+    put(output, " instance");
+    break;
+  case ObjType::CLOSURE:
+  case ObjType::FUNCTION: {
+    auto const function = is_closure(value) ? as_closure(value)->function
+                                            : as_function(value);
+    auto const name = function->name;
+    if (name == nullptr) {
+      put(output, "<script>");
+    } else {
+      put(output, "<fn ");
+      put(output, name->chars);
+      put(output, '>');
+    }
+    break;
+  }
+  case ObjType::NATIVE:
+    put(output, "<native ");
+    put(output, as_native(value)->name->chars);
+    put(output, '>');
+    break;
+  case ObjType::NUMBER_ARRAY: {
+    auto const array = as_number_array(value);
+    put(output, '[');
+    for (int i = 0; i < array->count; ++i) {
+      if (i != 0)
+        put(output, ", ");
+      put_number(output, array->data[i]);
+    }
+    put(output, ']');
+    break;
+  }
+  case ObjType::STRING: {
+    auto const string = as_string(value);
+    put(output, {string->chars, static_cast<size_t>(string->length)});
+    break;
+  }
+  case ObjType::UPVALUE:
+    put(output, "upvalue");
     break;
   }
 }
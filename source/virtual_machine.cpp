@@ -1,44 +1,737 @@
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <stdarg.h>
 #include <stdio.h>
+#include <type_traits>
 
+#include <bits.hpp>
+#include <collector.hpp>
 #include <compiler.hpp>
 #include <debug.hpp>
+#include <memory.hpp>
+#include <number_array.hpp>
+#include <nursery.hpp>
+#include <object.hpp>
+#include <output.hpp>
+#include <trace.hpp>
 #include <value.hpp>
 #include <virtual_machine.hpp>
 
 namespace lox {
 
+// How many steps a run with a time limit takes between looks at the clock.
+auto constexpr limit_check_steps = uint64_t{1024};
+
 auto runtime_error(VirtualMachine &vm, const char *format, ...) -> void;
-auto is_falsey(Value value) -> bool;
+auto callee_function(Value callee) -> ObjFunction *;
+auto check_arity(VirtualMachine &vm, ObjFunction const *function,
+                 int argument_count) -> bool;
+auto call_value(VirtualMachine &vm, Value callee, int argument_count) -> bool;
+auto call(VirtualMachine &vm, Value callee, int argument_count) -> bool;
+auto probe(PropertyCache const &cache, Shape const *shape)
+    -> CacheEntry const *;
+auto resolve_property(VirtualMachine &vm, PropertyCache &cache,
+                      ObjInstance const *instance, ObjString const *name,
+                      CacheEntry &entry) -> bool;
+auto resolve_field(PropertyCache &cache, Shape *shape, ObjString *name,
+                   CacheEntry &entry) -> void;
+auto cache(PropertyCache &cache, CacheEntry const &entry) -> void;
+auto is_pooled(VirtualMachine const &vm, ObjUpvalue const *upvalue) -> bool;
+auto capture_upvalue(VirtualMachine &vm, Value *slot) -> ObjUpvalue *;
+auto close_upvalues(VirtualMachine &vm, Value *last) -> void;
+auto close_upvalue(VirtualMachine &vm, ObjUpvalue *upvalue) -> void;
+auto escape(VirtualMachine &vm, Value value) -> void;
+auto escape(VirtualMachine &vm, ObjClosure *closure) -> void;
+auto array_operand(Value const &value, int &count) -> ArrayOperand;
+auto array_binary(VirtualMachine &vm, ArrayOp op) -> bool;
+auto run_cached(VirtualMachine &vm, CallFrame &frame, bool single_step)
+    -> bool;
+auto run(VirtualMachine &vm) -> InterpretResult;
+auto is_managed(VirtualMachine const &vm) -> bool;
+auto run_managed(VirtualMachine &vm) -> InterpretResult;
+auto is_limited(ResourceLimits const &limits) -> bool;
+auto execute_limited(VirtualMachine &vm, HeapMeter &meter) -> InterpretResult;
+auto reclaim(VirtualMachine &vm, HeapMeter &meter) -> bool;
+auto failed_call(VirtualMachine const &vm) -> InterpretResult;
+auto limit_name(ResourceLimit limit) -> char const *;
+auto execute(VirtualMachine &vm) -> InterpretResult;
+auto finish_script(VirtualMachine &vm, InterpretResult result)
+    -> InterpretResult;
 
 VirtualMachine::VirtualMachine() { reset_stack(*this); }
 
-auto reset_stack(VirtualMachine &vm) -> void { vm.stack_top = vm.stack; }
+VirtualMachine::~VirtualMachine() {
+  if (script != nullptr)
+    free_object(&script->obj);
+}
 
+auto reset_stack(VirtualMachine &vm) -> void {
+  vm.stack_top = vm.stack;
+  vm.frame_count = 0;
+  vm.open_upvalues = nullptr;
+  vm.free_upvalues = nullptr;
+  for (auto &upvalue : vm.upvalue_pool) {
+    upvalue.obj.type = ObjType::UPVALUE;
+    upvalue.obj.remembered = false;
+    upvalue.obj.mark = 0;
+    upvalue.promoted = nullptr;
+    upvalue.next = vm.free_upvalues;
+    vm.free_upvalues = &upvalue;
+  }
+}
+
+// What the script printed before the error is flushed first, so the two
+// keep their order on a terminal.
 auto runtime_error(VirtualMachine &vm, const char *format, ...) -> void {
   va_list args;
   va_start(args, format);
-  vfprintf(stderr, format, args);
+  put_vformat(vm.err, format, args);
   va_end(args);
-  fputs("\n", stderr);
+  put(vm.err, '\n');
 
-  auto const instruction = vm.instruction_pointer - vm.chunk->code.data - 1;
-  auto const line = vm.chunk->lines.data[instruction];
-  fprintf(stderr, "[line %d] in script\n", line);
+  for (int i = vm.frame_count - 1; i >= 0; --i) {
+    auto const &frame = vm.frames[i];
+    auto const &chunk = frame.function->chunk;
+    // A frame stopped by a limit may not have run its first instruction.
+    auto const instruction =
+        std::max(frame.instruction_pointer - chunk.code.data - 1, ptrdiff_t{0});
+    put_format(vm.err, "[line %d] in ", chunk.lines.data[instruction]);
+    if (frame.function->name == nullptr)
+      put(vm.err, "script\n");
+    else
+      put_format(vm.err, "%s()\n", frame.function->name->chars);
+  }
+  flush(vm.out);
+  flush(vm.err);
+  close_upvalues(vm, vm.stack);
   reset_stack(vm);
 }
 
+auto callee_function(Value callee) -> ObjFunction * {
+  return is_closure(callee) ? as_closure(callee)->function
+                            : as_function(callee);
+}
+
+auto check_arity(VirtualMachine &vm, ObjFunction const *function,
+                 int argument_count) -> bool {
+  if (argument_count != function->arity) {
+    runtime_error(vm, "Expected %d arguments but got %d.", function->arity,
+                  argument_count);
+    return false;
+  }
+  return true;
+}
+
+// Calling a class replaces it with a new instance, which its initializer
+// then receives in slot zero like any other method receiver.
+auto call_value(VirtualMachine &vm, Value callee, int argument_count) -> bool {
+  if (is_obj(callee)) {
+    switch (obj_type(callee)) {
+    case ObjType::BOUND_METHOD: {
+      auto const bound = as_bound_method(callee);
+      vm.stack_top[-argument_count - 1] = bound->receiver;
+      return call(vm, bound->method, argument_count);
+    }
+    case ObjType::CLASS: {
+      auto const klass = as_class(callee);
+      vm.stack_top[-argument_count - 1] = obj_val(new_instance(klass));
+      if (!is_nil(klass->initializer))
+        return call(vm, klass->initializer, argument_count);
+      if (argument_count != 0) {
+        runtime_error(vm, "Expected 0 arguments but got %d.",
+                      argument_count);
+        return false;
+      }
+      return true;
+    }
+    case ObjType::CLOSURE:
+    case ObjType::FUNCTION:
+      return call(vm, callee, argument_count);
+    case ObjType::NATIVE: {
+      // The arguments are passed in place and the result overwrites the
+      // callee, so a native call copies no values and pushes no frame.
+      auto const native = as_native(callee);
+      if (argument_count != native->arity) {
+        runtime_error(vm, "Expected %d arguments but got %d.", native->arity,
+                      argument_count);
+        return false;
+      }
+      auto const arguments = std::span<Value const>{
+          vm.stack_top - argument_count, static_cast<size_t>(argument_count)};
+      auto const result = vm.stack_top - argument_count - 1;
+      if (native->function != nullptr)
+        *result = native->function(arguments);
+      else
+        native->batch(arguments, std::span<Value>{result, 1});
+      vm.stack_top = result + 1;
+      return true;
+    }
+    default:
+      break;
+    }
+  }
+  runtime_error(vm, "Can only call functions and classes.");
+  return false;
+}
+
+// Frames come from the fixed frames array and their slots overlap the values
+// the caller pushed, so a call allocates nothing. Room for all the stack the
+// callee uses is checked here, so pushes need not check.
+auto call(VirtualMachine &vm, Value callee, int argument_count) -> bool {
+  if (!check_arity(vm, callee_function(callee), argument_count))
+    return false;
+  if (vm.frame_count >= std::min(vm.limits.frames, frames_max)) {
+    if (vm.frame_count == frames_max) {
+      runtime_error(vm, "Stack overflow.");
+      return false;
+    }
+    vm.usage.exceeded = ResourceLimit::FRAMES;
+    runtime_error(vm, "%s limit exceeded.", limit_name(vm.usage.exceeded));
+    return false;
+  }
+  auto const function = callee_function(callee);
+  auto const slots = vm.stack_top - argument_count - 1;
+  if (function->stack_size > vm.stack + stack_max - slots) {
+    runtime_error(vm, "Stack overflow.");
+    return false;
+  }
+  auto &frame = vm.frames[vm.frame_count++];
+  frame.function = function;
+  frame.closure = is_closure(callee) ? as_closure(callee) : nullptr;
+  frame.instruction_pointer = function->chunk.code.data;
+  frame.slots = slots;
+  return true;
+}
+
+auto probe(PropertyCache const &cache, Shape const *shape)
+    -> CacheEntry const * {
+  for (int i = 0; i < cache.count; ++i)
+    if (cache.entries[i].shape == shape)
+      return &cache.entries[i];
+  return nullptr;
+}
+
+// Fields shadow methods. Both are looked up by name only on a cache miss.
+auto resolve_property(VirtualMachine &vm, PropertyCache &cache,
+                      ObjInstance const *instance, ObjString const *name,
+                      CacheEntry &entry) -> bool {
+  ++cache.misses;
+  entry = CacheEntry{instance->shape, nullptr,
+                     find_field(instance->shape, name), nil_val};
+  if (entry.slot == -1) {
+    auto const method = find_method(instance->klass, name);
+    if (method == nullptr)
+      return false;
+    entry.method = *method;
+  }
+  auto const count = cache.count;
+  lox::cache(cache, entry);
+  if (cache.count != count)
+    remember_slot(vm.nursery, &cache.entries[count].method);
+  return true;
+}
+
+auto resolve_field(PropertyCache &cache, Shape *shape, ObjString *name,
+                   CacheEntry &entry) -> void {
+  ++cache.misses;
+  entry = CacheEntry{shape, nullptr, find_field(shape, name), nil_val};
+  if (entry.slot == -1) {
+    entry.transition = add_field(shape, name);
+    entry.slot = shape->field_count;
+  }
+  lox::cache(cache, entry);
+}
+
+auto cache(PropertyCache &cache, CacheEntry const &entry) -> void {
+  if (cache.count < property_cache_size)
+    cache.entries[cache.count++] = entry;
+}
+
+auto is_pooled(VirtualMachine const &vm, ObjUpvalue const *upvalue) -> bool {
+  return upvalue >= vm.upvalue_pool &&
+         upvalue < vm.upvalue_pool + upvalues_max;
+}
+
+// Open upvalues are sorted by descending slot so closing a scope only looks
+// at the head of the list. The heap is used once the pool runs dry.
+auto capture_upvalue(VirtualMachine &vm, Value *slot) -> ObjUpvalue * {
+  ObjUpvalue *previous = nullptr;
+  auto upvalue = vm.open_upvalues;
+  while (upvalue != nullptr && upvalue->location > slot) {
+    previous = upvalue;
+    upvalue = upvalue->next;
+  }
+  if (upvalue != nullptr && upvalue->location == slot)
+    return upvalue;
+  auto created = vm.free_upvalues;
+  if (created != nullptr) {
+    vm.free_upvalues = created->next;
+    created->obj.mark = 0;
+    created->location = slot;
+  } else {
+    created = new_upvalue(slot);
+  }
+  created->next = upvalue;
+  if (previous == nullptr)
+    vm.open_upvalues = created;
+  else
+    previous->next = created;
+  return created;
+}
+
+// Closures still pointing at a pooled upvalue never escaped and die with the
+// scope, so pooled upvalues go back to the pool and only their promoted
+// copies keep the value. A pooled upvalue still gray would no longer mark
+// its copy, so the copy is shaded as the two part.
+auto close_upvalues(VirtualMachine &vm, Value *last) -> void {
+  while (vm.open_upvalues != nullptr && vm.open_upvalues->location >= last) {
+    auto const upvalue = vm.open_upvalues;
+    vm.open_upvalues = upvalue->next;
+    if (!is_pooled(vm, upvalue)) {
+      close_upvalue(vm, upvalue);
+      continue;
+    }
+    if (upvalue->promoted != nullptr) {
+      close_upvalue(vm, upvalue->promoted);
+      mark_barrier(vm.collector, &upvalue->promoted->obj);
+      upvalue->promoted = nullptr;
+    }
+    upvalue->next = vm.free_upvalues;
+    vm.free_upvalues = upvalue;
+  }
+}
+
+auto close_upvalue(VirtualMachine &vm, ObjUpvalue *upvalue) -> void {
+  write_barrier(vm.nursery, &upvalue->obj, *upvalue->location);
+  upvalue->closed = *upvalue->location;
+  upvalue->location = &upvalue->closed;
+  escape(vm, upvalue->closed);
+}
+
+// A closure escapes when it is stored somewhere that may outlive the stack
+// slots it captured: a global, an upvalue, a lower local or a return value.
+auto escape(VirtualMachine &vm, Value value) -> void {
+  if (is_closure(value))
+    escape(vm, as_closure(value));
+}
+
+auto escape(VirtualMachine &vm, ObjClosure *closure) -> void {
+  if (closure->escaped)
+    return;
+  closure->escaped = true;
+  for (int i = 0; i < closure->upvalue_count; ++i) {
+    auto &upvalue = closure->upvalues[i];
+    if (!is_pooled(vm, upvalue))
+      continue;
+    if (upvalue->promoted == nullptr)
+      upvalue->promoted = new_upvalue(upvalue->location);
+    write_barrier(vm.nursery, &closure->obj, &upvalue->promoted->obj);
+    mark_barrier(vm.collector, &upvalue->obj);
+    upvalue = upvalue->promoted;
+  }
+}
+
+// A number operand broadcasts against the other side. count is left alone
+// for numbers and must agree across two arrays.
+auto array_operand(Value const &value, int &count) -> ArrayOperand {
+  if (is_number(value))
+    return {&value.as.number, true};
+  auto const array = as_number_array(value);
+  count = array->count;
+  return {array->data, false};
+}
+
+// The slow path of the arithmetic and comparison instructions, taken once
+// either operand is a number array.
+auto array_binary(VirtualMachine &vm, ArrayOp op) -> bool {
+  auto const rhs = peek(vm, 0);
+  auto const lhs = peek(vm, 1);
+  auto const is_operand = [](Value const &value) {
+    return is_number(value) || is_number_array(value);
+  };
+  if (!is_operand(lhs) || !is_operand(rhs)) {
+    runtime_error(vm, "Operands must be numbers.");
+    return false;
+  }
+  auto lhs_count = -1;
+  auto rhs_count = -1;
+  auto const lhs_operand = array_operand(lhs, lhs_count);
+  auto const rhs_operand = array_operand(rhs, rhs_count);
+  if (lhs_count != -1 && rhs_count != -1 && lhs_count != rhs_count) {
+    runtime_error(vm, "Array lengths differ.");
+    return false;
+  }
+  auto const result = new_number_array(std::max(lhs_count, rhs_count));
+  apply(op, lhs_operand, rhs_operand, result->data, result->count);
+  vm.stack_top -= 2;
+  push(vm, obj_val(result));
+  return true;
+}
+
+// Runs common instructions with the value on top of the stack, the stack
+// pointer and the instruction pointer in locals, until it reaches one it
+// cannot run. That is any instruction not handled here, and the slow paths
+// of those that are: mixed operand types, undefined globals and running out
+// of fuel. The cached top is stored back first, so run() then executes that
+// instruction on the stack in memory. Each handler comes in two copies, one
+// for each state of the cache: while the top is held in register its slot
+// in memory is stale and one past sp. Returns whether it ran anything.
+auto run_cached(VirtualMachine &vm, CallFrame &frame, bool single_step)
+    -> bool {
+  auto ip = frame.instruction_pointer;
+  auto sp = vm.stack_top;
+  auto top = nil_val;
+  auto cached = false;
+  auto const constants = frame.function->chunk.constants.data;
+  auto const globals = vm.globals.slots.data;
+  auto const step = [&](auto held) __attribute__((always_inline)) -> bool {
+    auto constexpr in_register = decltype(held)::value;
+    auto const push_top = [&](Value value) __attribute__((always_inline)) {
+      if constexpr (in_register)
+        *sp++ = top;
+      top = value;
+      cached = true;
+    };
+    auto const peek_top = [&]() __attribute__((always_inline)) -> Value {
+      if constexpr (in_register)
+        return top;
+      else
+        return sp[-1];
+    };
+    // A local that was just initialized may be the top held in register.
+    auto const local = [&]() __attribute__((always_inline)) -> Value & {
+      auto const slot = frame.slots + ip[1];
+      if constexpr (in_register)
+        if (slot == sp)
+          return top;
+      return *slot;
+    };
+    auto const global = [&]() __attribute__((always_inline)) -> GlobalSlot & {
+      return globals[(ip[1] << 8) | ip[2]];
+    };
+    auto const binary = [&](auto value_type, auto op)
+        __attribute__((always_inline)) -> bool {
+      auto const rhs = peek_top();
+      auto const lhs = sp[in_register ? -1 : -2];
+      if (!is_number(lhs) || !is_number(rhs))
+        return false;
+      sp -= in_register ? 1 : 2;
+      top = value_type(op(lhs.as.number, rhs.as.number));
+      cached = true;
+      ++ip;
+      return true;
+    };
+    // The right operand of a superinstruction is its constant.
+    auto const binary_constant = [&](auto value_type, auto op)
+        __attribute__((always_inline)) -> bool {
+      auto const lhs = peek_top();
+      auto const rhs = constants[ip[1]];
+      if (!is_number(lhs) || !is_number(rhs))
+        return false;
+      if constexpr (!in_register)
+        --sp;
+      top = value_type(op(lhs.as.number, rhs.as.number));
+      cached = true;
+      ip += 2;
+      return true;
+    };
+    switch (*ip) {
+    case static_cast<uint8_t>(OpCode::CONSTANT):
+      push_top(constants[ip[1]]);
+      ip += 2;
+      return true;
+    case static_cast<uint8_t>(OpCode::FALSE):
+      push_top(bool_val(false));
+      ++ip;
+      return true;
+    case static_cast<uint8_t>(OpCode::TRUE):
+      push_top(bool_val(true));
+      ++ip;
+      return true;
+    case static_cast<uint8_t>(OpCode::NIL):
+      push_top(nil_val);
+      ++ip;
+      return true;
+    case static_cast<uint8_t>(OpCode::POP):
+      if constexpr (in_register)
+        cached = false;
+      else
+        --sp;
+      ++ip;
+      return true;
+    case static_cast<uint8_t>(OpCode::GET_LOCAL):
+      push_top(local());
+      ip += 2;
+      return true;
+    case static_cast<uint8_t>(OpCode::SET_LOCAL):
+      if (is_closure(peek_top()))
+        return false;
+      local() = peek_top();
+      ip += 2;
+      return true;
+    case static_cast<uint8_t>(OpCode::GET_GLOBAL):
+      if (!global().defined)
+        return false;
+      push_top(global().value);
+      ip += 3;
+      return true;
+    case static_cast<uint8_t>(OpCode::SET_GLOBAL):
+      if (!global().defined || is_closure(peek_top()))
+        return false;
+      global().value = peek_top();
+      ip += 3;
+      return true;
+    case static_cast<uint8_t>(OpCode::JUMP):
+      ip += 3 + ((ip[1] << 8) | ip[2]);
+      return true;
+    case static_cast<uint8_t>(OpCode::JUMP_IF_FALSE):
+      ip += 3 + (is_falsey(peek_top()) ? (ip[1] << 8) | ip[2] : 0);
+      return true;
+    case static_cast<uint8_t>(OpCode::LOOP):
+      if (vm.fuel == 0 || (vm.collector != nullptr && vm.collector->pending) ||
+          (vm.nursery != nullptr && vm.nursery->full))
+        return false;
+      --vm.fuel;
+      ++frame.function->chunk.loops.data[(ip[3] << 8) | ip[4]].count;
+      ip += 5 - ((ip[1] << 8) | ip[2]);
+      return true;
+    case static_cast<uint8_t>(OpCode::EQUAL): {
+      auto const rhs = peek_top();
+      sp -= in_register ? 1 : 2;
+      top = bool_val(*sp == rhs);
+      cached = true;
+      ++ip;
+      return true;
+    }
+    case static_cast<uint8_t>(OpCode::GREATER):
+      return binary(bool_val, std::greater<double>());
+    case static_cast<uint8_t>(OpCode::LESS):
+      return binary(bool_val, std::less<double>());
+    case static_cast<uint8_t>(OpCode::ADD):
+      return binary(number_val, std::plus<double>());
+    case static_cast<uint8_t>(OpCode::SUBTRACT):
+      return binary(number_val, std::minus<double>());
+    case static_cast<uint8_t>(OpCode::MULTIPLY):
+      return binary(number_val, std::multiplies<double>());
+    case static_cast<uint8_t>(OpCode::DIVIDE):
+      return binary(number_val, std::divides<double>());
+    case static_cast<uint8_t>(OpCode::ADD_CONSTANT):
+      return binary_constant(number_val, std::plus<double>());
+    case static_cast<uint8_t>(OpCode::SUBTRACT_CONSTANT):
+      return binary_constant(number_val, std::minus<double>());
+    case static_cast<uint8_t>(OpCode::MULTIPLY_CONSTANT):
+      return binary_constant(number_val, std::multiplies<double>());
+    case static_cast<uint8_t>(OpCode::DIVIDE_CONSTANT):
+      return binary_constant(number_val, std::divides<double>());
+    case static_cast<uint8_t>(OpCode::EQUAL_CONSTANT):
+      if constexpr (!in_register)
+        --sp;
+      top = bool_val((in_register ? top : *sp) == constants[ip[1]]);
+      cached = true;
+      ip += 2;
+      return true;
+    case static_cast<uint8_t>(OpCode::GREATER_CONSTANT):
+      return binary_constant(bool_val, std::greater<double>());
+    case static_cast<uint8_t>(OpCode::LESS_CONSTANT):
+      return binary_constant(bool_val, std::less<double>());
+    case static_cast<uint8_t>(OpCode::NOT):
+      if constexpr (!in_register)
+        --sp;
+      top = bool_val(is_falsey(in_register ? top : *sp));
+      cached = true;
+      ++ip;
+      return true;
+    default:
+      return false;
+    }
+  };
+  if (single_step)
+    step(std::false_type{});
+  else
+    while (cached ? step(std::true_type{}) : step(std::false_type{}))
+      ;
+  if (cached)
+    *sp++ = top;
+  // Every instruction moves the instruction pointer.
+  auto const ran = ip != frame.instruction_pointer;
+  frame.instruction_pointer = ip;
+  vm.stack_top = sp;
+  return ran;
+}
+
+// A run that ends with no frames left, whether it returned or failed, is
+// followed by a collection of the nursery. One that yields keeps its young
+// objects until a later run ends or fills the nursery. With limits, what the
+// run allocates is counted from the start of the run to the end of that
+// collection.
 auto run(VirtualMachine &vm) -> InterpretResult {
-  auto const read_byte = [&]() -> uint8_t { return *vm.instruction_pointer++; };
+  auto const result = is_managed(vm) ? run_managed(vm) : execute(vm);
+  flush(vm.out);
+  return result;
+}
+
+auto is_managed(VirtualMachine const &vm) -> bool {
+  return vm.nursery != nullptr || vm.collector != nullptr ||
+         is_limited(vm.limits);
+}
+
+auto run_managed(VirtualMachine &vm) -> InterpretResult {
+  auto const limited = is_limited(vm.limits);
+  auto meter = HeapMeter{vm.usage.heap_bytes, vm.limits.heap_bytes, &vm.fuel};
+  meter.reclaimable = vm.collector != nullptr || vm.nursery != nullptr;
+  auto const outer_meter = limited ? use_heap_meter(&meter) : nullptr;
+  auto const outer_collector = use_collector(vm.collector);
+  auto const outer = use_nursery(vm.nursery);
+  auto const result = limited ? execute_limited(vm, meter) : execute(vm);
+  meter.fuel = nullptr;
+  use_nursery(outer);
+  if (vm.nursery != nullptr && vm.frame_count == 0)
+    collect_nursery(vm);
+  use_collector(outer_collector);
+  if (limited) {
+    use_heap_meter(outer_meter);
+    vm.usage.heap_bytes = meter.bytes;
+  }
+  return result;
+}
+
+auto is_limited(ResourceLimits const &limits) -> bool {
+  return limits.heap_bytes != SIZE_MAX || limits.frames < frames_max ||
+         limits.steps != UINT64_MAX || limits.nanoseconds != UINT64_MAX;
+}
+
+// Runs with fuel cut down to the steps left, and with a time limit to
+// limit_check_steps at a time, so a run that stops for want of fuel has
+// either passed a limit, yielded or is due a look at the clock. The meter
+// takes the fuel away once the heap passes its limit, and the run fails
+// there unless collecting brings it back under. A run that completes is not
+// failed for what it allocated on the way.
+auto execute_limited(VirtualMachine &vm, HeapMeter &meter) -> InterpretResult {
+  auto const start = std::chrono::steady_clock::now();
+  auto const timed = vm.limits.nanoseconds != UINT64_MAX;
+  auto const nanoseconds = [&] {
+    return vm.usage.nanoseconds +
+           std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+               .count();
+  };
+  auto fuel = vm.fuel;
+  auto result = InterpretResult::YIELDED;
+  vm.usage.exceeded = ResourceLimit::NONE;
+  while (vm.usage.exceeded == ResourceLimit::NONE) {
+    auto slice = std::min(fuel, vm.limits.steps -
+                                    std::min(vm.usage.steps, vm.limits.steps));
+    if (timed)
+      slice = std::min(slice, limit_check_steps);
+    vm.fuel = slice;
+    result = execute(vm);
+    auto const spent = slice - (meter.exceeded ? meter.fuel_left : vm.fuel);
+    vm.usage.steps += spent;
+    fuel -= spent;
+    if (result != InterpretResult::YIELDED)
+      break;
+    if (meter.exceeded && !reclaim(vm, meter))
+      vm.usage.exceeded = ResourceLimit::HEAP;
+    else if (fuel == 0)
+      break;
+    else if (vm.usage.steps >= vm.limits.steps)
+      vm.usage.exceeded = ResourceLimit::STEPS;
+    else if (timed && nanoseconds() >= vm.limits.nanoseconds)
+      vm.usage.exceeded = ResourceLimit::TIME;
+  }
+  vm.fuel = fuel;
+  vm.usage.nanoseconds = nanoseconds();
+  if (vm.usage.exceeded == ResourceLimit::NONE)
+    return result;
+  // A call past the frame limit has reported itself.
+  if (result == InterpretResult::YIELDED)
+    runtime_error(vm, "%s limit exceeded.", limit_name(vm.usage.exceeded));
+  return InterpretResult::LIMIT_EXCEEDED;
+}
+
+// A run that passes the heap limit stops where the stack holds everything,
+// so what it dropped can be freed there. Returns whether that brought it
+// back under the limit.
+auto reclaim(VirtualMachine &vm, HeapMeter &meter) -> bool {
+  if (!meter.reclaimable)
+    return false;
+  if (vm.collector != nullptr)
+    collect_garbage(vm);
+  else
+    collect_nursery(vm);
+  if (!fits(meter, 0))
+    return false;
+  meter.exceeded = false;
+  return true;
+}
+
+// The first call of a run fails it as a call from inside the run would, so
+// a call past the frame limit exceeds the limit.
+auto failed_call(VirtualMachine const &vm) -> InterpretResult {
+  return vm.usage.exceeded == ResourceLimit::NONE
+             ? InterpretResult::RUNTIME_ERROR
+             : InterpretResult::LIMIT_EXCEEDED;
+}
+
+auto limit_name(ResourceLimit limit) -> char const * {
+  switch (limit) {
+  case ResourceLimit::HEAP:
+    return "Heap";
+  case ResourceLimit::FRAMES:
+    return "Stack depth";
+  case ResourceLimit::STEPS:
+    return "Step";
+  case ResourceLimit::TIME:
+    return "Time";
+  case ResourceLimit::NONE:
+    break;
+  }
+  return "No";
+}
+
+auto execute(VirtualMachine &vm) -> InterpretResult {
+  auto frame = &vm.frames[vm.frame_count - 1];
+  auto const read_byte = [&]() -> uint8_t {
+    return *frame->instruction_pointer++;
+  };
+  auto const read_short = [&]() -> uint16_t {
+    frame->instruction_pointer += 2;
+    return (frame->instruction_pointer[-2] << 8) |
+           frame->instruction_pointer[-1];
+  };
   auto const read_constant = [&]() -> Value {
-    return vm.chunk->constants.data[read_byte()];
+    return frame->function->chunk.constants.data[read_byte()];
+  };
+  auto const read_string = [&]() -> ObjString * {
+    return as_string(frame->function->chunk.constants.data[read_short()]);
+  };
+  auto const read_cache = [&]() -> PropertyCache & {
+    return frame->function->chunk.caches.data[read_short()];
   };
-  auto const binary_op = [&](auto value_type, auto op) -> bool {
-    if (!is_number(peek(vm, 0)) || !is_number(peek(vm, 1))) {
-      runtime_error(vm, "Operands must be numbers.");
+  // Every instruction that can run unboundedly often without another one
+  // spending fuel is a back edge or a call, so only those check it. They
+  // stop after the jump or call, with the frames ready for resume(). The
+  // stack holds everything then, so the collector runs its slices here and
+  // a full nursery is collected.
+  auto const spend_fuel = [&]() -> bool {
+    if (vm.collector != nullptr && vm.collector->pending)
+      collect_slice(vm);
+    if (vm.nursery != nullptr && vm.nursery->full)
+      collect_nursery(vm);
+    if (vm.fuel == 0)
       return false;
-    }
+    --vm.fuel;
+    return true;
+  };
+  auto const undefined_variable = [&](int global) {
+    runtime_error(vm, "Undefined variable '%s'.",
+                  vm.globals.names.data[global]->chars);
+  };
+  auto const binary_op = [&](auto value_type, auto op,
+                             ArrayOp array_op) -> bool {
+    if (!is_number(peek(vm, 0)) || !is_number(peek(vm, 1)))
+      return array_binary(vm, array_op);
     auto const rhs = pop(vm).as.number;
     auto const lhs = pop(vm).as.number;
     push(vm, value_type(op(lhs, rhs)));
@@ -47,6 +740,9 @@ auto run(VirtualMachine &vm) -> InterpretResult {
 
   for (;;) {
     if constexpr (trace_execution) {
+      // The trace goes through stdio, so the script's output follows it.
+      fflush(stdout);
+      flush(vm.out);
       printf("          ");
       for (Value *slot = vm.stack; slot < vm.stack_top; ++slot) {
         printf("[ ");
@@ -54,9 +750,25 @@ auto run(VirtualMachine &vm) -> InterpretResult {
         printf(" ]");
       }
       printf("\n");
-      int const offset = vm.instruction_pointer - vm.chunk->code.data;
-      disassemble(*vm.chunk, offset);
+      auto const &chunk = frame->function->chunk;
+      int const offset = frame->instruction_pointer - chunk.code.data;
+      disassemble(chunk, offset);
+    }
+    if (vm.trace != nullptr) {
+      auto const &chunk = frame->function->chunk;
+      auto const top = vm.stack_top > vm.stack ? vm.stack_top[-1].type
+                                               : ValueType::NIL;
+      record(*vm.trace,
+             {static_cast<uint32_t>(frame->instruction_pointer -
+                                    chunk.code.data),
+              static_cast<uint16_t>(frame->function->id),
+              static_cast<OpCode>(*frame->instruction_pointer),
+              static_cast<uint8_t>(top)});
     }
+    // Tracing needs the stack in memory before every instruction.
+    if (vm.cache_top &&
+        run_cached(vm, *frame, trace_execution || vm.trace != nullptr))
+      continue;
     auto const instruction = read_byte();
     switch (instruction) {
     case static_cast<uint8_t>(OpCode::CONSTANT): {
@@ -64,6 +776,13 @@ auto run(VirtualMachine &vm) -> InterpretResult {
       push(vm, constant);
       break;
     }
+    case static_cast<uint8_t>(OpCode::CONSTANT_LONG): {
+      auto const a = read_byte();
+      auto const b = read_byte();
+      auto const c = read_byte();
+      push(vm, frame->function->chunk.constants.data[decode_bits(a, b, c)]);
+      break;
+    }
     case static_cast<uint8_t>(OpCode::FALSE):
       push(vm, bool_val(false));
       break;
@@ -73,31 +792,152 @@ auto run(VirtualMachine &vm) -> InterpretResult {
     case static_cast<uint8_t>(OpCode::NIL):
       push(vm, nil_val);
       break;
+    case static_cast<uint8_t>(OpCode::POP):
+      pop(vm);
+      break;
+    case static_cast<uint8_t>(OpCode::GET_LOCAL):
+      push(vm, frame->slots[read_byte()]);
+      break;
+    case static_cast<uint8_t>(OpCode::SET_LOCAL):
+      escape(vm, peek(vm, 0));
+      frame->slots[read_byte()] = peek(vm, 0);
+      break;
+    case static_cast<uint8_t>(OpCode::DEFINE_GLOBAL): {
+      auto &global = vm.globals.slots.data[read_short()];
+      escape(vm, peek(vm, 0));
+      global.value = pop(vm);
+      global.defined = true;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::GET_GLOBAL): {
+      auto const index = read_short();
+      auto const &global = vm.globals.slots.data[index];
+      if (!global.defined) {
+        undefined_variable(index);
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      push(vm, global.value);
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::SET_GLOBAL): {
+      auto const index = read_short();
+      auto &global = vm.globals.slots.data[index];
+      if (!global.defined) {
+        undefined_variable(index);
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      escape(vm, peek(vm, 0));
+      global.value = peek(vm, 0);
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::GET_UPVALUE):
+      push(vm, *frame->closure->upvalues[read_byte()]->location);
+      break;
+    case static_cast<uint8_t>(OpCode::SET_UPVALUE): {
+      auto const upvalue = frame->closure->upvalues[read_byte()];
+      escape(vm, peek(vm, 0));
+      if (!is_pooled(vm, upvalue))
+        write_barrier(vm.nursery, &upvalue->obj, peek(vm, 0));
+      mark_barrier(vm.collector, *upvalue->location);
+      *upvalue->location = peek(vm, 0);
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::GET_PROPERTY): {
+      auto const name = read_string();
+      auto &cache = read_cache();
+      auto const receiver = peek(vm, 0);
+      if (!is_instance(receiver)) {
+        runtime_error(vm, "Only instances have properties.");
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      auto const instance = as_instance(receiver);
+      auto entry = probe(cache, instance->shape);
+      auto missed = CacheEntry{};
+      if (entry == nullptr) {
+        if (!resolve_property(vm, cache, instance, name, missed)) {
+          runtime_error(vm, "Undefined property '%s'.", name->chars);
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        entry = &missed;
+      }
+      vm.stack_top[-1] =
+          entry->slot >= 0
+              ? instance->fields.data[entry->slot]
+              : obj_val(new_bound_method(receiver, entry->method));
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::SET_PROPERTY): {
+      auto const name = read_string();
+      auto &cache = read_cache();
+      auto const receiver = peek(vm, 1);
+      if (!is_instance(receiver)) {
+        runtime_error(vm, "Only instances have fields.");
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      auto const instance = as_instance(receiver);
+      auto const value = pop(vm);
+      escape(vm, value);
+      write_barrier(vm.nursery, &instance->obj, value);
+      auto entry = probe(cache, instance->shape);
+      auto missed = CacheEntry{};
+      if (entry == nullptr) {
+        resolve_field(cache, instance->shape, name, missed);
+        entry = &missed;
+      }
+      if (entry->transition != nullptr) {
+        instance->shape = entry->transition;
+        write(instance->fields, value);
+      } else {
+        mark_barrier(vm.collector, instance->fields.data[entry->slot]);
+        instance->fields.data[entry->slot] = value;
+      }
+      vm.stack_top[-1] = value;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::JUMP): {
+      auto const offset = read_short();
+      frame->instruction_pointer += offset;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::JUMP_IF_FALSE): {
+      auto const offset = read_short();
+      if (is_falsey(peek(vm, 0)))
+        frame->instruction_pointer += offset;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::LOOP): {
+      auto const offset = read_short();
+      ++frame->function->chunk.loops.data[read_short()].count;
+      frame->instruction_pointer -= offset;
+      if (!spend_fuel())
+        return InterpretResult::YIELDED;
+      break;
+    }
     case static_cast<uint8_t>(OpCode::EQUAL):
       push(vm, bool_val(pop(vm) == pop(vm)));
       break;
     case static_cast<uint8_t>(OpCode::GREATER):
-      if (!binary_op(bool_val, std::greater<double>()))
+      if (!binary_op(bool_val, std::greater<double>(), ArrayOp::GREATER))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::LESS):
-      if (!binary_op(bool_val, std::less<double>()))
+      if (!binary_op(bool_val, std::less<double>(), ArrayOp::LESS))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::ADD):
-      if (!binary_op(number_val, std::plus<double>()))
+      if (!binary_op(number_val, std::plus<double>(), ArrayOp::ADD))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::SUBTRACT):
-      if (!binary_op(number_val, std::minus<double>()))
+      if (!binary_op(number_val, std::minus<double>(), ArrayOp::SUBTRACT))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::MULTIPLY):
-      if (!binary_op(number_val, std::multiplies<double>()))
+      if (!binary_op(number_val, std::multiplies<double>(), ArrayOp::MULTIPLY))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::DIVIDE):
-      if (!binary_op(number_val, std::divides<double>()))
+      if (!binary_op(number_val, std::divides<double>(), ArrayOp::DIVIDE))
         return InterpretResult::RUNTIME_ERROR;
       break;
     case static_cast<uint8_t>(OpCode::NOT):
@@ -110,24 +950,250 @@ auto run(VirtualMachine &vm) -> InterpretResult {
       }
       push(vm, number_val(-pop(vm).as.number));
       break;
+    case static_cast<uint8_t>(OpCode::PRINT):
+      print(vm.out, pop(vm));
+      put(vm.out, '\n');
+      break;
+    case static_cast<uint8_t>(OpCode::CALL): {
+      auto const argument_count = read_byte();
+      if (!call_value(vm, peek(vm, argument_count), argument_count))
+        return InterpretResult::RUNTIME_ERROR;
+      frame = &vm.frames[vm.frame_count - 1];
+      if (!spend_fuel())
+        return InterpretResult::YIELDED;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::TAIL_CALL): {
+      // The callee and its arguments slide down over the current frame,
+      // which then runs the callee from its first instruction. They outlive
+      // the locals of the frame, so closures among them escape. Classes are
+      // called normally and the RETURN after TAIL_CALL returns the instance.
+      auto const argument_count = read_byte();
+      auto callee = peek(vm, argument_count);
+      if (is_bound_method(callee)) {
+        auto const bound = as_bound_method(callee);
+        vm.stack_top[-argument_count - 1] = bound->receiver;
+        callee = bound->method;
+      }
+      if (!is_function(callee) && !is_closure(callee)) {
+        if (!call_value(vm, callee, argument_count))
+          return InterpretResult::RUNTIME_ERROR;
+        frame = &vm.frames[vm.frame_count - 1];
+        if (!spend_fuel())
+          return InterpretResult::YIELDED;
+        break;
+      }
+      if (!check_arity(vm, callee_function(callee), argument_count))
+        return InterpretResult::RUNTIME_ERROR;
+      if (callee_function(callee)->stack_size >
+          vm.stack + stack_max - frame->slots) {
+        runtime_error(vm, "Stack overflow.");
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      auto const arguments = vm.stack_top - argument_count - 1;
+      for (auto slot = arguments; slot < vm.stack_top; ++slot)
+        escape(vm, *slot);
+      close_upvalues(vm, frame->slots);
+      std::copy(arguments, vm.stack_top, frame->slots);
+      vm.stack_top = frame->slots + argument_count + 1;
+      frame->function = callee_function(callee);
+      frame->closure = is_closure(callee) ? as_closure(callee) : nullptr;
+      frame->instruction_pointer = frame->function->chunk.code.data;
+      if (!spend_fuel())
+        return InterpretResult::YIELDED;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::INVOKE): {
+      // Methods are called with the receiver already in slot zero, so warm
+      // calls neither look the method up nor allocate a bound method.
+      auto const name = read_string();
+      auto const argument_count = read_byte();
+      auto &cache = read_cache();
+      auto const receiver = peek(vm, argument_count);
+      if (!is_instance(receiver)) {
+        runtime_error(vm, "Only instances have methods.");
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      auto const instance = as_instance(receiver);
+      auto entry = probe(cache, instance->shape);
+      auto missed = CacheEntry{};
+      if (entry == nullptr) {
+        if (!resolve_property(vm, cache, instance, name, missed)) {
+          runtime_error(vm, "Undefined property '%s'.", name->chars);
+          return InterpretResult::RUNTIME_ERROR;
+        }
+        entry = &missed;
+      }
+      if (entry->slot >= 0) {
+        auto const field = instance->fields.data[entry->slot];
+        vm.stack_top[-argument_count - 1] = field;
+        if (!call_value(vm, field, argument_count))
+          return InterpretResult::RUNTIME_ERROR;
+      } else if (!call(vm, entry->method, argument_count)) {
+        return InterpretResult::RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      if (!spend_fuel())
+        return InterpretResult::YIELDED;
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::CLOSURE): {
+      auto const closure = new_closure(as_function(peek(vm, 0)));
+      auto const upvalue_count = read_byte();
+      for (int i = 0; i < upvalue_count; ++i) {
+        auto const is_local = read_byte();
+        auto const index = read_byte();
+        closure->upvalues[i] = is_local
+                                   ? capture_upvalue(vm, frame->slots + index)
+                                   : frame->closure->upvalues[index];
+        write_barrier(vm.nursery, &closure->obj, &closure->upvalues[i]->obj);
+      }
+      vm.stack_top[-1] = obj_val(closure);
+      break;
+    }
+    case static_cast<uint8_t>(OpCode::CLOSE_UPVALUES):
+      close_upvalues(vm, frame->slots + read_byte());
+      break;
+    case static_cast<uint8_t>(OpCode::CLASS):
+      push(vm, obj_val(new_class(read_string())));
+      break;
+    case static_cast<uint8_t>(OpCode::METHOD): {
+      auto const name = read_string();
+      auto const method = peek(vm, 0);
+      auto const klass = as_class(peek(vm, 1));
+      escape(vm, method);
+      write_barrier(vm.nursery, &klass->obj, method);
+      write(klass->methods, Method{name, method});
+      auto const length = static_cast<size_t>(name->length);
+      if (std::string_view{name->chars, length} == "init")
+        klass->initializer = method;
+      pop(vm);
+      break;
+    }
     case static_cast<uint8_t>(OpCode::RETURN): {
-      print(pop(vm));
-      printf("\n");
-      return InterpretResult::OK;
+      auto const result = pop(vm);
+      escape(vm, result);
+      close_upvalues(vm, frame->slots);
+      --vm.frame_count;
+      if (vm.frame_count == 0) {
+        vm.stack_top = frame->slots;
+        vm.result = result;
+        return InterpretResult::OK;
+      }
+      vm.stack_top = frame->slots;
+      push(vm, result);
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+    // Superinstructions push their constant and carry on like the op they
+    // fused, so their slow paths match it.
+    case static_cast<uint8_t>(OpCode::ADD_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(number_val, std::plus<double>(), ArrayOp::ADD))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case static_cast<uint8_t>(OpCode::SUBTRACT_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(number_val, std::minus<double>(), ArrayOp::SUBTRACT))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case static_cast<uint8_t>(OpCode::MULTIPLY_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(number_val, std::multiplies<double>(), ArrayOp::MULTIPLY))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case static_cast<uint8_t>(OpCode::DIVIDE_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(number_val, std::divides<double>(), ArrayOp::DIVIDE))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case static_cast<uint8_t>(OpCode::EQUAL_CONSTANT): {
+      auto const constant = read_constant();
+      push(vm, bool_val(pop(vm) == constant));
+      break;
     }
+    case static_cast<uint8_t>(OpCode::GREATER_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(bool_val, std::greater<double>(), ArrayOp::GREATER))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
+    case static_cast<uint8_t>(OpCode::LESS_CONSTANT):
+      push(vm, read_constant());
+      if (!binary_op(bool_val, std::less<double>(), ArrayOp::LESS))
+        return InterpretResult::RUNTIME_ERROR;
+      break;
     }
   }
 }
 
 auto interpret(VirtualMachine &vm, std::string_view source) -> InterpretResult {
-  auto chunk = Chunk{};
-  if (!compile(source, chunk))
+  auto const outer = use_error_output(&vm.err);
+  auto const function = compile(source, vm.globals);
+  use_error_output(outer);
+  if (function == nullptr)
     return InterpretResult::COMPILE_ERROR;
-  vm.chunk = &chunk;
-  vm.instruction_pointer = vm.chunk->code.data;
+  vm.script = function;
+  return finish_script(vm, interpret(vm, function));
+}
+
+auto interpret(VirtualMachine &vm, ObjFunction *function) -> InterpretResult {
+  vm.usage.exceeded = ResourceLimit::NONE;
+  push(vm, obj_val(function));
+  if (!call(vm, obj_val(function), 0))
+    return failed_call(vm);
   return run(vm);
 }
 
+auto evaluate(VirtualMachine &vm, ObjFunction *function,
+              std::span<Value const> arguments, Value &result)
+    -> InterpretResult {
+  vm.usage.exceeded = ResourceLimit::NONE;
+  push(vm, obj_val(function));
+  for (auto const &argument : arguments)
+    push(vm, argument);
+  if (!call(vm, obj_val(function), arguments.size())) {
+    result = nil_val;
+    return failed_call(vm);
+  }
+  auto const status = run(vm);
+  result = status == InterpretResult::OK ? vm.result : nil_val;
+  return status;
+}
+
+auto resume(VirtualMachine &vm) -> InterpretResult {
+  if (vm.frame_count == 0)
+    return InterpretResult::OK;
+  return finish_script(vm, run(vm));
+}
+
+// Once the run of a script interpret compiled from source ends, prints what
+// it returned and frees it.
+auto finish_script(VirtualMachine &vm, InterpretResult result)
+    -> InterpretResult {
+  if (result == InterpretResult::YIELDED || vm.script == nullptr)
+    return result;
+  if (result == InterpretResult::OK && !is_nil(vm.result)) {
+    print(vm.out, vm.result);
+    put(vm.out, '\n');
+    flush(vm.out);
+  }
+  free_object(&vm.script->obj);
+  vm.script = nullptr;
+  return result;
+}
+
+auto define_native(VirtualMachine &vm, std::string_view name, int arity,
+                   NativeFn function, BatchNativeFn batch) -> bool {
+  auto const index = resolve_global(vm.globals, name);
+  if (index < 0)
+    return false;
+  auto &global = vm.globals.slots.data[index];
+  global.value =
+      obj_val(new_native(copy_string(name), arity, function, batch));
+  global.defined = true;
+  return true;
+}
+
 auto push(VirtualMachine &vm, Value value) -> void {
   *vm.stack_top = value;
   vm.stack_top++;
@@ -142,8 +1208,4 @@ auto peek(VirtualMachine &vm, int distance) -> Value {
   return vm.stack_top[-1 - distance];
 }
 
-auto is_falsey(Value value) -> bool {
-  return is_nil(value) || (is_bool(value) && !value.as.boolean);
-}
-
 } // namespace lox
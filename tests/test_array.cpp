@@ -0,0 +1,57 @@
+#include <doctest/doctest.h>
+#include <utility>
+
+#include <array.hpp>
+#include <chunk.hpp>
+
+using lox::Array;
+using lox::Chunk;
+using lox::number_val;
+
+TEST_CASE("move array") {
+  auto array = Array<int>{};
+  write(array, 1);
+  write(array, 2);
+  auto const data = array.data;
+  auto moved = std::move(array);
+  CHECK(moved.count == 2);
+  CHECK(moved.data == data);
+  CHECK(array.count == 0);
+  CHECK(array.capacity == 0);
+  CHECK(array.data == nullptr);
+  array = std::move(moved);
+  CHECK(array.count == 2);
+  CHECK(array.data[1] == 2);
+}
+
+TEST_CASE("reserve and shrink array") {
+  auto array = Array<int>{};
+  reserve(array, 100);
+  CHECK(array.capacity == 100);
+  write(array, 7);
+  reserve(array, 10);
+  CHECK(array.capacity == 100);
+  shrink_to_fit(array);
+  CHECK(array.capacity == 1);
+  CHECK(array.data[0] == 7);
+}
+
+TEST_CASE("append to array") {
+  int const values[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  auto array = Array<int>{};
+  write(array, 0);
+  append(array, values, 10);
+  CHECK(array.count == 11);
+  CHECK(array.capacity == 16);
+  CHECK(array.data[0] == 0);
+  CHECK(array.data[10] == 10);
+}
+
+TEST_CASE("move chunk") {
+  auto chunk = Chunk{};
+  write(chunk, number_val(1), 1);
+  auto moved = std::move(chunk);
+  CHECK(moved.code.count == 2);
+  CHECK(moved.constants.count == 1);
+  CHECK(chunk.code.data == nullptr);
+}
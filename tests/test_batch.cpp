@@ -0,0 +1,104 @@
+#include <doctest/doctest.h>
+#include <span>
+
+#include <batch.hpp>
+#include <compiler.hpp>
+#include <natives.hpp>
+
+using lox::Batch;
+using lox::BatchInput;
+using lox::bool_val;
+using lox::Globals;
+using lox::InterpretResult;
+using lox::nil_val;
+using lox::number_val;
+using lox::resolve_global;
+using lox::Value;
+
+auto twice(std::span<Value const> arguments) -> Value {
+  return number_val(2 * arguments[0].as.number);
+}
+
+TEST_CASE("batches evaluate an expression per row") {
+  auto globals = Globals{};
+  auto const function = lox::compile("x * 2 + y > limit", globals);
+  REQUIRE(function != nullptr);
+  auto &limit = globals.slots.data[resolve_global(globals, "limit")];
+  limit = {number_val(10), true};
+
+  // More rows than a block, so the last block is partial.
+  auto constexpr rows = lox::batch_rows + 5;
+  Value xs[rows];
+  Value ys[rows];
+  Value results[rows];
+  for (int i = 0; i < rows; ++i) {
+    xs[i] = number_val(i);
+    ys[i] = number_val(-i / 2.0);
+  }
+  BatchInput const inputs[] = {{resolve_global(globals, "x"), xs},
+                               {resolve_global(globals, "y"), ys}};
+  auto batch = Batch{};
+  REQUIRE(lox::evaluate_batch(batch, function, globals, inputs, results) ==
+          InterpretResult::OK);
+  for (int i = 0; i < rows; ++i)
+    CHECK(results[i] == bool_val(1.5 * i > 10));
+  lox::free_object(&function->obj);
+}
+
+TEST_CASE("batches check types row by row") {
+  auto globals = Globals{};
+  auto const equal = lox::compile("!(x == nil) == (x != nil)", globals);
+  auto const add = lox::compile("x + 1", globals);
+  Value xs[] = {number_val(1), nil_val, bool_val(false), number_val(4)};
+  Value results[4];
+  BatchInput const inputs[] = {{resolve_global(globals, "x"), xs}};
+  auto batch = Batch{};
+  REQUIRE(lox::evaluate_batch(batch, equal, globals, inputs, results) ==
+          InterpretResult::OK);
+  for (auto const &result : results)
+    CHECK(result == bool_val(true));
+  CHECK(lox::evaluate_batch(batch, add, globals, inputs, results) ==
+        InterpretResult::RUNTIME_ERROR);
+  CHECK(lox::evaluate_batch(batch, add, globals, {inputs, 1},
+                            {results, 1}) == InterpretResult::OK);
+  CHECK(results[0] == number_val(2));
+  lox::free_object(&equal->obj);
+  lox::free_object(&add->obj);
+}
+
+TEST_CASE("batches keep repeated subexpressions in temporaries") {
+  auto globals = Globals{};
+  auto const function =
+      lox::compile("(x * x + 1) * (x * x + 1) - -(x * x + 1)", globals);
+  REQUIRE(function != nullptr);
+  Value xs[] = {number_val(0), number_val(1), number_val(-3), number_val(7)};
+  Value results[4];
+  BatchInput const inputs[] = {{resolve_global(globals, "x"), xs}};
+  auto batch = Batch{};
+  REQUIRE(lox::evaluate_batch(batch, function, globals, inputs, results) ==
+          InterpretResult::OK);
+  for (int i = 0; i < 4; ++i) {
+    auto const y = xs[i].as.number * xs[i].as.number + 1;
+    CHECK(results[i] == number_val(y * y + y));
+  }
+  lox::free_object(&function->obj);
+}
+
+TEST_CASE("batches call natives and reject statements") {
+  auto vm = lox::VirtualMachine{};
+  lox::define_native(vm, "twice", 1, twice);
+  auto const call = lox::compile("twice(x) - twice(3)", vm.globals);
+  auto const statement = lox::compile("var a = x;", vm.globals);
+  Value xs[] = {number_val(1), number_val(2), number_val(3)};
+  Value results[3];
+  BatchInput const inputs[] = {{resolve_global(vm.globals, "x"), xs}};
+  auto batch = Batch{};
+  REQUIRE(lox::evaluate_batch(batch, call, vm.globals, inputs, results) ==
+          InterpretResult::OK);
+  CHECK(results[0] == number_val(-4));
+  CHECK(results[2] == number_val(0));
+  CHECK(lox::evaluate_batch(batch, statement, vm.globals, inputs, results) ==
+        InterpretResult::COMPILE_ERROR);
+  lox::free_object(&call->obj);
+  lox::free_object(&statement->obj);
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <doctest/doctest.h>
+#include <span>
+
+#include <collector.hpp>
+#include <memory.hpp>
+#include <natives.hpp>
+#include <nursery.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::Collector;
+using lox::CollectorPhase;
+using lox::InterpretResult;
+using lox::Nursery;
+using lox::number_val;
+using lox::PauseStats;
+using lox::ResourceLimit;
+using lox::Value;
+using lox::VirtualMachine;
+
+auto eager_collector() -> Collector;
+
+TEST_CASE("collectors free objects runs no longer reach") {
+  auto collector = eager_collector();
+  auto vm = VirtualMachine{};
+  vm.collector = &collector;
+  lox::define_array_natives(vm);
+  REQUIRE(interpret(vm, "class P {} var kept; var total = 0;"
+                        "for (var i = 0; i < 2000; i = i + 1) {"
+                        "  var p = P(); p.x = range(8) * i;"
+                        "  total = total + sum(p.x);"
+                        "  if (i == 50) kept = p;"
+                        "}") == InterpretResult::OK);
+  CHECK(collector.cycles > 10);
+  CHECK(collector.freed > 3000);
+  CHECK(collector.objects.count < 200);
+  CHECK(collector.mark_pauses.pauses > collector.cycles);
+  CHECK(collector.sweep_pauses.pauses > 0);
+  CHECK(global(vm, "total") == number_val(28 * 1999000));
+  REQUIRE(interpret(vm, "var x = sum(kept.x);") == InterpretResult::OK);
+  CHECK(global(vm, "x") == number_val(28 * 50));
+}
+
+TEST_CASE("runs with a collector see the same objects as without") {
+  char const *const scripts[] = {
+      "class N { init(v, next) { this.v = v; this.next = next; } }"
+      "var list = nil; for (var i = 0; i < 300; i = i + 1)"
+      "  list = N(range(4) * i, list);",
+      "fun reverse(l) { var previous = nil; while (l != nil) {"
+      "  var next = l.next; range(1); l.next = previous; previous = l;"
+      "  l = next; }"
+      "  return previous; }"
+      "for (var k = 0; k < 15; k = k + 1) list = reverse(list);",
+      "fun counter() { var last = nil; fun next(v) {"
+      "  var old = last; last = N(v, nil); return old; } return next; }"
+      "var count = counter(); var kept = nil;"
+      "for (var i = 0; i < 500; i = i + 1) {"
+      "  var old = count(range(3) * i); if (old != nil) kept = N(old, kept); }",
+      "var total = 0; var node = list; while (node != nil) {"
+      "  total = total + sum(node.v) + length(node.v); node = node.next; }"
+      "for (node = kept; node != nil; node = node.next)"
+      "  total = total + sum(node.v.v);",
+  };
+  Value totals[3];
+  for (auto i = 0; i < 3; ++i) {
+    auto collector = eager_collector();
+    auto nursery = Nursery{4096};
+    auto vm = VirtualMachine{};
+    if (i > 0)
+      vm.collector = &collector;
+    if (i > 1)
+      vm.nursery = &nursery;
+    lox::define_array_natives(vm);
+    for (auto const source : scripts) {
+      CAPTURE(source);
+      REQUIRE(interpret(vm, source) == InterpretResult::OK);
+    }
+    CHECK((i == 0 || collector.cycles > 0));
+    totals[i] = global(vm, "total");
+  }
+  CHECK(is_number(totals[0]));
+  CHECK(totals[1] == totals[0]);
+  CHECK(totals[2] == totals[0]);
+}
+
+TEST_CASE("nurseries leave collectors free to reclaim long runs") {
+  auto collector = Collector{};
+  auto nursery = Nursery{1 << 16};
+  auto vm = VirtualMachine{};
+  vm.collector = &collector;
+  vm.nursery = &nursery;
+  lox::define_array_natives(vm);
+  lox::reset_memory_stats();
+  // Lists of up to 200 arrays outlive the small nursery, then die.
+  REQUIRE(interpret(vm, "class N {} var total = 0; var list; var length = 0;"
+                        "for (var i = 0; i < 20000; i = i + 1) {"
+                        "  var node = N(); node.v = array(100, i) * 2;"
+                        "  node.next = list; list = node;"
+                        "  total = total + at(node.v, 0); length = length + 1;"
+                        "  if (length == 200) { list = nil; length = 0; }"
+                        "}") == InterpretResult::OK);
+  CHECK(global(vm, "total") == number_val(19999 * 20000));
+  CHECK(collector.freed > 10000);
+  CHECK(lox::memory_stats().total.peak_bytes < 8 << 20);
+}
+
+TEST_CASE("heap limits leave room for what collections free") {
+  for (auto i = 0; i < 3; ++i) {
+    auto collector = Collector{};
+    auto nursery = Nursery{};
+    auto vm = VirtualMachine{};
+    if (i != 1)
+      vm.collector = &collector;
+    if (i != 0)
+      vm.nursery = &nursery;
+    vm.limits.heap_bytes = 1 << 20;
+    lox::define_array_natives(vm);
+    CAPTURE(i);
+    REQUIRE(interpret(vm, "var kept; for (var i = 0; i < 2000; i = i + 1)"
+                          "  kept = array(1024, i);") == InterpretResult::OK);
+    CHECK(vm.usage.exceeded == ResourceLimit::NONE);
+    CHECK(vm.usage.heap_bytes < 1 << 20);
+    REQUIRE(interpret(vm, "var n = sum(kept) / 1024;") == InterpretResult::OK);
+    CHECK(global(vm, "n") == number_val(1999));
+    CHECK(interpret(vm, "class Node {} var list;"
+                        "while (true) { var node = Node();"
+                        "  node.v = array(1024, 0); node.next = list;"
+                        "  list = node; }") == InterpretResult::LIMIT_EXCEEDED);
+    CHECK(vm.usage.exceeded == ResourceLimit::HEAP);
+  }
+}
+
+TEST_CASE("pooled upvalues drop the copies collectors may free") {
+  auto collector = eager_collector();
+  auto vm = VirtualMachine{};
+  vm.collector = &collector;
+  REQUIRE(interpret(vm, "class P {} var kept = nil; var total = 0;"
+                        "fun keep(i) { var x = i; fun get() { return x; }"
+                        "  kept = get; }"
+                        "for (var i = 0; i < 40; i = i + 1) {"
+                        "  keep(i); total = total + kept(); kept = nil;"
+                        "  for (var j = 0; j < 200 + i * 7; j = j + 1) P();"
+                        "}") == InterpretResult::OK);
+  CHECK(collector.cycles > 40);
+  CHECK(global(vm, "total") == number_val(780));
+  for (auto const &upvalue : vm.upvalue_pool)
+    CHECK(upvalue.promoted == nullptr);
+}
+
+TEST_CASE("stores while marking keep what they overwrite") {
+  auto collector = Collector{};
+  auto vm = VirtualMachine{};
+  vm.collector = &collector;
+  lox::define_array_natives(vm);
+  REQUIRE(interpret(vm, "class Box {} var box = Box(); box.v = range(2);"
+                        "fun counter() { var last = range(3);"
+                        "  fun swap(v) { var old = last; last = v;"
+                        "    return old; }"
+                        "  return swap; }"
+                        "var swap = counter(); var a; var b;") ==
+          InterpretResult::OK);
+  // Start a cycle that marks nothing past the roots until the stores ran.
+  collector.slice_objects = 0;
+  lox::collect_slice(vm);
+  REQUIRE(collector.phase == CollectorPhase::MARK);
+  REQUIRE(interpret(vm, "a = swap(nil); b = box.v; box.v = nil;") ==
+          InterpretResult::OK);
+  collector.slice_objects = 256;
+  while (collector.phase == CollectorPhase::MARK)
+    lox::collect_slice(vm);
+  REQUIRE(interpret(vm, "for (var i = 0; i < 1000; i = i + 1) range(1);") ==
+          InterpretResult::OK);
+  REQUIRE(collector.cycles == 1);
+  auto const objects = std::span{collector.objects.data,
+                                 static_cast<size_t>(collector.objects.count)};
+  for (auto const name : {"a", "b"})
+    CHECK(std::ranges::count(objects, global(vm, name).as.obj) == 1);
+  REQUIRE(interpret(vm, "var s = sum(a) + sum(b);") == InterpretResult::OK);
+  CHECK(global(vm, "s") == number_val(4));
+}
+
+TEST_CASE("pause percentiles come from the histogram") {
+  auto stats = PauseStats{};
+  CHECK(lox::pause_percentile(stats, 0.99) == 0);
+  for (int i = 0; i < 99; ++i)
+    lox::record_pause(stats, 100);
+  lox::record_pause(stats, 5000);
+  CHECK(stats.pauses == 100);
+  CHECK(stats.max_ns == 5000);
+  CHECK(stats.histogram[6] == 99);
+  CHECK(stats.histogram[12] == 1);
+  CHECK(lox::pause_percentile(stats, 0.5) == 127);
+  CHECK(lox::pause_percentile(stats, 1) == 8191);
+}
+
+// Slices of a couple of objects make every cycle span many allocations and
+// stores.
+auto eager_collector() -> Collector {
+  auto collector = Collector{};
+  collector.next_cycle = 64;
+  collector.cycle_minimum = 64;
+  collector.slice_objects = 2;
+  collector.slice_allocations = 1;
+  collector.sweep_objects = 4;
+  collector.sweep_allocations = 1;
+  return collector;
+}
@@ -0,0 +1,170 @@
+#include <doctest/doctest.h>
+#include <iterator>
+#include <string>
+
+#include <chunk.hpp>
+#include <compiler.hpp>
+#include <virtual_machine.hpp>
+
+using lox::compile;
+using lox::free_object;
+using lox::Globals;
+using lox::number_val;
+using lox::OpCode;
+
+TEST_CASE("compile number literals") {
+  auto globals = Globals{};
+  auto const function =
+      compile("42 + 0.1 + 1234567890123456789 + 3.25", globals);
+  REQUIRE(function != nullptr);
+  auto const &chunk = function->chunk;
+  REQUIRE(chunk.constants.count == 4);
+  CHECK(chunk.constants.data[0] == number_val(42));
+  CHECK(chunk.constants.data[1] == number_val(0.1));
+  CHECK(chunk.constants.data[2] == number_val(1234567890123456789.0));
+  CHECK(chunk.constants.data[3] == number_val(3.25));
+  free_object(&function->obj);
+
+  // Long literals round once, to the nearest double.
+  auto const long_literals = compile(
+      "3.141592653589793238 + 9007199254740993 + 0." + std::string(400, '0') +
+          "1 + 1" + std::string(400, '0'),
+      globals);
+  REQUIRE(long_literals != nullptr);
+  auto const &constants = long_literals->chunk.constants;
+  REQUIRE(constants.count == 4);
+  CHECK(constants.data[0] == number_val(3.141592653589793238));
+  CHECK(constants.data[1] == number_val(9007199254740992.0));
+  CHECK(constants.data[2] == number_val(0));
+  CHECK(constants.data[3] == number_val(1e308 * 10));
+  free_object(&long_literals->obj);
+}
+
+TEST_CASE("compile returned calls as tail calls") {
+  auto globals = Globals{};
+  auto const script = compile("fun f(n) { if (n > 0) return f(n - 1);"
+                              "           return n or f(n); }",
+                              globals);
+  REQUIRE(script != nullptr);
+  REQUIRE(script->chunk.constants.count == 1);
+  auto const &chunk = lox::as_function(script->chunk.constants.data[0])->chunk;
+  auto tail_calls = 0;
+  for (int i = 0; i < chunk.code.count - 2; ++i)
+    if (chunk.code.data[i] == static_cast<uint8_t>(OpCode::TAIL_CALL) &&
+        chunk.code.data[i + 2] == static_cast<uint8_t>(OpCode::RETURN))
+      ++tail_calls;
+  CHECK(tail_calls == 2);
+  CHECK(compile("return 1;", globals) == nullptr);
+  free_object(&script->obj);
+}
+
+TEST_CASE("compile the most stack each function uses") {
+  auto globals = Globals{};
+  auto const script =
+      compile("fun f(a, b) { var c = a; if (a) { var d = b; print d + c; }"
+              "              return c; }",
+              globals);
+  REQUIRE(script != nullptr);
+  CHECK(script->stack_size == 2);
+  // The callee, a, b, c and d, with d + c on top.
+  CHECK(lox::as_function(script->chunk.constants.data[0])->stack_size == 7);
+  free_object(&script->obj);
+}
+
+TEST_CASE("compile binary ops on number constants as superinstructions") {
+  auto globals = Globals{};
+  auto const function = compile("x * 2 + 1 <= x - \"a\"", globals);
+  REQUIRE(function != nullptr);
+  auto const &chunk = function->chunk;
+  uint8_t const code[] = {
+      static_cast<uint8_t>(OpCode::GET_GLOBAL),        0, 0,
+      static_cast<uint8_t>(OpCode::MULTIPLY_CONSTANT), 0,
+      static_cast<uint8_t>(OpCode::ADD_CONSTANT),      1,
+      static_cast<uint8_t>(OpCode::GET_GLOBAL),        0, 0,
+      static_cast<uint8_t>(OpCode::CONSTANT),          2,
+      static_cast<uint8_t>(OpCode::SUBTRACT),
+      static_cast<uint8_t>(OpCode::GREATER),
+      static_cast<uint8_t>(OpCode::NOT),
+      static_cast<uint8_t>(OpCode::RETURN),
+  };
+  REQUIRE(chunk.code.count == static_cast<int>(std::size(code)));
+  for (int i = 0; i < chunk.code.count; ++i)
+    CHECK(chunk.code.data[i] == code[i]);
+  free_object(&function->obj);
+}
+
+TEST_CASE("compile no superinstruction across a jump target") {
+  auto globals = Globals{};
+  auto const function = compile("1 + (x and 2)", globals);
+  REQUIRE(function != nullptr);
+  auto const &chunk = function->chunk;
+  REQUIRE(chunk.code.count >= 3);
+  CHECK(chunk.code.data[chunk.code.count - 2] ==
+        static_cast<uint8_t>(OpCode::ADD));
+  CHECK(chunk.code.data[chunk.code.count - 4] ==
+        static_cast<uint8_t>(OpCode::CONSTANT));
+  free_object(&function->obj);
+}
+
+TEST_CASE("compile repeated subexpressions once") {
+  auto vm = lox::VirtualMachine{};
+  std::string_view const parameters[] = {"a", "b"};
+  auto const function = lox::compile_expression(
+      "(a * b + 1) * (a * b + 1) - (a * b + 1) * 1", parameters, vm.globals);
+  REQUIRE(function != nullptr);
+  auto const &chunk = function->chunk;
+  auto multiplies = 0;
+  for (int i = 0; i < chunk.code.count; ++i)
+    multiplies +=
+        chunk.code.data[i] == static_cast<uint8_t>(OpCode::MULTIPLY);
+  CHECK(multiplies == 2);
+  lox::Value const arguments[] = {number_val(2), number_val(3)};
+  auto result = lox::Value{};
+  REQUIRE(evaluate(vm, function, arguments, result) ==
+          lox::InterpretResult::OK);
+  CHECK(result == number_val(42));
+  free_object(&function->obj);
+}
+
+TEST_CASE("compile reads on either side of a call apart") {
+  auto vm = lox::VirtualMachine{};
+  REQUIRE(interpret(vm, "var g = 1; fun f() { g = 10; return 0; }"
+                        "var r = (g + 1) * 2 + f() + (g + 1) * 2;") ==
+          lox::InterpretResult::OK);
+  auto const r = resolve_global(vm.globals, "r");
+  CHECK(vm.globals.slots.data[r].value == number_val(26));
+}
+
+TEST_CASE("compile no code for unused values that cannot fail") {
+  auto globals = Globals{};
+  auto const function =
+      compile("{ var x = 1; x == 2; !!(x == 3); -1; x * 1; }", globals);
+  REQUIRE(function != nullptr);
+  auto const &chunk = function->chunk;
+  uint8_t const code[] = {
+      static_cast<uint8_t>(OpCode::CONSTANT), 0,
+      static_cast<uint8_t>(OpCode::GET_LOCAL), 1,
+      static_cast<uint8_t>(OpCode::MULTIPLY_CONSTANT), 1,
+      static_cast<uint8_t>(OpCode::POP),
+      static_cast<uint8_t>(OpCode::POP),
+      static_cast<uint8_t>(OpCode::NIL),
+      static_cast<uint8_t>(OpCode::RETURN),
+  };
+  REQUIRE(chunk.code.count == static_cast<int>(std::size(code)));
+  for (int i = 0; i < chunk.code.count; ++i)
+    CHECK(chunk.code.data[i] == code[i]);
+  free_object(&function->obj);
+}
+
+TEST_CASE("compile long expressions partly without a graph") {
+  // Well past the size at which the graph is flushed, with an and still
+  // open across it.
+  auto source = std::string{"var r = (0"};
+  for (int i = 1; i <= 1000; ++i)
+    source += (i == 100 ? ") > 0 and (0 + " : " + ") + std::to_string(i);
+  source += ");";
+  auto vm = lox::VirtualMachine{};
+  REQUIRE(interpret(vm, source) == lox::InterpretResult::OK);
+  auto const r = resolve_global(vm.globals, "r");
+  CHECK(vm.globals.slots.data[r].value == number_val(500500 - 4950));
+}
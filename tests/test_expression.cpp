@@ -0,0 +1,81 @@
+#include <doctest/doctest.h>
+
+#include <expression.hpp>
+
+using lox::bool_val;
+using lox::ExpressionGraph;
+using lox::NodeOp;
+using lox::number_val;
+
+TEST_CASE("expression graphs build equal nodes once") {
+  auto graph = ExpressionGraph{};
+  auto const x = read_node(graph, NodeOp::LOCAL, 1, 1);
+  CHECK(read_node(graph, NodeOp::LOCAL, 1, 2) == x);
+  CHECK(read_node(graph, NodeOp::GLOBAL, 1, 1) != x);
+  auto const sum = binary_node(graph, NodeOp::ADD, x, x, 1);
+  CHECK(binary_node(graph, NodeOp::ADD, x, x, 1) == sum);
+  CHECK(binary_node(graph, NodeOp::SUBTRACT, x, x, 1) != sum);
+  CHECK(constant_node(graph, number_val(0), 1) !=
+        constant_node(graph, number_val(-0.0), 1));
+
+  // Calls always run, and a read after one may see a different value.
+  auto const callee = read_node(graph, NodeOp::GLOBAL, 0, 1);
+  int const arguments[] = {sum};
+  auto const call = call_node(graph, callee, arguments, 1);
+  CHECK(call_node(graph, callee, arguments, 1) != call);
+  CHECK(read_node(graph, NodeOp::LOCAL, 1, 1) != x);
+  CHECK(!graph.nodes.data[call].pure);
+
+  // Enough nodes to grow the table keep their identity.
+  int nodes[100];
+  for (int i = 0; i < 100; ++i)
+    nodes[i] = constant_node(graph, number_val(i), 1);
+  for (int i = 0; i < 100; ++i)
+    CHECK(constant_node(graph, number_val(i), 1) == nodes[i]);
+}
+
+TEST_CASE("expression graphs simplify by what they know of operands") {
+  auto graph = ExpressionGraph{};
+  auto const x = read_node(graph, NodeOp::LOCAL, 1, 1);
+  auto const one = constant_node(graph, number_val(1), 1);
+  auto const zero = constant_node(graph, number_val(0), 1);
+  auto const number = binary_node(graph, NodeOp::ADD, one, one, 1);
+  CHECK(graph.nodes.data[number].number);
+  CHECK(binary_node(graph, NodeOp::MULTIPLY, number, one, 1) == number);
+  CHECK(binary_node(graph, NodeOp::MULTIPLY, one, number, 1) == number);
+  CHECK(binary_node(graph, NodeOp::DIVIDE, number, one, 1) == number);
+  CHECK(binary_node(graph, NodeOp::SUBTRACT, number, zero, 1) == number);
+  // x may be a string, and -0 + 0 is 0.
+  CHECK(binary_node(graph, NodeOp::MULTIPLY, x, one, 1) != x);
+  CHECK(binary_node(graph, NodeOp::ADD, number, zero, 1) != number);
+
+  auto const equal = binary_node(graph, NodeOp::EQUAL, x, one, 1);
+  auto const not_equal = unary_node(graph, NodeOp::NOT, equal, 1);
+  CHECK(unary_node(graph, NodeOp::NOT, not_equal, 1) == equal);
+  auto const not_x = unary_node(graph, NodeOp::NOT, x, 1);
+  CHECK(unary_node(graph, NodeOp::NOT, not_x, 1) != x);
+  CHECK(graph.nodes.data[unary_node(graph, NodeOp::NOT, one, 1)].value ==
+        bool_val(false));
+
+  auto const no = constant_node(graph, bool_val(false), 1);
+  CHECK(binary_node(graph, NodeOp::AND, no, x, 1) == no);
+  CHECK(binary_node(graph, NodeOp::OR, no, x, 1) == x);
+  CHECK(binary_node(graph, NodeOp::AND, one, x, 1) == x);
+  CHECK(binary_node(graph, NodeOp::OR, one, x, 1) == one);
+}
+
+TEST_CASE("expression graphs count uses from the root") {
+  auto graph = ExpressionGraph{};
+  auto const x = read_node(graph, NodeOp::LOCAL, 1, 1);
+  auto const unused = binary_node(graph, NodeOp::MULTIPLY, x, x, 1);
+  auto const twice = binary_node(graph, NodeOp::ADD, x, x, 1);
+  auto const root = binary_node(graph, NodeOp::DIVIDE, twice, twice, 1);
+  auto uses = lox::Array<int>{};
+  count_uses(graph, root, uses);
+  CHECK(uses.data[root] == 1);
+  CHECK(uses.data[twice] == 2);
+  CHECK(uses.data[x] == 2);
+  CHECK(uses.data[unused] == 0);
+  // x + x fails unless x is a number.
+  CHECK(!graph.nodes.data[root].pure);
+}
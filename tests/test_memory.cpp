@@ -0,0 +1,159 @@
+#include <doctest/doctest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <array.hpp>
+#include <chunk.hpp>
+#include <memory.hpp>
+#include <object.hpp>
+
+using lox::Array;
+using lox::Chunk;
+using lox::copy_string;
+using lox::memory_stats;
+using lox::MemoryCategory;
+using lox::number_val;
+using lox::reset_memory_stats;
+
+auto category_stats(MemoryCategory category) -> lox::AllocationStats const & {
+  return memory_stats().categories[static_cast<uint8_t>(category)];
+}
+
+TEST_CASE("account array growth and release") {
+  reset_memory_stats();
+  {
+    auto array = Array<int>{};
+    for (int i = 0; i < 9; ++i)
+      write(array, i);
+    auto const &stats = category_stats(MemoryCategory::OTHER);
+    CHECK(stats.allocations == 1);
+    CHECK(stats.reallocations == 1);
+    CHECK(stats.current_bytes == 16 * sizeof(int));
+    CHECK(stats.histogram[5] == 1);
+    CHECK(stats.histogram[6] == 1);
+  }
+  auto const &stats = category_stats(MemoryCategory::OTHER);
+  CHECK(stats.frees == 1);
+  CHECK(stats.current_bytes == 0);
+  CHECK(stats.peak_bytes == 16 * sizeof(int));
+}
+
+TEST_CASE("account chunk and string categories") {
+  reset_memory_stats();
+  {
+    auto chunk = Chunk{};
+    write(chunk, number_val(1), 1);
+    CHECK(category_stats(MemoryCategory::CHUNK_CODE).current_bytes == 8);
+    CHECK(category_stats(MemoryCategory::CHUNK_LINES).current_bytes ==
+          8 * sizeof(int));
+    CHECK(category_stats(MemoryCategory::CHUNK_CONSTANTS).allocations == 1);
+  }
+  auto const hello = copy_string("hello");
+  CHECK(category_stats(MemoryCategory::STRING_CHARS).current_bytes == 6);
+  CHECK(category_stats(MemoryCategory::OBJECT).allocations == 1);
+  CHECK(memory_stats().total.current_bytes ==
+        6 + sizeof(lox::ObjString));
+  lox::free_object(&hello->obj);
+  CHECK(category_stats(MemoryCategory::OBJECT).frees == 1);
+  CHECK(memory_stats().total.current_bytes == 0);
+}
+
+TEST_CASE("keep the stats of each thread apart") {
+  reset_memory_stats();
+  auto threads = std::vector<std::thread>{};
+  size_t allocations[4] = {};
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back([i, &allocations] {
+      for (int j = 0; j < 1000 * (i + 1); ++j) {
+        auto array = Array<int>{};
+        write(array, j);
+      }
+      allocations[i] = memory_stats().total.allocations;
+    });
+  for (auto &thread : threads)
+    thread.join();
+  for (int i = 0; i < 4; ++i)
+    CHECK(allocations[i] == 1000 * static_cast<size_t>(i + 1));
+  CHECK(memory_stats().total.allocations == 0);
+}
+
+TEST_CASE("meter the heap of a thread") {
+  auto fuel = uint64_t{50};
+  auto meter = lox::HeapMeter{0, 40, &fuel};
+  auto const outer = lox::use_heap_meter(&meter);
+  {
+    auto array = Array<int>{};
+    for (int i = 0; i < 8; ++i)
+      write(array, i);
+    CHECK(meter.bytes == 8 * sizeof(int));
+    CHECK(lox::heap_allows(8));
+    CHECK_FALSE(meter.exceeded);
+    write(array, 8);
+    CHECK(meter.bytes == 16 * sizeof(int));
+    CHECK(meter.exceeded);
+    CHECK(meter.fuel_left == 50);
+    CHECK(fuel == 0);
+  }
+  CHECK(meter.bytes == 0);
+  meter = lox::HeapMeter{0, 40};
+  CHECK(lox::heap_allows(40));
+  CHECK_FALSE(lox::heap_allows(41));
+  CHECK(meter.exceeded);
+  CHECK(lox::use_heap_meter(outer) == &meter);
+}
+
+TEST_CASE("pool objects by size class") {
+  lox::set_object_allocator(lox::ObjectAllocator::POOL);
+  reset_memory_stats();
+  auto const slabs = lox::pool_slabs();
+  auto const first = copy_string("first");
+  auto const second = copy_string("second");
+  // Both strings and both payloads are one block of 16 bytes, cut from the
+  // same slab one after the other.
+  CHECK(reinterpret_cast<char *>(second) - reinterpret_cast<char *>(first) ==
+        2 * lox::pool_class_size);
+  CHECK(category_stats(MemoryCategory::STRING_CHARS).current_bytes == 13);
+  CHECK(category_stats(MemoryCategory::OBJECT).allocations == 2);
+
+  // Freed blocks are handed out again last in, first out. A string frees
+  // its chars first and allocates them last, so it takes back its own.
+  auto const first_chars = reinterpret_cast<uintptr_t>(first->chars);
+  auto const first_string = reinterpret_cast<uintptr_t>(first);
+  lox::free_object(&first->obj);
+  CHECK(category_stats(MemoryCategory::OBJECT).frees == 1);
+  auto const third = copy_string("third");
+  CHECK(reinterpret_cast<uintptr_t>(third) == first_string);
+  CHECK(reinterpret_cast<uintptr_t>(third->chars) == first_chars);
+
+  // Blocks over the largest size class come from the system.
+  auto const long_chars = std::string(lox::pool_block_max, 'x');
+  auto const long_string = copy_string(long_chars);
+  CHECK(long_string->chars == long_chars);
+  CHECK(lox::pool_slabs() <= slabs + 1);
+
+  lox::free_object(&long_string->obj);
+  lox::free_object(&third->obj);
+  lox::free_object(&second->obj);
+  CHECK(memory_stats().total.current_bytes == 0);
+  lox::set_object_allocator(lox::ObjectAllocator::SYSTEM);
+}
+
+TEST_CASE("blocks go back to the allocator that made them") {
+  reset_memory_stats();
+  auto const system = copy_string("system");
+  lox::set_object_allocator(lox::ObjectAllocator::POOL);
+  auto const pooled = copy_string("pooled");
+  lox::free_object(&system->obj);
+  lox::set_object_allocator(lox::ObjectAllocator::SYSTEM);
+  lox::free_object(&pooled->obj);
+  CHECK(memory_stats().total.current_bytes == 0);
+
+  // The pool hands the block out again, so it was not given to the system.
+  lox::set_object_allocator(lox::ObjectAllocator::POOL);
+  auto const again = copy_string("pooled");
+  CHECK(again == pooled);
+  lox::set_object_allocator(lox::ObjectAllocator::SYSTEM);
+  lox::free_object(&again->obj);
+  CHECK(memory_stats().total.current_bytes == 0);
+}
@@ -0,0 +1,95 @@
+#include <doctest/doctest.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <globals.hpp>
+#include <memory.hpp>
+#include <natives.hpp>
+#include <number_array.hpp>
+#include <object.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::ArrayOp;
+using lox::InterpretResult;
+using lox::number_val;
+using lox::Value;
+using lox::VirtualMachine;
+
+auto array_global(VirtualMachine &vm, char const *name)
+    -> lox::ObjNumberArray * {
+  auto const value = global(vm, name);
+  REQUIRE(lox::is_number_array(value));
+  return lox::as_number_array(value);
+}
+
+TEST_CASE("kernels handle every length and broadcast") {
+  double lhs[13];
+  double rhs[13];
+  double result[13];
+  for (int i = 0; i < 13; ++i) {
+    lhs[i] = i;
+    rhs[i] = 12 - i;
+  }
+  auto const two = 2.0;
+  for (int count = 0; count <= 13; ++count) {
+    lox::apply(ArrayOp::ADD, {lhs, false}, {rhs, false}, result, count);
+    for (int i = 0; i < count; ++i)
+      CHECK(result[i] == 12);
+    lox::apply(ArrayOp::DIVIDE, {lhs, false}, {&two, true}, result, count);
+    for (int i = 0; i < count; ++i)
+      CHECK(result[i] == i / 2.0);
+    lox::apply(ArrayOp::LESS, {lhs, false}, {rhs, false}, result, count);
+    for (int i = 0; i < count; ++i)
+      CHECK(result[i] == (i < 12 - i ? 1.0 : 0.0));
+    lox::apply(ArrayOp::SUBTRACT, {&two, true}, {lhs, false}, result, count);
+    for (int i = 0; i < count; ++i)
+      CHECK(result[i] == 2 - i);
+    CHECK(lox::reduce_sum(lhs, count) == count * (count - 1) / 2);
+  }
+  CHECK(lox::reduce_min(rhs, 13) == 0);
+  CHECK(lox::reduce_max(rhs + 3, 10) == 9);
+  CHECK(isnan(lox::reduce_max(rhs, 0)));
+}
+
+TEST_CASE("number arrays are aligned and accounted") {
+  auto const &stats =
+      lox::memory_stats()
+          .categories[static_cast<int>(lox::MemoryCategory::NUMBER_ARRAY)];
+  auto const before = stats.current_bytes;
+  auto const array = lox::new_number_array(3);
+  CHECK(reinterpret_cast<uintptr_t>(array->data) %
+            lox::number_array_alignment ==
+        0);
+  CHECK(stats.current_bytes - before == lox::number_array_alignment);
+  lox::free_object(&array->obj);
+  CHECK(stats.current_bytes == before);
+}
+
+TEST_CASE("arithmetic on number arrays") {
+  auto vm = VirtualMachine{};
+  lox::define_array_natives(vm);
+  REQUIRE(interpret(vm, "var a = range(10);"
+                        "var b = a * 2 + 1;"
+                        "var c = 1 - a / array(10, 2);"
+                        "var d = a < 5;"
+                        "var s = sum(b); var lo = min(c); var hi = max(b);"
+                        "var n = length(d); var x = at(b, 3);"
+                        "var y = at(b, 10);") == InterpretResult::OK);
+  auto const b = array_global(vm, "b");
+  auto const d = array_global(vm, "d");
+  for (int i = 0; i < 10; ++i) {
+    CHECK(b->data[i] == 2 * i + 1);
+    CHECK(d->data[i] == (i < 5 ? 1 : 0));
+  }
+  CHECK(array_global(vm, "c")->data[9] == -3.5);
+  CHECK(global(vm, "s") == number_val(100));
+  CHECK(global(vm, "lo") == number_val(-3.5));
+  CHECK(global(vm, "hi") == number_val(19));
+  CHECK(global(vm, "n") == number_val(10));
+  CHECK(global(vm, "x") == number_val(7));
+  CHECK(global(vm, "y") == lox::nil_val);
+  CHECK(interpret(vm, "range(3) + range(4);") ==
+        InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "range(3) + nil;") == InterpretResult::RUNTIME_ERROR);
+}
@@ -0,0 +1,115 @@
+#include <doctest/doctest.h>
+
+#include <memory.hpp>
+#include <natives.hpp>
+#include <nursery.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::Nursery;
+using lox::number_val;
+using lox::Value;
+using lox::VirtualMachine;
+
+TEST_CASE("nurseries free temporaries and promote survivors") {
+  auto nursery = Nursery{};
+  auto vm = VirtualMachine{};
+  vm.nursery = &nursery;
+  lox::define_array_natives(vm);
+  lox::reset_memory_stats();
+  REQUIRE(interpret(vm, "class P {} var kept; var total = 0;"
+                        "for (var i = 0; i < 100; i = i + 1) {"
+                        "  var p = P(); p.x = range(8) * i;"
+                        "  total = total + sum(p.x);"
+                        "  if (i == 50) kept = p;"
+                        "}") == InterpretResult::OK);
+  CHECK(nursery.collections == 1);
+  CHECK(nursery.top == nursery.begin);
+  auto const kept = global(vm, "kept");
+  REQUIRE(is_instance(kept));
+  CHECK(!is_young(nursery, kept.as.obj));
+  CHECK(global(vm, "total") == number_val(28 * 4950));
+  // Only the survivor and its array are left of the objects the loop made.
+  auto const &objects =
+      lox::memory_stats().categories[static_cast<int>(
+          lox::MemoryCategory::OBJECT)];
+  CHECK(objects.allocations - objects.frees < 20);
+  REQUIRE(interpret(vm, "var x = sum(kept.x);") == InterpretResult::OK);
+  CHECK(global(vm, "x") == number_val(28 * 50));
+}
+
+TEST_CASE("write barriers keep young objects stored into old ones") {
+  auto nursery = Nursery{};
+  auto vm = VirtualMachine{};
+  vm.nursery = &nursery;
+  lox::define_array_natives(vm);
+  REQUIRE(interpret(vm, "fun define(k) {"
+                        "  class C { get() { k; return this.v; } } return C; }"
+                        "var C = define(1); var o = C(); o.v = 1; var count;"
+                        "fun counter() { var n = 0;"
+                        "  fun next() { n = n + 1; return n; } return next; }"
+                        "count = counter(); fun get(x) { return x.get(); }"
+                        "get(o);") == InterpretResult::OK);
+  auto const o = global(vm, "o");
+  REQUIRE(!is_young(nursery, o.as.obj));
+  REQUIRE(interpret(vm, "o.v = C(); o.v.v = range(3); count(); count();") ==
+          InterpretResult::OK);
+  CHECK(nursery.remembered.count == 0);
+  CHECK(!o.as.obj->remembered);
+  REQUIRE(interpret(vm, "var s = sum(get(get(o))); var c = count();") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "s") == number_val(3));
+  CHECK(global(vm, "c") == number_val(3));
+}
+
+TEST_CASE("runs past a full nursery see the same objects") {
+  char const *const scripts[] = {
+      "class N { init(v, next) { this.v = v; this.next = next; } }"
+      "var list = nil; for (var i = 0; i < 200; i = i + 1)"
+      "  list = N(range(i), list);",
+      "var total = 0; var node = list; while (node != nil) {"
+      "  total = total + sum(node.v) + length(node.v); node = node.next; }",
+      "fun make(k) { var a = range(k); fun get() { return a; } return get; }"
+      "var fs = N(nil, nil); for (var i = 0; i < 50; i = i + 1)"
+      "  fs = N(make(i), fs);",
+      "var node = fs; var t = 0; while (node.next != nil) {"
+      "  t = t + sum(node.v()); node = node.next; } total = total + t;",
+      "var bound = list.next.v; total = total + at(bound, 1);",
+  };
+  Value totals[3];
+  size_t const sizes[] = {0, 512, lox::nursery_size};
+  for (auto i = 0; i < 3; ++i) {
+    auto nursery = Nursery{sizes[i]};
+    auto vm = VirtualMachine{};
+    if (sizes[i] != 0)
+      vm.nursery = &nursery;
+    lox::define_array_natives(vm);
+    for (auto const source : scripts) {
+      CAPTURE(source);
+      REQUIRE(interpret(vm, source) == InterpretResult::OK);
+    }
+    totals[i] = global(vm, "total");
+  }
+  CHECK(is_number(totals[0]));
+  CHECK(totals[1] == totals[0]);
+  CHECK(totals[2] == totals[0]);
+}
+
+TEST_CASE("long runs collect the nursery each time it fills") {
+  auto nursery = Nursery{1 << 16};
+  auto vm = VirtualMachine{};
+  vm.nursery = &nursery;
+  lox::define_array_natives(vm);
+  lox::reset_memory_stats();
+  REQUIRE(interpret(vm, "var total = 0; var kept;"
+                        "for (var i = 0; i < 20000; i = i + 1) {"
+                        "  var a = array(100, i) * 2; total = total + at(a, 0);"
+                        "  if (i == 50) kept = a;"
+                        "}") == InterpretResult::OK);
+  CHECK(nursery.collections > 100);
+  CHECK(global(vm, "total") == number_val(19999 * 20000));
+  CHECK(lox::memory_stats().total.peak_bytes < 1 << 20);
+  REQUIRE(interpret(vm, "var x = at(kept, 99);") == InterpretResult::OK);
+  CHECK(global(vm, "x") == number_val(100));
+}
@@ -0,0 +1,100 @@
+#include <doctest/doctest.h>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+#include <output.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::Output;
+using lox::VirtualMachine;
+
+TEST_CASE("outputs gather text until flushed") {
+  auto text = std::string{};
+  auto output = Output{};
+  capture_into(output, text);
+  put(output, "a");
+  put(output, ' ');
+  put_number(output, 1.5);
+  put_format(output, " %d", 42);
+  CHECK(text.empty());
+  flush(output);
+  CHECK(text == "a 1.5 42");
+  CHECK(output.size == 0);
+
+  // Text larger than what is left of the buffer follows what it held.
+  put(output, "<");
+  auto const large = std::string(lox::output_buffer_size, 'x');
+  put(output, large);
+  CHECK(text == "a 1.5 42<" + large);
+  CHECK(output.size == 0);
+  for (int i = 0; i < lox::output_buffer_size + 1; ++i)
+    put(output, 'y');
+  CHECK(output.size == 1);
+
+  output.flush_lines = true;
+  text.clear();
+  put(output, "z");
+  put(output, '\n');
+  CHECK(text == "yz\n");
+}
+
+TEST_CASE("numbers print as %g does") {
+  double const numbers[] = {0,    -0.0,   1,        -1,      0.1,  1.0 / 3,
+                            1e6,  999999, 123456.7, 1e-5,    2e21, 1e300,
+                            5e-324, 1e308 * 10, -1e308 * 10, 0.0 / 0.0,
+                            -999999, 999999.5};
+  for (auto const number : numbers) {
+    auto text = std::string{};
+    auto output = Output{};
+    capture_into(output, text);
+    put_number(output, number);
+    flush(output);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%g", number);
+    CHECK(text == expected);
+  }
+}
+
+TEST_CASE("outputs write to their file descriptor") {
+  int pipe_fds[2];
+  REQUIRE(pipe(pipe_fds) == 0);
+  auto output = Output{pipe_fds[1]};
+  put(output, "buffered ");
+  put(output, std::string(100, 'x'));
+  put(output, std::string(lox::output_buffer_size, 'y'));
+  close(pipe_fds[1]);
+  auto text = std::string{};
+  char chunk[1024];
+  for (ssize_t size; (size = read(pipe_fds[0], chunk, sizeof(chunk))) > 0;)
+    text.append(chunk, size);
+  close(pipe_fds[0]);
+  CHECK(text == "buffered " + std::string(100, 'x') +
+                    std::string(lox::output_buffer_size, 'y'));
+}
+
+TEST_CASE("runs print to the outputs of their machine") {
+  auto out = std::string{};
+  auto err = std::string{};
+  auto vm = VirtualMachine{};
+  capture_into(vm.out, out);
+  capture_into(vm.err, err);
+  REQUIRE(interpret(vm, "class A {} print A(); print 1 + 2; print \"s\";"
+                        "print nil; print 1 / 3 > 0; 7") ==
+          InterpretResult::OK);
+  CHECK(out == "A instance\n3\ns\nnil\ntrue\n7\n");
+  CHECK(err.empty());
+
+  // What was printed comes out before the error that follows it.
+  out.clear();
+  REQUIRE(interpret(vm, "print 4;\n-nil;") == InterpretResult::RUNTIME_ERROR);
+  CHECK(out == "4\n");
+  CHECK(err == "Operand must be a number.\n[line 2] in script\n");
+
+  err.clear();
+  REQUIRE(interpret(vm, "print ;") == InterpretResult::COMPILE_ERROR);
+  CHECK(err == "[line 1] Error at ';': Expected expression.\n");
+  CHECK(&lox::error_output() != &vm.err);
+}
@@ -0,0 +1,123 @@
+#include <doctest/doctest.h>
+#include <memory>
+
+#include <compiler.hpp>
+#include <natives.hpp>
+#include <object.hpp>
+#include <registers.hpp>
+#include <testing.hpp>
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::RegisterChunk;
+using lox::Value;
+using lox::VirtualMachine;
+
+// Runs prelude on two VirtualMachines, then source on the stack machine of
+// one and on registers in the other, and checks both end with the same
+// result and globals.
+auto check_same_registers(char const *prelude, char const *source)
+    -> InterpretResult;
+
+TEST_CASE("registers run scripts like the stack machine") {
+  char const *const scripts[] = {
+      "var a = 1; var b = a + 2 * 3 - 4 / 2; var c = !(a < b) == false;",
+      "var g; { var x = 3; var y = x * 2; var z = x = y = y + x; g = z; }",
+      "var g = 0; { var x = 1; { var y = x + 1; g = y; } g = g + x; }",
+      "var g; { var x = 1; var y = x; x = 5; g = y * 10 + x; }",
+      "var s = 0; for (var i = 0; i < 100; i = i + 1)"
+      "  if (i / 2 < 20 and !(i == 7)) s = s + i; else s = s - 1;",
+      "var n = 0; while (n < 50) { var t = n; n = t + 1; }",
+      "var o = nil or 3; var p = false and 1; var q = (1 > 2) or (3 >= 3);",
+      "var e = \"a\" == \"a\"; var f = nil == false; var h = 1 == true;",
+      "var w = v * 2 + 1; var m = w > 3;",
+      "var k = 0; { var i = 0; var done = false; while (!done) {"
+      "  i = i + 1; if (i > 3) done = true; else k = k + i;"
+      "  while (false) {} { var z = k; while (z < 1000) z = z * 3;"
+      "  k = k + z; } } }",
+      "var bad = 1 + nil;",
+      "var u = missing + 1;",
+      "var neg = -\"text\";",
+  };
+  auto errors = 0;
+  for (auto const source : scripts) {
+    CAPTURE(source);
+    if (check_same_registers("var v = range(4);", source) ==
+        InterpretResult::RUNTIME_ERROR)
+      ++errors;
+  }
+  CHECK(errors == 3);
+}
+
+TEST_CASE("registers need fewer instructions than the stack") {
+  auto globals = lox::Globals{};
+  auto const function =
+      lox::compile("{ var a = 2; var b = 3; var c = 4; var d = 0;"
+                   "  for (var i = 0; i < 10; i = i + 1) d = a + b * c; }",
+                   globals);
+  REQUIRE(function != nullptr);
+  auto chunk = RegisterChunk{};
+  REQUIRE(lower_to_registers(function, chunk));
+  // The trace of the stack machine counts the instructions it runs.
+  auto const ring = std::make_unique<lox::TraceRing>();
+  auto vm = VirtualMachine{};
+  vm.trace = ring.get();
+  REQUIRE(interpret(vm, function) == InterpretResult::OK);
+  auto executed = uint64_t{0};
+  REQUIRE(run_registers(vm, chunk, &executed) == InterpretResult::OK);
+  CHECK(executed * 2 < ring->head);
+  lox::free_object(&function->obj);
+}
+
+TEST_CASE("registers reject calls, closures and classes") {
+  char const *const scripts[] = {
+      "fun f() {} f();",
+      "var x = clock();",
+      "class C {} var c = C;",
+      "print range(3);",
+  };
+  auto vm = VirtualMachine{};
+  lox::define_array_natives(vm);
+  for (auto const source : scripts) {
+    CAPTURE(source);
+    auto const function = lox::compile(source, vm.globals);
+    REQUIRE(function != nullptr);
+    auto chunk = RegisterChunk{};
+    CHECK(!lower_to_registers(function, chunk));
+    CHECK(chunk.code.count == 0);
+    lox::free_object(&function->obj);
+  }
+}
+
+auto check_same_registers(char const *prelude, char const *source)
+    -> InterpretResult {
+  VirtualMachine machines[2];
+  InterpretResult results[2]{};
+  for (auto i = 0; i < 2; ++i) {
+    auto &vm = machines[i];
+    lox::define_array_natives(vm);
+    REQUIRE(interpret(vm, prelude) == InterpretResult::OK);
+    auto const function = lox::compile(source, vm.globals);
+    REQUIRE(function != nullptr);
+    if (i == 0) {
+      results[i] = interpret(vm, function);
+    } else {
+      auto chunk = RegisterChunk{};
+      REQUIRE(lower_to_registers(function, chunk));
+      results[i] = run_registers(vm, chunk);
+    }
+    lox::free_object(&function->obj);
+  }
+  CHECK(results[0] == results[1]);
+  auto const &stack = machines[0].globals;
+  auto const &registers = machines[1].globals;
+  REQUIRE(stack.slots.count == registers.slots.count);
+  for (auto i = 0; i < stack.slots.count; ++i) {
+    CAPTURE(stack.names.data[i]->chars);
+    CHECK(stack.slots.data[i].defined == registers.slots.data[i].defined);
+    CHECK(same_value(stack.slots.data[i].value,
+                     registers.slots.data[i].value));
+  }
+  return results[0];
+}
@@ -0,0 +1,91 @@
+#include <doctest/doctest.h>
+#include <span>
+#include <stdio.h>
+
+#include <natives.hpp>
+#include <snapshot.hpp>
+#include <testing.hpp>
+
+using lox::InterpretResult;
+using lox::number_val;
+using lox::Value;
+using lox::VirtualMachine;
+
+auto constexpr prelude = "class Counter {"
+                         "  init(step) { this.count = 0; this.step = step; }"
+                         "  next() { this.count = this.count + this.step;"
+                         "           return this.count; }"
+                         "}"
+                         "fun adder(n) { fun add(x) { return x + n; }"
+                         "               return add; }"
+                         "var add2 = adder(2);"
+                         "var counter = Counter(5); counter.next();"
+                         "var table = range(4) * 10;"
+                         "var total = sum(table);";
+
+TEST_CASE("snapshots restore globals, closures and instances") {
+  auto original = VirtualMachine{};
+  lox::define_array_natives(original);
+  REQUIRE(interpret(original, prelude) == InterpretResult::OK);
+  auto snapshot = lox::Array<uint8_t>{};
+  REQUIRE(lox::save_snapshot(original, snapshot));
+
+  auto restored = VirtualMachine{};
+  lox::define_array_natives(restored);
+  REQUIRE(lox::load_snapshot(restored, {snapshot.data,
+                                        static_cast<size_t>(snapshot.count)}));
+  REQUIRE(interpret(restored, "var a = add2(40);"
+                              "var b = counter.next();"
+                              "var c = Counter(1).next();"
+                              "var d = at(table, 3) + total;") ==
+          InterpretResult::OK);
+  CHECK(global(restored, "a") == number_val(42));
+  CHECK(global(restored, "b") == number_val(10));
+  CHECK(global(restored, "c") == number_val(1));
+  CHECK(global(restored, "d") == number_val(90));
+
+  auto const path = "/tmp/lox_test_snapshot.bin";
+  REQUIRE(lox::write_snapshot(original, path));
+  auto mapped = VirtualMachine{};
+  lox::define_array_natives(mapped);
+  REQUIRE(lox::read_snapshot(mapped, path));
+  REQUIRE(interpret(mapped, "var a = add2(1);") == InterpretResult::OK);
+  CHECK(global(mapped, "a") == number_val(3));
+  remove(path);
+}
+
+TEST_CASE("malformed snapshots leave the machine unchanged") {
+  auto original = VirtualMachine{};
+  lox::define_array_natives(original);
+  REQUIRE(interpret(original, prelude) == InterpretResult::OK);
+  auto snapshot = lox::Array<uint8_t>{};
+  REQUIRE(lox::save_snapshot(original, snapshot));
+
+  auto restored = VirtualMachine{};
+  lox::define_array_natives(restored);
+  auto const bytes =
+      std::span<uint8_t const>{snapshot.data,
+                               static_cast<size_t>(snapshot.count)};
+  CHECK(!lox::load_snapshot(restored, bytes.first(bytes.size() / 2)));
+  CHECK(!lox::load_snapshot(restored, bytes.first(bytes.size() - 1)));
+  CHECK(restored.globals.slots.count == 7);
+
+  auto without_natives = VirtualMachine{};
+  CHECK(!lox::load_snapshot(without_natives, bytes));
+  CHECK(without_natives.globals.slots.count == 0);
+
+  // The natives, add2 and total are defined already, so the other four
+  // globals of the prelude need slots and only three are free.
+  auto full = VirtualMachine{};
+  lox::define_array_natives(full);
+  REQUIRE(interpret(full, "var add2 = 1; var total = 2;") ==
+          InterpretResult::OK);
+  char name[16];
+  for (auto i = full.globals.slots.count; i < lox::globals_max - 3; ++i) {
+    snprintf(name, sizeof(name), "g%d", i);
+    REQUIRE(lox::resolve_global(full.globals, name) == i);
+  }
+  CHECK(!lox::load_snapshot(full, bytes));
+  CHECK(full.globals.slots.count == lox::globals_max - 3);
+  CHECK(global(full, "add2") == number_val(1));
+}
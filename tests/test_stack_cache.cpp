@@ -0,0 +1,127 @@
+#include <doctest/doctest.h>
+#include <stdint.h>
+#include <string>
+
+#include <natives.hpp>
+#include <object.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::Value;
+using lox::VirtualMachine;
+
+// Runs source on a VirtualMachine with and without the cached top of stack
+// and checks both end with the same result, stack and globals. Runs may be
+// sliced by fuel, which must yield at the same points.
+auto check_same_run(std::string const &source, uint64_t fuel = UINT64_MAX)
+    -> InterpretResult;
+
+TEST_CASE("the cached top of stack runs scripts like the plain loop") {
+  char const *const scripts[] = {
+      "var a = 1; var b = a + 2 * 3 - 4 / 2; var c = !(a < b) == false;",
+      "var g; { var x = 3; var y = x * 2; var z = x = y = y + x; g = z; }",
+      "var g = 0; { var x = 1; { var y = x + 1; g = y; } g = g + x; }",
+      "var s = 0; for (var i = 0; i < 100; i = i + 1)"
+      "  if (i / 2 < 20 and !(i == 7)) s = s + i; else s = s - 1;",
+      "var n = 0; while (n < 50) { var t = n; n = t + 1; }",
+      "var e = \"a\" == \"a\"; var f = nil == false; var h = 1 == true;",
+      "fun f(x) { return x * x; } var r = 0;"
+      "for (var i = 0; i < 10; i = i + 1) r = r + f(i) - -i;",
+      "fun id(x) { return x; } var ne = 1 == id(2); var d = 10 - id(3);"
+      "var l = 1 < id(2); var o = !id(nil); var eq = id(4) == id(4);",
+      "fun make() { var c = 0; fun inc() { c = c + 1; return c; }"
+      "  return inc; } var k = make(); k(); var m = k() + 1;",
+      "var g; { var f = nil; { var v = 5; fun get() { return v; } f = get; }"
+      "  g = f(); }",
+      "var v = range(8) * 2 + 1; var w = sum(v < 9);",
+      "class P { init(x) { this.x = x; } } var p = P(3);"
+      "var q = p.x * 2; var same = p == p;",
+      "var bad = 1 + nil;",
+      "var u = missing + 1;",
+      "var neg = -\"text\";",
+  };
+  auto errors = 0;
+  for (auto const source : scripts) {
+    CAPTURE(source);
+    if (check_same_run(source) == InterpretResult::RUNTIME_ERROR)
+      ++errors;
+    check_same_run(source, 3);
+  }
+  CHECK(errors == 3);
+}
+
+TEST_CASE("the cached top of stack runs generated expressions alike") {
+  // A fixed linear congruential generator keeps the programs reproducible.
+  auto state = uint32_t{12345};
+  auto const next = [&](uint32_t bound) {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) % bound;
+  };
+  char const *const operators[] = {" + ", " - ", " * ", " / "};
+  char const *const comparisons[] = {" < ", " > ", " == "};
+  char const *const operands[] = {"a", "b", "x", "y", "1", "2.5"};
+  auto const expression = [&] {
+    auto result = std::string{operands[next(6)]};
+    for (auto term = next(4); term > 0; --term)
+      result = "(" + result + operators[next(4)] + operands[next(6)] + ")";
+    return result;
+  };
+  auto finished = 0;
+  for (auto program = 0; program < 50; ++program) {
+    auto source = std::string{"var a = 3; var b = -2;"
+                              "{ var x = 7; var y = 0.5; var i = 0;"
+                              "  while (i < 4) { i = i + 1; var flag;"};
+    for (auto statement = 0; statement < 6; ++statement) {
+      char const *const targets[] = {"a", "b", "x", "y"};
+      switch (next(3)) {
+      case 0:
+        source += "flag = " + std::string{next(2) ? "!" : ""} + "(" +
+                  expression() + comparisons[next(3)] + expression() + ");";
+        break;
+      case 1:
+        source += "if (flag) " + std::string{targets[next(4)]} + " = -" +
+                  expression() + ";";
+        break;
+      default:
+        source += std::string{targets[next(4)]} + " = " + expression() + ";";
+      }
+    }
+    source += "} b = x; a = y; }";
+    CAPTURE(source);
+    if (check_same_run(source) == InterpretResult::OK)
+      ++finished;
+  }
+  CHECK(finished == 50);
+}
+
+auto check_same_run(std::string const &source, uint64_t fuel)
+    -> InterpretResult {
+  VirtualMachine machines[2];
+  InterpretResult results[2];
+  int slices[2] = {1, 1};
+  for (auto i = 0; i < 2; ++i) {
+    auto &vm = machines[i];
+    vm.cache_top = i == 1;
+    vm.fuel = fuel;
+    lox::define_array_natives(vm);
+    results[i] = interpret(vm, source);
+    while (results[i] == InterpretResult::YIELDED) {
+      vm.fuel = fuel;
+      results[i] = lox::resume(vm);
+      ++slices[i];
+    }
+    CHECK(vm.stack_top == vm.stack);
+  }
+  CHECK(results[0] == results[1]);
+  CHECK(slices[0] == slices[1]);
+  auto const &plain = machines[0].globals;
+  auto const &cached = machines[1].globals;
+  REQUIRE(plain.slots.count == cached.slots.count);
+  for (auto i = 0; i < plain.slots.count; ++i) {
+    CAPTURE(plain.names.data[i]->chars);
+    CHECK(plain.slots.data[i].defined == cached.slots.data[i].defined);
+    CHECK(same_value(plain.slots.data[i].value, cached.slots.data[i].value));
+  }
+  return results[0];
+}
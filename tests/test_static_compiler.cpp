@@ -0,0 +1,69 @@
+#include <doctest/doctest.h>
+#include <stdint.h>
+
+#include <chunk.hpp>
+#include <compiler.hpp>
+#include <static_compiler.hpp>
+
+using lox::Chunk;
+using lox::fold;
+using lox::load;
+using lox::number_val;
+using lox::OpCode;
+using lox::static_compile;
+
+static_assert(fold("1 + 2 * 3").as.number == 7);
+static_assert(fold("-(4 - 6) / 4").as.number == 0.5);
+static_assert(fold("!(5 > 3 == true)").as.boolean == false);
+static_assert(fold("nil != false").as.boolean == true);
+static_assert(fold("0.1 + 0.2").as.number == 0.1 + 0.2);
+static_assert(fold("3.141592653589793238").as.number == 3.141592653589793238);
+static_assert(fold("9007199254740993").as.number == 9007199254740992.0);
+
+TEST_CASE("static compile folds constant expressions") {
+  auto constexpr chunk = static_compile("(1 + 2) * 3 <= 9");
+  CHECK(chunk.code_count == 3);
+  CHECK(chunk.code[0] == static_cast<uint8_t>(OpCode::CONSTANT));
+  CHECK(chunk.code[2] == static_cast<uint8_t>(OpCode::RETURN));
+  CHECK(chunk.constants_count == 1);
+  CHECK(chunk.constants[0] == lox::bool_val(true));
+}
+
+TEST_CASE("static compile leaves runtime errors unfolded") {
+  auto constexpr chunk = static_compile("2 * -true");
+  CHECK(chunk.code_count == 7);
+  CHECK(chunk.code[0] == static_cast<uint8_t>(OpCode::CONSTANT));
+  CHECK(chunk.code[2] == static_cast<uint8_t>(OpCode::CONSTANT));
+  CHECK(chunk.code[4] == static_cast<uint8_t>(OpCode::NEGATE));
+  CHECK(chunk.code[5] == static_cast<uint8_t>(OpCode::MULTIPLY));
+  CHECK(chunk.constants_count == 2);
+}
+
+TEST_CASE("static compile reads numbers as compile does") {
+  auto globals = lox::Globals{};
+  auto constexpr chunk = static_compile(
+      "0.30000000000000001665 + 123456789012345678901234567890 / "
+      "0.000000000000000000000000000000000000001234567890123456789");
+  auto const function = lox::compile(
+      "0.30000000000000001665 + 123456789012345678901234567890 / "
+      "0.000000000000000000000000000000000000001234567890123456789",
+      globals);
+  REQUIRE(function != nullptr);
+  auto const &constants = function->chunk.constants;
+  REQUIRE(constants.count == 3);
+  CHECK(chunk.constants[0] ==
+        number_val(constants.data[0].as.number +
+                   constants.data[1].as.number / constants.data[2].as.number));
+  lox::free_object(&function->obj);
+}
+
+TEST_CASE("load static chunk") {
+  auto constexpr static_chunk = static_compile("1 +\n2");
+  auto chunk = Chunk{};
+  load(static_chunk, chunk);
+  CHECK(chunk.code.count == 3);
+  CHECK(chunk.lines.data[0] == 1);
+  CHECK(chunk.lines.data[2] == 2);
+  CHECK(chunk.constants.count == 1);
+  CHECK(chunk.constants.data[0] == number_val(3));
+}
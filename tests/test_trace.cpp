@@ -0,0 +1,65 @@
+#include <doctest/doctest.h>
+#include <memory>
+#include <stdio.h>
+
+#include <trace.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::OpCode;
+using lox::TraceRecord;
+using lox::TraceRing;
+using lox::ValueType;
+using lox::VirtualMachine;
+
+TEST_CASE("traces record every instruction with its function") {
+  auto ring = std::make_unique<TraceRing>();
+  auto vm = VirtualMachine{};
+  vm.trace = ring.get();
+  REQUIRE(interpret(vm, "fun one() { return 1; }"
+                        "fun two() { return one() + 1; }"
+                        "two();") == InterpretResult::OK);
+  auto records = lox::Array<TraceRecord>{};
+  lox::read_trace(*ring, records);
+  REQUIRE(records.count > 0);
+  CHECK(records.count == static_cast<int>(ring->head.load()));
+  CHECK(records.data[0].function == 0);
+  CHECK(records.data[0].offset == 0);
+  auto const &last = records.data[records.count - 1];
+  CHECK(last.op_code == OpCode::RETURN);
+  CHECK(last.function == 0);
+  auto returns = 0;
+  for (auto i = 0; i < records.count; ++i) {
+    auto const &record = records.data[i];
+    if (record.op_code == OpCode::RETURN && record.function != 0) {
+      // one is compiled first and returns first, both with a number.
+      CHECK(record.function == 1 + returns);
+      CHECK(record.top == static_cast<uint8_t>(ValueType::NUMBER));
+      ++returns;
+    }
+  }
+  CHECK(returns == 2);
+}
+
+TEST_CASE("traces keep the newest records once the ring wraps") {
+  auto ring = std::make_unique<TraceRing>();
+  auto const total = lox::trace_capacity + 100;
+  for (auto i = 0; i < total; ++i)
+    record(*ring, {static_cast<uint32_t>(i), 7, OpCode::NIL, 0});
+  auto records = lox::Array<TraceRecord>{};
+  lox::read_trace(*ring, records);
+  REQUIRE(records.count == lox::trace_capacity - 1);
+  CHECK(records.data[0].offset == 101);
+  CHECK(records.data[records.count - 1].offset == total - 1);
+  CHECK(records.data[records.count - 1].function == 7);
+
+  auto const path = "/tmp/lox_test_trace.bin";
+  REQUIRE(lox::write_trace(*ring, path));
+  auto loaded = lox::Array<TraceRecord>{};
+  REQUIRE(lox::load_trace(path, loaded));
+  REQUIRE(loaded.count == records.count);
+  CHECK(loaded.data[0].offset == 101);
+  CHECK(loaded.data[loaded.count - 1].offset == total - 1);
+  remove(path);
+  CHECK_FALSE(lox::load_trace(path, loaded));
+}
@@ -0,0 +1,501 @@
+#include <doctest/doctest.h>
+#include <span>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+
+#include <compiler.hpp>
+#include <globals.hpp>
+#include <memory.hpp>
+#include <natives.hpp>
+#include <testing.hpp>
+#include <virtual_machine.hpp>
+
+using lox::InterpretResult;
+using lox::number_val;
+using lox::ResourceLimit;
+using lox::Value;
+using lox::VirtualMachine;
+
+TEST_CASE("define and assign globals") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "var a = 1; var b; b = a = a + 2;") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(3));
+  CHECK(global(vm, "b") == number_val(3));
+  REQUIRE(interpret(vm, "a = a * 10;") == InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(30));
+  CHECK(vm.globals.slots.count == 2);
+}
+
+TEST_CASE("locals shadow globals in blocks") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "var a = 1; var r;"
+                        "{ var a = 2; { var a = a; } var b = a + 1; r = b; }") ==
+          InterpretResult::COMPILE_ERROR);
+  REQUIRE(interpret(vm, "var a = 1; var r;"
+                        "{ var a = 2; { var c = a; a = c + 5; } r = a; }") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(1));
+  CHECK(global(vm, "r") == number_val(7));
+}
+
+TEST_CASE("undefined globals are runtime errors") {
+  auto vm = VirtualMachine{};
+  CHECK(interpret(vm, "var a = b;") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "b = 1;") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "var b = 2; var a = b;") == InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(2));
+}
+
+TEST_CASE("constants past the first 256 use long operands") {
+  auto vm = VirtualMachine{};
+  auto source = std::string{"var total = 0;"};
+  for (auto i = 0; i < 300; ++i)
+    source += "total = total + " + std::to_string(i) + ";";
+  REQUIRE(interpret(vm, source) == InterpretResult::OK);
+  CHECK(global(vm, "total") == number_val(300 * 299 / 2));
+}
+
+TEST_CASE("keywords are matched by whole identifier") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "var orange = 1; var android = orange + 1;") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "android") == number_val(2));
+}
+
+TEST_CASE("control flow") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "var sum = 0;"
+                        "for (var i = 0; i < 10; i = i + 1)"
+                        "  if (i == 3 or i == 5) sum = sum + 100;"
+                        "  else if (i > 7 and i != 9) sum = sum - i;"
+                        "  else sum = sum + i;"
+                        "var n = 3; while (n > 0) n = n - 1;") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "sum") == number_val(0 + 1 + 2 + 100 + 4 + 100 + 6 + 7 -
+                                        8 + 9));
+  CHECK(global(vm, "n") == number_val(0));
+}
+
+TEST_CASE("loop sites count back edges") {
+  auto vm = VirtualMachine{};
+  auto const function = compile("var n = 0;"
+                                "for (var i = 0; i < 4; i = i + 1) {"
+                                "  var j = 0;"
+                                "  while (j < 5) { j = j + 1; n = n + 1; }"
+                                "}",
+                                vm.globals);
+  REQUIRE(function != nullptr);
+  REQUIRE(interpret(vm, function) == InterpretResult::OK);
+  auto const &chunk = function->chunk;
+  CHECK(global(vm, "n") == number_val(20));
+  REQUIRE(chunk.loops.count == 3);
+  CHECK(chunk.loops.data[0].count == 4);
+  CHECK(chunk.loops.data[1].count == 20);
+  CHECK(chunk.loops.data[2].count == 4);
+  CHECK(chunk.code.data[chunk.loops.data[1].offset] ==
+        static_cast<uint8_t>(lox::OpCode::LOOP));
+  lox::free_object(&function->obj);
+}
+
+TEST_CASE("functions take arguments and return values") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "fun add(a, b) { return a + b; }"
+                        "fun fib(n) { if (n < 2) return n;"
+                        "             return fib(n - 2) + fib(n - 1); }"
+                        "fun none() { var a = 1; }"
+                        "var r = add(fib(10), 3); var n = none();") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "r") == number_val(58));
+  CHECK(global(vm, "n") == lox::nil_val);
+  CHECK(vm.stack_top == vm.stack);
+}
+
+TEST_CASE("tail calls run in constant frames") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "fun count(n, acc) {"
+                        "  if (n == 0) return acc;"
+                        "  return count(n - 1, acc + 1);"
+                        "}"
+                        "var r = count(100000, 0);") == InterpretResult::OK);
+  CHECK(global(vm, "r") == number_val(100000));
+  CHECK(interpret(vm, "fun deep(n) { if (n == 0) return 0;"
+                      "               return 1 + deep(n - 1); }"
+                      "deep(100000);") == InterpretResult::RUNTIME_ERROR);
+  CHECK(vm.frame_count == 0);
+}
+
+TEST_CASE("calls without room for their stack overflow it") {
+  // Each call holds 240 locals and 120 pending operands, so the stack runs
+  // out long before the frames do.
+  auto source = std::string{"fun f(n) { if (n == 0) return 0;"};
+  for (int i = 0; i < 240; ++i)
+    source += "var a" + std::to_string(i) + " = " + std::to_string(i) + ";";
+  source += "return ";
+  for (int i = 0; i < 120; ++i)
+    source += "a" + std::to_string(i) + " + (";
+  source += "f(n - 1)" + std::string(120, ')') + "; }";
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, source + "var r = f(2);") == InterpretResult::OK);
+  CHECK(global(vm, "r") == number_val(2 * 119 * 120 / 2));
+  CHECK(interpret(vm, source + "f(46);") == InterpretResult::RUNTIME_ERROR);
+  CHECK(vm.frame_count == 0);
+  CHECK(vm.stack_top == vm.stack);
+}
+
+TEST_CASE("bad calls are runtime errors") {
+  auto vm = VirtualMachine{};
+  CHECK(interpret(vm, "fun f(a) {} f();") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "var a = 1; a();") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "fun g(a) { return f(a, a); } g(1);") ==
+        InterpretResult::RUNTIME_ERROR);
+}
+
+TEST_CASE("closures share captured variables") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "fun counter() {"
+                        "  var n = 0;"
+                        "  fun get() { return n; }"
+                        "  fun inc() { n = n + 1; return get; }"
+                        "  return inc;"
+                        "}"
+                        "var inc = counter(); inc(); var get = inc();"
+                        "var a = get(); inc(); var b = get();"
+                        "fun outer() { var x = 1;"
+                        "  fun middle() { fun inner() { return x; }"
+                        "                 x = x + 1; return inner(); }"
+                        "  return middle(); }"
+                        "var c = outer();") == InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(2));
+  CHECK(global(vm, "b") == number_val(3));
+  CHECK(global(vm, "c") == number_val(2));
+}
+
+TEST_CASE("closures allocate upvalues only when they escape") {
+  auto vm = VirtualMachine{};
+  auto const objects = [](std::string_view source, VirtualMachine &vm) {
+    auto const function = compile(source, vm.globals);
+    REQUIRE(function != nullptr);
+    lox::reset_memory_stats();
+    REQUIRE(interpret(vm, function) == InterpretResult::OK);
+    lox::free_object(&function->obj);
+    return lox::memory_stats()
+        .categories[static_cast<uint8_t>(lox::MemoryCategory::OBJECT)]
+        .allocations;
+  };
+  REQUIRE(interpret(vm, "fun each(n, f) {"
+                        "  for (var i = 0; i < n; i = i + 1) f(i);"
+                        "}"
+                        "var total = 0; var kept;") == InterpretResult::OK);
+  CHECK(objects("for (var k = 0; k < 5; k = k + 1) {"
+                "  var sum = 0;"
+                "  fun add(i) { sum = sum + i + k; }"
+                "  each(10, add);"
+                "  total = total + sum;"
+                "}",
+                vm) == 5);
+  CHECK(global(vm, "total") == number_val(5 * 45 + 10 * 10));
+  CHECK(objects("{ var sum = 1;"
+                "  fun add(i) { sum = sum + i; }"
+                "  kept = add; }"
+                "kept(2); total = kept(3);",
+                vm) == 2);
+  CHECK(objects("fun make() { var n = 1; fun get() { return n; } return get; }"
+                "total = make()();",
+                vm) == 2);
+  CHECK(global(vm, "total") == number_val(1));
+}
+
+TEST_CASE("classes with fields, methods and initializers") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "class Point {"
+                        "  init(x, y) { this.x = x; this.y = y; }"
+                        "  sum() { return this.x + this.y; }"
+                        "  adder() { fun add(n) { return this.x + n; }"
+                        "            return add; }"
+                        "}"
+                        "var p = Point(1, 2); p.y = 5;"
+                        "var s = p.sum(); var m = p.sum; var b = m();"
+                        "var a = p.adder()(10);"
+                        "p.sum = Point; var q = p.sum(3, 4).x;") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "s") == number_val(6));
+  CHECK(global(vm, "b") == number_val(6));
+  CHECK(global(vm, "a") == number_val(11));
+  CHECK(global(vm, "q") == number_val(3));
+  CHECK(interpret(vm, "p.z;") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "var n = 1; n.x = 2;") ==
+        InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "Point(1);") == InterpretResult::RUNTIME_ERROR);
+  CHECK(interpret(vm, "print this;") == InterpretResult::COMPILE_ERROR);
+  CHECK(interpret(vm, "class A { init() { return 1; } }") ==
+        InterpretResult::COMPILE_ERROR);
+}
+
+TEST_CASE("property caches hit once warm") {
+  auto vm = VirtualMachine{};
+  auto const function = compile("class A { get() { return this.v; } }"
+                                "class B { get() { return this.v; } }"
+                                "var total = 0;"
+                                "for (var i = 0; i < 10; i = i + 1) {"
+                                "  var o = A(); o.v = i;"
+                                "  if (i > 4) { o = B(); o.w = 0; o.v = i; }"
+                                "  total = total + o.get();"
+                                "}",
+                                vm.globals);
+  REQUIRE(function != nullptr);
+  REQUIRE(interpret(vm, function) == InterpretResult::OK);
+  CHECK(global(vm, "total") == number_val(45));
+  auto const &chunk = function->chunk;
+  REQUIRE(chunk.caches.count == 4);
+  for (int i = 0; i < chunk.caches.count; ++i) {
+    auto const &cache = chunk.caches.data[i];
+    CHECK(cache.misses == static_cast<uint64_t>(cache.count));
+  }
+  CHECK(chunk.caches.data[3].count == 2);
+  lox::free_object(&function->obj);
+}
+
+auto sum_native(std::span<Value const> arguments) -> Value {
+  auto sum = 0.0;
+  for (auto const &argument : arguments)
+    sum += argument.as.number;
+  return number_val(sum);
+}
+
+auto square_batch(std::span<Value const> inputs, std::span<Value> results)
+    -> void {
+  for (size_t i = 0; i < results.size(); ++i)
+    results[i] = number_val(inputs[i].as.number * inputs[i].as.number);
+}
+
+TEST_CASE("natives read arguments from the stack") {
+  auto vm = VirtualMachine{};
+  define_native(vm, "sum", 3, sum_native);
+  define_native(vm, "square", 1, nullptr, square_batch);
+  REQUIRE(interpret(vm, "fun f(x) { return square(x); }"
+                        "var a = sum(1, 2, square(3)) + f(4);") ==
+          InterpretResult::OK);
+  CHECK(global(vm, "a") == number_val(28));
+  CHECK(vm.stack_top == vm.stack);
+  CHECK(interpret(vm, "sum(1, 2);") == InterpretResult::RUNTIME_ERROR);
+
+  Value const inputs[] = {number_val(1), number_val(2), number_val(3),
+                          number_val(4), number_val(5), number_val(6)};
+  Value results[2] = {};
+  lox::call_native(lox::as_native(global(vm, "sum")), inputs, results);
+  CHECK(results[0] == number_val(6));
+  CHECK(results[1] == number_val(15));
+  lox::call_native(lox::as_native(global(vm, "square")),
+                   std::span{inputs}.first(2), results);
+  CHECK(results[1] == number_val(4));
+
+  char name[16];
+  for (auto i = vm.globals.slots.count; i < lox::globals_max; ++i) {
+    snprintf(name, sizeof(name), "g%d", i);
+    REQUIRE(lox::resolve_global(vm.globals, name) == i);
+  }
+  CHECK(!define_native(vm, "cube", 1, sum_native));
+  CHECK(vm.globals.slots.count == lox::globals_max);
+  CHECK(define_native(vm, "sum", 2, sum_native));
+  CHECK(lox::as_native(global(vm, "sum"))->arity == 2);
+}
+
+TEST_CASE("prepared expressions evaluate with bound parameters") {
+  auto vm = VirtualMachine{};
+  REQUIRE(interpret(vm, "var scale = 10;") == InterpretResult::OK);
+  std::string_view const parameters[] = {"price", "quantity"};
+  auto const function = lox::compile_expression(
+      "price * quantity * scale + price", parameters, vm.globals);
+  REQUIRE(function != nullptr);
+  CHECK(function->arity == 2);
+  auto result = Value{};
+  for (int i = 0; i < 3; ++i) {
+    Value const arguments[] = {number_val(i), number_val(2)};
+    REQUIRE(lox::evaluate(vm, function, arguments, result) ==
+            InterpretResult::OK);
+    CHECK(result == number_val(21 * i));
+  }
+  CHECK(vm.stack_top == vm.stack);
+  Value const too_few[] = {number_val(1)};
+  CHECK(lox::evaluate(vm, function, too_few, result) ==
+        InterpretResult::RUNTIME_ERROR);
+  CHECK(vm.stack_top == vm.stack);
+  lox::free_object(&function->obj);
+
+  CHECK(lox::compile_expression("1; 2", {}, vm.globals) == nullptr);
+  auto errors = std::string{};
+  auto output = lox::Output{};
+  capture_into(output, errors);
+  auto const outer = lox::use_error_output(&output);
+  std::string_view const twice[] = {"a", "a"};
+  CHECK(lox::compile_expression("a", twice, vm.globals) == nullptr);
+  CHECK(errors == "[line 1] Error at 'a': Already a parameter with this "
+                  "name.\n");
+  for (auto const name : {"this", "nil", "a b", "1", ""}) {
+    errors.clear();
+    std::string_view const parameters[] = {name};
+    CHECK(lox::compile_expression("1", parameters, vm.globals) == nullptr);
+    CHECK(errors == "[line 1] Error at '" + std::string{name} +
+                        "': Expect parameter name.\n");
+  }
+  lox::use_error_output(outer);
+}
+
+TEST_CASE("runs yield when out of fuel and resume") {
+  auto first = VirtualMachine{};
+  auto second = VirtualMachine{};
+  auto const counter = lox::compile(
+      "var n = 0; while (n < 100) n = n + 1;", first.globals);
+  auto const calls =
+      lox::compile("fun f(x) { return x + 1; } var m = 0;"
+                   "for (var i = 0; i < 10; i = i + 1) m = f(m);",
+                   second.globals);
+  first.fuel = 30;
+  second.fuel = 3;
+  auto first_result = interpret(first, counter);
+  auto second_result = interpret(second, calls);
+  auto first_slices = 1;
+  auto second_slices = 1;
+  while (first_result == InterpretResult::YIELDED ||
+         second_result == InterpretResult::YIELDED) {
+    if (first_result == InterpretResult::YIELDED) {
+      CHECK(first.fuel == 0);
+      first.fuel = 30;
+      first_result = lox::resume(first);
+      ++first_slices;
+    }
+    if (second_result == InterpretResult::YIELDED) {
+      second.fuel = 3;
+      second_result = lox::resume(second);
+      ++second_slices;
+    }
+  }
+  CHECK(first_result == InterpretResult::OK);
+  CHECK(second_result == InterpretResult::OK);
+  CHECK(global(first, "n") == number_val(100));
+  CHECK(global(second, "m") == number_val(10));
+  // 100 back edges in slices of 30 take four slices.
+  CHECK(first_slices == 4);
+  CHECK(second_slices > first_slices);
+  CHECK(first.stack_top == first.stack);
+  lox::free_object(&counter->obj);
+  lox::free_object(&calls->obj);
+
+  auto runaway = VirtualMachine{};
+  runaway.fuel = 1000;
+  CHECK(interpret(runaway, "while (true) {}") == InterpretResult::YIELDED);
+  CHECK(runaway.frame_count == 1);
+}
+
+TEST_CASE("yielded scripts print and free themselves once they end") {
+  auto const code_bytes = [] {
+    auto const code = static_cast<uint8_t>(lox::MemoryCategory::CHUNK_CODE);
+    return lox::memory_stats().categories[code].current_bytes;
+  };
+  auto const before = code_bytes();
+  auto out = std::string{};
+  {
+    auto vm = VirtualMachine{};
+    capture_into(vm.out, out);
+    vm.fuel = 30;
+    auto result = interpret(vm, "var n = 0; while (n < 100) n = n + 1; n");
+    while (result == InterpretResult::YIELDED) {
+      CHECK(vm.script != nullptr);
+      vm.fuel = 30;
+      result = lox::resume(vm);
+    }
+    CHECK(result == InterpretResult::OK);
+    CHECK(vm.script == nullptr);
+    CHECK(code_bytes() == before);
+    CHECK(out == "100\n");
+
+    // A machine dropped while its script is yielded frees the script.
+    vm.fuel = 30;
+    CHECK(interpret(vm, "while (true) {}") == InterpretResult::YIELDED);
+  }
+  CHECK(code_bytes() == before);
+}
+
+TEST_CASE("runs stop at their resource limits") {
+  auto vm = VirtualMachine{};
+  lox::define_array_natives(vm);
+  vm.limits.steps = 1000;
+  CHECK(interpret(vm, "while (true) {}") == InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::STEPS);
+  CHECK(vm.usage.steps == 1000);
+  CHECK(vm.frame_count == 0);
+  CHECK(vm.stack_top == vm.stack);
+  CHECK(interpret(vm, "var n = 0; while (n < 10) n = n + 1;") ==
+        InterpretResult::LIMIT_EXCEEDED);
+  vm.usage = {};
+  CHECK(interpret(vm, "var n = 0; while (n < 10) n = n + 1;") ==
+        InterpretResult::OK);
+  CHECK(vm.usage.exceeded == ResourceLimit::NONE);
+  CHECK(vm.usage.steps == 10);
+
+  // Fuel running out first still yields, and the back edge that yields
+  // spends nothing.
+  vm.fuel = 4;
+  CHECK(interpret(vm, "n = 0; while (n < 10) n = n + 1;") ==
+        InterpretResult::YIELDED);
+  vm.fuel = 100;
+  CHECK(lox::resume(vm) == InterpretResult::OK);
+  CHECK(global(vm, "n") == number_val(10));
+  CHECK(vm.fuel == 95);
+  CHECK(vm.usage.steps == 19);
+  vm.fuel = UINT64_MAX;
+
+  vm.limits = {};
+  vm.limits.nanoseconds = 1000000;
+  vm.usage = {};
+  CHECK(interpret(vm, "while (true) {}") == InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::TIME);
+  CHECK(vm.usage.nanoseconds >= 1000000);
+
+  vm.limits = {};
+  vm.limits.frames = 8;
+  CHECK(interpret(vm, "fun f(n) { return 1 + f(n + 1); } f(0);") ==
+        InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::FRAMES);
+  CHECK(interpret(vm, "fun g(n) { if (n == 0) return 0; return 1 + g(n - 1); }"
+                      "n = g(6);") == InterpretResult::OK);
+  CHECK(global(vm, "n") == number_val(6));
+
+  // With no frames at all even the call that starts a run is past the limit.
+  vm.limits.frames = 0;
+  CHECK(interpret(vm, "n = 7;") == InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::FRAMES);
+  CHECK(global(vm, "n") == number_val(6));
+  auto const function = lox::compile_expression("1", {}, vm.globals);
+  REQUIRE(function != nullptr);
+  auto result = number_val(1);
+  CHECK(lox::evaluate(vm, function, {}, result) ==
+        InterpretResult::LIMIT_EXCEEDED);
+  CHECK(result == lox::nil_val);
+  CHECK(vm.frame_count == 0);
+  CHECK(vm.stack_top == vm.stack);
+  lox::free_object(&function->obj);
+
+  vm.limits = {};
+  vm.limits.heap_bytes = 1 << 16;
+  vm.usage = {};
+  CHECK(interpret(vm, "var big = range(1000000); n = 1;") ==
+        InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::HEAP);
+  CHECK(global(vm, "n") == number_val(6));
+  CHECK(interpret(vm, "class Node {} var list = nil; while (true) {"
+                      "  var node = Node(); node.next = list; list = node;"
+                      "}") == InterpretResult::LIMIT_EXCEEDED);
+  CHECK(vm.usage.exceeded == ResourceLimit::HEAP);
+  CHECK(vm.usage.heap_bytes > 1 << 16);
+  CHECK(vm.usage.heap_bytes < 1 << 17);
+
+  // Limits on one machine leave another on the thread alone.
+  auto other = VirtualMachine{};
+  lox::define_array_natives(other);
+  CHECK(interpret(other, "var big = length(range(1000000));") ==
+        InterpretResult::OK);
+  CHECK(global(other, "big") == number_val(1000000));
+}
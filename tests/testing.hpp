@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <string_view>
+
+#include <globals.hpp>
+#include <number_array.hpp>
+#include <object.hpp>
+#include <output.hpp>
+#include <virtual_machine.hpp>
+
+// The value of the global name, which the machine must have defined.
+inline auto global(lox::VirtualMachine &vm, std::string_view name)
+    -> lox::Value {
+  return vm.globals.slots.data[lox::resolve_global(vm.globals, name)].value;
+}
+
+// Objects made by different runs are different, so they only need the same
+// type, and number arrays the same elements.
+inline auto same_value(lox::Value const &lhs, lox::Value const &rhs) -> bool {
+  if (lhs.type != rhs.type)
+    return false;
+  if (!is_obj(lhs))
+    return lhs == rhs;
+  if (obj_type(lhs) != obj_type(rhs))
+    return false;
+  if (!lox::is_number_array(lhs))
+    return lox::is_string(lhs) ? lhs == rhs : true;
+  auto const left = lox::as_number_array(lhs);
+  auto const right = lox::as_number_array(rhs);
+  if (left->count != right->count)
+    return false;
+  for (auto i = 0; i < left->count; ++i)
+    if (left->data[i] != right->data[i])
+      return false;
+  return true;
+}
+
+// Makes output append what it flushes to text.
+inline auto capture_into(lox::Output &output, std::string &text) -> void {
+  output.sink = [](void *context, char const *data, size_t size) {
+    static_cast<std::string *>(context)->append(data, size);
+  };
+  output.context = &text;
+}